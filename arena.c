@@ -0,0 +1,213 @@
+/*
+ * Copyright (C) Fuzhou Rockchip Electronics Co.Ltd
+ * Author: Jacob Chen <jacob-chen@iotwrt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "arena.h"
+
+#define HUGE_SIZE (2 << 20)
+/* below this the rounding to huge pages wastes more than it saves */
+#define MIN_ARENA_SIZE (HUGE_SIZE / 2)
+/* freed blocks kept around for reuse */
+#define MAX_CACHED_BYTES (256 << 20)
+
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23
+#endif
+#define MPOL_PREFERRED 1
+
+struct block {
+    void* addr;
+    size_t size;
+    int node;
+    int in_use;
+    struct block* next;
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static struct block* blocks;
+static size_t cached_bytes;
+static int use_huge_pages = 1;
+/* hugetlbfs runs dry at some point, stop asking after that */
+static int hugetlb_failed;
+static int num_nodes = -1;
+
+static size_t round_up(size_t v, size_t align)
+{
+    return (v + align - 1) / align * align;
+}
+
+static int count_nodes(void)
+{
+    char path[64];
+    int n;
+
+    for (n = 0; n < 64; n++) {
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d", n);
+        if (access(path, F_OK))
+            break;
+    }
+    return n ? n : 1;
+}
+
+static int current_node(void)
+{
+    unsigned int cpu, node;
+
+    if (num_nodes < 2 || syscall(SYS_getcpu, &cpu, &node, NULL))
+        return 0;
+    return node;
+}
+
+/* 'huge': 0 for 4K pages, 1 for THP, 2 to try hugetlbfs first; lowered to 1 if that failed */
+static void* map_block(size_t size, int node, int* huge)
+{
+    unsigned long mask;
+    void* addr = MAP_FAILED;
+    char* p;
+    size_t off;
+
+    if (*huge == 2) {
+        addr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (addr == MAP_FAILED)
+            *huge = 1;
+    }
+
+    if (addr == MAP_FAILED) {
+        /* over-map to cut out a huge page aligned range for THP */
+        p = (char*)mmap(NULL, size + HUGE_SIZE, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED)
+            return NULL;
+        off = round_up((uintptr_t)p, HUGE_SIZE) - (uintptr_t)p;
+        if (off)
+            munmap(p, off);
+        munmap(p + off + size, HUGE_SIZE - off);
+        addr = p + off;
+        if (*huge)
+            madvise(addr, size, MADV_HUGEPAGE);
+    }
+
+    /* bind before the first touch, MAP_POPULATE would fault in place */
+    if (num_nodes > 1) {
+        mask = 1UL << node;
+        syscall(SYS_mbind, addr, size, MPOL_PREFERRED, &mask, sizeof(mask) * 8, 0);
+    }
+
+    if (madvise(addr, size, MADV_POPULATE_WRITE)) {
+        for (off = 0; off < size; off += 4096)
+            ((volatile char*)addr)[off] = 0;
+    }
+    return addr;
+}
+
+void* frame_alloc(size_t size)
+{
+    struct block *b, *best = NULL;
+    int node, huge;
+
+    if (size < MIN_ARENA_SIZE)
+        return malloc(size);
+    size = round_up(size, HUGE_SIZE);
+
+    pthread_mutex_lock(&lock);
+    if (num_nodes < 0)
+        num_nodes = count_nodes();
+    node = current_node();
+
+    for (b = blocks; b; b = b->next) {
+        if (!b->in_use && b->size == size && (!best || b->node == node))
+            best = b;
+    }
+    if (best) {
+        best->in_use = 1;
+        cached_bytes -= best->size;
+        pthread_mutex_unlock(&lock);
+        return best->addr;
+    }
+    huge = use_huge_pages ? 2 - hugetlb_failed : 0;
+    pthread_mutex_unlock(&lock);
+
+    b = (struct block*)calloc(1, sizeof(*b));
+    if (!b)
+        return NULL;
+    b->addr = map_block(size, node, &huge);
+    if (!b->addr) {
+        free(b);
+        return NULL;
+    }
+    b->size = size;
+    b->node = node;
+    b->in_use = 1;
+
+    pthread_mutex_lock(&lock);
+    if (huge == 1 && use_huge_pages)
+        hugetlb_failed = 1;
+    b->next = blocks;
+    blocks = b;
+    pthread_mutex_unlock(&lock);
+    return b->addr;
+}
+
+void frame_free(void* ptr)
+{
+    struct block **pb, *b;
+
+    if (!ptr)
+        return;
+
+    pthread_mutex_lock(&lock);
+    for (pb = &blocks; *pb && (*pb)->addr != ptr; pb = &(*pb)->next)
+        ;
+    b = *pb;
+    if (!b) {
+        pthread_mutex_unlock(&lock);
+        free(ptr);
+        return;
+    }
+
+    b->in_use = 0;
+    if (cached_bytes + b->size <= MAX_CACHED_BYTES) {
+        cached_bytes += b->size;
+        pthread_mutex_unlock(&lock);
+        return;
+    }
+    *pb = b->next;
+    pthread_mutex_unlock(&lock);
+
+    munmap(b->addr, b->size);
+    free(b);
+}
+
+void frame_arena_use_huge_pages(int enable)
+{
+    pthread_mutex_lock(&lock);
+    use_huge_pages = enable;
+    pthread_mutex_unlock(&lock);
+}
+
+size_t frame_arena_cached(void)
+{
+    size_t bytes;
+
+    pthread_mutex_lock(&lock);
+    bytes = cached_bytes;
+    pthread_mutex_unlock(&lock);
+    return bytes;
+}
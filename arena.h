@@ -0,0 +1,32 @@
+/*
+ * Copyright (C) Fuzhou Rockchip Electronics Co.Ltd
+ * Author: Jacob Chen <jacob-chen@iotwrt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#ifndef __ARENA_H_INCLUDED__
+#define __ARENA_H_INCLUDED__
+
+#include <stddef.h>
+
+/*
+ * Host memory for whole frames. Blocks are 2 MB aligned mappings backed by
+ * huge pages: hugetlbfs pages when the pool has some, transparent huge
+ * pages otherwise. They are placed on the NUMA node of the allocating
+ * thread and faulted in before they are returned. Freed blocks are kept
+ * for the next frame of the same size. Small requests go to malloc().
+ */
+void* frame_alloc(size_t size);
+void frame_free(void *ptr);
+
+/* 0 sticks to 4K pages, for comparisons. */
+void frame_arena_use_huge_pages(int enable);
+
+/* Bytes of freed blocks kept for reuse, at most 256 MB. */
+size_t frame_arena_cached(void);
+
+#endif /* __ARENA_H_INCLUDED__ */
@@ -19,9 +19,14 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <unistd.h>
+
+#include <linux/dma-buf.h>
+#include <linux/dma-heap.h>
 
 #include <drm_fourcc.h>
 #include <xf86drm.h>
@@ -29,6 +34,11 @@
 
 #include "bo.h"
 #include "dev.h"
+#include "fbcache.h"
+#include "wcmem.h"
+
+/* address space for CPU mappings before idle ones are given back */
+#define DEFAULT_MAP_BUDGET (512ull << 20)
 
 void fill_bo(struct sp_bo* bo, uint8_t a, uint8_t r, uint8_t g, uint8_t b)
 {
@@ -38,52 +48,78 @@ void fill_bo(struct sp_bo* bo, uint8_t a, uint8_t r, uint8_t g, uint8_t b)
 void draw_rect(struct sp_bo* bo, uint32_t x, uint32_t y, uint32_t width,
     uint32_t height, uint8_t a, uint8_t r, uint8_t g, uint8_t b)
 {
-    uint32_t i, j, xmax = x + width, ymax = y + height;
-
-    if (xmax > bo->width)
-        xmax = bo->width;
-    if (ymax > bo->height)
-        ymax = bo->height;
-
-    for (i = y; i < ymax; i++) {
-        uint8_t* row = (uint8_t*)bo->map_addr + i * bo->pitch;
-
-        for (j = x; j < xmax; j++) {
-            uint8_t* pixel = row + j * 4;
-
-            if (bo->format == DRM_FORMAT_ARGB8888 || bo->format == DRM_FORMAT_XRGB8888) {
-                pixel[0] = b;
-                pixel[1] = g;
-                pixel[2] = r;
-                pixel[3] = a;
-            } else if (bo->format == DRM_FORMAT_RGBA8888) {
-                pixel[0] = r;
-                pixel[1] = g;
-                pixel[2] = b;
-                pixel[3] = a;
-            }
-        }
+    uint32_t i, xmax, ymax;
+    uint8_t pixel[4];
+    uint32_t value;
+
+    /* nothing of it is on the buffer, the row length would wrap */
+    if (x >= bo->width || y >= bo->height)
+        return;
+    xmax = width < bo->width - x ? x + width : bo->width;
+    ymax = height < bo->height - y ? y + height : bo->height;
+
+    if (bo->format == DRM_FORMAT_ARGB8888 || bo->format == DRM_FORMAT_XRGB8888) {
+        pixel[0] = b;
+        pixel[1] = g;
+        pixel[2] = r;
+        pixel[3] = a;
+    } else if (bo->format == DRM_FORMAT_RGBA8888) {
+        pixel[0] = r;
+        pixel[1] = g;
+        pixel[2] = b;
+        pixel[3] = a;
+    } else {
+        return;
     }
+    memcpy(&value, pixel, 4);
+
+    /* whole rows of the write-combined mapping at once */
+    if (begin_cpu_sp_bo(bo, SP_BO_WRITE))
+        return;
+    for (i = y; i < ymax; i++)
+        wc_fill32((uint8_t*)bo->map_addr + i * bo->pitch + x * 4, value, (xmax - x) * 4);
+    end_cpu_sp_bo(bo, SP_BO_WRITE);
+}
+
+static int get_dmabuf_fd(struct sp_bo* bo)
+{
+    if (bo->dmabuf_fd < 0 && drmPrimeHandleToFD(bo->dev->fd, bo->handle, DRM_CLOEXEC | DRM_RDWR, &bo->dmabuf_fd))
+        bo->dmabuf_fd = -1;
+    return bo->dmabuf_fd;
 }
 
 int add_fb_sp_bo(struct sp_bo* bo, uint32_t format)
 {
     int ret;
-    uint32_t handles[4], pitches[4], offsets[4];
-
-    handles[0] = bo->handle;
-    pitches[0] = bo->pitch;
-    offsets[0] = 0;
+    struct fb_desc desc;
+    uint32_t handles[4] = { bo->handle };
+
+    memset(&desc, 0, sizeof(desc));
+    desc.width = bo->width;
+    desc.height = bo->height;
+    desc.format = format;
+    desc.modifier = DRM_FORMAT_MOD_INVALID;
+    desc.num_planes = 1;
+    desc.pitches[0] = bo->pitch;
+    desc.flags = bo->flags;
 
     if(format == DRM_FORMAT_NV12 || format == DRM_FORMAT_NV16) {
+        desc.num_planes = 2;
         handles[1] = bo->handle;
-        pitches[0] = bo->width;
-        pitches[1] = bo->width;
-        offsets[1] = bo->width * bo->height;
+        desc.pitches[0] = bo->width;
+        desc.pitches[1] = bo->width;
+        desc.offsets[1] = bo->width * bo->height;
     }
 
+    /* cached fbs can be evicted, so look up again on every use */
+    if (bo->dev->fbs && get_dmabuf_fd(bo) >= 0)
+        return fb_cache_get(bo->dev->fbs, bo->dmabuf_fd, bo->handle, &desc, &bo->fb_id);
+
+    if (bo->fb_id)
+        return 0;
+
     ret = drmModeAddFB2(bo->dev->fd, bo->width, bo->height,
-        format, handles, pitches, offsets,
+        format, handles, desc.pitches, desc.offsets,
         &bo->fb_id, bo->flags);
     if (ret) {
         printf("failed to create fb ret=%d\n", ret);
@@ -92,13 +128,25 @@ int add_fb_sp_bo(struct sp_bo* bo, uint32_t format)
     return 0;
 }
 
-static int map_sp_bo(struct sp_bo* bo)
+static int mmap_sp_bo(struct sp_bo* bo, int cached)
 {
     int ret;
     struct drm_mode_map_dumb md;
-
-    if (bo->map_addr)
-        return 0;
+    void* addr;
+
+    if (cached && get_dmabuf_fd(bo) >= 0) {
+        addr = mmap(NULL, bo->size, PROT_READ | PROT_WRITE, MAP_SHARED, bo->dmabuf_fd, 0);
+        if (addr != MAP_FAILED) {
+            bo->map_addr = addr;
+            bo->cached = 1;
+            return 0;
+        }
+        if (errno == ENOMEM)
+            return -ENOMEM;
+        if (!bo->handle)
+            return -errno;
+        printf("dmabuf can't be mapped, using the dumb mapping\n");
+    }
 
     md.handle = bo->handle;
     ret = drmIoctl(bo->dev->fd, DRM_IOCTL_MODE_MAP_DUMB, &md);
@@ -107,15 +155,172 @@ static int map_sp_bo(struct sp_bo* bo)
         return ret;
     }
 
-    bo->map_addr = mmap(NULL, bo->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+    addr = mmap(NULL, bo->size, PROT_READ | PROT_WRITE, MAP_SHARED,
         bo->dev->fd, md.offset);
-    if (bo->map_addr == MAP_FAILED) {
-        printf("failed to map bo ret=%d\n", -errno);
+    if (addr == MAP_FAILED)
         return -errno;
+    bo->map_addr = addr;
+    bo->cached = 0;
+    return 0;
+}
+
+static void unmap_sp_bo(struct sp_bo* bo)
+{
+    struct sp_bo** p;
+
+    if (!bo->map_addr)
+        return;
+
+    for (p = &bo->dev->mapped; *p; p = &(*p)->next_mapped) {
+        if (*p == bo) {
+            *p = bo->next_mapped;
+            break;
+        }
+    }
+    bo->next_mapped = NULL;
+    bo->dev->mapped_size -= bo->size;
+
+    munmap(bo->map_addr, bo->size);
+    bo->map_addr = NULL;
+    bo->cached = 0;
+}
+
+void trim_sp_bo_maps(struct sp_dev* dev, uint64_t keep)
+{
+    struct sp_bo *bo, *oldest;
+
+    while (dev->mapped_size > keep) {
+        oldest = NULL;
+        for (bo = dev->mapped; bo; bo = bo->next_mapped) {
+            if (!bo->pins && (!oldest || bo->last_use < oldest->last_use))
+                oldest = bo;
+        }
+        if (!oldest)
+            break;
+        unmap_sp_bo(oldest);
+    }
+}
+
+static int map_sp_bo(struct sp_bo* bo)
+{
+    struct sp_dev* dev = bo->dev;
+    uint64_t budget = dev->map_budget ? dev->map_budget : DEFAULT_MAP_BUDGET;
+    int ret;
+
+    if (bo->map_addr)
+        return 0;
+
+    if (dev->mapped_size + bo->size > budget)
+        trim_sp_bo_maps(dev, budget > bo->size ? budget - bo->size : 0);
+
+    ret = mmap_sp_bo(bo, bo->want_cached);
+    if (ret == -ENOMEM) {
+        /* out of address space or map count, give back all idle mappings */
+        trim_sp_bo_maps(dev, 0);
+        ret = mmap_sp_bo(bo, bo->want_cached);
+    }
+    if (ret) {
+        printf("failed to map bo ret=%d\n", ret);
+        return ret;
+    }
+
+    bo->next_mapped = dev->mapped;
+    dev->mapped = bo;
+    dev->mapped_size += bo->size;
+    return 0;
+}
+
+void* pin_sp_bo(struct sp_bo* bo)
+{
+    if (map_sp_bo(bo))
+        return NULL;
+    bo->pins++;
+    bo->last_use = ++bo->dev->map_clock;
+    return bo->map_addr;
+}
+
+void unpin_sp_bo(struct sp_bo* bo)
+{
+    if (bo->pins > 0)
+        bo->pins--;
+}
+
+int sync_dmabuf(int fd, int start, int access)
+{
+    struct dma_buf_sync sync;
+
+    sync.flags = start ? DMA_BUF_SYNC_START : DMA_BUF_SYNC_END;
+    if (access & SP_BO_READ)
+        sync.flags |= DMA_BUF_SYNC_READ;
+    if (access & SP_BO_WRITE)
+        sync.flags |= DMA_BUF_SYNC_WRITE;
+
+    while (ioctl(fd, DMA_BUF_IOCTL_SYNC, &sync)) {
+        /* memfds have no caches to maintain */
+        if (errno == ENOTTY)
+            return 0;
+        if (errno != EINTR && errno != EAGAIN)
+            return -errno;
     }
     return 0;
 }
 
+int export_sp_bo(struct sp_bo* bo)
+{
+    if (get_dmabuf_fd(bo) < 0)
+        return -1;
+    return fcntl(bo->dmabuf_fd, F_DUPFD_CLOEXEC, 0);
+}
+
+/* The buffer of a device without dumb buffers. */
+static int alloc_dmabuf(struct sp_dev* dev, uint64_t size)
+{
+    struct dma_heap_allocation_data data;
+    int fd, ret;
+
+    if (dev->alloc == SP_ALLOC_HEAP) {
+        memset(&data, 0, sizeof(data));
+        data.len = size;
+        data.fd_flags = O_RDWR | O_CLOEXEC;
+        if (ioctl(dev->heap_fd, DMA_HEAP_IOCTL_ALLOC, &data))
+            return -errno;
+        return data.fd;
+    }
+
+    fd = memfd_create("sp_bo", MFD_CLOEXEC);
+    if (fd < 0)
+        return -errno;
+    if (ftruncate(fd, size)) {
+        ret = -errno;
+        close(fd);
+        return ret;
+    }
+    return fd;
+}
+
+int begin_cpu_sp_bo(struct sp_bo* bo, int access)
+{
+    int ret = -1;
+
+    if (!pin_sp_bo(bo))
+        return -1;
+    if (get_dmabuf_fd(bo) >= 0)
+        ret = sync_dmabuf(bo->dmabuf_fd, 1, access);
+    if (ret)
+        unpin_sp_bo(bo);
+    return ret;
+}
+
+int end_cpu_sp_bo(struct sp_bo* bo, int access)
+{
+    int ret = -1;
+
+    if (bo->dmabuf_fd >= 0)
+        ret = sync_dmabuf(bo->dmabuf_fd, 0, access);
+    unpin_sp_bo(bo);
+    return ret;
+}
+
 struct sp_bo* create_sp_bo(struct sp_dev* dev, uint32_t width, uint32_t height,
     uint32_t depth, uint32_t bpp, uint32_t format, uint32_t flags)
 {
@@ -128,42 +333,46 @@ struct sp_bo* create_sp_bo(struct sp_dev* dev, uint32_t width, uint32_t height,
     bo = (sp_bo *) calloc(1, sizeof(*bo));
     if (!bo)
         return NULL;
+    bo->dmabuf_fd = -1;
 
     cd.height = height;
     cd.width = width;
     cd.bpp = bpp;
-    cd.flags = flags;
-
-    ret = drmIoctl(dev->fd, DRM_IOCTL_MODE_CREATE_DUMB, &cd);
-    if (ret) {
-        printf("failed to create sp_bo %d\n", ret);
-        goto err;
+    cd.flags = flags & ~SP_BO_FLAG_CACHED;
+
+    if (dev->alloc != SP_ALLOC_DUMB) {
+        /* no GEM object, the dmabuf is the buffer */
+        cd.pitch = (width * bpp + 7) / 8;
+        cd.size = ((uint64_t)cd.pitch * height + 4095) & ~4095ull;
+        bo->dmabuf_fd = alloc_dmabuf(dev, cd.size);
+        if (bo->dmabuf_fd < 0) {
+            printf("failed to allocate sp_bo %d\n", bo->dmabuf_fd);
+            bo->dmabuf_fd = -1;
+            goto err;
+        }
+    } else {
+        ret = drmIoctl(dev->fd, DRM_IOCTL_MODE_CREATE_DUMB, &cd);
+        if (ret) {
+            printf("failed to create sp_bo %d\n", ret);
+            goto err;
+        }
     }
 
     bo->dev = dev;
+    __atomic_add_fetch(&dev->num_bos, 1, __ATOMIC_RELAXED);
     bo->width = width;
     bo->height = height;
     bo->depth = depth;
     bo->bpp = bpp;
     bo->format = format;
-    bo->flags = flags;
+    bo->flags = flags & ~SP_BO_FLAG_CACHED;
 
     bo->handle = cd.handle;
     bo->pitch = cd.pitch;
     bo->size = cd.size;
+    bo->want_cached = !!(flags & SP_BO_FLAG_CACHED) || !bo->handle;
 
-    ret = add_fb_sp_bo(bo, format);
-    if (ret) {
-        printf("failed to add fb ret=%d\n", ret);
-        goto err;
-    }
-
-    ret = map_sp_bo(bo);
-    if (ret) {
-        printf("failed to map bo ret=%d\n", ret);
-        goto err;
-    }
-
+    /* the fb and the mapping follow on first display or CPU use */
     return bo;
 
 err:
@@ -179,14 +388,18 @@ void free_sp_bo(struct sp_bo* bo)
     if (!bo)
         return;
 
-    if (bo->map_addr)
-        munmap(bo->map_addr, bo->size);
+    unmap_sp_bo(bo);
 
-    if (bo->fb_id) {
+    /* the cache finds the fbs by the dmabuf, so before closing it */
+    if (bo->fb_id && bo->dev->fbs && bo->dmabuf_fd >= 0) {
+        fb_cache_release(bo->dev->fbs, bo->dmabuf_fd);
+    } else if (bo->fb_id) {
         ret = drmModeRmFB(bo->dev->fd, bo->fb_id);
         if (ret)
             printf("Failed to rmfb ret=%d!\n", ret);
     }
+    if (bo->dmabuf_fd >= 0)
+        close(bo->dmabuf_fd);
 
     if (bo->handle) {
         dd.handle = bo->handle;
@@ -194,6 +407,8 @@ void free_sp_bo(struct sp_bo* bo)
         if (ret)
             printf("Failed to destroy buffer ret=%d\n", ret);
     }
+    if (bo->dev)
+        __atomic_sub_fetch(&bo->dev->num_bos, 1, __ATOMIC_RELAXED);
 
     free(bo);
 }
\ No newline at end of file
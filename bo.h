@@ -37,9 +37,40 @@ struct sp_bo {
 	void *map_addr;
 	uint32_t pitch;
 	uint32_t size;
+
+	int dmabuf_fd;		/* for the CPU access calls, -1 until needed */
+	int cached;		/* map_addr is a cached mapping of the dmabuf */
+
+	/* map_addr is set up on first use, see pin_sp_bo() */
+	int want_cached;
+	int pins;
+	uint64_t last_use;
+	struct sp_bo *next_mapped;
 };
 
+/*
+ * create_sp_bo() flag: map through the dmabuf, which is cached where the
+ * exporter allows it, instead of the write-combined dumb mapping. Either
+ * way CPU access has to be bracketed by begin/end_cpu_sp_bo().
+ */
+#define SP_BO_FLAG_CACHED	(1u << 31)
+
+#define SP_BO_READ		1
+#define SP_BO_WRITE		2
+
+/*
+ * Neither a mapping nor a framebuffer exists until someone needs it.
+ * add_fb_sp_bo() looks the fb up in the device's fb cache, only the first
+ * call for a bo does an AddFB. pin_sp_bo() maps on first use and keeps
+ * map_addr valid until unpin_sp_bo(); unpinned mappings are dropped,
+ * oldest first, once the mapped bos of a device exceed its budget or an
+ * mmap runs out of memory.
+ */
 int add_fb_sp_bo(struct sp_bo *bo, uint32_t format);
+void* pin_sp_bo(struct sp_bo *bo);
+void unpin_sp_bo(struct sp_bo *bo);
+/* Unmap unpinned bos until at most 'keep' bytes stay mapped. */
+void trim_sp_bo_maps(struct sp_dev *dev, uint64_t keep);
 struct sp_bo* create_sp_bo(struct sp_dev *dev, uint32_t width, uint32_t height,
 			   uint32_t depth, uint32_t bpp, uint32_t format, uint32_t flags);
 
@@ -49,4 +80,16 @@ void draw_rect(struct sp_bo *bo, uint32_t x, uint32_t y, uint32_t width,
 
 void free_sp_bo(struct sp_bo *bo);
 
+/*
+ * DMA_BUF_IOCTL_SYNC around CPU access to the mapping, 'access' SP_BO_*.
+ * The pair pins the mapping in between, a failed begin leaves nothing to
+ * end.
+ */
+int begin_cpu_sp_bo(struct sp_bo *bo, int access);
+int end_cpu_sp_bo(struct sp_bo *bo, int access);
+int sync_dmabuf(int fd, int start, int access);
+
+/* A new dmabuf fd of the bo, which the caller closes. */
+int export_sp_bo(struct sp_bo *bo);
+
 #endif /* __BO_H_INCLUDED__ */ 
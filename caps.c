@@ -0,0 +1,473 @@
+/*
+ * Copyright (C) Fuzhou Rockchip Electronics Co.Ltd
+ * Author: Jacob Chen <jacob-chen@iotwrt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <linux/videodev2.h>
+
+#include "caps.h"
+#include "fakem2m.h"
+#include "format.h"
+#include "m2m.h"
+#include "rga.h"
+
+#define CAPS_MAGIC 0x43414752 /* "RGAC" */
+#define TRY_MAX_SIZE 65535
+
+struct caps_file {
+    uint32_t magic;
+    uint32_t size;
+    struct m2m_caps caps;
+};
+
+/* scaling limits of the drivers we know, V4L2 can not report them */
+static const struct {
+    const char* driver;
+    uint32_t max_downscale;
+    uint32_t max_upscale;
+    uint32_t max_job_width;
+} scale_limits[] = {
+    { "rockchip-rga", 16, 16, 0 },
+};
+
+static const uint32_t probed_ctrls[] = {
+    V4L2_CID_HFLIP,
+    V4L2_CID_VFLIP,
+    V4L2_CID_ROTATE,
+    V4L2_CID_BG_COLOR,
+    V4L2_CID_BLEND,
+};
+
+static int cache_path(const struct m2m_caps* caps, char* path, size_t len)
+{
+    const char* base = getenv("XDG_CACHE_HOME");
+    char dir[256];
+    char key[64];
+    size_t i;
+
+    if (base && *base) {
+        snprintf(dir, sizeof(dir), "%s", base);
+    } else {
+        base = getenv("HOME");
+        if (!base || !*base)
+            return -1;
+        snprintf(dir, sizeof(dir), "%s/.cache", base);
+    }
+    mkdir(dir, 0755);
+    strncat(dir, "/rga-v4l2", sizeof(dir) - strlen(dir) - 1);
+    mkdir(dir, 0755);
+
+    snprintf(key, sizeof(key), "%s-%s", caps->driver, caps->bus_info);
+    for (i = 0; key[i]; i++) {
+        if (!((key[i] >= 'a' && key[i] <= 'z') || (key[i] >= 'A' && key[i] <= 'Z')
+                || (key[i] >= '0' && key[i] <= '9') || key[i] == '-'))
+            key[i] = '_';
+    }
+    snprintf(path, len, "%s/%s.caps", dir, key);
+    return 0;
+}
+
+static int load_caps(const char* path, struct m2m_caps* caps)
+{
+    struct caps_file file;
+    FILE* fp;
+    size_t n;
+
+    fp = fopen(path, "rb");
+    if (!fp)
+        return -1;
+    n = fread(&file, 1, sizeof(file), fp);
+    fclose(fp);
+
+    if (n != sizeof(file) || file.magic != CAPS_MAGIC || file.size != sizeof(file))
+        return -1;
+
+    /* a different kernel may have a different driver */
+    if (strcmp(file.caps.driver, caps->driver) || strcmp(file.caps.card, caps->card)
+        || strcmp(file.caps.bus_info, caps->bus_info) || file.caps.version != caps->version)
+        return -1;
+
+    *caps = file.caps;
+    return 0;
+}
+
+static void store_caps(const char* path, const struct m2m_caps* caps)
+{
+    struct caps_file file;
+    char tmp[320];
+    FILE* fp;
+
+    memset(&file, 0, sizeof(file));
+    file.magic = CAPS_MAGIC;
+    file.size = sizeof(file);
+    file.caps = *caps;
+
+    snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+    fp = fopen(tmp, "wb");
+    if (!fp)
+        return;
+    if (fwrite(&file, sizeof(file), 1, fp) != 1) {
+        fclose(fp);
+        unlink(tmp);
+        return;
+    }
+    fclose(fp);
+    if (rename(tmp, path))
+        unlink(tmp);
+}
+
+static int try_size(int fd, uint32_t type, uint32_t format, uint32_t* width, uint32_t* height)
+{
+    struct v4l2_format fmt;
+
+    memset(&fmt, 0, sizeof(fmt));
+    fmt.type = type;
+    fmt.fmt.pix.width = *width;
+    fmt.fmt.pix.height = *height;
+    fmt.fmt.pix.pixelformat = format;
+    fmt.fmt.pix.field = V4L2_FIELD_ANY;
+    if (m2m_ioctl(fd, VIDIOC_TRY_FMT, &fmt))
+        return -errno;
+
+    *width = fmt.fmt.pix.width;
+    *height = fmt.fmt.pix.height;
+    return 0;
+}
+
+static void probe_sizes(int fd, uint32_t type, uint32_t format, struct size_range* r)
+{
+    struct v4l2_frmsizeenum fse;
+
+    memset(&fse, 0, sizeof(fse));
+    fse.pixel_format = format;
+    if (!m2m_ioctl(fd, VIDIOC_ENUM_FRAMESIZES, &fse)) {
+        if (fse.type != V4L2_FRMSIZE_TYPE_DISCRETE) {
+            r->min_width = fse.stepwise.min_width;
+            r->max_width = fse.stepwise.max_width;
+            r->step_width = fse.stepwise.step_width ? fse.stepwise.step_width : 1;
+            r->min_height = fse.stepwise.min_height;
+            r->max_height = fse.stepwise.max_height;
+            r->step_height = fse.stepwise.step_height ? fse.stepwise.step_height : 1;
+            return;
+        }
+
+        /* discrete sizes, keep their bounding range */
+        r->min_width = r->max_width = fse.discrete.width;
+        r->min_height = r->max_height = fse.discrete.height;
+        for (fse.index = 1; !m2m_ioctl(fd, VIDIOC_ENUM_FRAMESIZES, &fse); fse.index++) {
+            if (fse.discrete.width < r->min_width)
+                r->min_width = fse.discrete.width;
+            if (fse.discrete.width > r->max_width)
+                r->max_width = fse.discrete.width;
+            if (fse.discrete.height < r->min_height)
+                r->min_height = fse.discrete.height;
+            if (fse.discrete.height > r->max_height)
+                r->max_height = fse.discrete.height;
+        }
+        r->step_width = r->step_height = 1;
+        return;
+    }
+
+    /* most m2m drivers don't enumerate sizes but clamp them in TRY_FMT */
+    r->max_width = r->max_height = TRY_MAX_SIZE;
+    r->min_width = r->min_height = 1;
+    r->step_width = r->step_height = 1;
+    if (try_size(fd, type, format, &r->max_width, &r->max_height)
+        || try_size(fd, type, format, &r->min_width, &r->min_height)) {
+        r->max_width = r->max_height = TRY_MAX_SIZE;
+        r->min_width = r->min_height = 1;
+    }
+}
+
+static int probe_fmts(int fd, uint32_t type, struct fmt_caps* fmts)
+{
+    struct v4l2_fmtdesc desc;
+    int n = 0;
+
+    memset(&desc, 0, sizeof(desc));
+    desc.type = type;
+    for (desc.index = 0; n < CAPS_MAX_FMTS && !m2m_ioctl(fd, VIDIOC_ENUM_FMT, &desc); desc.index++) {
+        fmts[n].v4l2 = desc.pixelformat;
+        probe_sizes(fd, type, desc.pixelformat, &fmts[n].size);
+        n++;
+    }
+    return n;
+}
+
+static void probe_ctrls(int fd, struct m2m_caps* caps)
+{
+    struct v4l2_queryctrl qc;
+    size_t i;
+
+    for (i = 0; i < sizeof(probed_ctrls) / sizeof(probed_ctrls[0]); i++) {
+        memset(&qc, 0, sizeof(qc));
+        qc.id = probed_ctrls[i];
+        if (m2m_ioctl(fd, VIDIOC_QUERYCTRL, &qc) || (qc.flags & V4L2_CTRL_FLAG_DISABLED))
+            continue;
+
+        struct ctrl_caps* c = &caps->ctrls[caps->num_ctrls++];
+        c->id = qc.id;
+        snprintf(c->name, sizeof(c->name), "%s", (const char*)qc.name);
+        c->min = qc.minimum;
+        c->max = qc.maximum;
+        c->step = qc.step;
+        c->def = qc.default_value;
+    }
+}
+
+int probe_m2m_caps(int fd, struct m2m_caps* caps, int refresh)
+{
+    struct v4l2_capability cap;
+    char path[256];
+    int have_path;
+    size_t i;
+
+    memset(caps, 0, sizeof(*caps));
+    memset(&cap, 0, sizeof(cap));
+    if (m2m_ioctl(fd, VIDIOC_QUERYCAP, &cap))
+        return -errno;
+
+    snprintf(caps->driver, sizeof(caps->driver), "%s", (const char*)cap.driver);
+    snprintf(caps->card, sizeof(caps->card), "%s", (const char*)cap.card);
+    snprintf(caps->bus_info, sizeof(caps->bus_info), "%s", (const char*)cap.bus_info);
+    caps->version = cap.version;
+
+    have_path = !cache_path(caps, path, sizeof(path));
+    if (have_path && !refresh && !load_caps(path, caps))
+        return 0;
+
+    caps->num_src_fmts = probe_fmts(fd, V4L2_BUF_TYPE_VIDEO_OUTPUT, caps->src_fmts);
+    caps->num_dst_fmts = probe_fmts(fd, V4L2_BUF_TYPE_VIDEO_CAPTURE, caps->dst_fmts);
+    probe_ctrls(fd, caps);
+
+    caps->max_downscale = 16;
+    caps->max_upscale = 16;
+    for (i = 0; i < sizeof(scale_limits) / sizeof(scale_limits[0]); i++) {
+        if (!strcmp(caps->driver, scale_limits[i].driver)) {
+            caps->max_downscale = scale_limits[i].max_downscale;
+            caps->max_upscale = scale_limits[i].max_upscale;
+            caps->max_job_width = scale_limits[i].max_job_width;
+        }
+    }
+
+    if (have_path)
+        store_caps(path, caps);
+    return 0;
+}
+
+static void print_fmts(const char* what, const struct fmt_caps* fmts, int n)
+{
+    const struct fmt_info* fi;
+    int i;
+
+    printf("%s formats:\n", what);
+    for (i = 0; i < n; i++) {
+        fi = get_fmt_info(fmts[i].v4l2);
+        printf("  %-8.4s %-10s %ux%u - %ux%u, step %ux%u\n", (const char*)&fmts[i].v4l2,
+            fi ? fi->name : "(unused)",
+            fmts[i].size.min_width, fmts[i].size.min_height,
+            fmts[i].size.max_width, fmts[i].size.max_height,
+            fmts[i].size.step_width, fmts[i].size.step_height);
+    }
+}
+
+void print_m2m_caps(const struct m2m_caps* caps)
+{
+    int i;
+
+    printf("%s (%s) at %s, version %u.%u.%u\n", caps->card, caps->driver, caps->bus_info,
+        (caps->version >> 16) & 0xff, (caps->version >> 8) & 0xff, caps->version & 0xff);
+    print_fmts("OUTPUT", caps->src_fmts, caps->num_src_fmts);
+    print_fmts("CAPTURE", caps->dst_fmts, caps->num_dst_fmts);
+
+    printf("controls:\n");
+    for (i = 0; i < caps->num_ctrls; i++)
+        printf("  %-24s %d..%d step %d, default %d\n", caps->ctrls[i].name,
+            caps->ctrls[i].min, caps->ctrls[i].max, caps->ctrls[i].step, caps->ctrls[i].def);
+    printf("scaling: 1/%u to %ux per pass\n", caps->max_downscale, caps->max_upscale);
+    if (caps->max_job_width)
+        printf("jobs: up to %u pixels wide\n", caps->max_job_width);
+}
+
+const struct fmt_caps* find_fmt_caps(const struct m2m_caps* caps, int capture,
+    uint32_t v4l2_format)
+{
+    const struct fmt_caps* fmts = capture ? caps->dst_fmts : caps->src_fmts;
+    int i, n = capture ? caps->num_dst_fmts : caps->num_src_fmts;
+
+    for (i = 0; i < n; i++) {
+        if (fmts[i].v4l2 == v4l2_format)
+            return &fmts[i];
+    }
+    return NULL;
+}
+
+const struct ctrl_caps* find_ctrl_caps(const struct m2m_caps* caps, uint32_t id)
+{
+    int i;
+
+    for (i = 0; i < caps->num_ctrls; i++) {
+        if (caps->ctrls[i].id == id)
+            return &caps->ctrls[i];
+    }
+    return NULL;
+}
+
+static int fits_width(const struct size_range* r, uint32_t w)
+{
+    return w >= r->min_width && w <= r->max_width && (w - r->min_width) % r->step_width == 0;
+}
+
+static int fits_height(const struct size_range* r, uint32_t h)
+{
+    return h >= r->min_height && h <= r->max_height && (h - r->min_height) % r->step_height == 0;
+}
+
+static int ratio_ok(const struct m2m_caps* caps, uint32_t in, uint32_t out)
+{
+    return (uint64_t)out * caps->max_downscale >= in && (uint64_t)in * caps->max_upscale >= out;
+}
+
+/* Smallest intermediate size that both passes can reach. */
+static uint32_t mid_size(const struct m2m_caps* caps, uint32_t in, uint32_t out)
+{
+    uint32_t mid;
+
+    if (ratio_ok(caps, in, out))
+        return in;
+    if (in > out)
+        mid = (in + caps->max_downscale - 1) / caps->max_downscale;
+    else
+        mid = (out + caps->max_upscale - 1) / caps->max_upscale;
+    return (mid + 1) & ~1;
+}
+
+static uint32_t pick_mid_format(const struct m2m_caps* caps, const struct m2m_config* cfg)
+{
+    int i;
+
+    /* written by the first pass, read by the second */
+    if (find_fmt_caps(caps, 1, cfg->dst_format) && find_fmt_caps(caps, 0, cfg->dst_format))
+        return cfg->dst_format;
+    if (find_fmt_caps(caps, 1, cfg->src_format) && find_fmt_caps(caps, 0, cfg->src_format))
+        return cfg->src_format;
+    for (i = 0; i < caps->num_dst_fmts; i++) {
+        if (get_fmt_info(caps->dst_fmts[i].v4l2) && find_fmt_caps(caps, 0, caps->dst_fmts[i].v4l2))
+            return caps->dst_fmts[i].v4l2;
+    }
+    return 0;
+}
+
+static void plan_two_pass(const struct m2m_caps* caps, const struct m2m_config* cfg,
+    uint32_t out_w, uint32_t out_h, struct plan* plan)
+{
+    const struct fmt_caps *mid_in, *mid_out;
+
+    plan->mid_format = pick_mid_format(caps, cfg);
+    plan->mid_width = mid_size(caps, cfg->src_width, out_w);
+    plan->mid_height = mid_size(caps, cfg->src_height, out_h);
+
+    mid_out = find_fmt_caps(caps, 1, plan->mid_format);
+    mid_in = find_fmt_caps(caps, 0, plan->mid_format);
+    if (!plan->mid_format || !ratio_ok(caps, plan->mid_width, out_w)
+        || !ratio_ok(caps, plan->mid_height, out_h)
+        || !fits_width(&mid_out->size, plan->mid_width) || !fits_height(&mid_out->size, plan->mid_height)
+        || !fits_width(&mid_in->size, plan->mid_width) || !fits_height(&mid_in->size, plan->mid_height)) {
+        plan->route = ROUTE_CPU;
+        plan->reason = "scale factor beyond two passes";
+        return;
+    }
+    plan->route = ROUTE_TWO_PASS;
+    plan->reason = "scale factor beyond one pass";
+
+    /* not combined with stripes */
+    if ((caps->max_job_width && (cfg->src_width > caps->max_job_width
+                                    || cfg->dst_width > caps->max_job_width))
+        || !fits_width(&find_fmt_caps(caps, 0, cfg->src_format)->size, cfg->src_width)
+        || !fits_height(&find_fmt_caps(caps, 0, cfg->src_format)->size, cfg->src_height)
+        || !fits_width(&find_fmt_caps(caps, 1, cfg->dst_format)->size, cfg->dst_width)
+        || !fits_height(&find_fmt_caps(caps, 1, cfg->dst_format)->size, cfg->dst_height)) {
+        plan->route = ROUTE_CPU;
+        plan->reason = "frame size out of range";
+    }
+}
+
+void plan_transform(const struct m2m_caps* caps, const struct m2m_config* cfg,
+    struct plan* plan)
+{
+    const struct fmt_caps* in = find_fmt_caps(caps, 0, cfg->src_format);
+    const struct fmt_caps* out = find_fmt_caps(caps, 1, cfg->dst_format);
+    int swap = cfg->rotate == 90 || cfg->rotate == 270;
+    uint32_t out_w, out_h, job, tiles;
+
+    memset(plan, 0, sizeof(*plan));
+    plan->route = ROUTE_DIRECT;
+    plan->num_tiles = 1;
+
+    if (!in || !out) {
+        plan->route = ROUTE_CPU;
+        plan->reason = in ? "destination format not supported" : "source format not supported";
+        return;
+    }
+
+    /* the destination size seen from the source orientation */
+    out_w = swap ? cfg->dst_height : cfg->dst_width;
+    out_h = swap ? cfg->dst_width : cfg->dst_height;
+
+    if (!ratio_ok(caps, cfg->src_width, out_w) || !ratio_ok(caps, cfg->src_height, out_h)) {
+        plan_two_pass(caps, cfg, out_w, out_h, plan);
+        return;
+    }
+
+    if (!fits_width(&in->size, cfg->src_width) || !fits_height(&in->size, cfg->src_height)
+        || !fits_width(&out->size, cfg->dst_width) || !fits_height(&out->size, cfg->dst_height)) {
+        plan->route = ROUTE_CPU;
+        plan->reason = "frame size out of range";
+        return;
+    }
+
+    job = caps->max_job_width;
+    if (!job || (cfg->src_width <= job && cfg->dst_width <= job))
+        return;
+
+    /* stripes split the width of both frames, unless rotation swaps them */
+    if (swap) {
+        plan->route = ROUTE_CPU;
+        plan->reason = "too wide to rotate in stripes";
+        return;
+    }
+
+    tiles = (cfg->src_width > cfg->dst_width ? cfg->src_width : cfg->dst_width);
+    plan->route = ROUTE_TILED;
+    plan->num_tiles = (tiles + job - 1) / job;
+    plan->reason = "wider than one job";
+}
+
+const char* route_name(enum plan_route route)
+{
+    switch (route) {
+    case ROUTE_DIRECT:
+        return "direct";
+    case ROUTE_TILED:
+        return "tiled";
+    case ROUTE_TWO_PASS:
+        return "two pass";
+    case ROUTE_CPU:
+        return "cpu";
+    }
+    return "?";
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) Fuzhou Rockchip Electronics Co.Ltd
+ * Author: Jacob Chen <jacob-chen@iotwrt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#ifndef __CAPS_H_INCLUDED__
+#define __CAPS_H_INCLUDED__
+
+#include <stdint.h>
+
+#define CAPS_MAX_FMTS 32
+#define CAPS_MAX_CTRLS 8
+
+struct m2m_config;
+
+struct size_range {
+	uint32_t min_width;
+	uint32_t max_width;
+	uint32_t step_width;
+	uint32_t min_height;
+	uint32_t max_height;
+	uint32_t step_height;
+};
+
+struct fmt_caps {
+	uint32_t v4l2;
+	struct size_range size;
+};
+
+struct ctrl_caps {
+	uint32_t id;
+	char name[32];
+	int32_t min;
+	int32_t max;
+	int32_t step;
+	int32_t def;
+};
+
+/* What a mem2mem node can do, probed once and cached per device. */
+struct m2m_caps {
+	char driver[16];
+	char card[32];
+	char bus_info[32];
+	uint32_t version;
+
+	int num_src_fmts;
+	struct fmt_caps src_fmts[CAPS_MAX_FMTS];
+	int num_dst_fmts;
+	struct fmt_caps dst_fmts[CAPS_MAX_FMTS];
+
+	int num_ctrls;
+	struct ctrl_caps ctrls[CAPS_MAX_CTRLS];
+
+	/* per axis and pass, V4L2 has no query for these */
+	uint32_t max_downscale;
+	uint32_t max_upscale;
+	/* widest crop or compose rectangle of one job, 0 when the format is */
+	uint32_t max_job_width;
+};
+
+/*
+ * Fill 'caps' from the cache under $XDG_CACHE_HOME/rga-v4l2, or probe the
+ * node with ENUM_FMT, ENUM_FRAMESIZES (TRY_FMT where that is missing) and
+ * QUERYCTRL and store the result. 'refresh' skips the cache lookup.
+ */
+int probe_m2m_caps(int fd, struct m2m_caps *caps, int refresh);
+void print_m2m_caps(const struct m2m_caps *caps);
+
+/* 'capture' selects the destination side. NULL when not supported. */
+const struct fmt_caps* find_fmt_caps(const struct m2m_caps *caps, int capture,
+				     uint32_t v4l2_format);
+const struct ctrl_caps* find_ctrl_caps(const struct m2m_caps *caps, uint32_t id);
+
+enum plan_route {
+	ROUTE_DIRECT,		/* one job */
+	ROUTE_TILED,		/* vertical stripes, each within one job */
+	ROUTE_TWO_PASS,		/* scale beyond the ratio limit through 'mid' */
+	ROUTE_CPU,		/* the node can not do it at all */
+};
+
+struct plan {
+	enum plan_route route;
+	int num_tiles;
+	uint32_t mid_format;
+	uint32_t mid_width;
+	uint32_t mid_height;
+	const char *reason;
+};
+
+/* Pick the cheapest route that stays within the limits of the node. */
+void plan_transform(const struct m2m_caps *caps, const struct m2m_config *cfg,
+		    struct plan *plan);
+const char* route_name(enum plan_route route);
+
+#endif /* __CAPS_H_INCLUDED__ */
@@ -0,0 +1,414 @@
+/*
+ * Copyright (C) Fuzhou Rockchip Electronics Co.Ltd
+ * Author: Jacob Chen <jacob-chen@iotwrt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <linux/videodev2.h>
+
+#include "convert.h"
+#include "format.h"
+#include "simd.h"
+
+/*
+ * RGB <-> YCbCr in 8 bit fixed point. Forward rows give Y, Cb and Cr from
+ * R, G, B scaled to the range, inverse ones R, G, B from the offset Y and
+ * the centred chroma.
+ */
+struct yuv_matrix {
+    int y_offset;
+    int ry, gy, by;
+    int ru, gu, bu;
+    int rv, gv, bv;
+    int y_scale, v_r, u_g, v_g, u_b;
+};
+
+enum {
+    MATRIX_601,
+    MATRIX_709,
+    MATRIX_2020,
+    NUM_MATRICES
+};
+
+/* [matrix][full range] */
+static const struct yuv_matrix yuv_matrices[NUM_MATRICES][2] = {
+    [MATRIX_601] = {
+        { 16, 66, 129, 25, -38, -74, 112, 112, -94, -18, 298, 409, 100, 208, 516 },
+        { 0, 77, 150, 29, -43, -85, 128, 128, -107, -21, 256, 359, 88, 183, 454 },
+    },
+    [MATRIX_709] = {
+        { 16, 47, 157, 16, -26, -87, 112, 112, -102, -10, 298, 459, 55, 136, 541 },
+        { 0, 54, 183, 19, -29, -99, 128, 128, -116, -12, 256, 403, 48, 120, 475 },
+    },
+    [MATRIX_2020] = {
+        { 16, 58, 149, 13, -31, -81, 112, 112, -103, -9, 298, 430, 48, 167, 548 },
+        { 0, 67, 174, 15, -36, -92, 128, 128, -118, -10, 256, 377, 42, 146, 482 },
+    },
+};
+
+int init_image(struct image* img, uint32_t v4l2_format, void* addr,
+    uint32_t width, uint32_t height)
+{
+    size_t offsets[3];
+    int i;
+
+    memset(img, 0, sizeof(*img));
+    img->fi = get_fmt_info(v4l2_format);
+    if (!img->fi)
+        return -1;
+
+    img->matrix = &yuv_matrices[MATRIX_601][0];
+    img->width = width;
+    img->height = height;
+    img->size = fmt_frame_size(img->fi, width, height);
+    fmt_plane_layout(img->fi, width, height, offsets, img->pitches);
+    for (i = 0; i < img->fi->num_planes; i++)
+        img->planes[i] = (uint8_t*)addr + offsets[i];
+    return 0;
+}
+
+void set_image_colorimetry(struct image* img, const struct colorimetry* c)
+{
+    int m = MATRIX_601;
+
+    if (c && c->ycbcr_enc == V4L2_YCBCR_ENC_709)
+        m = MATRIX_709;
+    else if (c && c->ycbcr_enc == V4L2_YCBCR_ENC_BT2020)
+        m = MATRIX_2020;
+    img->matrix = &yuv_matrices[m][c && c->quantization == V4L2_QUANTIZATION_FULL_RANGE];
+}
+
+void image_columns(struct image* view, const struct image* img, uint32_t x, uint32_t w)
+{
+    const struct fmt_info* fi = img->fi;
+    int i;
+
+    *view = *img;
+    view->width = w;
+    view->planes[0] += (size_t)x * fi->cpp;
+    /* semi-planar chroma interleaves two bytes per sample */
+    for (i = 1; i < fi->num_planes; i++)
+        view->planes[i] += (size_t)x / fi->xsub * (fi->num_planes == 2 ? 2 : 1);
+}
+
+static inline v4i32 clamp_u8(v4i32 v)
+{
+    v4i32 over;
+
+    v &= ~(v >> 31);
+    over = v > 255;
+    return (v & ~over) | (over & 255);
+}
+
+/* Packed RGB writers, 'src' is a row of 0xAARRGGBB pixels. */
+
+static void pack_xrgb8888(uint8_t* dst, const uint32_t* src, uint32_t w, uint32_t amask)
+{
+    v4u32 a = splat_v4u32(amask);
+    uint32_t x, p;
+
+    for (x = 0; x + 4 <= w; x += 4)
+        store_v4u32(dst + x * 4, load_v4u32(src + x) | a);
+    for (; x < w; x++) {
+        p = src[x] | amask;
+        memcpy(dst + x * 4, &p, 4);
+    }
+}
+
+static void pack_bgrx8888(uint8_t* dst, const uint32_t* src, uint32_t w, uint32_t amask)
+{
+    v4u32 a = splat_v4u32(amask), v;
+    uint32_t x, p;
+
+    for (x = 0; x + 4 <= w; x += 4) {
+        v = load_v4u32(src + x) | a;
+        v = (v >> 24) | ((v >> 8) & 0xff00) | ((v << 8) & 0xff0000) | (v << 24);
+        store_v4u32(dst + x * 4, v);
+    }
+    for (; x < w; x++) {
+        p = __builtin_bswap32(src[x] | amask);
+        memcpy(dst + x * 4, &p, 4);
+    }
+}
+
+static void pack_rgb888(uint8_t* dst, const uint32_t* src, uint32_t w)
+{
+    uint32_t x;
+
+    /* 4 byte stores, the spare byte is overwritten by the next pixel */
+    for (x = 0; x + 1 < w; x++)
+        memcpy(dst + x * 3, &src[x], 4);
+    if (w)
+        memcpy(dst + x * 3, &src[x], 3);
+}
+
+static void pack_16bpp(uint8_t* dst, const uint32_t* src, uint32_t w, uint32_t v4l2_format)
+{
+    uint16_t* out = (uint16_t*)dst;
+    v4u32 v, a, r, g, b, p;
+    uint32_t x, i, n;
+
+    for (x = 0; x < w; x += 4) {
+        n = w - x < 4 ? w - x : 4;
+        if (n == 4) {
+            v = load_v4u32(src + x);
+        } else {
+            v = splat_v4u32(0);
+            for (i = 0; i < n; i++)
+                v[i] = src[x + i];
+        }
+        a = v >> 24;
+        r = (v >> 16) & 0xff;
+        g = (v >> 8) & 0xff;
+        b = v & 0xff;
+
+        if (v4l2_format == V4L2_PIX_FMT_RGB565)
+            p = ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+        else if (v4l2_format == V4L2_PIX_FMT_ARGB555)
+            p = ((a >> 7) << 15) | ((r >> 3) << 10) | ((g >> 3) << 5) | (b >> 3);
+        else
+            p = ((a >> 4) << 12) | ((r >> 4) << 8) | ((g >> 4) << 4) | (b >> 4);
+
+        for (i = 0; i < n; i++)
+            out[x + i] = p[i];
+    }
+}
+
+static void pack_luma(uint8_t* dst, const uint32_t* src, uint32_t w, const struct yuv_matrix* m)
+{
+    v4i32 v, y;
+    uint32_t x, i, n;
+
+    for (x = 0; x < w; x += 4) {
+        n = w - x < 4 ? w - x : 4;
+        if (n == 4) {
+            v = (v4i32)load_v4u32(src + x);
+        } else {
+            v = splat_v4i32(0);
+            for (i = 0; i < n; i++)
+                v[i] = src[x + i];
+        }
+        y = m->ry * ((v >> 16) & 0xff) + m->gy * ((v >> 8) & 0xff) + m->by * (v & 0xff);
+        y = ((y + 128) >> 8) + m->y_offset;
+        for (i = 0; i < n; i++)
+            dst[x + i] = y[i];
+    }
+}
+
+/* Average of two scaled chroma values, full range blue and red reach 256. */
+static inline uint8_t chroma_u8(int sum)
+{
+    sum = ((sum + 256) >> 9) + 128;
+    return sum < 0 ? 0 : sum > 255 ? 255 : sum;
+}
+
+void pack_chroma_row(const struct image* img, uint32_t y, const uint32_t* src)
+{
+    const struct fmt_info* fi = img->fi;
+    const struct yuv_matrix* m = img->matrix;
+    uint32_t cy = y / fi->ysub;
+    uint8_t* u = img->planes[1] + (size_t)cy * img->pitches[1];
+    uint8_t* v = fi->num_planes == 3 ? img->planes[2] + (size_t)cy * img->pitches[2] : u + 1;
+    int ustep = fi->num_planes == 3 ? 1 : 2;
+    uint32_t w = img->width, x, i, n, o;
+    v4i32 p, r, g, b, us, vs;
+
+    if (fi->uv_swap) {
+        v = u;
+        u = u + 1;
+    }
+
+    for (x = 0; x < w; x += 4) {
+        n = w - x < 4 ? w - x : 4;
+        if (n == 4) {
+            p = (v4i32)load_v4u32(src + x);
+        } else {
+            /* odd widths pair the last pixel with itself */
+            for (i = 0; i < 4; i++)
+                p[i] = src[x + (i < n ? i : n - 1)];
+        }
+        r = (p >> 16) & 0xff;
+        g = (p >> 8) & 0xff;
+        b = p & 0xff;
+        us = m->ru * r + m->gu * g + m->bu * b;
+        vs = m->rv * r + m->gv * g + m->bv * b;
+
+        for (i = 0; i < n; i += 2) {
+            o = (x + i) / 2 * ustep;
+            u[o] = chroma_u8(us[i] + us[i + 1]);
+            v[o] = chroma_u8(vs[i] + vs[i + 1]);
+        }
+    }
+}
+
+void pack_row(const struct image* img, uint32_t y, const uint32_t* src, int chroma)
+{
+    const struct fmt_info* fi = img->fi;
+    uint8_t* dst = img->planes[0] + (size_t)y * img->pitches[0];
+
+    switch (fi->v4l2) {
+    case V4L2_PIX_FMT_ARGB32:
+        pack_xrgb8888(dst, src, img->width, 0);
+        break;
+    case V4L2_PIX_FMT_XRGB32:
+        pack_xrgb8888(dst, src, img->width, 0xff000000);
+        break;
+    case V4L2_PIX_FMT_ABGR32:
+        pack_bgrx8888(dst, src, img->width, 0);
+        break;
+    case V4L2_PIX_FMT_XBGR32:
+        pack_bgrx8888(dst, src, img->width, 0xff000000);
+        break;
+    case V4L2_PIX_FMT_RGB24:
+        pack_rgb888(dst, src, img->width);
+        break;
+    case V4L2_PIX_FMT_RGB565:
+    case V4L2_PIX_FMT_ARGB555:
+    case V4L2_PIX_FMT_ARGB444:
+        pack_16bpp(dst, src, img->width, fi->v4l2);
+        break;
+    default:
+        pack_luma(dst, src, img->width, img->matrix);
+        if (chroma)
+            pack_chroma_row(img, y, src);
+        break;
+    }
+}
+
+static void unpack_bgrx8888(uint32_t* dst, const uint8_t* src, uint32_t w, uint32_t amask)
+{
+    v4u32 a = splat_v4u32(amask), v;
+    uint32_t x, p;
+
+    for (x = 0; x + 4 <= w; x += 4) {
+        v = load_v4u32(src + x * 4);
+        v = (v >> 24) | ((v >> 8) & 0xff00) | ((v << 8) & 0xff0000) | (v << 24);
+        store_v4u32(dst + x, v | a);
+    }
+    for (; x < w; x++) {
+        memcpy(&p, src + x * 4, 4);
+        dst[x] = __builtin_bswap32(p) | amask;
+    }
+}
+
+static void unpack_16bpp(uint32_t* dst, const uint8_t* src, uint32_t w, uint32_t v4l2_format)
+{
+    const uint16_t* in = (const uint16_t*)src;
+    v4u32 v, a, r, g, b;
+    uint32_t x, i, n;
+
+    for (x = 0; x < w; x += 4) {
+        n = w - x < 4 ? w - x : 4;
+        v = splat_v4u32(0);
+        for (i = 0; i < n; i++)
+            v[i] = in[x + i];
+
+        if (v4l2_format == V4L2_PIX_FMT_RGB565) {
+            a = splat_v4u32(0xff);
+            r = (v >> 11) & 0x1f;
+            g = (v >> 5) & 0x3f;
+            b = v & 0x1f;
+            r = (r << 3) | (r >> 2);
+            g = (g << 2) | (g >> 4);
+            b = (b << 3) | (b >> 2);
+        } else if (v4l2_format == V4L2_PIX_FMT_ARGB555) {
+            a = ((v >> 15) & 1) * 0xff;
+            r = (v >> 10) & 0x1f;
+            g = (v >> 5) & 0x1f;
+            b = v & 0x1f;
+            r = (r << 3) | (r >> 2);
+            g = (g << 3) | (g >> 2);
+            b = (b << 3) | (b >> 2);
+        } else {
+            a = ((v >> 12) & 0xf) * 17;
+            r = ((v >> 8) & 0xf) * 17;
+            g = ((v >> 4) & 0xf) * 17;
+            b = (v & 0xf) * 17;
+        }
+
+        v = (a << 24) | (r << 16) | (g << 8) | b;
+        for (i = 0; i < n; i++)
+            dst[x + i] = v[i];
+    }
+}
+
+static void unpack_yuv(const struct image* img, uint32_t y, uint32_t* dst)
+{
+    const struct fmt_info* fi = img->fi;
+    const struct yuv_matrix* m = img->matrix;
+    uint32_t cy = y / fi->ysub;
+    const uint8_t* luma = img->planes[0] + (size_t)y * img->pitches[0];
+    const uint8_t* u = img->planes[1] + (size_t)cy * img->pitches[1];
+    const uint8_t* v = fi->num_planes == 3 ? img->planes[2] + (size_t)cy * img->pitches[2] : u + 1;
+    int ustep = fi->num_planes == 3 ? 1 : 2;
+    uint32_t x, i, n, o;
+    v4i32 c, d, e, r, g, b;
+
+    if (fi->uv_swap) {
+        v = u;
+        u = u + 1;
+    }
+
+    for (x = 0; x < img->width; x += 4) {
+        n = img->width - x < 4 ? img->width - x : 4;
+        c = d = e = splat_v4i32(0);
+        for (i = 0; i < n; i++) {
+            o = (x + i) / fi->xsub * ustep;
+            c[i] = luma[x + i];
+            d[i] = u[o];
+            e[i] = v[o];
+        }
+        c = (c - m->y_offset) * m->y_scale + 128;
+        d -= 128;
+        e -= 128;
+
+        r = clamp_u8((c + m->v_r * e) >> 8);
+        g = clamp_u8((c - m->u_g * d - m->v_g * e) >> 8);
+        b = clamp_u8((c + m->u_b * d) >> 8);
+
+        r = (r << 16) | (g << 8) | b | (v4i32)splat_v4u32(0xff000000);
+        for (i = 0; i < n; i++)
+            dst[x + i] = r[i];
+    }
+}
+
+void unpack_row(const struct image* img, uint32_t y, uint32_t* dst)
+{
+    const struct fmt_info* fi = img->fi;
+    const uint8_t* src = img->planes[0] + (size_t)y * img->pitches[0];
+    uint32_t x;
+
+    switch (fi->v4l2) {
+    case V4L2_PIX_FMT_ARGB32:
+        memcpy(dst, src, img->width * 4);
+        break;
+    case V4L2_PIX_FMT_XRGB32:
+        pack_xrgb8888((uint8_t*)dst, (const uint32_t*)src, img->width, 0xff000000);
+        break;
+    case V4L2_PIX_FMT_ABGR32:
+        unpack_bgrx8888(dst, src, img->width, 0);
+        break;
+    case V4L2_PIX_FMT_XBGR32:
+        unpack_bgrx8888(dst, src, img->width, 0xff000000);
+        break;
+    case V4L2_PIX_FMT_RGB24:
+        for (x = 0; x < img->width; x++)
+            dst[x] = 0xff000000 | src[x * 3 + 2] << 16 | src[x * 3 + 1] << 8 | src[x * 3];
+        break;
+    case V4L2_PIX_FMT_RGB565:
+    case V4L2_PIX_FMT_ARGB555:
+    case V4L2_PIX_FMT_ARGB444:
+        unpack_16bpp(dst, src, img->width, fi->v4l2);
+        break;
+    default:
+        unpack_yuv(img, y, dst);
+        break;
+    }
+}
@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) Fuzhou Rockchip Electronics Co.Ltd
+ * Author: Jacob Chen <jacob-chen@iotwrt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#ifndef __CONVERT_H_INCLUDED__
+#define __CONVERT_H_INCLUDED__
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct colorimetry;
+struct fmt_info;
+struct yuv_matrix;
+
+/* A CPU visible frame in one of the formats of format.h. */
+struct image {
+	const struct fmt_info *fi;
+	const struct yuv_matrix *matrix;	/* YUV formats only */
+	uint32_t width;
+	uint32_t height;
+	uint8_t *planes[3];
+	uint32_t pitches[3];
+	size_t size;
+};
+
+int init_image(struct image *img, uint32_t v4l2_format, void *addr,
+	       uint32_t width, uint32_t height);
+/* Frames start out BT.601 limited range, NULL switches back to that. */
+void set_image_colorimetry(struct image *img, const struct colorimetry *c);
+/*
+ * Columns [x, x + w) of 'img' as a frame of their own, sharing the pixels.
+ * 'x' and 'w' must be multiples of the horizontal chroma subsampling.
+ */
+void image_columns(struct image *view, const struct image *img, uint32_t x, uint32_t w);
+
+/*
+ * Row converters between a frame and 0xAARRGGBB pixels. Formats without
+ * alpha read back as opaque. pack_row() only writes the chroma of 'y' when
+ * 'chroma' is set, 4:2:0 formats take it from the even rows.
+ */
+void pack_row(const struct image *img, uint32_t y, const uint32_t *src, int chroma);
+void pack_chroma_row(const struct image *img, uint32_t y, const uint32_t *src);
+void unpack_row(const struct image *img, uint32_t y, uint32_t *dst);
+
+#endif /* __CONVERT_H_INCLUDED__ */
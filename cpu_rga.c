@@ -0,0 +1,365 @@
+/*
+ * Copyright (C) Fuzhou Rockchip Electronics Co.Ltd
+ * Author: Jacob Chen <jacob-chen@iotwrt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "convert.h"
+#include "cpu_rga.h"
+#include "format.h"
+#include "rga.h"
+#include "simd.h"
+#include "threadpool.h"
+#include "wcmem.h"
+
+/* source position of one destination coordinate, 'f' in 1/256 steps */
+struct sample {
+    uint32_t i0;
+    uint32_t i1;
+    uint32_t f;
+};
+
+struct xform_job {
+    const struct image* src;
+    struct image* dst;
+    const struct rga_params* p;
+    struct rga_rect s;
+    struct rga_rect d;
+    int swap;
+
+    uint32_t* argb; /* unpacked source frame */
+    struct sample* colmap;
+    struct sample* rowmap;
+};
+
+static void normalize_rect(struct rga_rect* r, const struct rga_rect* in,
+    uint32_t width, uint32_t height)
+{
+    *r = *in;
+    if (!r->w || !r->h) {
+        r->x = r->y = 0;
+        r->w = width;
+        r->h = height;
+    }
+    if (r->x >= width)
+        r->x = 0;
+    if (r->y >= height)
+        r->y = 0;
+    if (r->x + r->w > width)
+        r->w = width - r->x;
+    if (r->y + r->h > height)
+        r->h = height - r->y;
+}
+
+static int swaps_axes(int rotate)
+{
+    return rotate == 90 || rotate == 270;
+}
+
+/*
+ * Map destination (x, y) of a w x h compose rectangle back into the
+ * rotated-but-unscaled space (u, v), undoing the flips first.
+ */
+static void map_coord(const struct rga_params* p, uint32_t w, uint32_t h,
+    uint32_t x, uint32_t y, uint32_t* u, uint32_t* v)
+{
+    if (p->hflip)
+        x = w - 1 - x;
+    if (p->vflip)
+        y = h - 1 - y;
+
+    switch (p->rotate) {
+    case 90:
+        *u = y;
+        *v = w - 1 - x;
+        break;
+    case 180:
+        *u = w - 1 - x;
+        *v = h - 1 - y;
+        break;
+    case 270:
+        *u = h - 1 - y;
+        *v = x;
+        break;
+    default:
+        *u = x;
+        *v = y;
+        break;
+    }
+}
+
+/* centre aligned 16.16 scaling of coordinate u from n_out to n_in samples */
+static void scale_coord(uint32_t u, uint32_t n_out, uint32_t n_in, uint32_t offset,
+    struct sample* s)
+{
+    int64_t pos = ((int64_t)(2 * u + 1) * n_in * 65536) / (2 * n_out) - 32768;
+    uint32_t i0;
+
+    if (pos < 0)
+        pos = 0;
+    i0 = pos >> 16;
+    s->f = (pos >> 8) & 0xff;
+    if (i0 >= n_in - 1) {
+        i0 = n_in - 1;
+        s->f = 0;
+    }
+    s->i0 = i0 + offset;
+    s->i1 = (i0 + 1 < n_in ? i0 + 1 : i0) + offset;
+}
+
+/* round to the closer tap, bilinear() then reads a single pixel */
+static void point_sample(struct sample* s)
+{
+    if (s->f >= 128)
+        s->i0 = s->i1;
+    s->f = 0;
+}
+
+int cpu_rga_is_exact(const struct image* src, const struct image* dst,
+    const struct rga_params* p)
+{
+    const struct fmt_info* fi = src->fi;
+    struct rga_rect s, d;
+    uint32_t sw, sh;
+
+    normalize_rect(&s, &p->src, src->width, src->height);
+    normalize_rect(&d, &p->dst, dst->width, dst->height);
+
+    if (src->fi != dst->fi || p->blend != V4L2_BLEND_SRC)
+        return 0;
+    if (fi->is_yuv && src->matrix != dst->matrix)
+        return 0;
+    sw = swaps_axes(p->rotate) ? d.h : d.w;
+    sh = swaps_axes(p->rotate) ? d.w : d.h;
+    if (sw != s.w || sh != s.h)
+        return 0;
+
+    if (fi->is_yuv) {
+        if (swaps_axes(p->rotate) && fi->xsub != fi->ysub)
+            return 0;
+        if (s.x % fi->xsub || s.y % fi->ysub || s.w % fi->xsub || s.h % fi->ysub)
+            return 0;
+        if (d.x % fi->xsub || d.y % fi->ysub || d.w % fi->xsub || d.h % fi->ysub)
+            return 0;
+    }
+    return 1;
+}
+
+/* exact path: move whole elements of every plane, no colour conversion */
+static void remap_plane(const struct rga_params* p, const uint8_t* src, uint32_t spitch,
+    uint32_t sx, uint32_t sy, uint8_t* dst, uint32_t dpitch, uint32_t w, uint32_t h,
+    uint32_t cpp)
+{
+    uint32_t x, y, u, v;
+
+    for (y = 0; y < h; y++) {
+        uint8_t* out = dst + (size_t)y * dpitch;
+
+        if (!p->rotate && !p->hflip) {
+            map_coord(p, w, h, 0, y, &u, &v);
+            wc_copy(out, src + (size_t)(sy + v) * spitch + (size_t)sx * cpp, (size_t)w * cpp);
+            continue;
+        }
+        for (x = 0; x < w; x++) {
+            map_coord(p, w, h, x, y, &u, &v);
+            memcpy(out + (size_t)x * cpp, src + (size_t)(sy + v) * spitch + (size_t)(sx + u) * cpp, cpp);
+        }
+    }
+}
+
+static void remap_exact(const struct image* src, struct image* dst, const struct rga_params* p)
+{
+    const struct fmt_info* fi = src->fi;
+    struct rga_rect s, d;
+    uint32_t cpp;
+    int i;
+
+    normalize_rect(&s, &p->src, src->width, src->height);
+    normalize_rect(&d, &p->dst, dst->width, dst->height);
+
+    remap_plane(p, src->planes[0], src->pitches[0], s.x, s.y,
+        dst->planes[0] + (size_t)d.y * dst->pitches[0] + (size_t)d.x * fi->cpp,
+        dst->pitches[0], d.w, d.h, fi->cpp);
+
+    for (i = 1; i < fi->num_planes; i++) {
+        cpp = fi->num_planes == 2 ? 2 : 1;
+        remap_plane(p, src->planes[i], src->pitches[i], s.x / fi->xsub, s.y / fi->ysub,
+            dst->planes[i] + (size_t)(d.y / fi->ysub) * dst->pitches[i] + (size_t)(d.x / fi->xsub) * cpp,
+            dst->pitches[i], d.w / fi->xsub, d.h / fi->ysub, cpp);
+    }
+}
+
+static void unpack_rows(void* arg, int begin, int end)
+{
+    struct xform_job* job = (struct xform_job*)arg;
+    int y;
+
+    for (y = begin; y < end; y++)
+        unpack_row(job->src, y, job->argb + (size_t)y * job->src->width);
+}
+
+static inline v4u32 channels(uint32_t p)
+{
+    v4u32 c = { p & 0xff, (p >> 8) & 0xff, (p >> 16) & 0xff, p >> 24 };
+    return c;
+}
+
+static inline uint32_t bilinear(const uint32_t* img, uint32_t stride,
+    const struct sample* sx, const struct sample* sy)
+{
+    const uint32_t* r0 = img + (size_t)sy->i0 * stride;
+    const uint32_t* r1 = img + (size_t)sy->i1 * stride;
+    v4u32 top, bot, c;
+
+    if (!sx->f && !sy->f)
+        return r0[sx->i0];
+
+    top = channels(r0[sx->i0]) * (256 - sx->f) + channels(r0[sx->i1]) * sx->f;
+    bot = channels(r1[sx->i0]) * (256 - sx->f) + channels(r1[sx->i1]) * sx->f;
+    c = (top * (256 - sy->f) + bot * sy->f + 32768) >> 16;
+
+    return c[0] | (c[1] << 8) | (c[2] << 16) | (c[3] << 24);
+}
+
+static inline uint32_t src_over(uint32_t s, uint32_t d)
+{
+    v4u32 sc = channels(s), dc = channels(d), c;
+    uint32_t a = s >> 24;
+    v4u32 sa = splat_v4u32(a);
+
+    c = (sc * sa + dc * (255 - sa) + 127) / 255;
+    c[3] = a + (dc[3] * (255 - a) + 127) / 255;
+
+    return c[0] | (c[1] << 8) | (c[2] << 16) | (c[3] << 24);
+}
+
+/*
+ * 'begin' and 'end' count groups of ysub rows from the one holding d.y:
+ * the rows that share a chroma row are unpacked and packed by one call.
+ */
+static void transform_rows(void* arg, int begin, int end)
+{
+    struct xform_job* job = (struct xform_job*)arg;
+    struct image* dst = job->dst;
+    struct image span;
+    const struct sample *sx, *sy;
+    uint32_t stride = job->src->width;
+    uint32_t x0 = job->d.x;
+    uint32_t ysub = dst->fi->ysub;
+    uint32_t first = job->d.y / ysub * ysub;
+    int blend = job->p->blend == V4L2_BLEND_SRCOVER;
+    int whole_row;
+    uint32_t* row;
+    uint32_t x, y, y0, y1, p;
+
+    /* only repack the composed columns, a YUV round trip of the rest is lossy */
+    if (x0 % dst->fi->xsub == 0 && job->d.w % dst->fi->xsub == 0) {
+        image_columns(&span, dst, x0, job->d.w);
+        dst = &span;
+        x0 = 0;
+    }
+    whole_row = !x0 && job->d.w == dst->width;
+
+    row = (uint32_t*)malloc(dst->width * sizeof(*row));
+    if (!row)
+        return;
+
+    y0 = first + begin * ysub;
+    y1 = first + end * ysub;
+    if (y0 < job->d.y)
+        y0 = job->d.y;
+    if (y1 > job->d.y + job->d.h)
+        y1 = job->d.y + job->d.h;
+
+    for (y = y0; y < y1; y++) {
+        if (!whole_row || blend)
+            unpack_row(dst, y, row);
+
+        for (x = 0; x < job->d.w; x++) {
+            if (job->swap) {
+                sx = &job->rowmap[y - job->d.y];
+                sy = &job->colmap[x];
+            } else {
+                sx = &job->colmap[x];
+                sy = &job->rowmap[y - job->d.y];
+            }
+            p = bilinear(job->argb, stride, sx, sy);
+            row[x0 + x] = blend ? src_over(p, row[x0 + x]) : p;
+        }
+
+        pack_row(dst, y, row, dst->fi->is_yuv && (y % dst->fi->ysub) == 0);
+    }
+
+    free(row);
+}
+
+int cpu_rga_transform(const struct image* src, struct image* dst,
+    const struct rga_params* p)
+{
+    struct thread_pool* pool = get_default_thread_pool();
+    struct xform_job job;
+    uint32_t x, y, u, v;
+
+    if (cpu_rga_is_exact(src, dst, p)) {
+        remap_exact(src, dst, p);
+        return 0;
+    }
+
+    memset(&job, 0, sizeof(job));
+    job.src = src;
+    job.dst = dst;
+    job.p = p;
+    job.swap = swaps_axes(p->rotate);
+    normalize_rect(&job.s, &p->src, src->width, src->height);
+    normalize_rect(&job.d, &p->dst, dst->width, dst->height);
+
+    job.argb = (uint32_t*)frame_alloc((size_t)src->width * src->height * sizeof(uint32_t));
+    job.colmap = (struct sample*)calloc(job.d.w, sizeof(struct sample));
+    job.rowmap = (struct sample*)calloc(job.d.h, sizeof(struct sample));
+    if (!job.argb || !job.colmap || !job.rowmap) {
+        printf("%s: out of memory\n", __func__);
+        frame_free(job.argb);
+        free(job.colmap);
+        free(job.rowmap);
+        return -1;
+    }
+
+    /* separable: a destination column moves along one source axis only */
+    for (x = 0; x < job.d.w; x++) {
+        map_coord(p, job.d.w, job.d.h, x, 0, &u, &v);
+        if (job.swap)
+            scale_coord(v, job.d.w, job.s.h, job.s.y, &job.colmap[x]);
+        else
+            scale_coord(u, job.d.w, job.s.w, job.s.x, &job.colmap[x]);
+        if (p->nearest)
+            point_sample(&job.colmap[x]);
+    }
+    for (y = 0; y < job.d.h; y++) {
+        map_coord(p, job.d.w, job.d.h, 0, y, &u, &v);
+        if (job.swap)
+            scale_coord(u, job.d.h, job.s.w, job.s.x, &job.rowmap[y]);
+        else
+            scale_coord(v, job.d.h, job.s.h, job.s.y, &job.rowmap[y]);
+        if (p->nearest)
+            point_sample(&job.rowmap[y]);
+    }
+
+    parallel_for(pool, src->height, 16, unpack_rows, &job);
+    /* in groups of rows that share chroma, see transform_rows() */
+    y = job.d.y / dst->fi->ysub;
+    parallel_for(pool, (job.d.y + job.d.h - 1) / dst->fi->ysub - y + 1, 16, transform_rows, &job);
+
+    frame_free(job.argb);
+    free(job.colmap);
+    free(job.rowmap);
+    return 0;
+}
@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) Fuzhou Rockchip Electronics Co.Ltd
+ * Author: Jacob Chen <jacob-chen@iotwrt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#ifndef __CPU_RGA_H_INCLUDED__
+#define __CPU_RGA_H_INCLUDED__
+
+#include <stdint.h>
+
+struct image;
+
+struct rga_rect {
+	uint32_t x;
+	uint32_t y;
+	uint32_t w;
+	uint32_t h;
+};
+
+/*
+ * One RGA operation. The source crop is scaled to the destination compose
+ * rectangle after rotating it clockwise by 'rotate' degrees, the flips are
+ * applied to the rotated result. Rectangles of zero size cover the frame.
+ */
+struct rga_params {
+	struct rga_rect src;
+	struct rga_rect dst;
+	int rotate;
+	int hflip;
+	int vflip;
+	int blend;		/* V4L2_BLEND_SRC or V4L2_BLEND_SRCOVER */
+	int nearest;		/* point sampling instead of bilinear */
+};
+
+/*
+ * Whether the operation is a pure pixel permutation the CPU reproduces bit
+ * for bit (same format, no scaling, no blending).
+ */
+int cpu_rga_is_exact(const struct image *src, const struct image *dst,
+		     const struct rga_params *p);
+
+/* Software version of the RGA: bilinear scaling through 0xAARRGGBB. */
+int cpu_rga_transform(const struct image *src, struct image *dst,
+		      const struct rga_params *p);
+
+#endif /* __CPU_RGA_H_INCLUDED__ */
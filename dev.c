@@ -28,25 +28,29 @@
 
 #include "bo.h"
 #include "dev.h"
+#include "fbcache.h"
 #include "modeset.h"
 
-#if 0 //def USE_ATOMIC_API
-static uint32_t get_prop_id(struct sp_dev *dev,
-			    drmModeObjectPropertiesPtr props, const char *name){
-	drmModePropertyPtr p;
-	uint32_t i, prop_id = 0; /* Property ID should always be > 0 */
-
-	for (i = 0; !prop_id && i < props->count_props; i++) {
-		p = drmModeGetProperty(dev->fd, props->props[i]);
-		if (!strcmp(p->name, name))
-		prop_id = p->prop_id;
-		drmModeFreeProperty(p);
-	}
-	if (!prop_id)
-	printf("Could not find %s property\n", name);
-	return prop_id;
+/* a few swapchains worth of buffers */
+#define MAX_CACHED_FBS 32
+
+/* Property IDs are > 0, 0 when the object doesn't have it. */
+static uint32_t get_prop_id(struct sp_dev* dev, drmModeObjectPropertiesPtr props,
+    const char* name)
+{
+    drmModePropertyPtr p;
+    uint32_t i, prop_id = 0;
+
+    for (i = 0; !prop_id && i < props->count_props; i++) {
+        p = drmModeGetProperty(dev->fd, props->props[i]);
+        if (!p)
+            continue;
+        if (!strcmp(p->name, name))
+            prop_id = p->prop_id;
+        drmModeFreeProperty(p);
+    }
+    return prop_id;
 }
-#endif
 
 int is_supported_format(struct sp_plane* plane, uint32_t format)
 {
@@ -79,6 +83,7 @@ struct sp_dev* create_sp_dev(void)
     int ret, fd, i, j;
     drmModeRes* r = NULL;
     drmModePlaneRes* pr = NULL;
+    drmModeObjectPropertiesPtr props;
 
     fd = open("/dev/dri/card0", O_RDWR | O_CLOEXEC);
     if (fd < 0) {
@@ -93,6 +98,8 @@ struct sp_dev* create_sp_dev(void)
     }
 
     dev->fd = fd;
+    dev->heap_fd = -1;
+    dev->fbs = create_fb_cache(dev->fd, MAX_CACHED_FBS);
 
 	ret = drmSetClientCap(dev->fd, DRM_CLIENT_CAP_ATOMIC, 1);
 	if (ret) {
@@ -155,6 +162,12 @@ struct sp_dev* create_sp_dev(void)
         dev->crtcs[i].scanout = NULL;
         dev->crtcs[i].pipe = i;
         dev->crtcs[i].num_planes = 0;
+
+        props = drmModeObjectGetProperties(dev->fd, r->crtcs[i], DRM_MODE_OBJECT_CRTC);
+        if (props) {
+            dev->crtcs[i].out_fence_pid = get_prop_id(dev, props, "OUT_FENCE_PTR");
+            drmModeFreeObjectProperties(props);
+        }
     }
 
     pr = drmModeGetPlaneResources(dev->fd);
@@ -165,7 +178,6 @@ struct sp_dev* create_sp_dev(void)
     dev->num_planes = pr->count_planes;
     dev->planes = (struct sp_plane*)calloc(dev->num_planes, sizeof(struct sp_plane));
     for (i = 0; i < dev->num_planes; i++) {
-        drmModeObjectPropertiesPtr props;
         struct sp_plane* plane = &dev->planes[i];
 
         plane->dev = dev;
@@ -194,58 +206,17 @@ struct sp_dev* create_sp_dev(void)
             printf("failed to get plane properties\n");
             goto err;
         }
-#if 0 //def USE_ATOMIC_API
-		plane->crtc_pid = get_prop_id(dev, props, "CRTC_ID");
-		if (!plane->crtc_pid) {
-			drmModeFreeObjectProperties(props);
-			goto err;
-		}
-		plane->fb_pid = get_prop_id(dev, props, "FB_ID");
-		if (!plane->fb_pid) {
-			drmModeFreeObjectProperties(props);
-			goto err;
-		}
-		plane->crtc_x_pid = get_prop_id(dev, props, "CRTC_X");
-		if (!plane->crtc_x_pid) {
-			drmModeFreeObjectProperties(props);
-			goto err;
-		}
-		plane->crtc_y_pid = get_prop_id(dev, props, "CRTC_Y");
-		if (!plane->crtc_y_pid) {
-			drmModeFreeObjectProperties(props);
-			goto err;
-		}
-		plane->crtc_w_pid = get_prop_id(dev, props, "CRTC_W");
-		if (!plane->crtc_w_pid) {
-			drmModeFreeObjectProperties(props);
-			goto err;
-		}
-		plane->crtc_h_pid = get_prop_id(dev, props, "CRTC_H");
-		if (!plane->crtc_h_pid) {
-			drmModeFreeObjectProperties(props);
-			goto err;
-		}
-		plane->src_x_pid = get_prop_id(dev, props, "SRC_X");
-		if (!plane->src_x_pid) {
-			drmModeFreeObjectProperties(props);
-			goto err;
-		}
-		plane->src_y_pid = get_prop_id(dev, props, "SRC_Y");
-		if (!plane->src_y_pid) {
-			drmModeFreeObjectProperties(props);
-			goto err;
-		}
-		plane->src_w_pid = get_prop_id(dev, props, "SRC_W");
-		if (!plane->src_w_pid) {
-			drmModeFreeObjectProperties(props);
-			goto err;
-		}
-		plane->src_h_pid = get_prop_id(dev, props, "SRC_H");
-		if (!plane->src_h_pid) {
-			drmModeFreeObjectProperties(props);
-			goto err;
-		}
-#endif
+        plane->crtc_pid = get_prop_id(dev, props, "CRTC_ID");
+        plane->fb_pid = get_prop_id(dev, props, "FB_ID");
+        plane->crtc_x_pid = get_prop_id(dev, props, "CRTC_X");
+        plane->crtc_y_pid = get_prop_id(dev, props, "CRTC_Y");
+        plane->crtc_w_pid = get_prop_id(dev, props, "CRTC_W");
+        plane->crtc_h_pid = get_prop_id(dev, props, "CRTC_H");
+        plane->src_x_pid = get_prop_id(dev, props, "SRC_X");
+        plane->src_y_pid = get_prop_id(dev, props, "SRC_Y");
+        plane->src_w_pid = get_prop_id(dev, props, "SRC_W");
+        plane->src_h_pid = get_prop_id(dev, props, "SRC_H");
+        plane->in_fence_pid = get_prop_id(dev, props, "IN_FENCE_FD");
         drmModeFreeObjectProperties(props);
     }
 
@@ -264,6 +235,38 @@ err:
     return NULL;
 }
 
+struct sp_dev* create_headless_sp_dev(const char* heap)
+{
+    struct sp_dev* dev;
+    char path[64];
+
+    dev = (struct sp_dev*)calloc(1, sizeof(*dev));
+    if (!dev) {
+        printf("failed to allocate dev\n");
+        return NULL;
+    }
+
+    snprintf(path, sizeof(path), "/dev/dma_heap/%s", heap ? heap : "system");
+    dev->heap_fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (dev->heap_fd >= 0) {
+        dev->fd = -1;
+        dev->alloc = SP_ALLOC_HEAP;
+        return dev;
+    }
+
+    /* a render node has no dumb buffers, the primary one does without KMS */
+    dev->fd = open("/dev/dri/card0", O_RDWR | O_CLOEXEC);
+    if (dev->fd >= 0) {
+        printf("no %s, allocating on card0\n", path);
+        dev->alloc = SP_ALLOC_DUMB;
+        return dev;
+    }
+
+    printf("no %s and no card0, allocating memfds for fake nodes\n", path);
+    dev->alloc = SP_ALLOC_MEMFD;
+    return dev;
+}
+
 void destroy_sp_dev(struct sp_dev* dev)
 {
     int i;
@@ -303,6 +306,10 @@ void destroy_sp_dev(struct sp_dev* dev)
         free(dev->connectors);
     }
 
-    close(dev->fd);
+    destroy_fb_cache(dev->fbs);
+    if (dev->heap_fd >= 0)
+        close(dev->heap_fd);
+    if (dev->fd >= 0)
+        close(dev->fd);
     free(dev);
 }
\ No newline at end of file
@@ -20,6 +20,7 @@
 #include <stdint.h>
 #include <xf86drmMode.h>
 
+struct fb_cache;
 struct sp_bo;
 struct sp_dev;
 
@@ -42,6 +43,7 @@ struct sp_plane {
 	uint32_t src_y_pid;
 	uint32_t src_w_pid;
 	uint32_t src_h_pid;
+	uint32_t in_fence_pid;
 };
 
 struct sp_crtc {
@@ -49,10 +51,21 @@ struct sp_crtc {
 	int pipe;
 	int num_planes;
 	struct sp_bo *scanout;
+	uint32_t out_fence_pid;
+};
+
+/* Where the bos of a device come from. */
+enum sp_alloc {
+	SP_ALLOC_DUMB,		/* dumb buffers of the DRM device */
+	SP_ALLOC_HEAP,		/* a DMA heap */
+	SP_ALLOC_MEMFD,		/* memfds, only fake m2m nodes take those */
 };
 
 struct sp_dev {
-	int fd;
+	int fd;			/* -1 without a DRM device */
+	enum sp_alloc alloc;
+	int heap_fd;		/* SP_ALLOC_HEAP, otherwise -1 */
+	int num_bos;		/* live bos, updated atomically */
 
 	int num_connectors;
 	drmModeConnectorPtr *connectors;
@@ -65,10 +78,26 @@ struct sp_dev {
 
 	int num_planes;
 	struct sp_plane *planes;
+
+	/* fbs of the bos and imported dmabufs that were shown */
+	struct fb_cache *fbs;
+
+	/* bos with a CPU mapping, see pin_sp_bo() */
+	struct sp_bo *mapped;
+	uint64_t mapped_size;
+	uint64_t map_budget;		/* 0 picks the default */
+	uint64_t map_clock;
 };
 
 int is_supported_format(struct sp_plane *plane, uint32_t format);
 struct sp_dev* create_sp_dev(void);
+/*
+ * A device that only allocates and can't display. Buffers come from the
+ * DMA heap 'heap' (NULL picks "system"); without it from dumb buffers of
+ * card0, which needs neither atomic nor usable planes; and as the last
+ * resort from memfds. Connectors, crtcs and planes are never looked at.
+ */
+struct sp_dev* create_headless_sp_dev(const char *heap);
 void destroy_sp_dev(struct sp_dev *dev);
 
 #endif /* __DEV_H_INCLUDED__ */
\ No newline at end of file
@@ -0,0 +1,904 @@
+/*
+ * Copyright (C) Fuzhou Rockchip Electronics Co.Ltd
+ * Author: Jacob Chen <jacob-chen@iotwrt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/videodev2.h>
+
+#include "bo.h"
+#include "convert.h"
+#include "cpu_rga.h"
+#include "fakem2m.h"
+#include "format.h"
+#include "m2m.h"
+#include "rga.h"
+
+#define FAKE_MAX_DEVS 16
+#define FAKE_MAX_BUFS 16
+#define FAKE_MAX_SIZE 8192
+
+enum {
+    Q_OUTPUT,
+    Q_CAPTURE,
+    NUM_QUEUES,
+};
+
+enum buf_state {
+    BUF_DEQUEUED,
+    BUF_QUEUED,
+    BUF_ACTIVE,
+    BUF_DONE,
+};
+
+struct fake_buf {
+    enum buf_state state;
+    int fd;             /* our reference to the dmabuf while queued */
+    int user_fd;
+    uint32_t bytesused;
+    uint32_t flags;     /* V4L2_BUF_FLAG_ERROR of a failed job */
+    uint32_t sequence;
+    struct timeval timestamp;
+};
+
+/* buffer indices in the order they were queued or completed */
+struct fifo {
+    unsigned int index[FAKE_MAX_BUFS];
+    unsigned int head;
+    unsigned int num;
+};
+
+struct fake_queue {
+    struct v4l2_pix_format fmt;
+    struct rga_rect sel;        /* OUTPUT crop, CAPTURE compose */
+    struct fake_buf bufs[FAKE_MAX_BUFS];
+    unsigned int num_bufs;
+    struct fifo queued;
+    struct fifo done;
+    int streaming;
+};
+
+/* what the worker needs of a job once it dropped the lock */
+struct fake_job {
+    unsigned int src;
+    unsigned int dst;
+    int src_fd;
+    int dst_fd;
+    struct v4l2_pix_format src_fmt;
+    struct v4l2_pix_format dst_fmt;
+    struct rga_params params;
+};
+
+struct fake_m2m {
+    int fd;             /* read end of the pipe, the node */
+    int wake_fd;        /* a byte per done CAPTURE buffer */
+    uint32_t job_us;
+    uint32_t mp_us;
+    int cpu;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t worker;
+    int quit;
+    int active;         /* the worker is running a job */
+
+    struct fake_queue q[NUM_QUEUES];
+    struct m2m_ctrls ctrls;
+    uint32_t sequence;
+};
+
+static const struct {
+    uint32_t id;
+    const char* name;
+    uint32_t type;
+    int32_t min;
+    int32_t max;
+    int32_t step;
+} fake_ctrls[] = {
+    { V4L2_CID_HFLIP, "Horizontal Flip", V4L2_CTRL_TYPE_BOOLEAN, 0, 1, 1 },
+    { V4L2_CID_VFLIP, "Vertical Flip", V4L2_CTRL_TYPE_BOOLEAN, 0, 1, 1 },
+    { V4L2_CID_ROTATE, "Rotate", V4L2_CTRL_TYPE_INTEGER, 0, 270, 90 },
+    { V4L2_CID_BG_COLOR, "Background Color", V4L2_CTRL_TYPE_INTEGER, INT32_MIN, INT32_MAX, 1 },
+    /* only the modes the CPU kernels have */
+    { V4L2_CID_BLEND, "Blend Mode", V4L2_CTRL_TYPE_INTEGER, V4L2_BLEND_SRC, V4L2_BLEND_SRCOVER, 4 },
+};
+
+static pthread_mutex_t fakes_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct fake_m2m* fakes[FAKE_MAX_DEVS];
+static int num_fakes;
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void fifo_push(struct fifo* f, unsigned int index)
+{
+    f->index[(f->head + f->num++) % FAKE_MAX_BUFS] = index;
+}
+
+static unsigned int fifo_pop(struct fifo* f)
+{
+    unsigned int index = f->index[f->head];
+
+    f->head = (f->head + 1) % FAKE_MAX_BUFS;
+    f->num--;
+    return index;
+}
+
+static int queue_of(uint32_t type)
+{
+    if (type == V4L2_BUF_TYPE_VIDEO_OUTPUT)
+        return Q_OUTPUT;
+    if (type == V4L2_BUF_TYPE_VIDEO_CAPTURE)
+        return Q_CAPTURE;
+    return -1;
+}
+
+static uint32_t clamp_size(uint32_t v)
+{
+    return v < 1 ? 1 : v > FAKE_MAX_SIZE ? FAKE_MAX_SIZE : v;
+}
+
+/* Adjust 'pix' the way TRY_FMT does. */
+static void try_fmt(struct v4l2_pix_format* pix)
+{
+    const struct fmt_info* fi = get_fmt_info(pix->pixelformat);
+    struct colorimetry c;
+
+    if (!fi)
+        fi = get_fmt_info_by_index(0);
+    pix->pixelformat = fi->v4l2;
+    pix->width = clamp_size(pix->width);
+    pix->height = clamp_size(pix->height);
+    pix->field = V4L2_FIELD_NONE;
+    pix->bytesperline = pix->width * fi->cpp;
+    pix->sizeimage = fmt_frame_size(fi, pix->width, pix->height);
+    if (!fi->is_yuv) {
+        pix->ycbcr_enc = V4L2_YCBCR_ENC_DEFAULT;
+        pix->quantization = V4L2_QUANTIZATION_FULL_RANGE;
+    }
+    c.ycbcr_enc = pix->ycbcr_enc;
+    c.quantization = pix->quantization;
+    pix->colorspace = fmt_colorspace(fi, &c);
+    pix->xfer_func = V4L2_XFER_FUNC_DEFAULT;
+    pix->priv = V4L2_PIX_FMT_PRIV_MAGIC;
+    pix->flags = 0;
+}
+
+static void get_rect(const struct fake_queue* fq, struct rga_rect* r)
+{
+    if (fq->sel.w && fq->sel.h) {
+        *r = fq->sel;
+        return;
+    }
+    r->x = r->y = 0;
+    r->w = fq->fmt.width;
+    r->h = fq->fmt.height;
+}
+
+static int check_ctrl(uint32_t id, int32_t value)
+{
+    size_t i;
+
+    for (i = 0; i < sizeof(fake_ctrls) / sizeof(fake_ctrls[0]); i++) {
+        if (fake_ctrls[i].id != id)
+            continue;
+        if (value < fake_ctrls[i].min || value > fake_ctrls[i].max
+            || ((int64_t)value - fake_ctrls[i].min) % fake_ctrls[i].step)
+            return -ERANGE;
+        return 0;
+    }
+    return -EINVAL;
+}
+
+static void set_ctrl(struct fake_m2m* f, uint32_t id, int32_t value)
+{
+    switch (id) {
+    case V4L2_CID_HFLIP:
+        f->ctrls.hflip = value;
+        break;
+    case V4L2_CID_VFLIP:
+        f->ctrls.vflip = value;
+        break;
+    case V4L2_CID_ROTATE:
+        f->ctrls.rotate = value;
+        break;
+    case V4L2_CID_BG_COLOR:
+        f->ctrls.fill_color = value;
+        break;
+    case V4L2_CID_BLEND:
+        f->ctrls.blend = value;
+        break;
+    }
+}
+
+static int get_ctrl(const struct fake_m2m* f, uint32_t id, int32_t* value)
+{
+    switch (id) {
+    case V4L2_CID_HFLIP:
+        *value = f->ctrls.hflip;
+        return 0;
+    case V4L2_CID_VFLIP:
+        *value = f->ctrls.vflip;
+        return 0;
+    case V4L2_CID_ROTATE:
+        *value = f->ctrls.rotate;
+        return 0;
+    case V4L2_CID_BG_COLOR:
+        *value = f->ctrls.fill_color;
+        return 0;
+    case V4L2_CID_BLEND:
+        *value = f->ctrls.blend;
+        return 0;
+    }
+    return -EINVAL;
+}
+
+static void release_buf(struct fake_buf* b)
+{
+    if (b->fd >= 0)
+        close(b->fd);
+    b->fd = -1;
+    b->state = BUF_DEQUEUED;
+}
+
+static unsigned int num_pending(const struct fake_queue* fq)
+{
+    unsigned int i, n = 0;
+
+    for (i = 0; i < fq->num_bufs; i++)
+        n += fq->bufs[i].state == BUF_QUEUED || fq->bufs[i].state == BUF_ACTIVE;
+    return n;
+}
+
+static int job_ready(const struct fake_m2m* f)
+{
+    return f->q[Q_OUTPUT].streaming && f->q[Q_CAPTURE].streaming
+        && f->q[Q_OUTPUT].queued.num && f->q[Q_CAPTURE].queued.num;
+}
+
+/* The time the modelled hardware spends on a job. */
+static uint64_t job_cost_us(const struct fake_m2m* f, const struct fake_job* job)
+{
+    uint64_t src = (uint64_t)job->params.src.w * job->params.src.h;
+    uint64_t dst = (uint64_t)job->params.dst.w * job->params.dst.h;
+
+    return f->job_us + (src > dst ? src : dst) * f->mp_us / 1000000;
+}
+
+static int transform(const struct fake_job* job)
+{
+    const struct v4l2_pix_format* sf = &job->src_fmt;
+    const struct v4l2_pix_format* df = &job->dst_fmt;
+    struct colorimetry sc = { sf->ycbcr_enc, sf->quantization };
+    struct colorimetry dc = { df->ycbcr_enc, df->quantization };
+    struct image src, dst;
+    void *src_addr, *dst_addr;
+    int ret;
+
+    src_addr = mmap(NULL, sf->sizeimage, PROT_READ, MAP_SHARED, job->src_fd, 0);
+    if (src_addr == MAP_FAILED)
+        return -errno;
+    dst_addr = mmap(NULL, df->sizeimage, PROT_READ | PROT_WRITE, MAP_SHARED, job->dst_fd, 0);
+    if (dst_addr == MAP_FAILED) {
+        ret = -errno;
+        munmap(src_addr, sf->sizeimage);
+        return ret;
+    }
+
+    init_image(&src, sf->pixelformat, src_addr, sf->width, sf->height);
+    init_image(&dst, df->pixelformat, dst_addr, df->width, df->height);
+    set_image_colorimetry(&src, &sc);
+    set_image_colorimetry(&dst, &dc);
+
+    /* blending reads the destination too */
+    sync_dmabuf(job->src_fd, 1, SP_BO_READ);
+    sync_dmabuf(job->dst_fd, 1, SP_BO_READ | SP_BO_WRITE);
+    ret = cpu_rga_transform(&src, &dst, &job->params);
+    sync_dmabuf(job->dst_fd, 0, SP_BO_READ | SP_BO_WRITE);
+    sync_dmabuf(job->src_fd, 0, SP_BO_READ);
+
+    munmap(dst_addr, df->sizeimage);
+    munmap(src_addr, sf->sizeimage);
+    return ret;
+}
+
+/* Called locked: take the next pair of buffers with the current state. */
+static void start_job(struct fake_m2m* f, struct fake_job* job)
+{
+    struct fake_queue* out = &f->q[Q_OUTPUT];
+    struct fake_queue* cap = &f->q[Q_CAPTURE];
+
+    job->src = fifo_pop(&out->queued);
+    job->dst = fifo_pop(&cap->queued);
+    out->bufs[job->src].state = BUF_ACTIVE;
+    cap->bufs[job->dst].state = BUF_ACTIVE;
+    job->src_fd = out->bufs[job->src].fd;
+    job->dst_fd = cap->bufs[job->dst].fd;
+    job->src_fmt = out->fmt;
+    job->dst_fmt = cap->fmt;
+
+    memset(&job->params, 0, sizeof(job->params));
+    get_rect(out, &job->params.src);
+    get_rect(cap, &job->params.dst);
+    job->params.rotate = f->ctrls.rotate;
+    job->params.hflip = f->ctrls.hflip;
+    job->params.vflip = f->ctrls.vflip;
+    job->params.blend = f->ctrls.blend;
+    f->active = 1;
+}
+
+/* Called locked. */
+static void finish_job(struct fake_m2m* f, const struct fake_job* job, int ret)
+{
+    struct fake_buf* src = &f->q[Q_OUTPUT].bufs[job->src];
+    struct fake_buf* dst = &f->q[Q_CAPTURE].bufs[job->dst];
+
+    src->state = dst->state = BUF_DONE;
+    src->flags = dst->flags = ret ? V4L2_BUF_FLAG_ERROR : 0;
+    src->sequence = dst->sequence = f->sequence++;
+    dst->timestamp = src->timestamp;
+    dst->bytesused = ret ? 0 : job->dst_fmt.sizeimage;
+    fifo_push(&f->q[Q_OUTPUT].done, job->src);
+    fifo_push(&f->q[Q_CAPTURE].done, job->dst);
+
+    if (write(f->wake_fd, "", 1) != 1)
+        perror("write");
+    f->active = 0;
+    pthread_cond_broadcast(&f->cond);
+}
+
+/* The device: one job at a time, each taking at least its modelled cost. */
+static void* fake_worker(void* arg)
+{
+    struct fake_m2m* f = (struct fake_m2m*)arg;
+    struct fake_job job;
+    uint64_t end, now;
+    int ret;
+
+    pthread_mutex_lock(&f->lock);
+    for (;;) {
+        while (!f->quit && !job_ready(f))
+            pthread_cond_wait(&f->cond, &f->lock);
+        if (f->quit)
+            break;
+
+        start_job(f, &job);
+        pthread_mutex_unlock(&f->lock);
+
+        end = now_us() + job_cost_us(f, &job);
+        ret = f->cpu ? transform(&job) : 0;
+        now = now_us();
+        if (now < end)
+            usleep(end - now);
+
+        pthread_mutex_lock(&f->lock);
+        finish_job(f, &job, ret);
+    }
+    pthread_mutex_unlock(&f->lock);
+    return NULL;
+}
+
+static void fill_buf(const struct fake_queue* fq, unsigned int index, struct v4l2_buffer* buf)
+{
+    const struct fake_buf* b = &fq->bufs[index];
+
+    buf->index = index;
+    buf->bytesused = b->bytesused;
+    buf->flags = V4L2_BUF_FLAG_TIMESTAMP_COPY | b->flags;
+    if (b->state == BUF_QUEUED || b->state == BUF_ACTIVE)
+        buf->flags |= V4L2_BUF_FLAG_QUEUED;
+    if (b->state == BUF_DONE)
+        buf->flags |= V4L2_BUF_FLAG_DONE;
+    buf->field = V4L2_FIELD_NONE;
+    buf->timestamp = b->timestamp;
+    buf->sequence = b->sequence;
+    buf->m.fd = b->user_fd;
+    buf->length = fq->fmt.sizeimage;
+}
+
+static int reqbufs(struct fake_m2m* f, struct v4l2_requestbuffers* req)
+{
+    int q = queue_of(req->type);
+    struct fake_queue* fq;
+    unsigned int i;
+
+    if (q < 0 || req->memory != V4L2_MEMORY_DMABUF)
+        return -EINVAL;
+    fq = &f->q[q];
+    if (fq->streaming || num_pending(fq) || fq->done.num)
+        return -EBUSY;
+
+    fq->num_bufs = req->count < FAKE_MAX_BUFS ? req->count : FAKE_MAX_BUFS;
+    for (i = 0; i < FAKE_MAX_BUFS; i++) {
+        memset(&fq->bufs[i], 0, sizeof(fq->bufs[i]));
+        fq->bufs[i].fd = fq->bufs[i].user_fd = -1;
+    }
+    req->count = fq->num_bufs;
+    req->capabilities = V4L2_BUF_CAP_SUPPORTS_DMABUF;
+    return 0;
+}
+
+static int qbuf(struct fake_m2m* f, struct v4l2_buffer* buf)
+{
+    int q = queue_of(buf->type);
+    struct fake_queue* fq;
+    struct fake_buf* b;
+    off_t end;
+
+    if (q < 0 || buf->memory != V4L2_MEMORY_DMABUF)
+        return -EINVAL;
+    fq = &f->q[q];
+    if (buf->index >= fq->num_bufs || fq->bufs[buf->index].state != BUF_DEQUEUED)
+        return -EINVAL;
+    /* no request API */
+    if (buf->flags & V4L2_BUF_FLAG_REQUEST_FD)
+        return -EBADR;
+    /* transform() maps sizeimage bytes, a smaller dmabuf would fault there */
+    end = lseek(buf->m.fd, 0, SEEK_END);
+    if (end < 0 || (uint64_t)end < fq->fmt.sizeimage)
+        return -EINVAL;
+
+    b = &fq->bufs[buf->index];
+    b->fd = fcntl(buf->m.fd, F_DUPFD_CLOEXEC, 0);
+    if (b->fd < 0)
+        return -EINVAL;
+    b->user_fd = buf->m.fd;
+    b->bytesused = buf->bytesused ? buf->bytesused : fq->fmt.sizeimage;
+    b->timestamp = buf->timestamp;
+    b->flags = 0;
+    b->state = BUF_QUEUED;
+    fifo_push(&fq->queued, buf->index);
+    pthread_cond_broadcast(&f->cond);
+    fill_buf(fq, buf->index, buf);
+    return 0;
+}
+
+static int dqbuf(struct fake_m2m* f, struct v4l2_buffer* buf)
+{
+    int q = queue_of(buf->type);
+    struct fake_queue* fq;
+    unsigned int index;
+    char c;
+
+    if (q < 0 || buf->memory != V4L2_MEMORY_DMABUF)
+        return -EINVAL;
+    fq = &f->q[q];
+
+    while (!fq->done.num) {
+        if (!fq->streaming)
+            return -EINVAL;
+        if (fcntl(f->fd, F_GETFL) & O_NONBLOCK)
+            return -EAGAIN;
+        /* vb2 would wait forever for buffers that were never queued */
+        if (!num_pending(fq))
+            return -EINVAL;
+        pthread_cond_wait(&f->cond, &f->lock);
+    }
+
+    /* the byte of the job is there, this doesn't block */
+    if (q == Q_CAPTURE && read(f->fd, &c, 1) != 1)
+        return -EIO;
+
+    index = fifo_pop(&fq->done);
+    fill_buf(fq, index, buf);
+    buf->flags &= ~V4L2_BUF_FLAG_DONE;
+    release_buf(&fq->bufs[index]);
+    return 0;
+}
+
+static int stream(struct fake_m2m* f, const uint32_t* type, int on)
+{
+    int q = queue_of(*type);
+    struct fake_queue* fq;
+    unsigned int i;
+    char c;
+
+    if (q < 0)
+        return -EINVAL;
+    fq = &f->q[q];
+    if (on) {
+        if (!fq->num_bufs)
+            return -EINVAL;
+        fq->streaming = 1;
+        pthread_cond_broadcast(&f->cond);
+        return 0;
+    }
+
+    /* a job that started runs to its end */
+    while (f->active)
+        pthread_cond_wait(&f->cond, &f->lock);
+
+    if (q == Q_CAPTURE) {
+        for (i = 0; i < fq->done.num; i++) {
+            if (read(f->fd, &c, 1) != 1)
+                return -EIO;
+        }
+    }
+    for (i = 0; i < fq->num_bufs; i++)
+        release_buf(&fq->bufs[i]);
+    memset(&fq->queued, 0, sizeof(fq->queued));
+    memset(&fq->done, 0, sizeof(fq->done));
+    fq->streaming = 0;
+    pthread_cond_broadcast(&f->cond);
+    return 0;
+}
+
+static int s_selection(struct fake_m2m* f, struct v4l2_selection* sel)
+{
+    int q = queue_of(sel->type);
+    struct fake_queue* fq;
+    struct v4l2_rect* r = &sel->r;
+
+    if (q < 0 || sel->target != (q == Q_OUTPUT ? V4L2_SEL_TGT_CROP : V4L2_SEL_TGT_COMPOSE))
+        return -EINVAL;
+    fq = &f->q[q];
+
+    /* keep the rectangle inside the frame */
+    if (r->left < 0)
+        r->left = 0;
+    if (r->top < 0)
+        r->top = 0;
+    if ((uint32_t)r->left >= fq->fmt.width)
+        r->left = fq->fmt.width - 1;
+    if ((uint32_t)r->top >= fq->fmt.height)
+        r->top = fq->fmt.height - 1;
+    if (!r->width || r->width > fq->fmt.width - r->left)
+        r->width = fq->fmt.width - r->left;
+    if (!r->height || r->height > fq->fmt.height - r->top)
+        r->height = fq->fmt.height - r->top;
+
+    fq->sel.x = r->left;
+    fq->sel.y = r->top;
+    fq->sel.w = r->width;
+    fq->sel.h = r->height;
+    return 0;
+}
+
+static int g_selection(const struct fake_m2m* f, struct v4l2_selection* sel)
+{
+    int q = queue_of(sel->type);
+    struct rga_rect r;
+
+    if (q < 0)
+        return -EINVAL;
+    if (sel->target == (q == Q_OUTPUT ? V4L2_SEL_TGT_CROP : V4L2_SEL_TGT_COMPOSE)) {
+        get_rect(&f->q[q], &r);
+    } else {
+        r.x = r.y = 0;
+        r.w = f->q[q].fmt.width;
+        r.h = f->q[q].fmt.height;
+    }
+    sel->r.left = r.x;
+    sel->r.top = r.y;
+    sel->r.width = r.w;
+    sel->r.height = r.h;
+    return 0;
+}
+
+static int s_ext_ctrls(struct fake_m2m* f, struct v4l2_ext_controls* ext)
+{
+    uint32_t i;
+    int ret;
+
+    if (ext->which == V4L2_CTRL_WHICH_REQUEST_VAL) {
+        ext->error_idx = ext->count;
+        return -EINVAL;
+    }
+
+    /* all or nothing, like the control framework */
+    for (i = 0; i < ext->count; i++) {
+        ret = check_ctrl(ext->controls[i].id, ext->controls[i].value);
+        if (ret) {
+            ext->error_idx = i;
+            return ret;
+        }
+    }
+    for (i = 0; i < ext->count; i++)
+        set_ctrl(f, ext->controls[i].id, ext->controls[i].value);
+    return 0;
+}
+
+static int queryctrl(struct v4l2_queryctrl* qc)
+{
+    size_t i;
+
+    for (i = 0; i < sizeof(fake_ctrls) / sizeof(fake_ctrls[0]); i++) {
+        if (fake_ctrls[i].id != qc->id)
+            continue;
+        qc->type = fake_ctrls[i].type;
+        snprintf((char*)qc->name, sizeof(qc->name), "%s", fake_ctrls[i].name);
+        qc->minimum = fake_ctrls[i].min;
+        qc->maximum = fake_ctrls[i].max;
+        qc->step = fake_ctrls[i].step;
+        qc->default_value = fake_ctrls[i].min > 0 ? fake_ctrls[i].min : 0;
+        qc->flags = 0;
+        return 0;
+    }
+    return -EINVAL;
+}
+
+static int fake_ioctl(struct fake_m2m* f, unsigned long req, void* arg)
+{
+    switch (req) {
+    case VIDIOC_QUERYCAP: {
+        struct v4l2_capability* cap = (struct v4l2_capability*)arg;
+
+        memset(cap, 0, sizeof(*cap));
+        snprintf((char*)cap->driver, sizeof(cap->driver), "fake-m2m");
+        snprintf((char*)cap->card, sizeof(cap->card), "CPU m2m emulation");
+        snprintf((char*)cap->bus_info, sizeof(cap->bus_info), "platform:fake-m2m");
+        cap->version = 1;
+        cap->device_caps = V4L2_CAP_VIDEO_M2M | V4L2_CAP_STREAMING;
+        cap->capabilities = cap->device_caps | V4L2_CAP_DEVICE_CAPS;
+        return 0;
+    }
+    case VIDIOC_ENUM_FMT: {
+        struct v4l2_fmtdesc* desc = (struct v4l2_fmtdesc*)arg;
+        const struct fmt_info* fi = get_fmt_info_by_index(desc->index);
+
+        if (queue_of(desc->type) < 0 || !fi)
+            return -EINVAL;
+        desc->flags = 0;
+        desc->pixelformat = fi->v4l2;
+        snprintf((char*)desc->description, sizeof(desc->description), "%s", fi->name);
+        return 0;
+    }
+    case VIDIOC_ENUM_FRAMESIZES: {
+        struct v4l2_frmsizeenum* fse = (struct v4l2_frmsizeenum*)arg;
+
+        if (fse->index || !get_fmt_info(fse->pixel_format))
+            return -EINVAL;
+        fse->type = V4L2_FRMSIZE_TYPE_CONTINUOUS;
+        fse->stepwise.min_width = fse->stepwise.min_height = 1;
+        fse->stepwise.max_width = fse->stepwise.max_height = FAKE_MAX_SIZE;
+        fse->stepwise.step_width = fse->stepwise.step_height = 1;
+        return 0;
+    }
+    case VIDIOC_TRY_FMT:
+    case VIDIOC_S_FMT:
+    case VIDIOC_G_FMT: {
+        struct v4l2_format* fmt = (struct v4l2_format*)arg;
+        int q = queue_of(fmt->type);
+
+        if (q < 0)
+            return -EINVAL;
+        if (req == VIDIOC_G_FMT) {
+            fmt->fmt.pix = f->q[q].fmt;
+            return 0;
+        }
+        try_fmt(&fmt->fmt.pix);
+        if (req == VIDIOC_TRY_FMT)
+            return 0;
+        if (f->q[q].num_bufs)
+            return -EBUSY;
+        f->q[q].fmt = fmt->fmt.pix;
+        memset(&f->q[q].sel, 0, sizeof(f->q[q].sel));
+        return 0;
+    }
+    case VIDIOC_QUERYCTRL:
+        return queryctrl((struct v4l2_queryctrl*)arg);
+    case VIDIOC_S_CTRL: {
+        struct v4l2_control* ctrl = (struct v4l2_control*)arg;
+        int ret = check_ctrl(ctrl->id, ctrl->value);
+
+        if (!ret)
+            set_ctrl(f, ctrl->id, ctrl->value);
+        return ret;
+    }
+    case VIDIOC_G_CTRL: {
+        struct v4l2_control* ctrl = (struct v4l2_control*)arg;
+
+        return get_ctrl(f, ctrl->id, &ctrl->value);
+    }
+    case VIDIOC_S_EXT_CTRLS:
+        return s_ext_ctrls(f, (struct v4l2_ext_controls*)arg);
+    case VIDIOC_S_SELECTION:
+        return s_selection(f, (struct v4l2_selection*)arg);
+    case VIDIOC_G_SELECTION:
+        return g_selection(f, (struct v4l2_selection*)arg);
+    case VIDIOC_REQBUFS:
+        return reqbufs(f, (struct v4l2_requestbuffers*)arg);
+    case VIDIOC_QUERYBUF: {
+        struct v4l2_buffer* buf = (struct v4l2_buffer*)arg;
+        int q = queue_of(buf->type);
+
+        if (q < 0 || buf->index >= f->q[q].num_bufs)
+            return -EINVAL;
+        fill_buf(&f->q[q], buf->index, buf);
+        return 0;
+    }
+    case VIDIOC_QBUF:
+        return qbuf(f, (struct v4l2_buffer*)arg);
+    case VIDIOC_DQBUF:
+        return dqbuf(f, (struct v4l2_buffer*)arg);
+    case VIDIOC_STREAMON:
+    case VIDIOC_STREAMOFF:
+        return stream(f, (const uint32_t*)arg, req == VIDIOC_STREAMON);
+    }
+    return -ENOTTY;
+}
+
+static struct fake_m2m* get_fake(int fd)
+{
+    struct fake_m2m* f = NULL;
+    int i;
+
+    /* real nodes only pay for this */
+    if (!__atomic_load_n(&num_fakes, __ATOMIC_ACQUIRE))
+        return NULL;
+
+    pthread_mutex_lock(&fakes_lock);
+    for (i = 0; i < FAKE_MAX_DEVS; i++) {
+        if (fakes[i] && fakes[i]->fd == fd)
+            f = fakes[i];
+    }
+    pthread_mutex_unlock(&fakes_lock);
+    return f;
+}
+
+static int parse_options(struct fake_m2m* f, const char* path)
+{
+    const char* p = strchr(path, ':');
+    unsigned long value;
+    char key[8];
+
+    for (; p; p = strchr(p, ':')) {
+        p++;
+        if (sscanf(p, "%7[^=:]=%lu", key, &value) != 2)
+            return -EINVAL;
+        if (!strcmp(key, "job"))
+            f->job_us = value;
+        else if (!strcmp(key, "mp"))
+            f->mp_us = value;
+        else if (!strcmp(key, "cpu"))
+            f->cpu = !!value;
+        else
+            return -EINVAL;
+    }
+    return 0;
+}
+
+int is_fake_m2m_path(const char* path)
+{
+    return !strcmp(path, "fake") || !strncmp(path, "fake:", 5);
+}
+
+int open_fake_m2m(const char* path)
+{
+    struct fake_m2m* f;
+    int fds[2], i, q, ret;
+
+    f = (struct fake_m2m*)calloc(1, sizeof(*f));
+    if (!f)
+        return -ENOMEM;
+
+    f->cpu = 1;
+    if (parse_options(f, path)) {
+        fprintf(stderr, "%s: options are job=<us>:mp=<us per megapixel>:cpu=<0|1>\n", path);
+        free(f);
+        return -EINVAL;
+    }
+
+    for (q = 0; q < NUM_QUEUES; q++) {
+        f->q[q].fmt.width = 1280;
+        f->q[q].fmt.height = 720;
+        try_fmt(&f->q[q].fmt);
+        for (i = 0; i < FAKE_MAX_BUFS; i++)
+            f->q[q].bufs[i].fd = f->q[q].bufs[i].user_fd = -1;
+    }
+
+    if (pipe2(fds, O_CLOEXEC)) {
+        ret = -errno;
+        free(f);
+        return ret;
+    }
+    f->fd = fds[0];
+    f->wake_fd = fds[1];
+    pthread_mutex_init(&f->lock, NULL);
+    pthread_cond_init(&f->cond, NULL);
+
+    ret = -pthread_create(&f->worker, NULL, fake_worker, f);
+    if (ret)
+        goto err;
+
+    pthread_mutex_lock(&fakes_lock);
+    for (i = 0; i < FAKE_MAX_DEVS && fakes[i]; i++)
+        ;
+    if (i < FAKE_MAX_DEVS) {
+        fakes[i] = f;
+        __atomic_add_fetch(&num_fakes, 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&fakes_lock);
+    if (i < FAKE_MAX_DEVS)
+        return f->fd;
+
+    pthread_mutex_lock(&f->lock);
+    f->quit = 1;
+    pthread_cond_broadcast(&f->cond);
+    pthread_mutex_unlock(&f->lock);
+    pthread_join(f->worker, NULL);
+    ret = -EMFILE;
+err:
+    pthread_cond_destroy(&f->cond);
+    pthread_mutex_destroy(&f->lock);
+    close(f->fd);
+    close(f->wake_fd);
+    free(f);
+    return ret;
+}
+
+int m2m_ioctl(int fd, unsigned long req, void* arg)
+{
+    struct fake_m2m* f = get_fake(fd);
+    int ret;
+
+    if (!f)
+        return ioctl(fd, req, arg);
+
+    pthread_mutex_lock(&f->lock);
+    ret = fake_ioctl(f, req, arg);
+    pthread_mutex_unlock(&f->lock);
+    if (ret) {
+        errno = -ret;
+        return -1;
+    }
+    return 0;
+}
+
+int m2m_close(int fd)
+{
+    struct fake_m2m* f = NULL;
+    int i, q;
+
+    if (__atomic_load_n(&num_fakes, __ATOMIC_ACQUIRE)) {
+        pthread_mutex_lock(&fakes_lock);
+        for (i = 0; i < FAKE_MAX_DEVS; i++) {
+            if (fakes[i] && fakes[i]->fd == fd) {
+                f = fakes[i];
+                fakes[i] = NULL;
+                __atomic_sub_fetch(&num_fakes, 1, __ATOMIC_RELEASE);
+            }
+        }
+        pthread_mutex_unlock(&fakes_lock);
+    }
+    if (!f)
+        return close(fd);
+
+    pthread_mutex_lock(&f->lock);
+    f->quit = 1;
+    pthread_cond_broadcast(&f->cond);
+    pthread_mutex_unlock(&f->lock);
+    pthread_join(f->worker, NULL);
+
+    for (q = 0; q < NUM_QUEUES; q++) {
+        for (i = 0; i < FAKE_MAX_BUFS; i++)
+            release_buf(&f->q[q].bufs[i]);
+    }
+    pthread_cond_destroy(&f->cond);
+    pthread_mutex_destroy(&f->lock);
+    close(f->fd);
+    close(f->wake_fd);
+    free(f);
+    return 0;
+}
@@ -0,0 +1,35 @@
+/*
+ * Copyright (C) Fuzhou Rockchip Electronics Co.Ltd
+ * Author: Jacob Chen <jacob-chen@iotwrt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#ifndef __FAKEM2M_H_INCLUDED__
+#define __FAKEM2M_H_INCLUDED__
+
+/*
+ * An in-process mem2mem node for machines without one. Opening the path
+ * "fake" returns a file descriptor that m2m_ioctl() serves like a V4L2
+ * node: formats, controls, selections, DMABUF queues and streaming, no
+ * request API. One job runs at a time, on a thread of its own, through
+ * cpu_rga_transform(); the descriptor polls readable while a CAPTURE
+ * buffer is done and follows O_NONBLOCK for DQBUF.
+ *
+ * Options follow the name, separated by colons: "fake:job=300:mp=2500"
+ * makes every job take at least 300us plus 2500us per megapixel of the
+ * larger of the source crop and destination compose rectangle, "cpu=0"
+ * skips the pixels and only keeps the timing.
+ */
+int is_fake_m2m_path(const char *path);
+/* Returns the descriptor, or a negative error. */
+int open_fake_m2m(const char *path);
+
+/* ioctl() and close() for V4L2 nodes, fake ones included. */
+int m2m_ioctl(int fd, unsigned long req, void *arg);
+int m2m_close(int fd);
+
+#endif /* __FAKEM2M_H_INCLUDED__ */
@@ -0,0 +1,209 @@
+/*
+ * Copyright (C) Fuzhou Rockchip Electronics Co.Ltd
+ * Author: Jacob Chen <jacob-chen@iotwrt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <drm_fourcc.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+#include "fbcache.h"
+
+struct fb_entry {
+    /* st_dev/st_ino name a dmabuf for as long as the system runs */
+    dev_t dev;
+    ino_t ino;
+    struct fb_desc desc;
+
+    uint32_t fb_id;
+    uint32_t handle;
+    int imported;
+    uint64_t last_use;
+};
+
+struct fb_cache {
+    int fd;
+    int max_fbs;
+    int num_fbs;
+    uint64_t clock;
+    struct fb_entry* fbs;
+};
+
+struct fb_cache* create_fb_cache(int drm_fd, int max_fbs)
+{
+    struct fb_cache* cache;
+
+    cache = (struct fb_cache*)calloc(1, sizeof(*cache));
+    if (!cache)
+        return NULL;
+
+    cache->fbs = (struct fb_entry*)calloc(max_fbs, sizeof(*cache->fbs));
+    if (!cache->fbs) {
+        free(cache);
+        return NULL;
+    }
+    cache->fd = drm_fd;
+    cache->max_fbs = max_fbs;
+    return cache;
+}
+
+static int same_desc(const struct fb_desc* a, const struct fb_desc* b)
+{
+    int i;
+
+    if (a->width != b->width || a->height != b->height || a->format != b->format
+        || a->modifier != b->modifier || a->num_planes != b->num_planes
+        || a->flags != b->flags)
+        return 0;
+    for (i = 0; i < a->num_planes; i++) {
+        if (a->pitches[i] != b->pitches[i] || a->offsets[i] != b->offsets[i])
+            return 0;
+    }
+    return 1;
+}
+
+/* the same buffer under another layout imports to the same handle */
+static void put_handle(struct fb_cache* cache, const struct fb_entry* e)
+{
+    int i;
+
+    if (!e->imported)
+        return;
+    for (i = 0; i < cache->num_fbs; i++) {
+        if (&cache->fbs[i] != e && cache->fbs[i].handle == e->handle)
+            return;
+    }
+    drmCloseBufferHandle(cache->fd, e->handle);
+}
+
+static void remove_fb(struct fb_cache* cache, int i)
+{
+    struct fb_entry* e = &cache->fbs[i];
+    int ret;
+
+    ret = drmModeRmFB(cache->fd, e->fb_id);
+    if (ret)
+        printf("Failed to rmfb ret=%d!\n", ret);
+    put_handle(cache, e);
+
+    *e = cache->fbs[--cache->num_fbs];
+}
+
+static int add_fb(struct fb_cache* cache, struct fb_entry* e)
+{
+    const struct fb_desc* d = &e->desc;
+    uint32_t handles[4];
+    uint64_t modifiers[4];
+    int i;
+
+    for (i = 0; i < d->num_planes; i++) {
+        handles[i] = e->handle;
+        modifiers[i] = d->modifier;
+    }
+    for (; i < 4; i++) {
+        handles[i] = 0;
+        modifiers[i] = 0;
+    }
+
+    if (d->modifier != DRM_FORMAT_MOD_INVALID)
+        return drmModeAddFB2WithModifiers(cache->fd, d->width, d->height, d->format,
+            handles, d->pitches, d->offsets, modifiers, &e->fb_id,
+            d->flags | DRM_MODE_FB_MODIFIERS);
+    return drmModeAddFB2(cache->fd, d->width, d->height, d->format,
+        handles, d->pitches, d->offsets, &e->fb_id, d->flags);
+}
+
+int fb_cache_get(struct fb_cache* cache, int dmabuf_fd, uint32_t handle,
+    const struct fb_desc* desc, uint32_t* fb_id)
+{
+    struct fb_entry* e;
+    struct stat st;
+    int i, oldest, ret;
+
+    if (fstat(dmabuf_fd, &st))
+        return -errno;
+
+    for (i = 0; i < cache->num_fbs; i++) {
+        e = &cache->fbs[i];
+        if (e->ino == st.st_ino && e->dev == st.st_dev && same_desc(&e->desc, desc)) {
+            e->last_use = ++cache->clock;
+            *fb_id = e->fb_id;
+            return 0;
+        }
+    }
+
+    if (cache->num_fbs == cache->max_fbs) {
+        oldest = 0;
+        for (i = 1; i < cache->num_fbs; i++) {
+            if (cache->fbs[i].last_use < cache->fbs[oldest].last_use)
+                oldest = i;
+        }
+        remove_fb(cache, oldest);
+    }
+
+    e = &cache->fbs[cache->num_fbs];
+    memset(e, 0, sizeof(*e));
+    e->dev = st.st_dev;
+    e->ino = st.st_ino;
+    e->desc = *desc;
+    e->handle = handle;
+
+    if (!e->handle) {
+        ret = drmPrimeFDToHandle(cache->fd, dmabuf_fd, &e->handle);
+        if (ret) {
+            printf("failed to import dmabuf ret=%d\n", ret);
+            return ret;
+        }
+        e->imported = 1;
+    }
+
+    ret = add_fb(cache, e);
+    if (ret) {
+        printf("failed to create fb ret=%d\n", ret);
+        put_handle(cache, e);
+        return ret;
+    }
+
+    e->last_use = ++cache->clock;
+    cache->num_fbs++;
+    *fb_id = e->fb_id;
+    return 0;
+}
+
+void fb_cache_release(struct fb_cache* cache, int dmabuf_fd)
+{
+    struct stat st;
+    int i;
+
+    if (fstat(dmabuf_fd, &st))
+        return;
+
+    for (i = 0; i < cache->num_fbs;) {
+        if (cache->fbs[i].ino == st.st_ino && cache->fbs[i].dev == st.st_dev)
+            remove_fb(cache, i);
+        else
+            i++;
+    }
+}
+
+void destroy_fb_cache(struct fb_cache* cache)
+{
+    if (!cache)
+        return;
+
+    while (cache->num_fbs)
+        remove_fb(cache, cache->num_fbs - 1);
+    free(cache->fbs);
+    free(cache);
+}
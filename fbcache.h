@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) Fuzhou Rockchip Electronics Co.Ltd
+ * Author: Jacob Chen <jacob-chen@iotwrt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#ifndef __FBCACHE_H_INCLUDED__
+#define __FBCACHE_H_INCLUDED__
+
+#include <stdint.h>
+
+struct fb_cache;
+
+struct fb_desc {
+	uint32_t width;
+	uint32_t height;
+	uint32_t format;
+	uint64_t modifier;	/* DRM_FORMAT_MOD_INVALID for none */
+	int num_planes;
+	uint32_t pitches[4];
+	uint32_t offsets[4];
+	uint32_t flags;
+};
+
+/*
+ * Framebuffers of dmabufs, keyed by the dmabuf and its layout, so showing
+ * a buffer again costs a lookup instead of an AddFB. The least recently
+ * used fb is removed once 'max_fbs' are held; the one on screen is always
+ * the freshest.
+ */
+struct fb_cache* create_fb_cache(int drm_fd, int max_fbs);
+
+/*
+ * 'handle' is the GEM handle of the buffer on drm_fd when the caller owns
+ * one, 0 makes the cache import 'dmabuf_fd' and close the handle again
+ * with the fb.
+ */
+int fb_cache_get(struct fb_cache *cache, int dmabuf_fd, uint32_t handle,
+		 const struct fb_desc *desc, uint32_t *fb_id);
+
+/* RmFB every fb of a buffer that is going away. */
+void fb_cache_release(struct fb_cache *cache, int dmabuf_fd);
+void destroy_fb_cache(struct fb_cache *cache);
+
+#endif /* __FBCACHE_H_INCLUDED__ */
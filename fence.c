@@ -0,0 +1,161 @@
+/*
+ * Copyright (C) Fuzhou Rockchip Electronics Co.Ltd
+ * Author: Jacob Chen <jacob-chen@iotwrt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <linux/dma-buf.h>
+
+#include "fence.h"
+
+#ifndef DMA_BUF_IOCTL_EXPORT_SYNC_FILE
+struct dma_buf_export_sync_file {
+    __u32 flags;
+    __s32 fd;
+};
+#define DMA_BUF_IOCTL_EXPORT_SYNC_FILE _IOWR(DMA_BUF_BASE, 2, struct dma_buf_export_sync_file)
+#endif
+
+/* drivers/dma-buf/sw_sync.c, the uapi is not exported */
+struct sw_sync_create_fence_data {
+    __u32 value;
+    char name[32];
+    __s32 fence;
+};
+#define SW_SYNC_IOC_CREATE_FENCE _IOWR('W', 0, struct sw_sync_create_fence_data)
+#define SW_SYNC_IOC_INC _IOW('W', 1, __u32)
+
+#define SW_SYNC_PATH "/sys/kernel/debug/sync/sw_sync"
+
+struct sw_timeline {
+    int fd;
+    uint32_t value;
+};
+
+static int export_supported = 1;
+
+int wait_fence(int fence_fd, int timeout_ms)
+{
+    struct pollfd pfd;
+    int ret;
+
+    pfd.fd = fence_fd;
+    pfd.events = POLLIN;
+    do {
+        ret = poll(&pfd, 1, timeout_ms);
+    } while (ret < 0 && errno == EINTR);
+
+    if (ret < 0)
+        return -errno;
+    if (!ret)
+        return -ETIME;
+    return pfd.revents & (POLLERR | POLLNVAL) ? -EINVAL : 0;
+}
+
+int export_dmabuf_fence(int dmabuf_fd, int write)
+{
+    struct dma_buf_export_sync_file arg;
+
+    if (!export_supported)
+        return -ENOTTY;
+
+    memset(&arg, 0, sizeof(arg));
+    arg.flags = write ? DMA_BUF_SYNC_WRITE : DMA_BUF_SYNC_READ;
+    if (ioctl(dmabuf_fd, DMA_BUF_IOCTL_EXPORT_SYNC_FILE, &arg)) {
+        /* older than 6.0, don't ask again */
+        if (errno == ENOTTY)
+            export_supported = 0;
+        return -errno;
+    }
+    return arg.fd;
+}
+
+int wait_dmabuf(int dmabuf_fd, int write, int timeout_ms)
+{
+    struct pollfd pfd;
+    int fence, ret;
+
+    fence = export_dmabuf_fence(dmabuf_fd, write);
+    if (fence >= 0) {
+        ret = wait_fence(fence, timeout_ms);
+        close(fence);
+        return ret;
+    }
+
+    /* a dmabuf polls like its fences */
+    pfd.fd = dmabuf_fd;
+    pfd.events = write ? POLLOUT : POLLIN;
+    ret = poll(&pfd, 1, timeout_ms);
+    if (ret < 0)
+        return -errno;
+    return ret ? 0 : -ETIME;
+}
+
+struct sw_timeline* create_sw_timeline(void)
+{
+    struct sw_timeline* tl;
+
+    tl = (struct sw_timeline*)calloc(1, sizeof(*tl));
+    if (!tl)
+        return NULL;
+
+    tl->fd = open(SW_SYNC_PATH, O_RDWR | O_CLOEXEC);
+    if (tl->fd < 0) {
+        printf("failed to open %s: %s\n", SW_SYNC_PATH, strerror(errno));
+        free(tl);
+        return NULL;
+    }
+    return tl;
+}
+
+int sw_timeline_fence(struct sw_timeline* tl, uint32_t value)
+{
+    struct sw_sync_create_fence_data data;
+
+    memset(&data, 0, sizeof(data));
+    data.value = value;
+    snprintf(data.name, sizeof(data.name), "rga-%u", value);
+    if (ioctl(tl->fd, SW_SYNC_IOC_CREATE_FENCE, &data)) {
+        fprintf(stderr, "%s:%d: ", __func__, __LINE__);
+        perror("ioctl");
+        return -errno;
+    }
+    return data.fence;
+}
+
+int sw_timeline_signal(struct sw_timeline* tl, uint32_t value)
+{
+    __u32 inc = value - tl->value;
+
+    if ((int32_t)inc <= 0)
+        return 0;
+    if (ioctl(tl->fd, SW_SYNC_IOC_INC, &inc)) {
+        fprintf(stderr, "%s:%d: ", __func__, __LINE__);
+        perror("ioctl");
+        return -errno;
+    }
+    tl->value = value;
+    return 0;
+}
+
+void destroy_sw_timeline(struct sw_timeline* tl)
+{
+    if (!tl)
+        return;
+    /* closing signals whatever is still pending */
+    close(tl->fd);
+    free(tl);
+}
@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) Fuzhou Rockchip Electronics Co.Ltd
+ * Author: Jacob Chen <jacob-chen@iotwrt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#ifndef __FENCE_H_INCLUDED__
+#define __FENCE_H_INCLUDED__
+
+#include <stdint.h>
+
+struct sw_timeline;
+
+/* Wait for a sync_file, -1 waits forever. Returns -ETIME on timeout. */
+int wait_fence(int fence_fd, int timeout_ms);
+
+/*
+ * The implicit fences of a dmabuf as a sync_file: the writers when 'write'
+ * is 0, everyone when it is set. Returns -ENOTTY on kernels without
+ * DMA_BUF_IOCTL_EXPORT_SYNC_FILE.
+ */
+int export_dmabuf_fence(int dmabuf_fd, int write);
+
+/* Wait before the CPU reads (write 0) or writes a dmabuf. */
+int wait_dmabuf(int dmabuf_fd, int write, int timeout_ms);
+
+/*
+ * sw_sync timelines stand in for the fences V4L2 doesn't export: a fence
+ * for 'value' signals once the timeline has been advanced to it. They need
+ * debugfs, create_sw_timeline() returns NULL without it.
+ */
+struct sw_timeline* create_sw_timeline(void);
+int sw_timeline_fence(struct sw_timeline *tl, uint32_t value);
+int sw_timeline_signal(struct sw_timeline *tl, uint32_t value);
+void destroy_sw_timeline(struct sw_timeline *tl);
+
+#endif /* __FENCE_H_INCLUDED__ */
@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) Fuzhou Rockchip Electronics Co.Ltd
+ * Author: Jacob Chen <jacob-chen@iotwrt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <drm_fourcc.h>
+#include <linux/videodev2.h>
+
+#include "format.h"
+
+static const struct fmt_info formats[NUM_FORMATS] = {
+    /* index, v4l2, drm, name, planes, cpp, xsub, ysub, yuv, uv_swap */
+    { 0, V4L2_PIX_FMT_NV12, DRM_FORMAT_NV12, "NV12", 2, 1, 2, 2, 1, 0 },
+    { 1, V4L2_PIX_FMT_ARGB32, DRM_FORMAT_ARGB8888, "ARGB32", 1, 4, 1, 1, 0, 0 },
+    { 2, V4L2_PIX_FMT_RGB24, DRM_FORMAT_RGB888, "RGB24", 1, 3, 1, 1, 0, 0 },
+    { 3, V4L2_PIX_FMT_RGB565, DRM_FORMAT_RGB565, "RGB565", 1, 2, 1, 1, 0, 0 },
+    { 4, V4L2_PIX_FMT_YUV420, DRM_FORMAT_YUV420, "YUV420", 3, 1, 2, 2, 1, 0 },
+    { 5, V4L2_PIX_FMT_XRGB32, DRM_FORMAT_XRGB8888, "XRGB32", 1, 4, 1, 1, 0, 0 },
+    { 6, V4L2_PIX_FMT_ABGR32, DRM_FORMAT_BGRA8888, "ABGR32", 1, 4, 1, 1, 0, 0 },
+    { 7, V4L2_PIX_FMT_XBGR32, DRM_FORMAT_BGRX8888, "XBGR32", 1, 4, 1, 1, 0, 0 },
+    { 8, V4L2_PIX_FMT_ARGB555, DRM_FORMAT_ARGB1555, "ARGB555", 1, 2, 1, 1, 0, 0 },
+    { 9, V4L2_PIX_FMT_ARGB444, DRM_FORMAT_ARGB4444, "ARGB444", 1, 2, 1, 1, 0, 0 },
+    { 10, V4L2_PIX_FMT_NV61, DRM_FORMAT_NV61, "NV61", 2, 1, 2, 1, 1, 1 },
+    { 11, V4L2_PIX_FMT_NV16, DRM_FORMAT_NV16, "NV16", 2, 1, 2, 1, 1, 0 },
+    { 12, V4L2_PIX_FMT_YUV422P, DRM_FORMAT_YUV422, "YUV422P", 3, 1, 2, 1, 1, 0 },
+};
+
+const struct fmt_info* get_fmt_info(uint32_t v4l2_format)
+{
+    int i;
+
+    for (i = 0; i < NUM_FORMATS; i++) {
+        if (formats[i].v4l2 == v4l2_format)
+            return &formats[i];
+    }
+    return NULL;
+}
+
+const struct fmt_info* get_fmt_info_by_index(int index)
+{
+    if (index < 0 || index >= NUM_FORMATS)
+        return NULL;
+    return &formats[index];
+}
+
+void fmt_plane_layout(const struct fmt_info* fi, uint32_t width, uint32_t height,
+    size_t offsets[3], uint32_t pitches[3])
+{
+    size_t luma = (size_t)width * height;
+    uint32_t cw = (width + fi->xsub - 1) / fi->xsub;
+    uint32_t ch = (height + fi->ysub - 1) / fi->ysub;
+
+    offsets[0] = offsets[1] = offsets[2] = 0;
+    pitches[0] = width * fi->cpp;
+    pitches[1] = pitches[2] = 0;
+
+    if (fi->num_planes == 2) {
+        offsets[1] = luma;
+        pitches[1] = cw * 2;
+    } else if (fi->num_planes == 3) {
+        offsets[1] = luma;
+        offsets[2] = luma + (size_t)cw * ch;
+        pitches[1] = pitches[2] = cw;
+    }
+}
+
+size_t fmt_frame_size(const struct fmt_info* fi, uint32_t width, uint32_t height)
+{
+    uint32_t cw = (width + fi->xsub - 1) / fi->xsub;
+    uint32_t ch = (height + fi->ysub - 1) / fi->ysub;
+
+    if (!fi->is_yuv)
+        return (size_t)width * height * fi->cpp;
+    return (size_t)width * height + (size_t)cw * ch * 2;
+}
+
+uint32_t fmt_bpp(const struct fmt_info* fi)
+{
+    if (!fi->is_yuv)
+        return fi->cpp * 8;
+    return 8 + 16 / (fi->xsub * fi->ysub);
+}
+
+int parse_ycbcr_enc(const char* arg)
+{
+    if (!strcmp(arg, "601"))
+        return V4L2_YCBCR_ENC_601;
+    if (!strcmp(arg, "709"))
+        return V4L2_YCBCR_ENC_709;
+    if (!strcmp(arg, "2020"))
+        return V4L2_YCBCR_ENC_BT2020;
+    return -1;
+}
+
+int parse_quantization(const char* arg)
+{
+    if (!strcmp(arg, "limited"))
+        return V4L2_QUANTIZATION_LIM_RANGE;
+    if (!strcmp(arg, "full"))
+        return V4L2_QUANTIZATION_FULL_RANGE;
+    return -1;
+}
+
+uint32_t fmt_colorspace(const struct fmt_info* fi, const struct colorimetry* c)
+{
+    if (!fi->is_yuv)
+        return V4L2_COLORSPACE_SRGB;
+
+    switch (c->ycbcr_enc) {
+    case V4L2_YCBCR_ENC_709:
+        return V4L2_COLORSPACE_REC709;
+    case V4L2_YCBCR_ENC_BT2020:
+        return V4L2_COLORSPACE_BT2020;
+    default:
+        return V4L2_COLORSPACE_SMPTE170M;
+    }
+}
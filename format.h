@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) Fuzhou Rockchip Electronics Co.Ltd
+ * Author: Jacob Chen <jacob-chen@iotwrt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#ifndef __FORMAT_H_INCLUDED__
+#define __FORMAT_H_INCLUDED__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Memory layout of every format the tool can hand to the RGA.
+ *
+ * Packed RGB formats use the byte order of the DRM fourcc the buffer is
+ * displayed with, YUV formats use the tightly packed V4L2 single-planar
+ * layout (bytesperline == width for the luma plane).
+ */
+struct fmt_info {
+	int index;		/* value of --src-fmt / --dst-fmt */
+	uint32_t v4l2;
+	uint32_t drm;
+	const char *name;
+
+	uint8_t num_planes;	/* 1 = packed, 2 = semi-planar, 3 = planar */
+	uint8_t cpp;		/* bytes per pixel in plane 0 */
+	uint8_t xsub;		/* horizontal chroma subsampling */
+	uint8_t ysub;		/* vertical chroma subsampling */
+	uint8_t is_yuv;
+	uint8_t uv_swap;	/* V before U (NV61) */
+};
+
+#define NUM_FORMATS 13
+
+/*
+ * YCbCr encoding and quantization of a YUV frame as V4L2_YCBCR_ENC_* and
+ * V4L2_QUANTIZATION_* values. Zero (DEFAULT) means BT.601 limited range,
+ * RGB formats are always full range.
+ */
+struct colorimetry {
+	uint32_t ycbcr_enc;
+	uint32_t quantization;
+};
+
+const struct fmt_info* get_fmt_info(uint32_t v4l2_format);
+const struct fmt_info* get_fmt_info_by_index(int index);
+
+void fmt_plane_layout(const struct fmt_info* fi, uint32_t width, uint32_t height,
+    size_t offsets[3], uint32_t pitches[3]);
+size_t fmt_frame_size(const struct fmt_info* fi, uint32_t width, uint32_t height);
+uint32_t fmt_bpp(const struct fmt_info* fi);
+
+/* "601", "709", "2020" and "limited", "full"; -1 for anything else. */
+int parse_ycbcr_enc(const char* arg);
+int parse_quantization(const char* arg);
+/* The V4L2_COLORSPACE_* to set with S_FMT for a frame. */
+uint32_t fmt_colorspace(const struct fmt_info* fi, const struct colorimetry* c);
+
+#endif /* __FORMAT_H_INCLUDED__ */
@@ -0,0 +1,385 @@
+/*
+ * Copyright (C) Fuzhou Rockchip Electronics Co.Ltd
+ * Author: Jacob Chen <jacob-chen@iotwrt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "arena.h"
+#include "frameio.h"
+#include "hash.h"
+#include "wcmem.h"
+
+#define READER_WINDOW (64 << 20)
+#define READAHEAD_FRAMES 4
+
+#define WRITER_BUF_SIZE (8 << 20)
+#define DIRECT_ALIGN 4096
+
+struct frame_reader {
+    int fd;
+    size_t frame_size;
+    off_t file_size;
+    uint32_t count;
+    size_t window;
+
+    pthread_mutex_t lock;
+    uint8_t* map;
+    off_t map_off;
+    size_t map_len;
+};
+
+struct frame_writer {
+    int fd;
+    int direct;
+    size_t frame_size;
+    size_t buf_size;
+    int frames;
+    off_t bytes;
+
+    /* filled by the caller */
+    uint8_t* buf[2];
+    int cur;
+    size_t fill;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int busy[2];
+    size_t len[2];
+    int queue[2];
+    int queued;
+    int quit;
+    int error;
+    off_t offset;
+};
+
+static size_t round_up(size_t v, size_t align)
+{
+    return (v + align - 1) / align * align;
+}
+
+struct frame_reader* open_frame_reader(const char* path, size_t frame_size)
+{
+    struct frame_reader* r;
+    size_t page = sysconf(_SC_PAGESIZE);
+    struct stat st;
+
+    r = (struct frame_reader*)calloc(1, sizeof(*r));
+    if (!r)
+        return NULL;
+
+    r->fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (r->fd < 0) {
+        printf("failed to open %s: %s\n", path, strerror(errno));
+        free(r);
+        return NULL;
+    }
+
+    if (fstat(r->fd, &st) || !frame_size || st.st_size < (off_t)frame_size) {
+        printf("%s holds no complete %zu byte frame\n", path, frame_size);
+        close(r->fd);
+        free(r);
+        return NULL;
+    }
+
+    r->frame_size = frame_size;
+    r->file_size = st.st_size;
+    r->count = st.st_size / frame_size;
+    r->window = round_up(frame_size * 2 + page, page);
+    if (r->window < READER_WINDOW)
+        r->window = READER_WINDOW;
+    pthread_mutex_init(&r->lock, NULL);
+
+    posix_fadvise(r->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    printf("%s: %u frames\n", path, r->count);
+    return r;
+}
+
+uint32_t frame_reader_count(struct frame_reader* r)
+{
+    return r->count;
+}
+
+static int map_window(struct frame_reader* r, off_t off)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    off_t start = off / page * page;
+    void* map;
+
+    if (r->map) {
+        munmap(r->map, r->map_len);
+        /* the clip is streamed once, keep the page cache small */
+        if (start > r->map_off)
+            posix_fadvise(r->fd, r->map_off, start - r->map_off, POSIX_FADV_DONTNEED);
+        r->map = NULL;
+    }
+
+    r->map_len = r->window;
+    if (start + (off_t)r->map_len > r->file_size)
+        r->map_len = r->file_size - start;
+
+    map = mmap(NULL, r->map_len, PROT_READ, MAP_SHARED, r->fd, start);
+    if (map == MAP_FAILED) {
+        printf("failed to map input ret=%d\n", -errno);
+        return -errno;
+    }
+    madvise(map, r->map_len, MADV_SEQUENTIAL);
+
+    r->map = (uint8_t*)map;
+    r->map_off = start;
+    return 0;
+}
+
+/* Called locked: make sure the frame at 'off' is in the window. */
+static int map_frame(struct frame_reader* r, off_t off)
+{
+    if (r->map && off >= r->map_off
+        && off + (off_t)r->frame_size <= r->map_off + (off_t)r->map_len)
+        return 0;
+    return map_window(r, off);
+}
+
+int read_frame(struct frame_reader* r, uint32_t index, void* dst)
+{
+    off_t off = (off_t)(index % r->count) * r->frame_size;
+    int ret;
+
+    pthread_mutex_lock(&r->lock);
+
+    ret = map_frame(r, off);
+    if (!ret) {
+        wc_copy(dst, r->map + (off - r->map_off), r->frame_size);
+        readahead(r->fd, off + r->frame_size, r->frame_size * READAHEAD_FRAMES);
+    }
+
+    pthread_mutex_unlock(&r->lock);
+    return ret;
+}
+
+int hash_frame(struct frame_reader* r, uint32_t index, uint64_t* hash)
+{
+    off_t off = (off_t)(index % r->count) * r->frame_size;
+    int ret;
+
+    pthread_mutex_lock(&r->lock);
+
+    ret = map_frame(r, off);
+    if (!ret)
+        *hash = xxh32_64(r->map + (off - r->map_off), r->frame_size);
+
+    pthread_mutex_unlock(&r->lock);
+    return ret;
+}
+
+void close_frame_reader(struct frame_reader* r)
+{
+    if (!r)
+        return;
+    if (r->map)
+        munmap(r->map, r->map_len);
+    pthread_mutex_destroy(&r->lock);
+    close(r->fd);
+    free(r);
+}
+
+static int write_all(struct frame_writer* w, const uint8_t* data, size_t len, off_t off)
+{
+    ssize_t ret;
+
+    while (len) {
+        ret = pwrite(w->fd, data, len, off);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret < 0 && errno == EINVAL && w->direct) {
+            /* the filesystem refused O_DIRECT after all */
+            fcntl(w->fd, F_SETFL, fcntl(w->fd, F_GETFL) & ~O_DIRECT);
+            w->direct = 0;
+            continue;
+        }
+        if (ret <= 0) {
+            printf("failed to write output: %s\n", strerror(errno));
+            return -1;
+        }
+        data += ret;
+        off += ret;
+        len -= ret;
+    }
+    return 0;
+}
+
+static void* writer_main(void* data)
+{
+    struct frame_writer* w = (struct frame_writer*)data;
+    int idx, ret;
+
+    pthread_mutex_lock(&w->lock);
+    for (;;) {
+        while (!w->queued && !w->quit)
+            pthread_cond_wait(&w->cond, &w->lock);
+        if (!w->queued)
+            break;
+        idx = w->queue[0];
+        pthread_mutex_unlock(&w->lock);
+
+        ret = write_all(w, w->buf[idx], w->len[idx], w->offset);
+
+        pthread_mutex_lock(&w->lock);
+        if (ret)
+            w->error = 1;
+        w->offset += w->len[idx];
+        w->busy[idx] = 0;
+        w->queue[0] = w->queue[1];
+        w->queued--;
+        pthread_cond_broadcast(&w->cond);
+    }
+    pthread_mutex_unlock(&w->lock);
+    return NULL;
+}
+
+struct frame_writer* open_frame_writer(const char* path, size_t frame_size)
+{
+    struct frame_writer* w;
+    int i;
+
+    w = (struct frame_writer*)calloc(1, sizeof(*w));
+    if (!w)
+        return NULL;
+
+    w->direct = 1;
+    w->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_DIRECT, 0644);
+    if (w->fd < 0 && errno == EINVAL) {
+        w->direct = 0;
+        w->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    }
+    if (w->fd < 0) {
+        printf("failed to create %s: %s\n", path, strerror(errno));
+        free(w);
+        return NULL;
+    }
+
+    w->frame_size = frame_size;
+    w->buf_size = round_up(frame_size, DIRECT_ALIGN);
+    if (w->buf_size < WRITER_BUF_SIZE)
+        w->buf_size = WRITER_BUF_SIZE;
+
+    /* arena blocks are huge page aligned, plenty for O_DIRECT */
+    for (i = 0; i < 2; i++) {
+        w->buf[i] = (uint8_t*)frame_alloc(w->buf_size);
+        if (!w->buf[i]) {
+            printf("failed to allocate output buffer\n");
+            frame_free(w->buf[0]);
+            close(w->fd);
+            free(w);
+            return NULL;
+        }
+    }
+
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->cond, NULL);
+    if (pthread_create(&w->thread, NULL, writer_main, w)) {
+        printf("failed to create writer thread\n");
+        pthread_cond_destroy(&w->cond);
+        pthread_mutex_destroy(&w->lock);
+        frame_free(w->buf[0]);
+        frame_free(w->buf[1]);
+        close(w->fd);
+        free(w);
+        return NULL;
+    }
+    return w;
+}
+
+static int submit_buffer(struct frame_writer* w, size_t len)
+{
+    int error;
+
+    pthread_mutex_lock(&w->lock);
+    w->busy[w->cur] = 1;
+    w->len[w->cur] = len;
+    w->queue[w->queued++] = w->cur;
+    pthread_cond_broadcast(&w->cond);
+
+    /* double buffering: only wait while the other buffer is being written */
+    w->cur ^= 1;
+    while (w->busy[w->cur])
+        pthread_cond_wait(&w->cond, &w->lock);
+    error = w->error;
+    pthread_mutex_unlock(&w->lock);
+
+    w->fill = 0;
+    return error ? -1 : 0;
+}
+
+int write_frame(struct frame_writer* w, const void* src)
+{
+    const uint8_t* p = (const uint8_t*)src;
+    size_t left = w->frame_size, n;
+
+    while (left) {
+        n = w->buf_size - w->fill;
+        if (n > left)
+            n = left;
+        wc_copy(w->buf[w->cur] + w->fill, p, n);
+        w->fill += n;
+        p += n;
+        left -= n;
+
+        if (w->fill == w->buf_size && submit_buffer(w, w->buf_size))
+            return -1;
+    }
+
+    w->frames++;
+    w->bytes += w->frame_size;
+    return 0;
+}
+
+int close_frame_writer(struct frame_writer* w)
+{
+    int frames;
+
+    if (!w)
+        return 0;
+
+    if (w->fill) {
+        size_t len = round_up(w->fill, DIRECT_ALIGN);
+
+        memset(w->buf[w->cur] + w->fill, 0, len - w->fill);
+        submit_buffer(w, len);
+    }
+
+    pthread_mutex_lock(&w->lock);
+    while (w->queued)
+        pthread_cond_wait(&w->cond, &w->lock);
+    w->quit = 1;
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+    pthread_join(w->thread, NULL);
+
+    /* drop the O_DIRECT block padding */
+    if (ftruncate(w->fd, w->bytes))
+        printf("failed to truncate output: %s\n", strerror(errno));
+
+    frames = w->error ? -1 : w->frames;
+    pthread_cond_destroy(&w->cond);
+    pthread_mutex_destroy(&w->lock);
+    frame_free(w->buf[0]);
+    frame_free(w->buf[1]);
+    close(w->fd);
+    free(w);
+    return frames;
+}
@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) Fuzhou Rockchip Electronics Co.Ltd
+ * Author: Jacob Chen <jacob-chen@iotwrt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#ifndef __FRAMEIO_H_INCLUDED__
+#define __FRAMEIO_H_INCLUDED__
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct frame_reader;
+struct frame_writer;
+
+/*
+ * Raw frame sequences. The reader maps a sliding window of the file with
+ * MADV_SEQUENTIAL and reads ahead of the current frame, so files larger
+ * than the address space work too.
+ */
+struct frame_reader* open_frame_reader(const char *path, size_t frame_size);
+uint32_t frame_reader_count(struct frame_reader *r);
+/* Copy frame 'index' to 'dst', safe to call from several threads. */
+int read_frame(struct frame_reader *r, uint32_t index, void *dst);
+/* xxh32_64() of frame 'index', straight from the file mapping. */
+int hash_frame(struct frame_reader *r, uint32_t index, uint64_t *hash);
+void close_frame_reader(struct frame_reader *r);
+
+/*
+ * The writer collects frames in two aligned staging buffers; a background
+ * thread writes one with O_DIRECT while the other fills up.
+ */
+struct frame_writer* open_frame_writer(const char *path, size_t frame_size);
+int write_frame(struct frame_writer *w, const void *src);
+/* Flush, trim the block padding and close. Returns the frames written. */
+int close_frame_writer(struct frame_writer *w);
+
+#endif /* __FRAMEIO_H_INCLUDED__ */
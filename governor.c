@@ -0,0 +1,307 @@
+/*
+ * Copyright (C) Fuzhou Rockchip Electronics Co.Ltd
+ * Author: Jacob Chen <jacob-chen@iotwrt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#include <dirent.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "governor.h"
+
+#define GOV_MAX_SENSORS 16
+#define GOV_PATH_LEN 300
+/* deeper than any queue of the tool, depths past it share a baseline */
+#define GOV_MAX_DEPTH 32
+
+#define GOV_PERIOD_US 250000
+/* periods the temperature trend is extrapolated ahead */
+#define GOV_LOOKAHEAD 4
+/* clear of the ceiling by this much before the load goes back up */
+#define GOV_HYSTERESIS_MC 3000
+/* the rate after a cut, of what the period achieved */
+#define GOV_CUT 0.85
+/* the rate after a raise, of the one before */
+#define GOV_RAISE 1.05
+/* what counts as throttled: engine time up or clock down this much */
+#define GOV_SLOWDOWN 1.15
+#define GOV_CLOCK_DROP 0.95
+
+struct gov_clock {
+    char cur[GOV_PATH_LEN];
+    uint64_t max;
+};
+
+struct governor {
+    struct governor_config cfg;
+
+    char zones[GOV_MAX_SENSORS][GOV_PATH_LEN];
+    int num_zones;
+    struct gov_clock clocks[GOV_MAX_SENSORS];
+    int num_clocks;
+
+    unsigned int depth;		/* 0: as deep as the caller goes */
+    unsigned int max_depth;	/* the caller's, from governor_depth() */
+    uint64_t interval_us;	/* between frame starts, 0: unpaced */
+    uint64_t next_us;
+
+    uint64_t period_start_us;
+    unsigned int frames;
+    uint64_t engine_us;
+
+    int temp_mc;
+    double slope_mc;		/* per period, smoothed */
+    /* per frame at each depth, the least seen */
+    double cool_engine_us[GOV_MAX_DEPTH + 1];
+};
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+static int read_sysfs(const char* path, long long* value)
+{
+    FILE* fp;
+    int ret;
+
+    fp = fopen(path, "r");
+    if (!fp)
+        return -1;
+    ret = fscanf(fp, "%lld", value) == 1 ? 0 : -1;
+    fclose(fp);
+    return ret;
+}
+
+/* <root>/class/thermal/thermal_zone<n>/temp */
+static void find_zones(struct governor* g, const char* root)
+{
+    char path[GOV_PATH_LEN];
+    struct dirent* e;
+    long long temp;
+    DIR* dir;
+
+    snprintf(path, sizeof(path), "%s/class/thermal", root);
+    dir = opendir(path);
+    if (!dir)
+        return;
+
+    while ((e = readdir(dir)) && g->num_zones < GOV_MAX_SENSORS) {
+        if (strncmp(e->d_name, "thermal_zone", 12))
+            continue;
+        snprintf(path, sizeof(path), "%s/class/thermal/%s/temp", root, e->d_name);
+        /* disabled zones fail the read */
+        if (read_sysfs(path, &temp))
+            continue;
+        strcpy(g->zones[g->num_zones++], path);
+    }
+    closedir(dir);
+}
+
+/*
+ * The entries of 'dir' starting with 'prefix' that have a current and a
+ * maximum frequency. The maximum is taken once, thermal cooling lowers
+ * the limits of devfreq devices at run time.
+ */
+static void find_clocks(struct governor* g, const char* dir_path, const char* prefix,
+    const char* cur, const char* max)
+{
+    char path[GOV_PATH_LEN];
+    struct gov_clock* c;
+    struct dirent* e;
+    long long freq;
+    DIR* dir;
+
+    dir = opendir(dir_path);
+    if (!dir)
+        return;
+
+    while ((e = readdir(dir)) && g->num_clocks < GOV_MAX_SENSORS) {
+        if (e->d_name[0] == '.' || strncmp(e->d_name, prefix, strlen(prefix)))
+            continue;
+        c = &g->clocks[g->num_clocks];
+        snprintf(path, sizeof(path), "%s/%s/%s", dir_path, e->d_name, max);
+        if (read_sysfs(path, &freq) || freq <= 0)
+            continue;
+        c->max = freq;
+        snprintf(c->cur, sizeof(c->cur), "%s/%s/%s", dir_path, e->d_name, cur);
+        if (read_sysfs(c->cur, &freq))
+            continue;
+        g->num_clocks++;
+    }
+    closedir(dir);
+}
+
+static int read_temp(struct governor* g)
+{
+    long long temp;
+    int i, hottest = INT_MIN;
+
+    for (i = 0; i < g->num_zones; i++) {
+        if (!read_sysfs(g->zones[i], &temp) && temp > hottest)
+            hottest = temp;
+    }
+    return hottest;
+}
+
+/* The slowest clock as a fraction of its maximum, 1 without clocks. */
+static double read_clock(struct governor* g)
+{
+    long long freq;
+    double ratio, lowest = 1;
+    int i;
+
+    for (i = 0; i < g->num_clocks; i++) {
+        if (read_sysfs(g->clocks[i].cur, &freq))
+            continue;
+        ratio = (double)freq / g->clocks[i].max;
+        if (ratio < lowest)
+            lowest = ratio;
+    }
+    return lowest;
+}
+
+struct governor* create_governor(const struct governor_config* cfg)
+{
+    const char* root = cfg->sysfs_root ? cfg->sysfs_root : "/sys";
+    char path[GOV_PATH_LEN];
+    struct governor* g;
+
+    g = (struct governor*)calloc(1, sizeof(*g));
+    if (!g)
+        return NULL;
+    g->cfg = *cfg;
+    g->cfg.sysfs_root = NULL;
+
+    find_zones(g, root);
+    if (!g->num_zones) {
+        printf("no thermal zones under %s\n", root);
+        free(g);
+        return NULL;
+    }
+
+    snprintf(path, sizeof(path), "%s/class/devfreq", root);
+    find_clocks(g, path, "", "cur_freq", "max_freq");
+    snprintf(path, sizeof(path), "%s/devices/system/cpu/cpufreq", root);
+    find_clocks(g, path, "policy", "scaling_cur_freq", "cpuinfo_max_freq");
+
+    g->temp_mc = read_temp(g);
+    g->period_start_us = now_us();
+    printf("*[GOVERNOR]* : %d zones at %.1f C, %d clocks, ceiling %.1f C\n", g->num_zones,
+        g->temp_mc / 1000.0, g->num_clocks, cfg->ceiling_mc / 1000.0);
+    return g;
+}
+
+void destroy_governor(struct governor* g)
+{
+    free(g);
+}
+
+unsigned int governor_depth(struct governor* g, unsigned int max)
+{
+    g->max_depth = max;
+    return g->depth && g->depth < max ? g->depth : max;
+}
+
+void governor_pace(struct governor* g)
+{
+    struct timespec ts;
+    uint64_t now;
+
+    if (!g->interval_us)
+        return;
+
+    now = now_us();
+    if (g->next_us > now) {
+        ts.tv_sec = g->next_us / 1000000;
+        ts.tv_nsec = g->next_us % 1000000 * 1000;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+        now = g->next_us;
+    }
+    /* a late frame moves the schedule, no burst to catch up */
+    g->next_us = now + g->interval_us;
+}
+
+static void adjust(struct governor* g, uint64_t now)
+{
+    double fps = g->frames * 1e6 / (now - g->period_start_us);
+    double engine_us = (double)g->engine_us / g->frames;
+    unsigned int depth = g->depth ? g->depth : g->max_depth;
+    double clock = read_clock(g), *cool;
+    int temp, predicted, paced, throttled;
+
+    if (!depth)
+        depth = 1;
+    /* a paced pipeline reaps late, its frames seem to take longer */
+    paced = g->interval_us && depth > 1;
+    cool = &g->cool_engine_us[depth < GOV_MAX_DEPTH ? depth : GOV_MAX_DEPTH];
+    if (!paced && (!*cool || engine_us < *cool))
+        *cool = engine_us;
+    throttled = clock < GOV_CLOCK_DROP || (!paced && engine_us > *cool * GOV_SLOWDOWN);
+
+    temp = read_temp(g);
+    if (temp == INT_MIN)
+        temp = g->temp_mc;
+    g->slope_mc = (3 * g->slope_mc + temp - g->temp_mc) / 4;
+    g->temp_mc = temp;
+    predicted = temp + g->slope_mc * GOV_LOOKAHEAD;
+
+    if (predicted >= g->cfg.ceiling_mc) {
+        /* back off hard, the heat of what is queued is still to come */
+        if (depth > 1)
+            g->depth = depth - 1;
+        g->interval_us = 1e6 / (fps * GOV_CUT);
+    } else if (throttled) {
+        /*
+         * The engine was slowed down under us: frames queued deeper only
+         * wait longer, and more than it still makes only heats it up.
+         * Nothing is given back until it runs at full speed again.
+         */
+        if (depth > 1)
+            g->depth = depth - 1;
+        if (!g->interval_us || g->interval_us < 1e6 / fps)
+            g->interval_us = 1e6 / fps;
+    } else if (temp < g->cfg.ceiling_mc - GOV_HYSTERESIS_MC && g->slope_mc <= 0) {
+        if (g->interval_us) {
+            g->interval_us /= GOV_RAISE;
+            /* the rate is no longer what holds the frames back */
+            if (1e6 / g->interval_us > fps / GOV_CUT)
+                g->interval_us = 0;
+        }
+        if (g->depth && ++g->depth >= g->max_depth)
+            g->depth = 0;
+    }
+
+    printf("*[GOVERNOR]* : %.1f C %+.2f C/s, clock %.0f%%, %.2f msecs/frame%s, %.1f fps, depth %u",
+        temp / 1000.0, g->slope_mc * 1e6 / GOV_PERIOD_US / 1000, clock * 100, engine_us / 1000,
+        throttled ? " throttled" : "", fps, g->depth ? g->depth : depth);
+    if (g->interval_us)
+        printf(", capped at %.1f fps", 1e6 / g->interval_us);
+    printf("\n");
+}
+
+void governor_frame(struct governor* g, uint64_t us)
+{
+    uint64_t now = now_us();
+
+    g->frames++;
+    g->engine_us += us;
+    if (now - g->period_start_us < GOV_PERIOD_US)
+        return;
+
+    adjust(g, now);
+    g->period_start_us = now;
+    g->frames = 0;
+    g->engine_us = 0;
+}
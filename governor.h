@@ -0,0 +1,43 @@
+/*
+ * Copyright (C) Fuzhou Rockchip Electronics Co.Ltd
+ * Author: Jacob Chen <jacob-chen@iotwrt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#ifndef __GOVERNOR_H_INCLUDED__
+#define __GOVERNOR_H_INCLUDED__
+
+#include <stdint.h>
+
+struct governor_config {
+	const char *sysfs_root;		/* NULL for /sys, or a tree laid out like it */
+	int ceiling_mc;			/* the hottest zone, millidegrees Celsius */
+};
+
+/*
+ * Keeps a sustained load below a thermal ceiling. Every quarter second the
+ * thermal zones and the devfreq and cpufreq clocks are read and set against
+ * the frame rate and engine time of the period. When the temperature trend
+ * reaches the ceiling the frames in flight and the frame rate are cut; once
+ * it is clear of the ceiling again both are given back a little at a time.
+ * An engine time above what the same depth took while cool, or a clock
+ * below its maximum, is throttling: the depth is cut, the rate held at
+ * what the engine still makes and nothing is given back while it lasts.
+ *
+ * Returns NULL when there are no thermal zones under the root.
+ */
+struct governor *create_governor(const struct governor_config *cfg);
+void destroy_governor(struct governor *g);
+
+/* How many frames the caller may have in flight, at most 'max'. */
+unsigned int governor_depth(struct governor *g, unsigned int max);
+/* Waits until the next frame may start at the current rate. */
+void governor_pace(struct governor *g);
+/* A frame took 'us' from submission to completion. */
+void governor_frame(struct governor *g, uint64_t us);
+
+#endif /* __GOVERNOR_H_INCLUDED__ */
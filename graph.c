@@ -0,0 +1,443 @@
+/*
+ * Copyright (C) Fuzhou Rockchip Electronics Co.Ltd
+ * Author: Jacob Chen <jacob-chen@iotwrt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <linux/videodev2.h>
+
+#include "bo.h"
+#include "caps.h"
+#include "convert.h"
+#include "format.h"
+#include "graph.h"
+#include "m2m.h"
+#include "rga.h"
+
+#define MAX_PASSES 8
+#define MAX_BUFFERS 8
+
+/* buffers supplied by the caller for every frame */
+enum {
+    BUF_SRC,
+    BUF_OSD,
+    BUF_DST,
+    NUM_IO_BUFFERS,
+};
+
+struct graph_buffer {
+    uint32_t format;
+    uint32_t width;
+    uint32_t height;
+    struct colorimetry color;
+    size_t size;
+
+    /* intermediates only: levels it is live in and its pool slot */
+    int first;
+    int last;
+    int slot;
+};
+
+struct graph_pass {
+    const char* what;
+    int cpu;
+    int src;
+    int dst;
+    struct rga_params params;
+    struct m2m_dev* dev; /* a context of its own per hardware pass */
+    int level;
+
+    /* set up by run_graph() for the current frame */
+    struct graph* g;
+    int result;
+};
+
+struct graph {
+    struct graph_buffer buffers[MAX_BUFFERS];
+    int num_buffers;
+    struct graph_pass passes[MAX_PASSES];
+    int num_passes;
+    int num_levels;
+
+    struct graph_image pool[MAX_BUFFERS];
+    size_t pool_size[MAX_BUFFERS];
+    int num_slots;
+    struct graph_alloc alloc;
+
+    /* images of every buffer for the frame being run */
+    struct graph_image images[MAX_BUFFERS];
+};
+
+static int add_buffer(struct graph* g, uint32_t format, uint32_t width, uint32_t height,
+    const struct colorimetry* color)
+{
+    struct graph_buffer* b = &g->buffers[g->num_buffers];
+
+    b->format = format;
+    b->color = *color;
+    b->width = width;
+    b->height = height;
+    b->size = fmt_frame_size(get_fmt_info(format), width, height);
+    b->slot = -1;
+    return g->num_buffers++;
+}
+
+static struct graph_pass* add_pass(struct graph* g, const char* what, int cpu, int src, int dst)
+{
+    struct graph_pass* p = &g->passes[g->num_passes++];
+
+    p->what = what;
+    p->cpu = cpu;
+    p->src = src;
+    p->dst = dst;
+    p->params.blend = V4L2_BLEND_SRC;
+    return p;
+}
+
+/*
+ * The main chain. A pass that needs the node beyond its scale limits goes
+ * through an intermediate that only scales, the rotation happens when
+ * reading it back.
+ */
+static void plan_main(struct graph* g, const struct transform_op* op, const struct m2m_caps* caps)
+{
+    struct m2m_config cfg;
+    struct graph_pass* p;
+    struct plan plan;
+    int mid;
+
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.src_format = op->src_format;
+    cfg.src_width = op->crop.w ? op->crop.w : op->src_width;
+    cfg.src_height = op->crop.h ? op->crop.h : op->src_height;
+    cfg.dst_format = op->dst_format;
+    cfg.dst_width = op->dst_width;
+    cfg.dst_height = op->dst_height;
+    cfg.rotate = op->rotate;
+    cfg.hflip = op->hflip;
+    cfg.vflip = op->vflip;
+    cfg.src_color = op->src_color;
+    cfg.dst_color = op->dst_color;
+
+    plan.route = ROUTE_CPU;
+    if (caps)
+        plan_transform(caps, &cfg, &plan);
+
+    if (plan.route == ROUTE_TWO_PASS) {
+        mid = add_buffer(g, plan.mid_format, plan.mid_width, plan.mid_height,
+            plan.mid_format == op->src_format ? &op->src_color : &op->dst_color);
+        p = add_pass(g, "scale", 0, BUF_SRC, mid);
+        p->params.src = op->crop;
+        p = add_pass(g, "rotate", 0, mid, BUF_DST);
+        p->params.rotate = op->rotate;
+        p->params.hflip = op->hflip;
+        p->params.vflip = op->vflip;
+        return;
+    }
+
+    /* stripes are for the plain single node path */
+    p = add_pass(g, "transform", plan.route != ROUTE_DIRECT, BUF_SRC, BUF_DST);
+    p->params.src = op->crop;
+    p->params.rotate = op->rotate;
+    p->params.hflip = op->hflip;
+    p->params.vflip = op->vflip;
+}
+
+/*
+ * The overlay. The node blends formats it reads; other overlays are
+ * converted on the CPU first, which doesn't depend on the main chain and
+ * runs next to it.
+ */
+static void plan_osd(struct graph* g, const struct transform_op* op, const struct m2m_caps* caps)
+{
+    struct graph_pass* p;
+    int hw, osd = BUF_OSD;
+
+    hw = caps && find_ctrl_caps(caps, V4L2_CID_BLEND)
+        && find_fmt_caps(caps, 1, op->dst_format);
+
+    if (hw && !find_fmt_caps(caps, 0, op->osd_format)) {
+        if (!find_fmt_caps(caps, 0, op->dst_format)) {
+            hw = 0;
+        } else {
+            osd = add_buffer(g, op->dst_format, op->osd_rect.w, op->osd_rect.h, &op->dst_color);
+            add_pass(g, "osd convert", 1, BUF_OSD, osd);
+        }
+    }
+
+    p = add_pass(g, "osd blend", !hw, osd, BUF_DST);
+    p->params.dst = op->osd_rect;
+    p->params.blend = V4L2_BLEND_SRCOVER;
+}
+
+/*
+ * A pass waits for every earlier pass that writes what it reads, writes
+ * what it writes or reads what it overwrites.
+ */
+static void assign_levels(struct graph* g)
+{
+    int i, j;
+
+    for (i = 0; i < g->num_passes; i++) {
+        struct graph_pass* p = &g->passes[i];
+
+        p->level = 0;
+        for (j = 0; j < i; j++) {
+            struct graph_pass* q = &g->passes[j];
+
+            if ((q->dst == p->src || q->dst == p->dst || q->src == p->dst) && q->level + 1 > p->level)
+                p->level = q->level + 1;
+        }
+        if (p->level + 1 > g->num_levels)
+            g->num_levels = p->level + 1;
+    }
+}
+
+/* Interval allocation: a slot is free again once its tenant's last level passed. */
+static int assign_slots(struct graph* g)
+{
+    int slot_free_after[MAX_BUFFERS];
+    int i, j, best;
+
+    for (i = NUM_IO_BUFFERS; i < g->num_buffers; i++) {
+        struct graph_buffer* b = &g->buffers[i];
+
+        b->first = g->num_levels;
+        b->last = -1;
+        for (j = 0; j < g->num_passes; j++) {
+            if (g->passes[j].dst == i && g->passes[j].level < b->first)
+                b->first = g->passes[j].level;
+            if (g->passes[j].src == i && g->passes[j].level > b->last)
+                b->last = g->passes[j].level;
+        }
+    }
+
+    for (i = NUM_IO_BUFFERS; i < g->num_buffers; i++) {
+        struct graph_buffer* b = &g->buffers[i];
+
+        best = -1;
+        for (j = 0; j < g->num_slots; j++) {
+            if (slot_free_after[j] >= b->first)
+                continue;
+            /* the closest size wastes the least when the slot grows */
+            if (best < 0 || labs((long)g->pool_size[j] - (long)b->size)
+                    < labs((long)g->pool_size[best] - (long)b->size))
+                best = j;
+        }
+        if (best < 0) {
+            best = g->num_slots++;
+            g->pool_size[best] = 0;
+        }
+        if (g->pool_size[best] < b->size)
+            g->pool_size[best] = b->size;
+        slot_free_after[best] = b->last;
+        b->slot = best;
+    }
+
+    for (i = 0; i < g->num_slots; i++) {
+        if (g->alloc.alloc(g->alloc.priv, g->pool_size[i], &g->pool[i])) {
+            g->num_slots = i;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int open_pass_dev(struct graph* g, struct graph_pass* p, const char* path)
+{
+    const struct graph_buffer* src = &g->buffers[p->src];
+    const struct graph_buffer* dst = &g->buffers[p->dst];
+    struct m2m_config cfg;
+
+    p->dev = open_m2m_dev(path);
+    if (!p->dev)
+        return -1;
+
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.src_format = src->format;
+    cfg.src_width = src->width;
+    cfg.src_height = src->height;
+    cfg.dst_format = dst->format;
+    cfg.dst_width = dst->width;
+    cfg.dst_height = dst->height;
+    cfg.rotate = p->params.rotate;
+    cfg.hflip = p->params.hflip;
+    cfg.vflip = p->params.vflip;
+    cfg.src_color = src->color;
+    cfg.dst_color = dst->color;
+    cfg.blend = p->params.blend;
+
+    if (m2m_set_config(p->dev, &cfg) || m2m_request_bufs(p->dev, 1, 1))
+        return -1;
+    if (p->params.src.w && m2m_set_selection(p->dev, 0, &p->params.src))
+        return -1;
+    if (p->params.dst.w && m2m_set_selection(p->dev, 1, &p->params.dst))
+        return -1;
+    return m2m_stream(p->dev, 1);
+}
+
+struct graph* create_graph(const struct transform_op* op, const char* m2m_path,
+    const struct graph_alloc* alloc)
+{
+    struct m2m_dev* probe = NULL;
+    struct graph* g;
+    int i;
+
+    g = (struct graph*)calloc(1, sizeof(*g));
+    if (!g)
+        return NULL;
+    g->alloc = *alloc;
+
+    add_buffer(g, op->src_format, op->src_width, op->src_height, &op->src_color);
+    add_buffer(g, op->osd_format, op->osd_width, op->osd_height, &op->src_color);
+    add_buffer(g, op->dst_format, op->dst_width, op->dst_height, &op->dst_color);
+
+    if (m2m_path)
+        probe = open_m2m_dev(m2m_path);
+
+    plan_main(g, op, probe ? &probe->caps : NULL);
+    if (op->osd_width)
+        plan_osd(g, op, probe ? &probe->caps : NULL);
+    close_m2m_dev(probe);
+
+    assign_levels(g);
+    if (assign_slots(g))
+        goto err;
+
+    for (i = 0; i < g->num_passes; i++) {
+        if (!g->passes[i].cpu && open_pass_dev(g, &g->passes[i], m2m_path)) {
+            printf("%s pass can not run on %s\n", g->passes[i].what, m2m_path);
+            goto err;
+        }
+    }
+    return g;
+
+err:
+    destroy_graph(g);
+    return NULL;
+}
+
+void print_graph(const struct graph* g)
+{
+    const struct graph_buffer *src, *dst;
+    int i;
+
+    for (i = 0; i < g->num_passes; i++) {
+        src = &g->buffers[g->passes[i].src];
+        dst = &g->buffers[g->passes[i].dst];
+        printf("*[GRAPH]* : level %d: %-11s on %-4s %.4s %ux%u -> %.4s %ux%u\n",
+            g->passes[i].level, g->passes[i].what, g->passes[i].cpu ? "cpu" : "rga",
+            (const char*)&src->format, src->width, src->height,
+            (const char*)&dst->format, dst->width, dst->height);
+    }
+    printf("*[GRAPH]* : %d intermediates in %d pool buffers\n",
+        g->num_buffers - NUM_IO_BUFFERS, g->num_slots);
+}
+
+static void run_pass(struct graph_pass* p)
+{
+    struct graph* g = p->g;
+    const struct graph_buffer* sb = &g->buffers[p->src];
+    const struct graph_buffer* db = &g->buffers[p->dst];
+    struct image src, dst;
+    int ret;
+
+    if (!p->cpu) {
+        ret = m2m_queue(p->dev, 0, g->images[p->src].fd, g->images[p->dst].fd);
+        if (!ret)
+            ret = m2m_dequeue(p->dev);
+        p->result = ret < 0 ? ret : 0;
+        return;
+    }
+
+    init_image(&src, sb->format, g->images[p->src].addr, sb->width, sb->height);
+    init_image(&dst, db->format, g->images[p->dst].addr, db->width, db->height);
+    set_image_colorimetry(&src, &sb->color);
+    set_image_colorimetry(&dst, &db->color);
+
+    if (g->images[p->src].fd >= 0)
+        sync_dmabuf(g->images[p->src].fd, 1, SP_BO_READ);
+    if (g->images[p->dst].fd >= 0)
+        sync_dmabuf(g->images[p->dst].fd, 1, SP_BO_READ | SP_BO_WRITE);
+    p->result = cpu_rga_transform(&src, &dst, &p->params);
+    if (g->images[p->dst].fd >= 0)
+        sync_dmabuf(g->images[p->dst].fd, 0, SP_BO_READ | SP_BO_WRITE);
+    if (g->images[p->src].fd >= 0)
+        sync_dmabuf(g->images[p->src].fd, 0, SP_BO_READ);
+}
+
+static void* pass_main(void* data)
+{
+    run_pass((struct graph_pass*)data);
+    return NULL;
+}
+
+int run_graph(struct graph* g, const struct graph_io* io)
+{
+    pthread_t threads[MAX_PASSES];
+    int started[MAX_PASSES];
+    int i, level, first, ret = 0;
+
+    g->images[BUF_SRC] = io->src;
+    g->images[BUF_OSD] = io->osd;
+    g->images[BUF_DST] = io->dst;
+    for (i = NUM_IO_BUFFERS; i < g->num_buffers; i++)
+        g->images[i] = g->pool[g->buffers[i].slot];
+
+    for (level = 0; level < g->num_levels; level++) {
+        first = -1;
+        for (i = 0; i < g->num_passes; i++) {
+            started[i] = 0;
+            if (g->passes[i].level != level)
+                continue;
+            g->passes[i].g = g;
+            if (first < 0) {
+                first = i;
+                continue;
+            }
+            started[i] = !pthread_create(&threads[i], NULL, pass_main, &g->passes[i]);
+            if (!started[i])
+                run_pass(&g->passes[i]);
+        }
+
+        /* the calling thread takes the first pass of the level */
+        run_pass(&g->passes[first]);
+
+        for (i = 0; i < g->num_passes; i++) {
+            if (started[i])
+                pthread_join(threads[i], NULL);
+            if (g->passes[i].level == level && g->passes[i].result)
+                ret = -1;
+        }
+        if (ret)
+            break;
+    }
+    return ret;
+}
+
+void destroy_graph(struct graph* g)
+{
+    int i;
+
+    if (!g)
+        return;
+
+    for (i = 0; i < g->num_passes; i++) {
+        if (g->passes[i].dev) {
+            m2m_stream(g->passes[i].dev, 0);
+            close_m2m_dev(g->passes[i].dev);
+        }
+    }
+    for (i = 0; i < g->num_slots; i++)
+        g->alloc.free(g->alloc.priv, &g->pool[i]);
+    free(g);
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) Fuzhou Rockchip Electronics Co.Ltd
+ * Author: Jacob Chen <jacob-chen@iotwrt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#ifndef __GRAPH_H_INCLUDED__
+#define __GRAPH_H_INCLUDED__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cpu_rga.h"
+#include "format.h"
+
+struct graph;
+
+/* Crop, rotate, scale and convert the source, then blend an overlay on it. */
+struct transform_op {
+	uint32_t src_format;
+	uint32_t src_width;
+	uint32_t src_height;
+	struct rga_rect crop;		/* zero size: the whole source */
+	int rotate;
+	int hflip;
+	int vflip;
+	uint32_t dst_format;
+	uint32_t dst_width;
+	uint32_t dst_height;
+	struct colorimetry src_color;
+	struct colorimetry dst_color;
+
+	/* blended over the result at 'osd_rect', osd_width 0 for none */
+	uint32_t osd_format;
+	uint32_t osd_width;
+	uint32_t osd_height;
+	struct rga_rect osd_rect;
+};
+
+struct graph_image {
+	void *addr;
+	int fd;
+};
+
+struct graph_io {
+	struct graph_image src;
+	struct graph_image osd;
+	struct graph_image dst;
+};
+
+/* Intermediate buffers have to be dmabufs for the m2m passes. */
+struct graph_alloc {
+	int (*alloc)(void *priv, size_t size, struct graph_image *img);
+	void (*free)(void *priv, struct graph_image *img);
+	void *priv;
+};
+
+/*
+ * Plan 'op' as hardware passes on the node at 'm2m_path' where it can do
+ * them and CPU passes elsewhere (m2m_path NULL: CPU only). Intermediates
+ * whose lifetimes don't overlap share a pool buffer.
+ */
+struct graph* create_graph(const struct transform_op *op, const char *m2m_path,
+			   const struct graph_alloc *alloc);
+void print_graph(const struct graph *g);
+
+/* Run the passes level by level, independent ones concurrently. */
+int run_graph(struct graph *g, const struct graph_io *io);
+
+void destroy_graph(struct graph *g);
+
+#endif /* __GRAPH_H_INCLUDED__ */
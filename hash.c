@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) Fuzhou Rockchip Electronics Co.Ltd
+ * Author: Jacob Chen <jacob-chen@iotwrt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#include <string.h>
+
+#include "hash.h"
+#include "simd.h"
+
+#define PRIME32_1 0x9E3779B1U
+#define PRIME32_2 0x85EBCA77U
+#define PRIME32_3 0xC2B2AE3DU
+#define PRIME32_4 0x27D4EB2FU
+#define PRIME32_5 0x165667B1U
+
+static inline uint32_t rotl32(uint32_t x, int r)
+{
+    return (x << r) | (x >> (32 - r));
+}
+
+uint32_t xxh32(const void* data, size_t len, uint32_t seed)
+{
+    const uint8_t* p = (const uint8_t*)data;
+    const uint8_t* end = p + len;
+    uint32_t h, w;
+
+    if (len >= 16) {
+        v4u32 acc = { seed + PRIME32_1 + PRIME32_2, seed + PRIME32_2, seed, seed - PRIME32_1 };
+        const uint8_t* limit = end - 16;
+
+        do {
+            acc += load_v4u32(p) * PRIME32_2;
+            acc = (acc << 13) | (acc >> 19);
+            acc *= PRIME32_1;
+            p += 16;
+        } while (p <= limit);
+
+        h = rotl32(acc[0], 1) + rotl32(acc[1], 7) + rotl32(acc[2], 12) + rotl32(acc[3], 18);
+    } else {
+        h = seed + PRIME32_5;
+    }
+
+    h += (uint32_t)len;
+
+    while (p + 4 <= end) {
+        memcpy(&w, p, 4);
+        h = rotl32(h + w * PRIME32_3, 17) * PRIME32_4;
+        p += 4;
+    }
+    while (p < end) {
+        h = rotl32(h + (*p) * PRIME32_5, 11) * PRIME32_1;
+        p++;
+    }
+
+    h ^= h >> 15;
+    h *= PRIME32_2;
+    h ^= h >> 13;
+    h *= PRIME32_3;
+    h ^= h >> 16;
+    return h;
+}
+
+uint64_t xxh32_64(const void* data, size_t len)
+{
+    return (uint64_t)xxh32(data, len, 0) << 32 | xxh32(data, len, PRIME32_1);
+}
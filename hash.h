@@ -0,0 +1,23 @@
+/*
+ * Copyright (C) Fuzhou Rockchip Electronics Co.Ltd
+ * Author: Jacob Chen <jacob-chen@iotwrt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#ifndef __HASH_H_INCLUDED__
+#define __HASH_H_INCLUDED__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* XXH32, the four lanes run in one vector register. */
+uint32_t xxh32(const void *data, size_t len, uint32_t seed);
+
+/* Two XXH32 passes with different seeds, for keys that stand for content. */
+uint64_t xxh32_64(const void *data, size_t len);
+
+#endif /* __HASH_H_INCLUDED__ */
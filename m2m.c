@@ -0,0 +1,482 @@
+/*
+ * Copyright (C) Fuzhou Rockchip Electronics Co.Ltd
+ * Author: Jacob Chen <jacob-chen@iotwrt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <linux/media.h>
+#include <linux/videodev2.h>
+
+#include "cpu_rga.h"
+#include "fakem2m.h"
+#include "format.h"
+#include "m2m.h"
+#include "rga.h"
+
+#define MAX_VIDEO_NODES 64
+
+static int is_m2m(int fd)
+{
+    struct v4l2_capability cap;
+    uint32_t caps;
+
+    memset(&cap, 0, sizeof(cap));
+    if (m2m_ioctl(fd, VIDIOC_QUERYCAP, &cap))
+        return 0;
+
+    caps = cap.capabilities;
+    if (caps & V4L2_CAP_DEVICE_CAPS)
+        caps = cap.device_caps;
+    return (caps & V4L2_CAP_VIDEO_M2M) && (caps & V4L2_CAP_STREAMING);
+}
+
+int find_m2m_devs(char paths[][32], int max)
+{
+    char path[32];
+    int i, fd, n = 0;
+
+    for (i = 0; i < MAX_VIDEO_NODES && n < max; i++) {
+        snprintf(path, sizeof(path), "/dev/video%d", i);
+        fd = open(path, O_RDWR | O_CLOEXEC);
+        if (fd < 0)
+            continue;
+        if (is_m2m(fd))
+            strcpy(paths[n++], path);
+        close(fd);
+    }
+    return n;
+}
+
+struct m2m_dev* open_m2m_dev(const char* path)
+{
+    struct m2m_dev* dev;
+    int i;
+
+    dev = (struct m2m_dev*)calloc(1, sizeof(*dev));
+    if (!dev)
+        return NULL;
+
+    dev->media_fd = -1;
+    for (i = 0; i < M2M_MAX_BUFS; i++)
+        dev->req_fds[i] = -1;
+
+    snprintf(dev->path, sizeof(dev->path), "%s", path);
+    if (is_fake_m2m_path(path)) {
+        dev->fd = open_fake_m2m(path);
+        if (dev->fd < 0) {
+            free(dev);
+            return NULL;
+        }
+    } else {
+        dev->fd = open(path, O_RDWR | O_CLOEXEC, 0);
+        if (dev->fd < 0) {
+            fprintf(stderr, "%s:%d: ", __func__, __LINE__);
+            perror("open");
+            free(dev);
+            return NULL;
+        }
+    }
+
+    if (!is_m2m(dev->fd)) {
+        fprintf(stderr, "%s is not a streaming m2m device\n", path);
+        m2m_close(dev->fd);
+        free(dev);
+        return NULL;
+    }
+
+    if (probe_m2m_caps(dev->fd, &dev->caps, 0))
+        fprintf(stderr, "%s: failed to probe capabilities\n", path);
+    return dev;
+}
+
+void close_m2m_dev(struct m2m_dev* dev)
+{
+    int i;
+
+    if (!dev)
+        return;
+    for (i = 0; i < M2M_MAX_BUFS; i++) {
+        if (dev->req_fds[i] >= 0)
+            close(dev->req_fds[i]);
+    }
+    if (dev->media_fd >= 0)
+        close(dev->media_fd);
+    m2m_close(dev->fd);
+    free(dev);
+}
+
+static int add_ctrl(struct m2m_dev* dev, struct v4l2_ext_control* ctrls,
+    const char** names, int n, uint32_t id, int32_t value, const char* name)
+{
+    /* unprobed nodes only get the controls that change something */
+    if (dev->caps.num_ctrls ? !find_ctrl_caps(&dev->caps, id) : !value)
+        return n;
+
+    memset(&ctrls[n], 0, sizeof(ctrls[n]));
+    ctrls[n].id = id;
+    ctrls[n].value = value;
+    names[n] = name;
+    return n + 1;
+}
+
+/* All controls in one S_EXT_CTRLS, stored in 'request_fd' unless it's -1. */
+static int set_ctrls(struct m2m_dev* dev, const struct m2m_ctrls* c, int request_fd)
+{
+    struct v4l2_ext_control ctrls[5];
+    struct v4l2_ext_controls ext;
+    const char* names[5];
+    int n = 0;
+
+    n = add_ctrl(dev, ctrls, names, n, V4L2_CID_HFLIP, c->hflip, "HFLIP");
+    n = add_ctrl(dev, ctrls, names, n, V4L2_CID_VFLIP, c->vflip, "VFLIP");
+    n = add_ctrl(dev, ctrls, names, n, V4L2_CID_ROTATE, c->rotate, "ROTATE");
+    n = add_ctrl(dev, ctrls, names, n, V4L2_CID_BLEND, c->blend, "BLEND");
+    if (c->fill_color)
+        n = add_ctrl(dev, ctrls, names, n, V4L2_CID_BG_COLOR, c->fill_color, "Fill Color");
+    if (!n)
+        return 0;
+
+    memset(&ext, 0, sizeof(ext));
+    ext.which = request_fd >= 0 ? V4L2_CTRL_WHICH_REQUEST_VAL : V4L2_CTRL_WHICH_CUR_VAL;
+    ext.count = n;
+    ext.controls = ctrls;
+    ext.request_fd = request_fd;
+    if (m2m_ioctl(dev->fd, VIDIOC_S_EXT_CTRLS, &ext)) {
+        /* error_idx == count: the batch was refused before any control */
+        if (ext.error_idx < ext.count)
+            fprintf(stderr, "%s: Set %s failed\n", dev->path, names[ext.error_idx]);
+        else
+            fprintf(stderr, "%s: Set controls failed\n", dev->path);
+        return -errno;
+    }
+    return 0;
+}
+
+static void get_ctrls(const struct m2m_config* cfg, struct m2m_ctrls* c)
+{
+    c->rotate = cfg->rotate;
+    c->hflip = cfg->hflip;
+    c->vflip = cfg->vflip;
+    c->blend = cfg->blend;
+    c->fill_color = cfg->fill_color;
+}
+
+static int set_fmt(struct m2m_dev* dev, uint32_t type, uint32_t format,
+    uint32_t width, uint32_t height, const struct colorimetry* c)
+{
+    const struct fmt_info* fi = get_fmt_info(format);
+    struct v4l2_format fmt;
+
+    memset(&fmt, 0, sizeof(fmt));
+    fmt.type = type;
+    fmt.fmt.pix.width = width;
+    fmt.fmt.pix.height = height;
+    fmt.fmt.pix.pixelformat = format;
+    fmt.fmt.pix.field = V4L2_FIELD_ANY;
+    if (fi) {
+        fmt.fmt.pix.colorspace = fmt_colorspace(fi, c);
+        fmt.fmt.pix.ycbcr_enc = fi->is_yuv ? c->ycbcr_enc : (uint32_t)V4L2_YCBCR_ENC_DEFAULT;
+        fmt.fmt.pix.quantization = fi->is_yuv ? c->quantization : (uint32_t)V4L2_QUANTIZATION_FULL_RANGE;
+    }
+    /* CAPTURE colorimetry is only taken as a request with SET_CSC */
+    if (type == V4L2_BUF_TYPE_VIDEO_CAPTURE) {
+        fmt.fmt.pix.priv = V4L2_PIX_FMT_PRIV_MAGIC;
+        fmt.fmt.pix.flags = V4L2_PIX_FMT_FLAG_SET_CSC;
+    }
+
+    if (m2m_ioctl(dev->fd, VIDIOC_S_FMT, &fmt)) {
+        fprintf(stderr, "%s:%d: ", __func__, __LINE__);
+        perror("ioctl");
+        return -errno;
+    }
+
+    if (fmt.fmt.pix.pixelformat != format || fmt.fmt.pix.width != width
+        || fmt.fmt.pix.height != height) {
+        fprintf(stderr, "%s: %.4s %ux%u was adjusted to %.4s %ux%u\n", dev->path,
+            (const char*)&format, width, height, (const char*)&fmt.fmt.pix.pixelformat,
+            fmt.fmt.pix.width, fmt.fmt.pix.height);
+        return -EINVAL;
+    }
+
+    /* drivers that don't know colorimetry leave it at DEFAULT */
+    if (fi && fi->is_yuv && ((fmt.fmt.pix.ycbcr_enc && fmt.fmt.pix.ycbcr_enc != c->ycbcr_enc)
+        || (fmt.fmt.pix.quantization && fmt.fmt.pix.quantization != c->quantization)))
+        fprintf(stderr, "%s: %.4s uses YCbCr encoding %u quantization %u instead\n", dev->path,
+            (const char*)&format, fmt.fmt.pix.ycbcr_enc, fmt.fmt.pix.quantization);
+    return 0;
+}
+
+int m2m_set_config(struct m2m_dev* dev, const struct m2m_config* cfg)
+{
+    int ret;
+
+    get_ctrls(cfg, &dev->cur);
+    ret = set_ctrls(dev, &dev->cur, -1);
+    if (ret)
+        return ret;
+
+    ret = set_fmt(dev, V4L2_BUF_TYPE_VIDEO_OUTPUT, cfg->src_format,
+        cfg->src_width, cfg->src_height, &cfg->src_color);
+    if (ret)
+        return ret;
+
+    return set_fmt(dev, V4L2_BUF_TYPE_VIDEO_CAPTURE, cfg->dst_format,
+        cfg->dst_width, cfg->dst_height, &cfg->dst_color);
+}
+
+static int request_bufs(struct m2m_dev* dev, uint32_t type, unsigned int count,
+    size_t* sizes, unsigned int* num, uint32_t* buf_caps)
+{
+    struct v4l2_requestbuffers reqbuf;
+    struct v4l2_buffer buf;
+    unsigned int i;
+
+    if (count > M2M_MAX_BUFS)
+        count = M2M_MAX_BUFS;
+
+    memset(&reqbuf, 0, sizeof(reqbuf));
+    reqbuf.count = count;
+    reqbuf.type = type;
+    reqbuf.memory = V4L2_MEMORY_DMABUF;
+    if (m2m_ioctl(dev->fd, VIDIOC_REQBUFS, &reqbuf)) {
+        fprintf(stderr, "%s:%d: ", __func__, __LINE__);
+        perror("ioctl");
+        return -errno;
+    }
+    *num = reqbuf.count < M2M_MAX_BUFS ? reqbuf.count : M2M_MAX_BUFS;
+    *buf_caps = reqbuf.capabilities;
+
+    for (i = 0; i < *num; i++) {
+        memset(&buf, 0, sizeof(buf));
+        buf.type = type;
+        buf.memory = V4L2_MEMORY_DMABUF;
+        buf.index = i;
+        if (m2m_ioctl(dev->fd, VIDIOC_QUERYBUF, &buf)) {
+            fprintf(stderr, "%s:%d: ", __func__, __LINE__);
+            perror("ioctl");
+            return -errno;
+        }
+        sizes[i] = buf.length;
+    }
+    return 0;
+}
+
+/* The media device registered next to the video node, -1 if there's none. */
+static int open_media_dev(const char* video_path)
+{
+    const char* name = strrchr(video_path, '/');
+    char path[300];
+    struct dirent* e;
+    DIR* dir;
+    int fd = -1;
+
+    snprintf(path, sizeof(path), "/sys/class/video4linux/%s/device", name ? name + 1 : video_path);
+    dir = opendir(path);
+    if (!dir)
+        return -1;
+
+    while ((e = readdir(dir))) {
+        if (strncmp(e->d_name, "media", 5))
+            continue;
+        snprintf(path, sizeof(path), "/dev/%s", e->d_name);
+        fd = open(path, O_RDWR | O_CLOEXEC);
+        break;
+    }
+    closedir(dir);
+    return fd;
+}
+
+int m2m_request_bufs(struct m2m_dev* dev, unsigned int num_src, unsigned int num_dst)
+{
+    uint32_t buf_caps;
+    int ret;
+
+    ret = request_bufs(dev, V4L2_BUF_TYPE_VIDEO_OUTPUT, num_src,
+        dev->src_size, &dev->num_src_bufs, &buf_caps);
+    if (ret)
+        return ret;
+
+    if ((buf_caps & V4L2_BUF_CAP_SUPPORTS_REQUESTS) && dev->media_fd < 0) {
+        dev->media_fd = open_media_dev(dev->path);
+        if (dev->media_fd < 0)
+            fprintf(stderr, "%s: no media device, controls can't go with a job\n", dev->path);
+    }
+
+    return request_bufs(dev, V4L2_BUF_TYPE_VIDEO_CAPTURE, num_dst,
+        dev->dst_size, &dev->num_dst_bufs, &buf_caps);
+}
+
+int m2m_stream(struct m2m_dev* dev, int on)
+{
+    enum v4l2_buf_type type;
+    unsigned long req = on ? VIDIOC_STREAMON : VIDIOC_STREAMOFF;
+
+    type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    if (m2m_ioctl(dev->fd, req, &type)) {
+        fprintf(stderr, "%s:%d: ", __func__, __LINE__);
+        perror("ioctl");
+        return -errno;
+    }
+    /* streaming off returns every queued buffer */
+    dev->num_queued = 0;
+
+    type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    if (m2m_ioctl(dev->fd, req, &type)) {
+        fprintf(stderr, "%s:%d: ", __func__, __LINE__);
+        perror("ioctl");
+        return -errno;
+    }
+    return 0;
+}
+
+int m2m_set_selection(struct m2m_dev* dev, int capture, const struct rga_rect* r)
+{
+    struct v4l2_selection sel;
+
+    memset(&sel, 0, sizeof(sel));
+    sel.type = capture ? V4L2_BUF_TYPE_VIDEO_CAPTURE : V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    sel.target = capture ? V4L2_SEL_TGT_COMPOSE : V4L2_SEL_TGT_CROP;
+    sel.r.left = r->x;
+    sel.r.top = r->y;
+    sel.r.width = r->w;
+    sel.r.height = r->h;
+    if (m2m_ioctl(dev->fd, VIDIOC_S_SELECTION, &sel)) {
+        fprintf(stderr, "%s:%d: ", __func__, __LINE__);
+        perror("ioctl");
+        return -errno;
+    }
+    return 0;
+}
+
+/* A request for OUTPUT buffer 'index', free again once the buffer is. */
+static int get_request(struct m2m_dev* dev, unsigned int index)
+{
+    int* fd = &dev->req_fds[index];
+    struct pollfd pfd;
+
+    if (*fd < 0) {
+        if (ioctl(dev->media_fd, MEDIA_IOC_REQUEST_ALLOC, fd)) {
+            *fd = -1;
+            fprintf(stderr, "%s:%d: ", __func__, __LINE__);
+            perror("ioctl");
+            return -errno;
+        }
+        return *fd;
+    }
+
+    /* the driver may complete the request just after the buffer */
+    pfd.fd = *fd;
+    pfd.events = POLLPRI;
+    poll(&pfd, 1, 1000);
+    if (ioctl(*fd, MEDIA_REQUEST_IOC_REINIT)) {
+        fprintf(stderr, "%s:%d: ", __func__, __LINE__);
+        perror("ioctl");
+        return -errno;
+    }
+    return *fd;
+}
+
+static int queue_buf(struct m2m_dev* dev, uint32_t type, unsigned int index,
+    int fd, size_t bytesused, int request_fd)
+{
+    struct v4l2_buffer buf;
+
+    memset(&(buf), 0, sizeof(buf));
+    buf.type = type;
+    buf.memory = V4L2_MEMORY_DMABUF;
+    buf.bytesused = bytesused;
+    buf.index = index;
+    buf.m.fd = fd;
+    if (request_fd >= 0) {
+        buf.flags = V4L2_BUF_FLAG_REQUEST_FD;
+        buf.request_fd = request_fd;
+    }
+    if (m2m_ioctl(dev->fd, VIDIOC_QBUF, &buf)) {
+        fprintf(stderr, "%s:%d: ", __func__, __LINE__);
+        perror("ioctl");
+        return -errno;
+    }
+    return 0;
+}
+
+int m2m_queue_ctrls(struct m2m_dev* dev, unsigned int index, int src_fd,
+    int dst_fd, const struct m2m_ctrls* ctrls)
+{
+    int req = -1, ret;
+
+    if (dev->media_fd >= 0 && (ctrls || dev->uses_requests)) {
+        req = get_request(dev, index);
+        if (req < 0)
+            return req;
+        if (ctrls) {
+            ret = set_ctrls(dev, ctrls, req);
+            if (ret)
+                return ret;
+        }
+        dev->uses_requests = 1;
+    } else if (ctrls && memcmp(ctrls, &dev->cur, sizeof(*ctrls))) {
+        /* the queued jobs would run with them too */
+        if (dev->num_queued)
+            return -EBUSY;
+        ret = set_ctrls(dev, ctrls, -1);
+        if (ret)
+            return ret;
+        dev->cur = *ctrls;
+    }
+
+    ret = queue_buf(dev, V4L2_BUF_TYPE_VIDEO_OUTPUT, index, src_fd,
+        dev->src_size[index], req);
+    if (ret)
+        return ret;
+
+    if (req >= 0 && ioctl(req, MEDIA_REQUEST_IOC_QUEUE)) {
+        fprintf(stderr, "%s:%d: ", __func__, __LINE__);
+        perror("ioctl");
+        return -errno;
+    }
+
+    ret = queue_buf(dev, V4L2_BUF_TYPE_VIDEO_CAPTURE, index, dst_fd, 0, -1);
+    if (!ret)
+        dev->num_queued++;
+    return ret;
+}
+
+int m2m_queue(struct m2m_dev* dev, unsigned int index, int src_fd, int dst_fd)
+{
+    return m2m_queue_ctrls(dev, index, src_fd, dst_fd, NULL);
+}
+
+int m2m_dequeue(struct m2m_dev* dev)
+{
+    struct v4l2_buffer buf;
+
+    memset(&(buf), 0, sizeof(buf));
+    buf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+    buf.memory = V4L2_MEMORY_DMABUF;
+    m2m_ioctl(dev->fd, VIDIOC_DQBUF, &buf);
+
+    memset(&(buf), 0, sizeof(buf));
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_DMABUF;
+    if (m2m_ioctl(dev->fd, VIDIOC_DQBUF, &buf)) {
+        fprintf(stderr, "%s:%d: ", __func__, __LINE__);
+        perror("ioctl");
+        return -errno;
+    }
+    dev->num_queued--;
+    return buf.index;
+}
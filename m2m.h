@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) Fuzhou Rockchip Electronics Co.Ltd
+ * Author: Jacob Chen <jacob-chen@iotwrt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#ifndef __M2M_H_INCLUDED__
+#define __M2M_H_INCLUDED__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "caps.h"
+#include "format.h"
+
+#define M2M_MAX_BUFS 4
+#define M2M_MAX_DEVS 16
+
+struct rga_rect;
+
+/* The controls that can change from one job to the next. */
+struct m2m_ctrls {
+	int rotate;
+	int hflip;
+	int vflip;
+	int blend;		/* enum v4l2_blend_mode */
+	uint32_t fill_color;	/* 0 keeps the driver's */
+};
+
+struct m2m_config {
+	uint32_t src_format;
+	uint32_t src_width;
+	uint32_t src_height;
+	uint32_t dst_format;
+	uint32_t dst_width;
+	uint32_t dst_height;
+	int rotate;
+	int hflip;
+	int vflip;
+	struct colorimetry src_color;
+	struct colorimetry dst_color;
+	int blend;		/* enum v4l2_blend_mode */
+	uint32_t fill_color;
+};
+
+/* A V4L2 mem2mem node with DMABUF queues on both sides. */
+struct m2m_dev {
+	int fd;
+	char path[32];
+	unsigned int num_src_bufs;
+	unsigned int num_dst_bufs;
+	size_t src_size[M2M_MAX_BUFS];
+	size_t dst_size[M2M_MAX_BUFS];
+	struct m2m_caps caps;
+
+	/* media device for the request API, -1 when the node has none */
+	int media_fd;
+	int req_fds[M2M_MAX_BUFS];	/* one request per OUTPUT buffer */
+	int uses_requests;
+	struct m2m_ctrls cur;		/* last controls set outside a request */
+	unsigned int num_queued;	/* by m2m_queue*(), not yet dequeued */
+};
+
+/* Scan /dev/video* for mem2mem nodes, returns how many paths were stored. */
+int find_m2m_devs(char paths[][32], int max);
+
+struct m2m_dev* open_m2m_dev(const char *path);
+void close_m2m_dev(struct m2m_dev *dev);
+
+/*
+ * Controls and formats; fails when the node rejects or adjusts either
+ * format. Check plan_transform() on dev->caps first.
+ */
+int m2m_set_config(struct m2m_dev *dev, const struct m2m_config *cfg);
+int m2m_request_bufs(struct m2m_dev *dev, unsigned int num_src,
+		     unsigned int num_dst);
+int m2m_stream(struct m2m_dev *dev, int on);
+
+/* OUTPUT crop or, with 'capture', CAPTURE compose rectangle. */
+int m2m_set_selection(struct m2m_dev *dev, int capture, const struct rga_rect *r);
+
+int m2m_queue(struct m2m_dev *dev, unsigned int index, int src_fd, int dst_fd);
+/*
+ * Queue a job with its own controls. They travel with the OUTPUT buffer in
+ * a media request where the node supports the request API; otherwise they
+ * are set right away, which would hit the jobs still queued, so changing
+ * them fails with -EBUSY until m2m_dequeue() took every job back. Once a
+ * node has seen a request, every job needs one and m2m_queue() sends an
+ * empty one.
+ */
+int m2m_queue_ctrls(struct m2m_dev *dev, unsigned int index, int src_fd,
+		    int dst_fd, const struct m2m_ctrls *ctrls);
+/* Wait for the oldest job, returns the CAPTURE index or a negative error. */
+int m2m_dequeue(struct m2m_dev *dev);
+
+#endif /* __M2M_H_INCLUDED__ */
@@ -14,6 +14,8 @@
  * limitations under the License.
 */
 
+#include <errno.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -118,6 +120,9 @@ int initialize_screens(struct sp_dev *dev) {
 
 		fill_bo(cr->scanout, 0xFF, 0x0, 0x0, 0x0);
 
+		if (add_fb_sp_bo(cr->scanout, cr->scanout->format))
+			continue;
+
 		ret = drmModeSetCrtc(dev->fd, cr->crtc->crtc_id,
 				     cr->scanout->fb_id, 0, 0, &c->connector_id,
 				     1, m);
@@ -179,6 +184,10 @@ int set_sp_plane(struct sp_dev *dev, struct sp_plane *plane,
 	int ret;
 	uint32_t w, h;
 
+	ret = add_fb_sp_bo(plane->bo, plane->bo->format);
+	if (ret)
+		return ret;
+
 	w = plane->bo->width;
 	h = plane->bo->height;
 
@@ -198,12 +207,70 @@ int set_sp_plane(struct sp_dev *dev, struct sp_plane *plane,
 	return ret;
 }
 
+int commit_sp_plane(struct sp_dev *dev, struct sp_plane *plane,
+		    struct sp_crtc *crtc, int x, int y, int in_fence,
+		    int *out_fence) {
+	drmModeAtomicReqPtr req;
+	uint32_t id = plane->plane->plane_id;
+	uint32_t w, h;
+	int32_t fence = -1;
+	int ret;
+
+	*out_fence = -1;
+	if (!plane->fb_pid || (in_fence >= 0 && !plane->in_fence_pid))
+		return -ENOTSUP;
+	ret = add_fb_sp_bo(plane->bo, plane->bo->format);
+	if (ret)
+		return ret;
+
+	w = plane->bo->width;
+	h = plane->bo->height;
+
+	if ((w + x) > crtc->crtc->mode.hdisplay)
+		w = crtc->crtc->mode.hdisplay - x;
+	if ((h + y) > crtc->crtc->mode.vdisplay)
+		h = crtc->crtc->mode.vdisplay - y;
+
+	req = drmModeAtomicAlloc();
+	if (!req)
+		return -ENOMEM;
+
+	drmModeAtomicAddProperty(req, id, plane->crtc_pid, crtc->crtc->crtc_id);
+	drmModeAtomicAddProperty(req, id, plane->fb_pid, plane->bo->fb_id);
+	drmModeAtomicAddProperty(req, id, plane->crtc_x_pid, x);
+	drmModeAtomicAddProperty(req, id, plane->crtc_y_pid, y);
+	drmModeAtomicAddProperty(req, id, plane->crtc_w_pid, w);
+	drmModeAtomicAddProperty(req, id, plane->crtc_h_pid, h);
+	drmModeAtomicAddProperty(req, id, plane->src_x_pid, 0);
+	drmModeAtomicAddProperty(req, id, plane->src_y_pid, 0);
+	drmModeAtomicAddProperty(req, id, plane->src_w_pid, w << 16);
+	drmModeAtomicAddProperty(req, id, plane->src_h_pid, h << 16);
+	if (in_fence >= 0)
+		drmModeAtomicAddProperty(req, id, plane->in_fence_pid, in_fence);
+	if (crtc->out_fence_pid)
+		drmModeAtomicAddProperty(req, crtc->crtc->crtc_id,
+					 crtc->out_fence_pid, (uintptr_t)&fence);
+
+	ret = drmModeAtomicCommit(dev->fd, req, DRM_MODE_ATOMIC_NONBLOCK, NULL);
+	drmModeAtomicFree(req);
+	if (ret) {
+		printf("failed to commit plane ret=%d\n", ret);
+		return ret;
+	}
+
+	*out_fence = fence;
+	return 0;
+}
+
 #ifdef USE_ATOMIC_API
 int set_sp_plane_pset(struct sp_dev *dev, struct sp_plane *plane,
 		      drmModePropertySetPtr pset, struct sp_crtc *crtc, int x, int y) {
 	int ret;
 	uint32_t w, h;
 
+	if (add_fb_sp_bo(plane->bo, plane->bo->format))
+		return -1;
+
 	w = plane->bo->width;
 	h = plane->bo->height;
 
@@ -33,6 +33,16 @@ void put_sp_plane(struct sp_plane *plane);
 int set_sp_plane(struct sp_dev *dev, struct sp_plane *plane,
 		 struct sp_crtc *crtc, int x, int y);
 
+/*
+ * Non-blocking atomic flip that the kernel holds back until 'in_fence'
+ * (-1 for none) signals. '*out_fence' is a sync_file that signals when the
+ * flip is on screen, -1 if the CRTC can't provide one. -ENOTSUP without
+ * the atomic plane properties.
+ */
+int commit_sp_plane(struct sp_dev *dev, struct sp_plane *plane,
+		    struct sp_crtc *crtc, int x, int y, int in_fence,
+		    int *out_fence);
+
 #ifdef USE_ATOMIC_API
 int set_sp_plane_pset(struct sp_dev *dev, struct sp_plane *plane,
 		      drmModePropertySetPtr pset, struct sp_crtc *crtc, int x, int y);
@@ -0,0 +1,397 @@
+/*
+ * Copyright (C) Fuzhou Rockchip Electronics Co.Ltd
+ * Author: Jacob Chen <jacob-chen@iotwrt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bo.h"
+#include "convert.h"
+#include "cpu_rga.h"
+#include "format.h"
+#include "pattern.h"
+#include "simd.h"
+#include "wcmem.h"
+#include "threadpool.h"
+
+/* rows per work item, even so 4:2:0 chroma rows never straddle two items */
+#define BAND_ROWS 16
+
+struct fill_job {
+    int type;
+    uint32_t color;
+    struct image img;
+    uint32_t width;
+    uint32_t height;
+    uint32_t frame;
+
+    struct rga_rect box;
+};
+
+static const char* pattern_names[NUM_PATTERNS] = {
+    "checker", "smpte", "gradient", "zoneplate", "box", "solid",
+};
+
+static uint8_t sin_lut[256];
+static pthread_once_t sin_lut_once = PTHREAD_ONCE_INIT;
+
+static void init_sin_lut(void)
+{
+    int i;
+
+    for (i = 0; i < 256; i++)
+        sin_lut[i] = 128 + (int)lrint(127.0 * sin(2.0 * M_PI * i / 256.0));
+}
+
+int parse_pattern(const char* arg)
+{
+    int i;
+
+    for (i = 0; i < NUM_PATTERNS; i++) {
+        if (!strcmp(arg, pattern_names[i]))
+            return i;
+    }
+
+    i = atoi(arg);
+    if (i < 0 || i >= NUM_PATTERNS || (i == 0 && arg[0] != '0'))
+        return -1;
+    return i;
+}
+
+const char* pattern_name(int type)
+{
+    if (type < 0 || type >= NUM_PATTERNS)
+        return "unknown";
+    return pattern_names[type];
+}
+
+int pattern_is_animated(int type)
+{
+    return type == PATTERN_GRADIENT || type == PATTERN_ZONEPLATE || type == PATTERN_MOVING_BOX;
+}
+
+/*
+ * Rows with equal keys are identical, so a band only generates the rows
+ * where the key changes and copies the rest.
+ */
+static uint32_t row_key(const struct fill_job* job, uint32_t y)
+{
+    switch (job->type) {
+    case PATTERN_CHECKER:
+        return y / 16;
+    case PATTERN_SMPTE:
+        if (y < job->height * 2 / 3)
+            return 0;
+        if (y < job->height * 3 / 4)
+            return 1;
+        return 2;
+    case PATTERN_GRADIENT:
+        return (y * 256) / job->height;
+    case PATTERN_ZONEPLATE:
+        return y;
+    case PATTERN_MOVING_BOX:
+        return y >= job->box.y && y < job->box.y + job->box.h;
+    }
+    return 0;
+}
+
+static void gen_checker(const struct fill_job* job, uint32_t y, uint32_t* row)
+{
+    const v4u32 step = { 0, 1, 2, 3 };
+    v4u32 xs, idx, rgb;
+    uint32_t x, i;
+
+    for (x = 0; x + 4 <= job->width; x += 4) {
+        xs = splat_v4u32(x) + step;
+        idx = (xs >> 4) + (y >> 4);
+        rgb = ((idx & 0x3) << 6) | ((idx & 0xc) << 12) | ((idx & 0x30) << 18);
+        store_v4u32(row + x, rgb | 0xff000000);
+    }
+    for (; x < job->width; x++) {
+        i = x / 16 + y / 16;
+        row[x] = 0xff000000 | ((i & 0x3) << 6) | ((i & 0xc) << 12) | ((i & 0x30) << 18);
+    }
+}
+
+static void gen_smpte(const struct fill_job* job, uint32_t y, uint32_t* row)
+{
+    static const uint32_t top[7] = {
+        0xffc0c0c0, 0xffc0c000, 0xff00c0c0, 0xff00c000,
+        0xffc000c0, 0xffc00000, 0xff0000c0,
+    };
+    static const uint32_t middle[7] = {
+        0xff0000c0, 0xff131313, 0xffc000c0, 0xff131313,
+        0xff00c0c0, 0xff131313, 0xffc0c0c0,
+    };
+    static const uint32_t bottom[4] = {
+        0xff00214c, 0xffffffff, 0xff32006a, 0xff131313,
+    };
+    static const uint32_t pluge[3] = { 0xff090909, 0xff131313, 0xff1d1d1d };
+    uint32_t w = job->width;
+    uint32_t band = row_key(job, y);
+    uint32_t x, seg;
+
+    for (x = 0; x < w; x++) {
+        seg = x * 7 / w;
+        if (band == 0) {
+            row[x] = top[seg];
+        } else if (band == 1) {
+            row[x] = middle[seg];
+        } else if (x < w * 5 / 7) {
+            row[x] = bottom[x * 4 / (w * 5 / 7)];
+        } else if (x < w * 6 / 7) {
+            row[x] = pluge[(x - w * 5 / 7) * 3 / (w * 6 / 7 - w * 5 / 7)];
+        } else {
+            row[x] = 0xff131313;
+        }
+    }
+}
+
+static void gen_gradient(const struct fill_job* job, uint32_t y, uint32_t* row)
+{
+    const v4u32 step = { 0, 1, 2, 3 };
+    uint32_t xstep = (256 << 16) / job->width;
+    uint32_t g = (y * 256) / job->height;
+    uint32_t base = 0xff000080 | (g << 8);
+    v4u32 xs, r;
+    uint32_t x;
+
+    for (x = 0; x + 4 <= job->width; x += 4) {
+        xs = splat_v4u32(x) + step;
+        r = (((xs * xstep) >> 16) + job->frame) & 0xff;
+        store_v4u32(row + x, (r << 16) | base);
+    }
+    for (; x < job->width; x++)
+        row[x] = ((((x * xstep) >> 16) + job->frame) & 0xff) << 16 | base;
+}
+
+static void gen_zoneplate(const struct fill_job* job, uint32_t y, uint32_t* row)
+{
+    const v4i32 step = { 0, 1, 2, 3 };
+    int32_t cx = job->width / 2;
+    int32_t dy = (int32_t)y - (int32_t)(job->height / 2);
+    uint32_t k = (128 << 8) / job->width + 1;
+    uint32_t phase = job->frame * 8;
+    v4i32 dx;
+    v4u32 idx;
+    uint32_t x, i, v;
+
+    for (x = 0; x + 4 <= job->width; x += 4) {
+        dx = splat_v4i32((int32_t)x - cx) + step;
+        idx = (((v4u32)(dx * dx + dy * dy) * k) >> 8) + phase;
+        for (i = 0; i < 4; i++) {
+            v = sin_lut[idx[i] & 0xff];
+            row[x + i] = 0xff000000 | (v << 16) | (v << 8) | v;
+        }
+    }
+    for (; x < job->width; x++) {
+        int32_t d = (int32_t)x - cx;
+
+        v = sin_lut[((((uint32_t)(d * d + dy * dy) * k) >> 8) + phase) & 0xff];
+        row[x] = 0xff000000 | (v << 16) | (v << 8) | v;
+    }
+}
+
+static void gen_solid(uint32_t color, uint32_t* row, uint32_t width)
+{
+    v4u32 c = splat_v4u32(color);
+    uint32_t x;
+
+    for (x = 0; x + 4 <= width; x += 4)
+        store_v4u32(row + x, c);
+    for (; x < width; x++)
+        row[x] = color;
+}
+
+static void gen_moving_box(const struct fill_job* job, uint32_t y, uint32_t* row)
+{
+    gen_solid(0xff404040, row, job->width);
+    if (row_key(job, y))
+        gen_solid(job->color, row + job->box.x, job->box.w);
+}
+
+static void gen_row(const struct fill_job* job, uint32_t y, uint32_t* row)
+{
+    switch (job->type) {
+    case PATTERN_CHECKER:
+        gen_checker(job, y, row);
+        break;
+    case PATTERN_SMPTE:
+        gen_smpte(job, y, row);
+        break;
+    case PATTERN_GRADIENT:
+        gen_gradient(job, y, row);
+        break;
+    case PATTERN_ZONEPLATE:
+        gen_zoneplate(job, y, row);
+        break;
+    case PATTERN_MOVING_BOX:
+        gen_moving_box(job, y, row);
+        break;
+    default:
+        gen_solid(job->color, row, job->width);
+        break;
+    }
+}
+
+/* Rows of 'line', packed in host memory, into row 'y' of the frame. */
+static void store_luma(const struct image* img, const struct image* line, uint32_t y)
+{
+    wc_copy(img->planes[0] + (size_t)y * img->pitches[0], line->planes[0], img->pitches[0]);
+}
+
+static void store_chroma(const struct image* img, const struct image* line, uint32_t y)
+{
+    uint32_t cy = y / img->fi->ysub;
+    int i;
+
+    for (i = 1; i < img->fi->num_planes; i++)
+        wc_copy(img->planes[i] + (size_t)cy * img->pitches[i], line->planes[i], img->pitches[i]);
+}
+
+static void fill_bands(void* arg, int begin, int end)
+{
+    const struct fill_job* job = (const struct fill_job*)arg;
+    const struct image* img = &job->img;
+    const struct fmt_info* fi = img->fi;
+    uint32_t y0 = begin * BAND_ROWS;
+    uint32_t y1 = end * BAND_ROWS;
+    uint32_t y, key, last_key = 0, last_ckey = 0;
+    int have_last = 0, have_ckey = 0, chroma, i;
+    struct image line;
+    uint32_t* row;
+    uint8_t* packed;
+    size_t size = 0;
+
+    if (y1 > job->height)
+        y1 = job->height;
+
+    /*
+     * The last packed row of every plane stays in host memory, repeats are
+     * stored from there: reading them back from an uncached or
+     * write-combined mapping costs more than packing them again.
+     */
+    for (i = 0; i < fi->num_planes; i++)
+        size += img->pitches[i];
+    row = (uint32_t*)calloc(1, job->width * sizeof(*row) + size);
+    if (!row)
+        return;
+    packed = (uint8_t*)(row + job->width);
+
+    line = *img;
+    line.height = 1;
+    for (i = 0; i < fi->num_planes; i++) {
+        line.planes[i] = packed;
+        packed += img->pitches[i];
+    }
+
+    for (y = y0; y < y1; y++) {
+        key = row_key(job, y);
+        chroma = fi->is_yuv && (y % fi->ysub) == 0;
+
+        if (!have_last || key != last_key) {
+            gen_row(job, y, row);
+            pack_row(&line, 0, row, chroma);
+            if (chroma) {
+                last_ckey = key;
+                have_ckey = 1;
+            }
+        } else if (chroma && (!have_ckey || key != last_ckey)) {
+            gen_row(job, y, row);
+            pack_chroma_row(&line, 0, row);
+            last_ckey = key;
+            have_ckey = 1;
+        }
+
+        store_luma(img, &line, y);
+        if (chroma)
+            store_chroma(img, &line, y);
+
+        last_key = key;
+        have_last = 1;
+    }
+
+    free(row);
+}
+
+static uint32_t bounce(uint32_t pos, uint32_t range)
+{
+    if (!range)
+        return 0;
+    pos %= 2 * range;
+    return pos < range ? pos : 2 * range - pos;
+}
+
+static void get_box(uint32_t width, uint32_t height, uint32_t frame, struct rga_rect* r)
+{
+    r->w = width / 8 ? width / 8 : 1;
+    r->h = height / 8 ? height / 8 : 1;
+    r->x = bounce(frame * (width / 128 + 1), width - r->w);
+    r->y = bounce(frame * (height / 128 + 1), height - r->h);
+}
+
+int pattern_damage(int type, uint32_t width, uint32_t height, uint32_t frame,
+    struct rga_rect* rects, int max)
+{
+    if (!frame)
+        return -1;
+    if (!pattern_is_animated(type))
+        return 0;
+    if (type != PATTERN_MOVING_BOX || max < 2)
+        return -1;
+
+    /* where the box was is background again */
+    get_box(width, height, frame - 1, &rects[0]);
+    get_box(width, height, frame, &rects[1]);
+    return 2;
+}
+
+int fill_pattern(int type, uint32_t color, uint32_t v4l2_format, void* addr,
+    uint32_t width, uint32_t height, uint32_t frame, const struct colorimetry* c)
+{
+    struct fill_job job;
+
+    memset(&job, 0, sizeof(job));
+    if (!addr || !width || !height || init_image(&job.img, v4l2_format, addr, width, height)) {
+        printf("%s: unsupported format %.4s\n", __func__, (char*)&v4l2_format);
+        return -1;
+    }
+    set_image_colorimetry(&job.img, c);
+
+    pthread_once(&sin_lut_once, init_sin_lut);
+
+    job.type = type;
+    job.color = color;
+    job.width = width;
+    job.height = height;
+    job.frame = frame;
+
+    get_box(width, height, frame, &job.box);
+
+    parallel_for(get_default_thread_pool(), (height + BAND_ROWS - 1) / BAND_ROWS, 1,
+        fill_bands, &job);
+    return 0;
+}
+
+int fill_pattern_bo(int type, uint32_t color, uint32_t v4l2_format,
+    struct sp_bo* bo, uint32_t frame, const struct colorimetry* c)
+{
+    int ret;
+
+    /* every row is stored from host memory, nothing is read back */
+    if (begin_cpu_sp_bo(bo, SP_BO_WRITE))
+        return -1;
+    ret = fill_pattern(type, color, v4l2_format, bo->map_addr, bo->width,
+        bo->height, frame, c);
+    end_cpu_sp_bo(bo, SP_BO_WRITE);
+    return ret;
+}
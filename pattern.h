@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) Fuzhou Rockchip Electronics Co.Ltd
+ * Author: Jacob Chen <jacob-chen@iotwrt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#ifndef __PATTERN_H_INCLUDED__
+#define __PATTERN_H_INCLUDED__
+
+#include <stdint.h>
+
+enum pattern_type {
+	PATTERN_CHECKER		= 0,	/* 16x16 colour blocks */
+	PATTERN_SMPTE		= 1,	/* SMPTE RP 219 style colour bars */
+	PATTERN_GRADIENT	= 2,	/* R/G ramps, B scrolls with the frame */
+	PATTERN_ZONEPLATE	= 3,	/* circular zone plate, phase per frame */
+	PATTERN_MOVING_BOX	= 4,	/* box bouncing over a grey background */
+	PATTERN_SOLID		= 5,	/* single colour */
+	NUM_PATTERNS
+};
+
+struct colorimetry;
+struct rga_rect;
+struct sp_bo;
+
+int parse_pattern(const char* arg);
+const char* pattern_name(int type);
+int pattern_is_animated(int type);
+
+/*
+ * The rectangles where frame 'frame' differs from the one before, at most
+ * 'max'. Returns -1 when the whole frame changes.
+ */
+int pattern_damage(int type, uint32_t width, uint32_t height, uint32_t frame,
+    struct rga_rect* rects, int max);
+
+/*
+ * Render frame 'frame' of a pattern into a buffer laid out as described in
+ * format.h. 'color' is 0xAARRGGBB and used by PATTERN_SOLID and as the box
+ * colour of PATTERN_MOVING_BOX. YUV frames are encoded as described by
+ * 'c', NULL for BT.601 limited range. Rows are generated in parallel on
+ * the default thread pool.
+ */
+int fill_pattern(int type, uint32_t color, uint32_t v4l2_format, void* addr,
+    uint32_t width, uint32_t height, uint32_t frame, const struct colorimetry* c);
+int fill_pattern_bo(int type, uint32_t color, uint32_t v4l2_format,
+    struct sp_bo* bo, uint32_t frame, const struct colorimetry* c);
+
+#endif /* __PATTERN_H_INCLUDED__ */
@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) Fuzhou Rockchip Electronics Co.Ltd
+ * Author: Jacob Chen <jacob-chen@iotwrt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hash.h"
+#include "rescache.h"
+
+struct result_slot {
+    uint64_t src;
+    uint32_t xform_hash;	/* rules most slots out before the memcmp */
+    uint8_t* xform;
+    int valid;
+    uint64_t last_use;
+};
+
+struct result_cache {
+    int num_slots;
+    size_t xform_size;
+    uint8_t* xforms;
+    uint64_t clock;
+    unsigned long hits;
+    unsigned long misses;
+    struct result_slot* slots;
+};
+
+struct result_cache* create_result_cache(int num_slots, size_t xform_size)
+{
+    struct result_cache* rc;
+    int i;
+
+    if (num_slots <= 0)
+        return NULL;
+
+    rc = (struct result_cache*)calloc(1, sizeof(*rc));
+    if (!rc)
+        return NULL;
+
+    rc->slots = (struct result_slot*)calloc(num_slots, sizeof(*rc->slots));
+    rc->xforms = (uint8_t*)calloc(num_slots, xform_size ? xform_size : 1);
+    if (!rc->slots || !rc->xforms) {
+        free(rc->slots);
+        free(rc->xforms);
+        free(rc);
+        return NULL;
+    }
+    for (i = 0; i < num_slots; i++)
+        rc->slots[i].xform = rc->xforms + i * xform_size;
+    rc->num_slots = num_slots;
+    rc->xform_size = xform_size;
+    return rc;
+}
+
+void destroy_result_cache(struct result_cache* rc)
+{
+    if (!rc)
+        return;
+    printf("*[CACHE]* : %lu hits, %lu misses\n", rc->hits, rc->misses);
+    free(rc->xforms);
+    free(rc->slots);
+    free(rc);
+}
+
+int result_cache_find(struct result_cache* rc, uint64_t src, const void* xform)
+{
+    uint32_t hash = xxh32(xform, rc->xform_size, 0);
+    int i;
+
+    for (i = 0; i < rc->num_slots; i++) {
+        struct result_slot* s = &rc->slots[i];
+
+        if (s->valid && s->src == src && s->xform_hash == hash
+            && !memcmp(s->xform, xform, rc->xform_size)) {
+            s->last_use = ++rc->clock;
+            rc->hits++;
+            return i;
+        }
+    }
+    rc->misses++;
+    return -1;
+}
+
+int result_cache_replace(struct result_cache* rc, uint64_t src, const void* xform)
+{
+    struct result_slot* lru = &rc->slots[0];
+    int i;
+
+    /* invalid slots have never been used and sort first */
+    for (i = 1; i < rc->num_slots; i++) {
+        if (rc->slots[i].last_use < lru->last_use)
+            lru = &rc->slots[i];
+    }
+
+    lru->src = src;
+    lru->xform_hash = xxh32(xform, rc->xform_size, 0);
+    memcpy(lru->xform, xform, rc->xform_size);
+    lru->valid = 1;
+    lru->last_use = ++rc->clock;
+    return lru - rc->slots;
+}
+
+void result_cache_drop(struct result_cache* rc, int slot)
+{
+    rc->slots[slot].valid = 0;
+    rc->slots[slot].last_use = 0;
+}
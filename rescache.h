@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) Fuzhou Rockchip Electronics Co.Ltd
+ * Author: Jacob Chen <jacob-chen@iotwrt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#ifndef __RESCACHE_H_INCLUDED__
+#define __RESCACHE_H_INCLUDED__
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct result_cache;
+
+/*
+ * Results of earlier transforms. The caller owns one destination buffer
+ * per slot; the cache remembers which source and transform produced the
+ * contents of each, so a repeated transform becomes a lookup. 'src' is a
+ * content hash or any generation number the caller bumps on every change,
+ * 'xform' the 'xform_size' bytes of everything else that went into the
+ * result. Those are kept and compared whole, a transform is never taken
+ * for another one with the same hash.
+ */
+struct result_cache* create_result_cache(int num_slots, size_t xform_size);
+void destroy_result_cache(struct result_cache *rc);
+
+/* The slot holding the result, or -1. */
+int result_cache_find(struct result_cache *rc, uint64_t src, const void *xform);
+
+/*
+ * The least recently used slot, to produce the result in. It is found
+ * from now on; result_cache_drop() it when the transform fails. With two
+ * or more slots, the last result found is never handed out here.
+ */
+int result_cache_replace(struct result_cache *rc, uint64_t src, const void *xform);
+void result_cache_drop(struct result_cache *rc, int slot);
+
+#endif /* __RESCACHE_H_INCLUDED__ */
@@ -14,6 +14,8 @@
 #include <fcntl.h>
 #include <getopt.h>
 #include <malloc.h>
+#include <poll.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -27,28 +29,32 @@
 #include <linux/stddef.h>
 #include <linux/videodev2.h>
 
+#include "arena.h"
 #include "bo.h"
 #include "dev.h"
+#include "fakem2m.h"
+#include "fence.h"
+#include "format.h"
+#include "frameio.h"
+#include "governor.h"
+#include "graph.h"
+#include "hash.h"
+#include "m2m.h"
 #include "modeset.h"
-
-/* operation values */
-#define V4L2_CID_BLEND			(V4L2_CID_IMAGE_PROC_CLASS_BASE + 4)
-enum v4l2_blend_mode {
-	V4L2_BLEND_SRC			= 0,
-	V4L2_BLEND_SRCATOP		= 1,
-	V4L2_BLEND_SRCIN		= 2,
-	V4L2_BLEND_SRCOUT		= 3,
-	V4L2_BLEND_SRCOVER		= 4,
-	V4L2_BLEND_DST			= 5,
-	V4L2_BLEND_DSTATOP		= 6,
-	V4L2_BLEND_DSTIN		= 7,
-	V4L2_BLEND_DSTOUT		= 8,
-	V4L2_BLEND_DSTOVER		= 9,
-	V4L2_BLEND_ADD			= 10,
-	V4L2_BLEND_CLEAR		= 11,
-};
+#include "pattern.h"
+#include "rga.h"
+#include "rescache.h"
+#include "rgad.h"
+#include "scheduler.h"
+#include "session.h"
+#include "snapshot.h"
+#include "soak.h"
+#include "tile.h"
+#include "uring.h"
+#include "verify.h"
 
 #define NUM_BUFS 4
+#define MAX_SRC_FRAMES 32
 
 static char* mem2mem_dev_name = NULL;
 
@@ -59,6 +65,94 @@ static int fill_color = 0;
 static int op = 0;
 static int num_frames = 1;
 static int display = 0;
+static char* heap_name = NULL;
+
+/* buffers asked from the node, 0 for what the mode needs */
+static unsigned int src_pool = 0, dst_pool = 0;
+
+/* set up everything, then wait for a line on stdin before the first frame */
+static int warm = 0;
+static char* save_config_path = NULL;
+static struct timespec launch;
+static int first_frame_done = 0;
+
+/* rounds of randomized runs until the time is up, see run_soak() */
+static int soak_secs = 0;
+static unsigned int soak_seed = 0;
+static unsigned long long soak_frames, soak_us;
+
+static int governor_ceiling_mc = 0;
+static char* sysfs_root = NULL;
+static struct governor* governor;
+
+static int pattern = PATTERN_CHECKER;
+static uint32_t pattern_color = 0xffffffff;
+static int pattern_cache = 0;
+
+static int verify = 0;
+static int verify_tolerance = 255;
+static double verify_psnr = 30.0;
+static char* verify_dump_dir = NULL;
+static struct verifier* verifier;
+static int verify_failures = 0;
+/* runs that stopped before their last frame */
+static int run_failures = 0;
+
+static char* input_path = NULL;
+static char* output_path = NULL;
+static struct frame_reader* reader;
+static struct frame_writer* writer;
+
+static int use_uring = 0;
+
+static int use_fences = 0;
+
+/* degrees added to the rotation of every job */
+static int spin = 0;
+static unsigned int num_spun;
+
+static uint32_t bo_flags = 0;
+static struct sw_timeline* timeline;
+static int flip_fence = -1;
+
+#define MAX_SCHED_SLOTS 16
+
+static char* sched_devices = NULL;
+static int cpu_workers = 0;
+
+/* class of the scheduled jobs, and how long after submission they are due */
+static int job_prio = SCHED_PRIO_REALTIME;
+static int job_late = SCHED_LATE_RUN;
+static uint32_t job_budget_us = 0;
+
+static char* serve_path = NULL;
+static char* client_path = NULL;
+static struct rgad* server;
+static struct rgad_client* client;
+static int client_src_id[NUM_BUFS];
+static int client_dst_id[NUM_BUFS];
+
+static int probe = 0;
+
+static int tile_width = 0;
+static struct stripe stripes[MAX_STRIPES];
+static int num_stripes = 0;
+static struct sched* scheduler;
+static struct sched_job sched_jobs[MAX_SCHED_SLOTS];
+static struct sp_bo* sched_src_bo[MAX_SCHED_SLOTS];
+static struct sp_bo* sched_dst_bo[MAX_SCHED_SLOTS];
+static int sched_src_fd[MAX_SCHED_SLOTS], sched_dst_fd[MAX_SCHED_SLOTS];
+static struct timespec sched_start[MAX_SCHED_SLOTS];
+static int num_sched_slots = 0;
+
+#define MAX_GRAPH_BUFS 8
+
+static struct rga_rect osd_rect;
+static uint32_t osd_color = 0x80ffffff;
+static struct graph* graph;
+static struct graph_io graph_io;
+static struct sp_bo* osd_bo;
+static struct sp_bo* graph_bo[MAX_GRAPH_BUFS];
 
 static size_t SRC_WIDTH = 1024;
 static size_t SRC_HEIGHT = 768;
@@ -75,20 +169,41 @@ static size_t DST_CROP_X = 0;
 static size_t DST_CROP_Y = 0;
 static size_t DST_CROP_W = 0;
 static size_t DST_CROP_H = 0;
+/* what the single node composes into, only it takes the crop */
+static struct rga_rect dst_compose;
 
 static int src_format = V4L2_PIX_FMT_NV12;
 static int dst_format = V4L2_PIX_FMT_NV12;
+static struct colorimetry src_color;
+static struct colorimetry dst_color;
 
 static struct timespec start, end;
 static unsigned long long time_consumed;
+/* the single node, 'm2m' is its device for the loops that queue by hand */
+static rga::Session session;
+static struct m2m_dev* m2m;
 static int mem2mem_fd;
 
 static void *p_src_buf[NUM_BUFS], *p_dst_buf[NUM_BUFS];
 static int src_buf_fd[NUM_BUFS], dst_buf_fd[NUM_BUFS];
 static struct sp_bo *src_buf_bo[NUM_BUFS], *dst_buf_bo[NUM_BUFS];
-static size_t src_buf_size[NUM_BUFS], dst_buf_size[NUM_BUFS];
 static unsigned int num_src_bufs = 0, num_dst_bufs = 0;
 
+static struct sp_bo* src_frame_bo[MAX_SRC_FRAMES];
+static int src_frame_fd[MAX_SRC_FRAMES];
+static int num_src_frames = 0;
+
+/* transform only what changed since the previous frame */
+#define MAX_DAMAGE 8
+static int damage = 0;
+
+/* destination buffers that keep the results of repeated transforms */
+#define MAX_RESULTS 16
+static int num_results = 0;
+static struct result_cache* results;
+static struct sp_bo* result_bo[MAX_RESULTS];
+static int result_fd[MAX_RESULTS];
+
 static struct sp_dev* dev_sp;
 static struct sp_plane** plane_sp;
 static struct sp_crtc* test_crtc_sp;
@@ -96,461 +211,1574 @@ static struct sp_plane* test_plane_sp;
 
 static unsigned int get_drm_format(unsigned int v4l2_format)
 {
-    switch (v4l2_format) {
-    case V4L2_PIX_FMT_NV12: //0
-        return DRM_FORMAT_NV12;
-    case V4L2_PIX_FMT_ARGB32: //1
-        return DRM_FORMAT_ARGB8888;
-    case V4L2_PIX_FMT_RGB24: //2
-        return DRM_FORMAT_RGB888;
-    case V4L2_PIX_FMT_RGB565: //3
-        return DRM_FORMAT_RGB565;
-    case V4L2_PIX_FMT_YUV420: //4
-        return DRM_FORMAT_YUV420;
-    case V4L2_PIX_FMT_XRGB32: //5
-        return DRM_FORMAT_XRGB8888;
-    case V4L2_PIX_FMT_ABGR32: //6
-        return DRM_FORMAT_BGRA8888;
-    case V4L2_PIX_FMT_XBGR32: //7
-        return DRM_FORMAT_BGRX8888;
-    case V4L2_PIX_FMT_ARGB555: //8
-        return DRM_FORMAT_ARGB1555;
-    case V4L2_PIX_FMT_ARGB444: //9
-        return DRM_FORMAT_ARGB4444;
-    case V4L2_PIX_FMT_NV61: // 10
-        return DRM_FORMAT_NV61;
-    case V4L2_PIX_FMT_NV16: //11
-        return DRM_FORMAT_NV16;
-    case V4L2_PIX_FMT_YUV422P: //12
-        return DRM_FORMAT_YUV422;
-    }
-    return DRM_FORMAT_NV12;
-}
-void fillbuffer(unsigned int v4l2_format, struct sp_bo* bo)
-{
-    if (v4l2_format == V4L2_PIX_FMT_NV12) {
-        int i, j;
-        unsigned char* y = (unsigned char*)bo->map_addr;
-        unsigned char* u = (unsigned char*)bo->map_addr + bo->height * bo->width;
-        unsigned char* v = (unsigned char*)bo->map_addr + bo->height * bo->width + 1;
-        int cs = 2;
-        int width = bo->width;
-        int height = bo->height;
-        int stride = width;
-
-        for (j = 0; j < height; j += 2) {
-            unsigned char* y1p = y + j * stride;
-            unsigned char* y2p = y1p + stride;
-            unsigned char* up = u + (j / 2) * stride * cs / 2;
-            unsigned char* vp = v + (j / 2) * stride * cs / 2;
-
-            for (i = 0; i < width; i += 2) {
-                uint32_t rgb = (((j / 16 + i / 16) & 0x3) << 6) + (((j / 16 + i / 16) & 0xc) << 12) + (((j / 16 + i / 16) & 0x30) << 18);
-                unsigned char* rgbp = (unsigned char*)&rgb;
-                unsigned char y = (0.299 * rgbp[2]) + (0.587 * rgbp[1]) + (0.114 * rgbp[0]);
-
-                *(y2p++) = *(y1p++) = y;
-                *(y2p++) = *(y1p++) = y;
-
-                *up = (rgbp[0] - y) * 0.565 + 128;
-                *vp = (rgbp[2] - y) * 0.713 + 128;
-                up += cs;
-                vp += cs;
-            }
-        }
-    } else if (v4l2_format == V4L2_PIX_FMT_ARGB32) {
-        uint32_t* buf = (uint32_t*)bo->map_addr;
-        int i, j;
+    const struct fmt_info* fi = get_fmt_info(v4l2_format);
+
+    if (!fi) {
+        printf("no DRM format for %.4s\n", (const char*)&v4l2_format);
+        exit(EXIT_FAILURE);
+    }
+    return fi->drm;
+}
 
-        for (j = 0; j < bo->height; j += 1) {
+static unsigned long long elapsed_us(struct timespec* a, struct timespec* b)
+{
+    unsigned long long us;
 
-            for (i = 0; i < bo->width; i += 1) {
-                uint32_t rgb = (((j / 16 + i / 16) & 0x3) << 6) + (((j / 16 + i / 16) & 0xc) << 12) + (((j / 16 + i / 16) & 0x30) << 18);
+    us = (b->tv_sec - a->tv_sec) * 1000000000ULL;
+    us += (b->tv_nsec - a->tv_nsec);
+    return us / 1000;
+}
 
-                *(buf++) = 0xff000000 | rgb;
-            }
-        }
-    } else if (v4l2_format == V4L2_PIX_FMT_RGB24) {
-        uint8_t* buf = (uint8_t*)bo->map_addr;
-        int i, j;
+/* The next input frame into 'bo', -ENODATA when it can't be mapped. */
+static int read_src_frame(struct sp_bo* bo, unsigned int frame)
+{
+    if (begin_cpu_sp_bo(bo, SP_BO_WRITE)) {
+        printf("frame %u can't be read in, skipped\n", frame);
+        run_failures++;
+        return -ENODATA;
+    }
+    read_frame(reader, frame, bo->map_addr);
+    end_cpu_sp_bo(bo, SP_BO_WRITE);
+    return 0;
+}
 
-        for (j = 0; j < bo->height; j += 1) {
+/*
+ * Frame 'frame' of the source sequence: the next frame of the input file,
+ * one of the precomputed buffers of the pattern cache, or the single
+ * source buffer regenerated in place when the pattern is animated. -1 when
+ * the frame is to be skipped.
+ */
+static int get_src_frame_fd(unsigned int frame, unsigned int index)
+{
+    struct timespec t0, t1;
+
+    /* the CPU must not overwrite what the node or the display still reads */
+    if (use_fences && (reader || (num_src_frames <= 1 && pattern_is_animated(pattern))))
+        wait_dmabuf(src_buf_fd[index], 1, -1);
+
+    if (reader) {
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        if (read_src_frame(src_buf_bo[index], frame))
+            return -1;
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        printf("*[INPUT]* : use %f msecs\n", elapsed_us(&t0, &t1) * 1.0 / 1000);
+        return src_buf_fd[index];
+    }
 
-            for (i = 0; i < bo->width; i += 1) {
-                uint32_t rgb = (((j / 16 + i / 16) & 0x3) << 6) + (((j / 16 + i / 16) & 0xc) << 12) + (((j / 16 + i / 16) & 0x30) << 18);
+    if (num_src_frames > 1)
+        return src_frame_fd[frame % num_src_frames];
 
-                *(buf++) = 0xff & rgb;
-                *(buf++) = 0xff & (rgb >> 8);
-                *(buf++) = 0xff & (rgb >> 16);
-            }
+    if (pattern_is_animated(pattern) && frame) {
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        fill_pattern_bo(pattern, pattern_color, src_format, src_buf_bo[index], frame, &src_color);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        printf("*[PATTERN]* : use %f msecs\n", elapsed_us(&t0, &t1) * 1.0 / 1000);
+    }
+    return src_buf_fd[index];
+}
+
+static uint32_t get_src_id(unsigned int frame)
+{
+    if (reader)
+        return frame % frame_reader_count(reader);
+    if (num_src_frames > 1)
+        return frame % num_src_frames;
+    return pattern_is_animated(pattern) ? frame : 0;
+}
+
+/*
+ * What the source of 'frame' holds: the content hash of input frames, so
+ * repeated or paused stretches of a clip match, or the number of the
+ * generated pattern frame.
+ */
+static int get_src_key(unsigned int frame, uint64_t* key)
+{
+    if (reader)
+        return hash_frame(reader, frame, key);
+    *key = get_src_id(frame);
+    return 0;
+}
+
+static int render_src_frame(void* priv, uint32_t src_id, void* addr)
+{
+    if (reader)
+        return read_frame(reader, src_id, addr);
+    return fill_pattern(pattern, pattern_color, src_format, addr, SRC_WIDTH, SRC_HEIGHT, src_id, &src_color);
+}
+
+static void start_verifier()
+{
+    struct verify_config cfg;
+
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.src_format = src_format;
+    cfg.src_width = SRC_WIDTH;
+    cfg.src_height = SRC_HEIGHT;
+    cfg.dst_format = dst_format;
+    cfg.dst_width = DST_WIDTH;
+    cfg.dst_height = DST_HEIGHT;
+    cfg.src_color = src_color;
+    cfg.dst_color = dst_color;
+    cfg.params.rotate = rotate;
+    cfg.params.hflip = hflip;
+    cfg.params.vflip = vflip;
+    cfg.params.blend = V4L2_BLEND_SRC;
+    cfg.params.src.x = SRC_CROP_X;
+    cfg.params.src.y = SRC_CROP_Y;
+    cfg.params.src.w = SRC_CROP_W;
+    cfg.params.src.h = SRC_CROP_H;
+    cfg.params.dst = dst_compose;
+    cfg.dst_background = 0x550000ff;
+    cfg.max_diff = verify_tolerance;
+    cfg.min_psnr = verify_psnr;
+    cfg.dump_dir = verify_dump_dir;
+
+    verifier = create_verifier(&cfg, render_src_frame, NULL);
+    if (!verifier)
+        printf("Failed to start verifier\n");
+}
+
+static void create_pattern_cache(size_t size)
+{
+    int i;
+
+    src_frame_bo[0] = src_buf_bo[0];
+    src_frame_fd[0] = src_buf_fd[0];
+    num_src_frames = 1;
+
+    for (i = 1; i < pattern_cache && i < MAX_SRC_FRAMES; i++) {
+        struct sp_bo* bo
+            = create_sp_bo(dev_sp, SRC_WIDTH, SRC_HEIGHT, 0, size * 8 / (SRC_WIDTH * SRC_HEIGHT), get_drm_format(src_format), bo_flags);
+        if (!bo) {
+            printf("Failed to create gem buf, pattern cache has %d frames\n", i);
+            break;
         }
+
+        src_frame_fd[i] = export_sp_bo(bo);
+        src_frame_bo[i] = bo;
+        fill_pattern_bo(pattern, pattern_color, src_format, bo, i, &src_color);
+        num_src_frames++;
     }
 }
 
-void fillbuffer2(unsigned int v4l2_format, struct sp_bo* bo)
+static void get_m2m_config(struct m2m_config* cfg)
 {
-    if (v4l2_format == V4L2_PIX_FMT_ARGB32) {
-        uint32_t* buf = (uint32_t*)bo->map_addr;
-        int i, j;
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->src_format = src_format;
+    cfg->src_width = SRC_WIDTH;
+    cfg->src_height = SRC_HEIGHT;
+    cfg->dst_format = dst_format;
+    cfg->dst_width = DST_WIDTH;
+    cfg->dst_height = DST_HEIGHT;
+    cfg->rotate = rotate;
+    cfg->hflip = hflip;
+    cfg->vflip = vflip;
+    cfg->src_color = src_color;
+    cfg->dst_color = dst_color;
+    cfg->fill_color = fill_color;
+}
 
-        for (j = 0; j < bo->height; j += 1) {
+/* -ENAMETOOLONG rather than a cut device path that opens another node */
+static int get_snapshot(struct snapshot* s)
+{
+    memset(s, 0, sizeof(*s));
+    if ((size_t)snprintf(s->device, sizeof(s->device), "%s", mem2mem_dev_name) >= sizeof(s->device))
+        return -ENAMETOOLONG;
+    get_m2m_config(&s->cfg);
+    s->src_crop.x = SRC_CROP_X;
+    s->src_crop.y = SRC_CROP_Y;
+    s->src_crop.w = SRC_CROP_W;
+    s->src_crop.h = SRC_CROP_H;
+    s->dst_crop.x = DST_CROP_X;
+    s->dst_crop.y = DST_CROP_Y;
+    s->dst_crop.w = DST_CROP_W;
+    s->dst_crop.h = DST_CROP_H;
+    s->src_pool = src_pool ? src_pool : use_uring ? NUM_BUFS : 1;
+    s->dst_pool = dst_pool ? dst_pool : NUM_BUFS;
+    s->pattern_cache = pattern_cache;
+    s->bo_flags = bo_flags;
+    return 0;
+}
 
-            for (i = 0; i < bo->width / 2; i += 1) {
-                *(buf++) = 0x550000ff;
-            }
+static void set_snapshot(const struct snapshot* s)
+{
+    static char device[sizeof(s->device)];
+
+    memcpy(device, s->device, sizeof(device));
+    mem2mem_dev_name = device;
+    src_format = s->cfg.src_format;
+    SRC_WIDTH = s->cfg.src_width;
+    SRC_HEIGHT = s->cfg.src_height;
+    dst_format = s->cfg.dst_format;
+    DST_WIDTH = s->cfg.dst_width;
+    DST_HEIGHT = s->cfg.dst_height;
+    rotate = s->cfg.rotate;
+    hflip = s->cfg.hflip;
+    vflip = s->cfg.vflip;
+    src_color = s->cfg.src_color;
+    dst_color = s->cfg.dst_color;
+    fill_color = s->cfg.fill_color;
+    SRC_CROP_X = s->src_crop.x;
+    SRC_CROP_Y = s->src_crop.y;
+    SRC_CROP_W = s->src_crop.w;
+    SRC_CROP_H = s->src_crop.h;
+    DST_CROP_X = s->dst_crop.x;
+    DST_CROP_Y = s->dst_crop.y;
+    DST_CROP_W = s->dst_crop.w;
+    DST_CROP_H = s->dst_crop.h;
+    src_pool = s->src_pool;
+    dst_pool = s->dst_pool;
+    pattern_cache = s->pattern_cache;
+    bo_flags = s->bo_flags;
+}
+
+/* The --dst-crop-* rectangle, 0 when the whole frame is written. */
+static int get_dst_crop(struct rga_rect* r)
+{
+    if (!DST_CROP_X && !DST_CROP_Y && !DST_CROP_W && !DST_CROP_H)
+        return 0;
+    r->x = DST_CROP_X;
+    r->y = DST_CROP_Y;
+    r->w = DST_CROP_W ? DST_CROP_W : DST_WIDTH - DST_CROP_X;
+    r->h = DST_CROP_H ? DST_CROP_H : DST_HEIGHT - DST_CROP_Y;
+    return 1;
+}
+
+/* The graph and the scheduler write whole frames. */
+static void skip_dst_crop()
+{
+    struct rga_rect r;
+
+    if (get_dst_crop(&r))
+        printf("only a single node crops the destination, not cropping\n");
+}
+
+/*
+ * Open and configure the node in 'dev'. Returns -1 when the transform is
+ * not a single job for it, 'plan' says why.
+ */
+static int init_mem2mem_dev(rga::Device& dev, struct plan* plan)
+{
+    struct m2m_config cfg;
+
+    if (dev.open(mem2mem_dev_name))
+        exit(EXIT_FAILURE);
+    m2m = dev.get();
+
+    if (tile_width)
+        m2m->caps.max_job_width = tile_width;
+
+    get_m2m_config(&cfg);
+    plan_transform(&m2m->caps, &cfg, plan);
+    if (plan->route == ROUTE_TILED) {
+        num_stripes = plan_stripes(&cfg, plan->num_tiles, m2m->caps.max_job_width,
+            stripes, MAX_STRIPES);
+        if (num_stripes < 0) {
+            num_stripes = 0;
+            printf("%s: %s, no stripes fit\n", m2m->path, plan->reason);
+            plan->route = ROUTE_CPU;
+            return -1;
         }
+        printf("%s: %s, %d stripes\n", m2m->path, plan->reason, num_stripes);
+    } else if (plan->route != ROUTE_DIRECT) {
+        printf("%s: %s, needs the %s route\n", m2m->path, plan->reason, route_name(plan->route));
+        return -1;
     }
+    return 0;
 }
 
-static void init_mem2mem_dev()
+/* The rotation of the next job. */
+static int get_job_rotation()
 {
-    struct v4l2_capability cap;
-    struct v4l2_format fmt;
-    struct v4l2_control ctrl;
-    struct v4l2_crop crop;
-    int ret;
+    return spin ? (rotate + spin * num_spun) % 360 : rotate;
+}
 
-    mem2mem_fd = open(mem2mem_dev_name, O_RDWR | O_CLOEXEC, 0);
-    if (mem2mem_fd < 0) {
-        fprintf(stderr, "%s:%d: ", __func__, __LINE__);
-        perror("open");
-        return;
+static int queue_mem2mem_frame(unsigned int index, int src_fd, int dst_fd)
+{
+    struct m2m_ctrls ctrls;
+
+    if (!spin)
+        return m2m_queue(m2m, index, src_fd, dst_fd);
+
+    /* the rotation changes per job, without a restart */
+    ctrls = m2m->cur;
+    ctrls.rotate = get_job_rotation();
+    num_spun++;
+    return m2m_queue_ctrls(m2m, index, src_fd, dst_fd, &ctrls);
+}
+
+/*
+ * Jobs that share the frame buffers, each composes its own part of the
+ * destination. The selection is queue state the driver reads when the job
+ * starts, so they can't be queued ahead of each other.
+ */
+static int run_mem2mem_parts(unsigned int index, int src_fd, int dst_fd,
+    const struct stripe* parts, int num_parts)
+{
+    int i, ret = 0;
+
+    for (i = 0; i < num_parts; i++) {
+        ret = m2m_set_selection(m2m, 0, &parts[i].src);
+        if (!ret)
+            ret = m2m_set_selection(m2m, 1, &parts[i].dst);
+        if (!ret)
+            ret = queue_mem2mem_frame(index, src_fd, dst_fd);
+        if (!ret)
+            ret = m2m_dequeue(m2m);
+        if (ret < 0)
+            return ret;
     }
+    return ret;
+}
 
-    if (hflip != 0) {
-        ctrl.id = V4L2_CID_HFLIP;
-        ctrl.value = 1;
-        ret = ioctl(mem2mem_fd, VIDIOC_S_CTRL, &ctrl);
-        if (ret != 0)
-            fprintf(stderr, "%s:%d: Set HFLIP failed\n",
-                __func__, __LINE__);
-    }
-
-    if (vflip != 0) {
-        ctrl.id = V4L2_CID_VFLIP;
-        ctrl.value = 1;
-        ret = ioctl(mem2mem_fd, VIDIOC_S_CTRL, &ctrl);
-        if (ret != 0)
-            fprintf(stderr, "%s:%d: Set VFLIP failed\n",
-                __func__, __LINE__);
-    }
-
-    if (rotate != 0) {
-        ctrl.id = V4L2_CID_ROTATE;
-        ctrl.value = rotate;
-        ret = ioctl(mem2mem_fd, VIDIOC_S_CTRL, &ctrl);
-        if (ret != 0)
-            fprintf(stderr, "%s:%d: Set ROTATE failed\n",
-                __func__, __LINE__);
-    }
-
-    if (fill_color != 0) {
-        ctrl.id = V4L2_CID_BG_COLOR;
-        ctrl.value = fill_color;
-        ret = ioctl(mem2mem_fd, VIDIOC_S_CTRL, &ctrl);
-        if (ret != 0)
-            fprintf(stderr, "%s:%d: Set Fill Color failed\n",
-                __func__, __LINE__);
-    }
-#if 0
-    ctrl.id = V4L2_CID_BLEND;
-    ctrl.value = op;
-    ret = ioctl(mem2mem_fd, VIDIOC_S_CTRL, &ctrl);
-    if (ret != 0)
-        fprintf(stderr, "%s:%d: Set OP failed\n",
-            __func__, __LINE__);
-#endif
-    ret = ioctl(mem2mem_fd, VIDIOC_QUERYCAP, &cap);
-    if (ret != 0) {
-        fprintf(stderr, "%s:%d: ", __func__, __LINE__);
-        perror("ioctl");
-        return;
+/* One frame through the node, whole or in stripes. Returns < 0 on failure. */
+static int run_mem2mem_job(int src_fd, int dst_fd)
+{
+    rga::Job job(src_fd, dst_fd);
+    struct m2m_ctrls ctrls;
+
+    if (num_stripes)
+        return run_mem2mem_parts(0, src_fd, dst_fd, stripes, num_stripes);
+
+    if (spin) {
+        /* the rotation changes per job, without a restart */
+        ctrls = m2m->cur;
+        ctrls.rotate = get_job_rotation();
+        num_spun++;
+        job.set_ctrls(ctrls);
     }
+    return session.run(job);
+}
 
-    if (!(cap.capabilities & V4L2_CAP_VIDEO_M2M)) {
-        fprintf(stderr, "Device does not support m2m\n");
-        exit(EXIT_FAILURE);
+/*
+ * Redo only what changed since the previous frame, whose output is still
+ * in dst buffer 0. Frames without damage information are transformed
+ * whole, through the same selections.
+ */
+static int run_mem2mem_damage(unsigned int frame, int src_fd)
+{
+    struct rga_rect damage[MAX_DAMAGE];
+    struct stripe parts[MAX_DAMAGE];
+    struct m2m_config cfg;
+    uint64_t area = 0;
+    int i, n;
+
+    get_m2m_config(&cfg);
+    n = pattern_damage(pattern, SRC_WIDTH, SRC_HEIGHT, frame, damage, MAX_DAMAGE);
+    if (n < 0 || reader || num_src_frames > 1) {
+        memset(parts, 0, sizeof(parts[0]));
+        parts[0].src.w = SRC_WIDTH;
+        parts[0].src.h = SRC_HEIGHT;
+        parts[0].dst.w = DST_WIDTH;
+        parts[0].dst.h = DST_HEIGHT;
+        n = 1;
+    } else {
+        n = plan_damage(&cfg, damage, n, parts, MAX_DAMAGE);
     }
-    if (!(cap.capabilities & V4L2_CAP_STREAMING)) {
-        fprintf(stderr, "Device does not support streaming\n");
-        exit(EXIT_FAILURE);
+
+    for (i = 0; i < n; i++)
+        area += (uint64_t)parts[i].dst.w * parts[i].dst.h;
+    printf("*[DAMAGE]* : %d jobs, %.1f%% of the frame\n", n, area * 100.0 / (DST_WIDTH * DST_HEIGHT));
+
+    /* nothing changed, the previous output is this frame's too */
+    if (!n)
+        return 0;
+    return run_mem2mem_parts(0, src_fd, dst_buf_fd[0], parts, n);
+}
+
+static void finish_mem2mem_frame(unsigned int frame, struct sp_bo* bo)
+{
+    struct timespec now;
+
+    if (!first_frame_done) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        printf("*[START]* : first frame %f msecs after %s\n", elapsed_us(&launch, &now) * 1.0 / 1000,
+            warm ? "the go" : "launch");
+        first_frame_done = 1;
+    }
+    soak_frames++;
+
+    /* the bo is only mapped for whoever reads it back */
+    if ((verifier || writer) && begin_cpu_sp_bo(bo, SP_BO_READ)) {
+        printf("frame %u can't be read back\n", frame);
+    } else if (verifier || writer) {
+        if (verifier)
+            verify_frame(verifier, frame, get_src_id(frame), bo->map_addr);
+
+        if (writer && write_frame(writer, bo->map_addr)) {
+            close_frame_writer(writer);
+            writer = NULL;
+        }
+        end_cpu_sp_bo(bo, SP_BO_READ);
     }
 
-    /* Set format for output */
-    fmt.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
-    fmt.fmt.pix.width = SRC_WIDTH;
-    fmt.fmt.pix.height = SRC_HEIGHT;
-    fmt.fmt.pix.pixelformat = src_format;
-    fmt.fmt.pix.field = V4L2_FIELD_ANY;
+    /* fenced flips were committed with the job */
+    if (display == 1 && !timeline) {
+        test_plane_sp->bo = bo;
+        set_sp_plane(dev_sp, test_plane_sp, test_crtc_sp, 0, 0);
+    }
+}
 
-    ret = ioctl(mem2mem_fd, VIDIOC_S_FMT, &fmt);
-    if (ret != 0) {
-        fprintf(stderr, "%s:%d: ", __func__, __LINE__);
-        perror("ioctl");
-        return;
+/*
+ * Flip to 'bo' before the frame is done. The commit carries a sw_sync
+ * fence that is signalled on DQBUF, the kernel holds the flip back until
+ * then instead of us waiting for the job first.
+ */
+static int present_fenced(unsigned int frame, struct sp_bo* bo)
+{
+    int in_fence, ret;
+
+    /* one flip in flight, the previous one has to be on screen */
+    if (flip_fence >= 0) {
+        wait_fence(flip_fence, 1000);
+        close(flip_fence);
+        flip_fence = -1;
     }
 
-    /* Set format for capture */
-    fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    fmt.fmt.pix.width = DST_WIDTH;
-    fmt.fmt.pix.height = DST_HEIGHT;
-    fmt.fmt.pix.pixelformat = dst_format;
-    fmt.fmt.pix.field = V4L2_FIELD_ANY;
+    in_fence = sw_timeline_fence(timeline, frame + 1);
+    if (in_fence < 0)
+        return in_fence;
 
-    ret = ioctl(mem2mem_fd, VIDIOC_S_FMT, &fmt);
-    if (ret != 0) {
-        fprintf(stderr, "%s:%d: ", __func__, __LINE__);
-        perror("ioctl");
-        return;
+    test_plane_sp->bo = bo;
+    ret = commit_sp_plane(dev_sp, test_plane_sp, test_crtc_sp, 0, 0, in_fence, &flip_fence);
+    close(in_fence);
+    return ret;
+}
+
+static int run_mem2mem_fenced(unsigned int frame, int src_fd)
+{
+    int index, ret;
+
+    ret = queue_mem2mem_frame(0, src_fd, dst_buf_fd[0]);
+    if (ret)
+        return ret;
+
+    if (present_fenced(frame, dst_buf_bo[0])) {
+        printf("no fenced flips, presenting after the transform\n");
+        destroy_sw_timeline(timeline);
+        timeline = NULL;
     }
 
-    printf("crop was replaced by selection \n");
-#if 0
-    if (SRC_CROP_X != 0 || SRC_CROP_Y != 0 || SRC_CROP_W != 0 || SRC_CROP_H != 0) {
-        if (SRC_CROP_W == 0 && SRC_CROP_H == 0) {
-            SRC_CROP_W = SRC_WIDTH;
-            SRC_CROP_H = SRC_HEIGHT;
-        }
+    index = m2m_dequeue(m2m);
+    if (timeline)
+        sw_timeline_signal(timeline, frame + 1);
+    return index;
+}
+
+/* Frames a loop may have in flight, fewer while the governor cools down. */
+static unsigned int get_depth(unsigned int max)
+{
+    return governor ? governor_depth(governor, max) : max;
+}
 
-        memset(&crop, 0, sizeof(struct v4l2_crop));
+static void pace_frame()
+{
+    if (governor)
+        governor_pace(governor);
+}
 
-        crop.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
-        crop.c.left = SRC_CROP_X;
-        crop.c.top = SRC_CROP_Y;
-        crop.c.width = SRC_CROP_W;
-        crop.c.height = SRC_CROP_H;
-        ret = ioctl(mem2mem_fd, VIDIOC_S_CROP, &crop);
-        if (ret != 0) {
-            fprintf(stderr, "%s:%d: ", __func__, __LINE__);
-            perror("ioctl");
-            return;
+static void govern_frame()
+{
+    if (governor)
+        governor_frame(governor, time_consumed);
+}
+
+/* Everything besides the source that goes into the next result. */
+static void get_xform(struct m2m_config* cfg)
+{
+    get_m2m_config(cfg);
+    cfg->rotate = get_job_rotation();
+}
+
+static void run_mem2mem_sync()
+{
+    struct sp_bo* dst_bo;
+    struct m2m_config xform;
+    uint64_t src_key;
+    int ret, i, slot, src_fd, dst_fd;
+
+    for (i = 0; i < num_frames; i++) {
+        dst_bo = dst_buf_bo[0];
+        dst_fd = dst_buf_fd[0];
+        slot = -1;
+
+        /* a hit skips the source and the job */
+        if (results && !get_src_key(i, &src_key)) {
+            get_xform(&xform);
+            slot = result_cache_find(results, src_key, &xform);
+            if (slot >= 0) {
+                if (spin)
+                    num_spun++;
+                printf("*[CACHE]* : frame %d reuses result %d\n", i, slot);
+                finish_mem2mem_frame(i, result_bo[slot]);
+                continue;
+            }
+            slot = result_cache_replace(results, src_key, &xform);
+            dst_bo = result_bo[slot];
+            dst_fd = result_fd[slot];
         }
-    }
 
-    if (DST_CROP_X != 0 || DST_CROP_Y != 0 || DST_CROP_W != 0 || DST_CROP_H != 0) {
-        if (DST_CROP_W == 0 && DST_CROP_H == 0) {
-            DST_CROP_W = DST_WIDTH;
-            DST_CROP_H = DST_HEIGHT;
+        src_fd = get_src_frame_fd(i, 0);
+        if (src_fd < 0) {
+            if (slot >= 0)
+                result_cache_drop(results, slot);
+            continue;
         }
-        memset(&crop, 0, sizeof(struct v4l2_crop));
+        pace_frame();
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
 
-        crop.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        crop.c.left = DST_CROP_X;
-        crop.c.top = DST_CROP_Y;
-        crop.c.width = DST_CROP_W;
-        crop.c.height = DST_CROP_H;
-        ret = ioctl(mem2mem_fd, VIDIOC_S_CROP, &crop);
-        if (ret != 0) {
-            fprintf(stderr, "%s:%d: ", __func__, __LINE__);
-            perror("ioctl");
+        if (timeline)
+            ret = run_mem2mem_fenced(i, src_fd);
+        else if (damage)
+            ret = run_mem2mem_damage(i, src_fd);
+        else
+            ret = run_mem2mem_job(src_fd, dst_fd);
+        if (ret < 0) {
+            if (slot >= 0)
+                result_cache_drop(results, slot);
             return;
         }
+        printf("Dequeued dst buffer\n");
+
+        if (use_fences)
+            wait_dmabuf(dst_fd, 0, -1);
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        time_consumed = elapsed_us(&start, &end);
+
+        printf("*[RGA]* : use %f msecs\n", time_consumed * 1.0 / 1000);
+        govern_frame();
+
+        finish_mem2mem_frame(i, dst_bo);
     }
-#endif
 }
 
-static void process_mem2mem_frame()
+enum uring_op {
+    URING_POLL,
+    URING_READ,
+    URING_WRITE,
+};
+
+#define URING_TAG(op, index) (((uint64_t)(op) << 32) | (index))
+
+/* the stages a buffer pair goes through in the io_uring loop */
+enum slot_state {
+    SLOT_FREE,
+    SLOT_READING,
+    SLOT_QUEUED,
+    SLOT_WRITING,
+};
+
+struct uring_slot {
+    enum slot_state state;
+    int src_queued;
+    int dst_queued;
+    unsigned int frame;
+    struct timespec start;
+};
+
+/*
+ * Dequeue every finished buffer without blocking, returns frames completed
+ * or -1 on failure.
+ */
+static int dequeue_mem2mem_uring(struct uring* ring, struct uring_slot* slots, int out_fd)
 {
+    size_t out_size = fmt_frame_size(get_fmt_info(dst_format), DST_WIDTH, DST_HEIGHT);
     struct v4l2_buffer buf;
-    int ret, i;
-
-    i = num_frames;
-    while (i--) {
-        clock_gettime(CLOCK_MONOTONIC, &start);
+    struct uring_slot* s;
+    int done = 0;
 
+    for (;;) {
         memset(&(buf), 0, sizeof(buf));
-        buf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
         buf.memory = V4L2_MEMORY_DMABUF;
-        buf.bytesused = src_buf_size[0];
-        buf.index = 0;
-        buf.m.fd = src_buf_fd[0];
-        ret = ioctl(mem2mem_fd, VIDIOC_QBUF, &buf);
-        if (ret != 0) {
-            fprintf(stderr, "%s:%d: ", __func__, __LINE__);
-            perror("ioctl");
-            return;
+        if (m2m_ioctl(mem2mem_fd, VIDIOC_DQBUF, &buf)) {
+            if (errno != EAGAIN) {
+                fprintf(stderr, "%s:%d: ", __func__, __LINE__);
+                perror("ioctl");
+                return -1;
+            }
+            break;
         }
 
-        memset(&(buf), 0, sizeof(buf));
-        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        buf.memory = V4L2_MEMORY_DMABUF;
-        buf.index = 0;
-        buf.m.fd = dst_buf_fd[0];
-        ret = ioctl(mem2mem_fd, VIDIOC_QBUF, &buf);
-        if (ret != 0) {
-            fprintf(stderr, "%s:%d: ", __func__, __LINE__);
-            perror("ioctl");
-            return;
+        s = &slots[buf.index];
+        s->dst_queued = 0;
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        time_consumed = elapsed_us(&s->start, &end);
+        printf("*[RGA]* : frame %u use %f msecs\n", s->frame, time_consumed * 1.0 / 1000);
+        govern_frame();
+
+        finish_mem2mem_frame(s->frame, dst_buf_bo[buf.index]);
+
+        s->state = SLOT_FREE;
+        done++;
+        if (out_fd < 0)
+            continue;
+
+        if (begin_cpu_sp_bo(dst_buf_bo[buf.index], SP_BO_READ)) {
+            printf("frame %u can't be written out\n", s->frame);
+            return -1;
+        }
+        if (uring_write(ring, out_fd, dst_buf_bo[buf.index]->map_addr, out_size,
+                (uint64_t)s->frame * out_size, URING_TAG(URING_WRITE, buf.index))) {
+            end_cpu_sp_bo(dst_buf_bo[buf.index], SP_BO_READ);
+            printf("io_uring is full, frame %u isn't written\n", s->frame);
+            return -1;
         }
+        s->state = SLOT_WRITING;
+    }
 
+    /* a job completes its source buffer before the destination one */
+    for (;;) {
         memset(&(buf), 0, sizeof(buf));
         buf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
         buf.memory = V4L2_MEMORY_DMABUF;
-        ret = ioctl(mem2mem_fd, VIDIOC_DQBUF, &buf);
-        printf("Dequeued source buffer, index: %d\n", buf.index);
+        if (m2m_ioctl(mem2mem_fd, VIDIOC_DQBUF, &buf))
+            break;
+        slots[buf.index].src_queued = 0;
+    }
+    return done;
+}
 
-        memset(&(buf), 0, sizeof(buf));
-        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        buf.memory = V4L2_MEMORY_DMABUF;
-        ret = ioctl(mem2mem_fd, VIDIOC_DQBUF, &buf);
-        if (ret != 0) {
-            fprintf(stderr, "%s:%d: ", __func__, __LINE__);
-            perror("ioctl");
+/*
+ * Reads and writes in flight still target the buffers, they have to finish
+ * before the ring goes and the buffers with it.
+ */
+static void drain_mem2mem_uring(struct uring* ring, struct uring_slot* slots, unsigned int depth)
+{
+    unsigned int index, busy;
+    uint64_t tag;
+    int32_t res;
+
+    for (;;) {
+        for (index = 0, busy = 0; index < depth; index++)
+            busy += slots[index].state == SLOT_READING || slots[index].state == SLOT_WRITING;
+        if (!busy || uring_submit(ring, 1) < 0)
             return;
+
+        while (uring_reap(ring, &tag, &res)) {
+            index = (uint32_t)tag;
+            if (tag >> 32 == URING_READ)
+                end_cpu_sp_bo(src_buf_bo[index], SP_BO_WRITE);
+            else if (tag >> 32 == URING_WRITE)
+                end_cpu_sp_bo(dst_buf_bo[index], SP_BO_READ);
+            else
+                continue;
+            slots[index].state = SLOT_FREE;
+        }
+    }
+}
+
+/*
+ * io_uring variant of the processing loop. Every buffer pair carries a
+ * frame; input reads, output writes and the readiness poll on the m2m fd
+ * are batched into one io_uring_enter that also waits for the next event.
+ * V4L2 has no uring_cmd support, so QBUF/DQBUF stay ioctls, but DQBUF is
+ * only issued once the poll reported finished buffers.
+ *
+ * Returns 1 without io_uring, for the plain loop to run instead, and -1
+ * when the run failed.
+ */
+static int run_mem2mem_uring()
+{
+    size_t in_size = fmt_frame_size(get_fmt_info(src_format), SRC_WIDTH, SRC_HEIGHT);
+    struct uring_slot slots[NUM_BUFS];
+    unsigned int depth = 0, index;
+    int queued = 0, done = 0, busy, waiting, polling = 0, n, ret = -1;
+    int in_fd = -1, out_fd = -1, flags = -1;
+    struct uring* ring;
+    uint64_t tag;
+    int32_t res;
+
+    ring = create_uring(4 * NUM_BUFS);
+    if (!ring)
+        return 1;
+    memset(slots, 0, sizeof(slots));
+
+    if (reader) {
+        in_fd = open(input_path, O_RDONLY | O_CLOEXEC);
+        if (in_fd < 0) {
+            perror("open");
+            goto out;
         }
-        printf("Dequeued dst buffer, index: %d\n", buf.index);
+    }
+    if (output_path) {
+        out_fd = open(output_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (out_fd < 0) {
+            perror("open");
+            goto out;
+        }
+    }
 
+    flags = fcntl(mem2mem_fd, F_GETFL);
+    if (flags < 0 || fcntl(mem2mem_fd, F_SETFL, flags | O_NONBLOCK)) {
+        perror("fcntl");
+        flags = -1;
+        goto out;
+    }
+
+    depth = num_src_bufs < num_dst_bufs ? num_src_bufs : num_dst_bufs;
+
+    for (;;) {
+        busy = waiting = 0;
+        for (index = 0; index < depth; index++) {
+            struct uring_slot* s = &slots[index];
+
+            if (s->state == SLOT_FREE && !s->src_queued && queued < num_frames
+                && (unsigned int)(queued - done) < get_depth(depth)) {
+                pace_frame();
+                s->frame = queued++;
+                clock_gettime(CLOCK_MONOTONIC, &s->start);
+                if (in_fd >= 0) {
+                    if (begin_cpu_sp_bo(src_buf_bo[index], SP_BO_WRITE)) {
+                        printf("frame %u can't be read in\n", s->frame);
+                        goto out;
+                    }
+                    if (uring_read(ring, in_fd, src_buf_bo[index]->map_addr, in_size,
+                            (uint64_t)get_src_id(s->frame) * in_size, URING_TAG(URING_READ, index))) {
+                        end_cpu_sp_bo(src_buf_bo[index], SP_BO_WRITE);
+                        printf("io_uring is full, frame %u isn't read\n", s->frame);
+                        goto out;
+                    }
+                    s->state = SLOT_READING;
+                } else {
+                    if (queue_mem2mem_frame(index, get_src_frame_fd(s->frame, index), dst_buf_fd[index]))
+                        goto out;
+                    s->src_queued = s->dst_queued = 1;
+                    s->state = SLOT_QUEUED;
+                }
+            }
+            if (s->state != SLOT_FREE || s->src_queued)
+                busy++;
+            if (s->dst_queued || s->src_queued)
+                waiting++;
+        }
+
+        if (!busy)
+            break;
+
+        if (!polling && waiting) {
+            if (uring_poll_add(ring, mem2mem_fd, POLLIN | POLLOUT, URING_TAG(URING_POLL, 0))) {
+                printf("io_uring is full, can't poll %s\n", m2m->path);
+                goto out;
+            }
+            polling = 1;
+        }
+
+        n = uring_submit(ring, 1);
+        if (n < 0) {
+            printf("io_uring_enter failed: %s\n", strerror(-n));
+            goto out;
+        }
+
+        while (uring_reap(ring, &tag, &res)) {
+            index = (uint32_t)tag;
+
+            switch (tag >> 32) {
+            case URING_POLL:
+                polling = 0;
+                n = dequeue_mem2mem_uring(ring, slots, out_fd);
+                if (n < 0)
+                    goto out;
+                done += n;
+                break;
+            case URING_READ:
+                end_cpu_sp_bo(src_buf_bo[index], SP_BO_WRITE);
+                slots[index].state = SLOT_FREE;
+                if (res != (int32_t)in_size) {
+                    printf("short input read for frame %u\n", slots[index].frame);
+                    goto out;
+                }
+                if (queue_mem2mem_frame(index, src_buf_fd[index], dst_buf_fd[index]))
+                    goto out;
+                slots[index].src_queued = slots[index].dst_queued = 1;
+                slots[index].state = SLOT_QUEUED;
+                break;
+            case URING_WRITE:
+                end_cpu_sp_bo(dst_buf_bo[index], SP_BO_READ);
+                slots[index].state = SLOT_FREE;
+                if (res != (int32_t)fmt_frame_size(get_fmt_info(dst_format), DST_WIDTH, DST_HEIGHT)) {
+                    printf("failed to write frame %u: %s\n", slots[index].frame,
+                        res < 0 ? strerror(-res) : "short write");
+                    goto out;
+                }
+                break;
+            }
+        }
+    }
+
+    printf("*[URING]* : %d frames, %lu io_uring_enter calls\n", done, uring_enter_count(ring));
+    ret = 0;
+
+out:
+    drain_mem2mem_uring(ring, slots, depth);
+    if (flags >= 0)
+        fcntl(mem2mem_fd, F_SETFL, flags);
+    if (in_fd >= 0)
+        close(in_fd);
+    if (out_fd >= 0)
+        close(out_fd);
+    destroy_uring(ring);
+    return ret;
+}
+
+/*
+ * Frames are handed to the scheduler in order and retired in order, so the
+ * verifier, the output file and the display see the same sequence as with
+ * a single node even though the jobs finish anywhere.
+ */
+static void retire_sched_frame(unsigned int frame)
+{
+    int slot = frame % num_sched_slots, ret;
+    struct sched_job* job = &sched_jobs[slot];
+
+    ret = sched_wait(scheduler, job);
+    if (ret == -ENODATA)
+        return;
+    if (ret == -ETIME)
+        printf("frame %u dropped, it would have missed its deadline\n", job->frame);
+    else if (ret)
+        printf("frame %u failed on %s\n", job->frame, job->worker);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    time_consumed = elapsed_us(&sched_start[slot], &end);
+    printf("*[RGA]* : frame %u on %s use %f msecs%s\n", job->frame, job->worker,
+        time_consumed * 1.0 / 1000, job->degraded ? " (degraded)" : "");
+    govern_frame();
+    if (ret != -ETIME)
+        finish_mem2mem_frame(job->frame, sched_dst_bo[slot]);
+}
+
+static void run_mem2mem_sched()
+{
+    struct sched_job* job;
+    struct timespec t0;
+    unsigned int frame, retired = 0;
+    int slot;
+
+    for (frame = 0; frame < (unsigned int)num_frames; frame++) {
+        /* a slot is free once the frame before in it is retired */
+        while (frame - retired >= get_depth(num_sched_slots))
+            retire_sched_frame(retired++);
+
+        slot = frame % num_sched_slots;
+        job = &sched_jobs[slot];
+
+        if (reader) {
+            if (read_src_frame(sched_src_bo[slot], frame)) {
+                /* retired in order like the others, without running */
+                job->frame = frame;
+                job->result = -ENODATA;
+                job->done = 1;
+                continue;
+            }
+        } else if (pattern_is_animated(pattern)) {
+            clock_gettime(CLOCK_MONOTONIC, &t0);
+            fill_pattern_bo(pattern, pattern_color, src_format, sched_src_bo[slot], frame, &src_color);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            printf("*[PATTERN]* : use %f msecs\n", elapsed_us(&t0, &end) * 1.0 / 1000);
+        }
+
+        pace_frame();
+        job->frame = frame;
+        clock_gettime(CLOCK_MONOTONIC, &sched_start[slot]);
+        job->deadline_us = job_budget_us ? sched_now_us() + job_budget_us : 0;
+        sched_submit(scheduler, job);
+    }
+
+    while (retired < frame)
+        retire_sched_frame(retired++);
+}
+
+static void run_mem2mem_graph()
+{
+    struct timespec t0;
+    int i, ret;
+
+    for (i = 0; i < num_frames; i++) {
+        if (get_src_frame_fd(i, 0) < 0)
+            continue;
+        if (num_src_frames > 1) {
+            graph_io.src.addr = pin_sp_bo(src_frame_bo[i % num_src_frames]);
+            graph_io.src.fd = src_frame_fd[i % num_src_frames];
+        }
+
+        pace_frame();
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        ret = run_graph(graph, &graph_io);
+        if (num_src_frames > 1)
+            unpin_sp_bo(src_frame_bo[i % num_src_frames]);
+        if (ret) {
+            printf("frame %d failed\n", i);
+            return;
+        }
         clock_gettime(CLOCK_MONOTONIC, &end);
+        time_consumed = elapsed_us(&t0, &end);
+        printf("*[GRAPH]* : use %f msecs\n", time_consumed * 1.0 / 1000);
+        govern_frame();
 
-        time_consumed = (end.tv_sec - start.tv_sec) * 1000000000ULL;
-        time_consumed += (end.tv_nsec - start.tv_nsec);
-        time_consumed /= 1000;
+        finish_mem2mem_frame(i, dst_buf_bo[0]);
+    }
+}
 
-        printf("*[RGA]* : use %f msecs\n", time_consumed * 1.0 / 1000);
+/*
+ * Jobs through a daemon started with --serve. They complete in any order,
+ * frames are retired in order as with the scheduler.
+ */
+static void run_mem2mem_client()
+{
+    struct timespec t0[NUM_BUFS];
+    int done[NUM_BUFS], result[NUM_BUFS];
+    unsigned int queued = 0, retired = 0, slot;
+    uint64_t tag;
+    int res;
+
+    memset(done, 0, sizeof(done));
+    while (retired < (unsigned int)num_frames) {
+        while (queued < (unsigned int)num_frames && queued - retired < get_depth(NUM_BUFS)) {
+            slot = queued % NUM_BUFS;
+            if (reader) {
+                if (read_src_frame(src_buf_bo[slot], queued)) {
+                    /* retired in order like the others, without running */
+                    done[slot] = 1;
+                    result[slot] = -ENODATA;
+                    queued++;
+                    continue;
+                }
+            } else if (pattern_is_animated(pattern)) {
+                fill_pattern_bo(pattern, pattern_color, src_format, src_buf_bo[slot], queued, &src_color);
+            }
 
-        if (display == 1) {
-            test_plane_sp->bo = dst_buf_bo[buf.index];
-            set_sp_plane(dev_sp, test_plane_sp, test_crtc_sp, 0, 0);
+            pace_frame();
+            clock_gettime(CLOCK_MONOTONIC, &t0[slot]);
+            if (rgad_submit(client, queued, client_src_id[slot], client_dst_id[slot])) {
+                printf("failed to submit frame %u\n", queued);
+                return;
+            }
+            queued++;
+        }
+
+        /* a skipped frame at the head retires without waiting */
+        if (!done[retired % NUM_BUFS]) {
+            if (rgad_reap(client, &tag, &res, 1000)) {
+                printf("no completion from the daemon\n");
+                return;
+            }
+            done[tag % NUM_BUFS] = 1;
+            result[tag % NUM_BUFS] = res;
+        }
 
-            if (0) {
-                unsigned int *addr = (unsigned int *)test_plane_sp->bo->map_addr;
-                printf("dump buffer : %x %x %x \n", addr[0], addr[1], addr[2]);
-                usleep(1000 * 1000);
-                printf("dump buffer2 : %x %x %x \n", addr[0], addr[1], addr[2]);
+        while (retired < queued && done[retired % NUM_BUFS]) {
+            slot = retired % NUM_BUFS;
+            if (result[slot] == -ENODATA) {
+                done[slot] = 0;
+                retired++;
+                continue;
             }
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            time_consumed = elapsed_us(&t0[slot], &end);
+            if (result[slot] == -ETIME)
+                printf("frame %u dropped, it would have missed its deadline\n", retired);
+            else if (result[slot])
+                printf("frame %u failed ret=%d\n", retired, result[slot]);
+            printf("*[RGAD]* : frame %u use %f msecs\n", retired, time_consumed * 1.0 / 1000);
+            govern_frame();
+            if (result[slot] != -ETIME)
+                finish_mem2mem_frame(retired, dst_buf_bo[slot]);
+            done[slot] = 0;
+            retired++;
+        }
+    }
+}
+
+/* Park the prepared run until it is told to go, a line on stdin. */
+static void wait_warm()
+{
+    struct timespec now;
+    int c;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    printf("*[WARM]* : ready after %f msecs\n", elapsed_us(&launch, &now) * 1.0 / 1000);
+    fflush(stdout);
+    do
+        c = getchar();
+    while (c != '\n' && c != EOF);
+    clock_gettime(CLOCK_MONOTONIC, &launch);
+}
+
+/* -1 when the run failed before its frames were through */
+static int process_mem2mem_frame()
+{
+    struct timespec t0, t1;
+    int ret = 1;
+
+    if (warm)
+        wait_warm();
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if (use_uring && !scheduler && !graph && !client && !results && !damage && !num_stripes)
+        ret = run_mem2mem_uring();
+    if (ret > 0) {
+        if (output_path) {
+            writer = open_frame_writer(output_path,
+                fmt_frame_size(get_fmt_info(dst_format), DST_WIDTH, DST_HEIGHT));
+            if (!writer)
+                exit(-1);
+        }
+        if (scheduler)
+            run_mem2mem_sched();
+        else if (client)
+            run_mem2mem_client();
+        else if (graph)
+            run_mem2mem_graph();
+        else
+            run_mem2mem_sync();
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    soak_us += elapsed_us(&t0, &t1);
+
+    if (verifier) {
+        verify_failures += destroy_verifier(verifier);
+        verifier = NULL;
+    }
+
+    if (writer) {
+        printf("*[OUTPUT]* : %d frames written\n", close_frame_writer(writer));
+        writer = NULL;
+    }
+
+    if (!soak_secs) {
+        printf("press <ENTER> to exit test application\n");
+        getchar();
+    }
+    return ret < 0 ? -1 : 0;
+}
+
+static struct sp_bo* create_frame_bo(uint32_t v4l2_format, uint32_t width, uint32_t height, int* fd)
+{
+    const struct fmt_info* fi = get_fmt_info(v4l2_format);
+    struct sp_bo* bo;
+
+    bo = create_sp_bo(dev_sp, width, height, 0, fmt_bpp(fi), fi->drm, bo_flags);
+    if (!bo) {
+        printf("Failed to create gem buf\n");
+        exit(-1);
+    }
+    *fd = export_sp_bo(bo);
+    return bo;
+}
+
+static int open_sched_devs(const struct m2m_config* cfg, struct m2m_dev** devs)
+{
+    char paths[M2M_MAX_DEVS][32];
+    char* list;
+    char* tok;
+    char* save;
+    int i, n = 0, num_devs = 0;
+
+    if (!strcmp(sched_devices, "all")) {
+        n = find_m2m_devs(paths, M2M_MAX_DEVS);
+    } else {
+        list = strdup(sched_devices);
+        for (tok = strtok_r(list, ",", &save); tok && n < M2M_MAX_DEVS;
+             tok = strtok_r(NULL, ",", &save))
+            snprintf(paths[n++], sizeof(paths[0]), "%s", tok);
+        free(list);
+    }
+
+    for (i = 0; i < n; i++) {
+        struct m2m_dev* dev = open_m2m_dev(paths[i]);
+        struct plan plan;
+
+        if (!dev)
+            continue;
+        plan_transform(&dev->caps, cfg, &plan);
+        if (plan.route != ROUTE_DIRECT) {
+            printf("%s: %s, skipped\n", paths[i], plan.reason);
+            close_m2m_dev(dev);
+            continue;
+        }
+        if (m2m_set_config(dev, cfg) || m2m_request_bufs(dev, 1, 1) || m2m_stream(dev, 1)) {
+            printf("%s: can not do this transform, skipped\n", paths[i]);
+            close_m2m_dev(dev);
+            continue;
+        }
+        printf("%s: scheduled\n", paths[i]);
+        devs[num_devs++] = dev;
+    }
+    return num_devs;
+}
+
+/* Spread the frames over every usable m2m node and the CPU workers. */
+static int start_mem2mem_sched()
+{
+    struct m2m_dev* devs[M2M_MAX_DEVS];
+    struct m2m_config cfg;
+    int i, ret, num_devs = 0;
+
+    skip_dst_crop();
+    get_m2m_config(&cfg);
+    if (sched_devices)
+        num_devs = open_sched_devs(&cfg, devs);
+    if (!num_devs && !cpu_workers) {
+        printf("no usable m2m device, falling back to the CPU\n");
+        cpu_workers = 1;
+    }
+
+    scheduler = create_sched(&cfg, devs, num_devs, cpu_workers);
+    if (!scheduler)
+        exit(-1);
+
+    /* two frames in flight per worker keep every queue fed */
+    num_sched_slots = 2 * (num_devs + cpu_workers);
+    if (num_sched_slots > MAX_SCHED_SLOTS)
+        num_sched_slots = MAX_SCHED_SLOTS;
+
+    if (input_path) {
+        reader = open_frame_reader(input_path,
+            fmt_frame_size(get_fmt_info(src_format), SRC_WIDTH, SRC_HEIGHT));
+        if (!reader)
+            exit(-1);
+    }
+
+    for (i = 0; i < num_sched_slots; i++) {
+        struct sched_job* job = &sched_jobs[i];
+
+        sched_src_bo[i] = create_frame_bo(src_format, SRC_WIDTH, SRC_HEIGHT, &sched_src_fd[i]);
+        sched_dst_bo[i] = create_frame_bo(dst_format, DST_WIDTH, DST_HEIGHT, &sched_dst_fd[i]);
+        fill_pattern_bo(pattern, pattern_color, src_format, sched_src_bo[i], 0, &src_color);
+        fill_pattern_bo(PATTERN_SOLID, 0x550000ff, dst_format, sched_dst_bo[i], 0, &dst_color);
+
+        memset(job, 0, sizeof(*job));
+        job->prio = job_prio;
+        job->late = job_late;
+        job->src_fd = sched_src_fd[i];
+        job->dst_fd = sched_dst_fd[i];
+        /* only the CPU workers touch the frames through a mapping */
+        if (cpu_workers) {
+            job->src_addr = pin_sp_bo(sched_src_bo[i]);
+            job->dst_addr = pin_sp_bo(sched_dst_bo[i]);
+        }
+    }
+
+    /* the reference scales bilinear */
+    if (verify && job_late == SCHED_LATE_DEGRADE)
+        printf("degradable frames are not verified\n");
+    else if (verify)
+        start_verifier();
+
+    ret = process_mem2mem_frame();
+
+    destroy_sched(scheduler);
+    scheduler = NULL;
+
+    for (i = 0; i < num_devs; i++) {
+        m2m_stream(devs[i], 0);
+        close_m2m_dev(devs[i]);
+    }
+
+    for (i = 0; i < num_sched_slots; i++) {
+        close(sched_src_fd[i]);
+        close(sched_dst_fd[i]);
+        free_sp_bo(sched_src_bo[i]);
+        free_sp_bo(sched_dst_bo[i]);
+    }
+
+    close_frame_reader(reader);
+    reader = NULL;
+    return ret;
+}
+
+/* The frame buffers stay ours, the daemon gets a dmabuf of each once. */
+static int start_mem2mem_client()
+{
+    struct m2m_config cfg, served;
+    int i, ret;
+
+    get_m2m_config(&cfg);
+    client = rgad_connect(client_path, &served);
+    if (!client)
+        exit(-1);
+    if (served.src_format != cfg.src_format || served.src_width != cfg.src_width
+        || served.src_height != cfg.src_height || served.dst_format != cfg.dst_format
+        || served.dst_width != cfg.dst_width || served.dst_height != cfg.dst_height) {
+        printf("%s serves %.4s %ux%u to %.4s %ux%u\n", client_path,
+            (const char*)&served.src_format, served.src_width, served.src_height,
+            (const char*)&served.dst_format, served.dst_width, served.dst_height);
+        exit(-1);
+    }
+    rgad_set_class(client, job_prio, job_budget_us, job_late);
+
+    num_src_bufs = num_dst_bufs = NUM_BUFS;
+    for (i = 0; i < NUM_BUFS; i++) {
+        src_buf_bo[i] = create_frame_bo(src_format, SRC_WIDTH, SRC_HEIGHT, &src_buf_fd[i]);
+        dst_buf_bo[i] = create_frame_bo(dst_format, DST_WIDTH, DST_HEIGHT, &dst_buf_fd[i]);
+        fill_pattern_bo(pattern, pattern_color, src_format, src_buf_bo[i], 0, &src_color);
+        fill_pattern_bo(PATTERN_SOLID, 0x550000ff, dst_format, dst_buf_bo[i], 0, &dst_color);
+
+        client_src_id[i] = rgad_register(client, src_buf_fd[i], src_buf_bo[i]->size);
+        client_dst_id[i] = rgad_register(client, dst_buf_fd[i], dst_buf_bo[i]->size);
+        if (client_src_id[i] < 0 || client_dst_id[i] < 0) {
+            printf("failed to register buffers with the daemon\n");
+            exit(-1);
         }
     }
 
-    printf("press <ENTER> to exit test application\n");
+    if (input_path) {
+        reader = open_frame_reader(input_path,
+            fmt_frame_size(get_fmt_info(src_format), SRC_WIDTH, SRC_HEIGHT));
+        if (!reader)
+            exit(-1);
+    }
+
+    if (verify && job_late == SCHED_LATE_DEGRADE)
+        printf("degradable frames are not verified\n");
+    else if (verify)
+        start_verifier();
+
+    ret = process_mem2mem_frame();
 
-    getchar();
+    rgad_disconnect(client);
+    client = NULL;
+    close_frame_reader(reader);
+    reader = NULL;
+    return ret;
 }
 
-static void start_mem2mem()
+static void stop_serving(int sig)
 {
-    int ret, i;
-    struct v4l2_buffer buf;
-    struct v4l2_requestbuffers reqbuf;
-    enum v4l2_buf_type type;
-
-    init_mem2mem_dev();
-
-    memset(&(buf), 0, sizeof(buf));
-    reqbuf.count = 1;
-    reqbuf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
-    type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
-    reqbuf.memory = V4L2_MEMORY_DMABUF;
-    ret = ioctl(mem2mem_fd, VIDIOC_REQBUFS, &reqbuf);
-    if (ret != 0) {
-        fprintf(stderr, "%s:%d: ", __func__, __LINE__);
-        perror("ioctl");
+    stop_rgad(server);
+}
+
+/* Own the nodes and serve other processes until SIGINT or SIGTERM. */
+static int serve_mem2mem()
+{
+    struct m2m_dev* devs[M2M_MAX_DEVS];
+    struct m2m_config cfg;
+    int i, num_devs = 0;
+
+    get_m2m_config(&cfg);
+    if (sched_devices)
+        num_devs = open_sched_devs(&cfg, devs);
+    if (!num_devs && !cpu_workers) {
+        printf("no usable m2m device, serving with the CPU\n");
+        cpu_workers = 1;
+    }
+
+    server = create_rgad(serve_path, &cfg, devs, num_devs, cpu_workers);
+    if (!server)
+        return EXIT_FAILURE;
+
+    signal(SIGINT, stop_serving);
+    signal(SIGTERM, stop_serving);
+    run_rgad(server);
+    destroy_rgad(server);
+    server = NULL;
+
+    for (i = 0; i < num_devs; i++) {
+        m2m_stream(devs[i], 0);
+        close_m2m_dev(devs[i]);
+    }
+    return 0;
+}
+
+/* Pool buffers are plain 32 bpp bos of the right byte size. */
+static int alloc_graph_bo(void* priv, size_t size, struct graph_image* img)
+{
+    int i;
+
+    for (i = 0; i < MAX_GRAPH_BUFS && graph_bo[i]; i++)
+        ;
+    if (i == MAX_GRAPH_BUFS)
+        return -1;
+
+    graph_bo[i] = create_sp_bo(dev_sp, 1024, (size + 4095) / 4096, 0, 32, DRM_FORMAT_XRGB8888, bo_flags);
+    if (!graph_bo[i]) {
+        printf("Failed to create gem buf\n");
+        return -1;
+    }
+    img->fd = export_sp_bo(graph_bo[i]);
+    img->addr = pin_sp_bo(graph_bo[i]);
+    return 0;
+}
+
+static void free_graph_bo(void* priv, struct graph_image* img)
+{
+    int i;
+
+    for (i = 0; i < MAX_GRAPH_BUFS; i++) {
+        if (graph_bo[i] && graph_bo[i]->map_addr == img->addr) {
+            close(img->fd);
+            free_sp_bo(graph_bo[i]);
+            graph_bo[i] = NULL;
+        }
+    }
+}
+
+/*
+ * Crops, overlays and transforms beyond one job of the node run as a
+ * graph of passes over pooled intermediates.
+ */
+static int start_mem2mem_graph()
+{
+    struct graph_alloc alloc = { alloc_graph_bo, free_graph_bo, NULL };
+    struct transform_op op;
+    int ret;
+
+    skip_dst_crop();
+    memset(&op, 0, sizeof(op));
+    op.src_format = src_format;
+    op.src_width = SRC_WIDTH;
+    op.src_height = SRC_HEIGHT;
+    op.crop.x = SRC_CROP_X;
+    op.crop.y = SRC_CROP_Y;
+    op.crop.w = SRC_CROP_W;
+    op.crop.h = SRC_CROP_H;
+    op.rotate = rotate;
+    op.hflip = hflip;
+    op.vflip = vflip;
+    op.dst_format = dst_format;
+    op.dst_width = DST_WIDTH;
+    op.dst_height = DST_HEIGHT;
+    op.src_color = src_color;
+    op.dst_color = dst_color;
+
+    if (osd_rect.w) {
+        /* a solid overlay is all the test needs, a small one scales up */
+        op.osd_format = V4L2_PIX_FMT_ARGB32;
+        op.osd_width = 64;
+        op.osd_height = 64;
+        op.osd_rect = osd_rect;
+        osd_bo = create_frame_bo(op.osd_format, op.osd_width, op.osd_height, &graph_io.osd.fd);
+        fill_pattern_bo(PATTERN_SOLID, osd_color, op.osd_format, osd_bo, 0, NULL);
+        graph_io.osd.addr = pin_sp_bo(osd_bo);
+    }
+
+    graph = create_graph(&op, mem2mem_dev_name, &alloc);
+    if (!graph)
+        exit(-1);
+    print_graph(graph);
+
+    src_buf_bo[0] = create_frame_bo(src_format, SRC_WIDTH, SRC_HEIGHT, &src_buf_fd[0]);
+    dst_buf_bo[0] = create_frame_bo(dst_format, DST_WIDTH, DST_HEIGHT, &dst_buf_fd[0]);
+    num_src_bufs = num_dst_bufs = 1;
+    fill_pattern_bo(pattern, pattern_color, src_format, src_buf_bo[0], 0, &src_color);
+    fill_pattern_bo(PATTERN_SOLID, 0x550000ff, dst_format, dst_buf_bo[0], 0, &dst_color);
+    graph_io.src.addr = pin_sp_bo(src_buf_bo[0]);
+    graph_io.src.fd = src_buf_fd[0];
+    graph_io.dst.addr = pin_sp_bo(dst_buf_bo[0]);
+    graph_io.dst.fd = dst_buf_fd[0];
+
+    if (input_path) {
+        reader = open_frame_reader(input_path,
+            fmt_frame_size(get_fmt_info(src_format), SRC_WIDTH, SRC_HEIGHT));
+        if (!reader)
+            exit(-1);
+    } else if (pattern_cache > 1) {
+        create_pattern_cache(fmt_frame_size(get_fmt_info(src_format), SRC_WIDTH, SRC_HEIGHT));
+    }
+
+    if (verify && osd_rect.w)
+        printf("overlays are not verified\n");
+    else if (verify)
+        start_verifier();
+
+    ret = process_mem2mem_frame();
+
+    destroy_graph(graph);
+    graph = NULL;
+
+    if (osd_bo) {
+        close(graph_io.osd.fd);
+        free_sp_bo(osd_bo);
+        osd_bo = NULL;
+    }
+
+    close_frame_reader(reader);
+    reader = NULL;
+    return ret;
+}
+
+/* Like the destination buffers, one per slot of the result cache. */
+static void create_results()
+{
+    int i;
+
+    results = create_result_cache(num_results, sizeof(struct m2m_config));
+    if (!results)
         return;
+
+    for (i = 0; i < num_results; i++) {
+        struct sp_bo* bo
+            = create_sp_bo(dev_sp, DST_WIDTH, DST_HEIGHT, 0, m2m->dst_size[0] * 8 / (DST_WIDTH * DST_HEIGHT), get_drm_format(dst_format), bo_flags);
+        if (!bo) {
+            printf("Failed to create gem buf\n");
+            exit(-1);
+        }
+
+        result_fd[i] = export_sp_bo(bo);
+        result_bo[i] = bo;
+        fill_pattern_bo(PATTERN_SOLID, 0x550000ff, dst_format, bo, 0, &dst_color);
     }
-    num_src_bufs = reqbuf.count;
-    printf("Got %d src buffers\n", num_src_bufs);
+}
 
-    reqbuf.count = NUM_BUFS;
-    reqbuf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    ret = ioctl(mem2mem_fd, VIDIOC_REQBUFS, &reqbuf);
-    if (ret != 0) {
-        fprintf(stderr, "%s:%d: ", __func__, __LINE__);
-        perror("ioctl");
+static void destroy_results()
+{
+    int i;
+
+    if (!results)
         return;
+
+    for (i = 0; i < num_results; i++) {
+        close(result_fd[i]);
+        free_sp_bo(result_bo[i]);
     }
-    num_dst_bufs = reqbuf.count;
-    printf("Got %d dst buffers\n", num_dst_bufs);
+    destroy_result_cache(results);
+    results = NULL;
+}
 
-    for (i = 0; i < num_src_bufs; ++i) {
-        buf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
-        buf.memory = V4L2_MEMORY_DMABUF;
-        buf.index = i;
-        ret = ioctl(mem2mem_fd, VIDIOC_QUERYBUF, &buf);
-        if (ret != 0) {
-            fprintf(stderr, "%s:%d: ", __func__, __LINE__);
-            perror("ioctl");
-            return;
+static int start_mem2mem()
+{
+    unsigned int src_want = src_pool ? src_pool : use_uring ? NUM_BUFS : 1;
+    unsigned int dst_want = dst_pool ? dst_pool : NUM_BUFS;
+    struct m2m_config cfg;
+    rga::Device dev;
+    struct plan plan;
+    int i, ret = -1;
+
+    memset(&dst_compose, 0, sizeof(dst_compose));
+    if (SRC_CROP_W || osd_rect.w)
+        return start_mem2mem_graph();
+
+    if (init_mem2mem_dev(dev, &plan)) {
+        dev.close();
+        m2m = NULL;
+        if (plan.route == ROUTE_TWO_PASS)
+            return start_mem2mem_graph();
+        printf("falling back to the CPU\n");
+        cpu_workers = 1;
+        return start_mem2mem_sched();
+    }
+
+    /* the slots pair a source with a destination, the loops use what they asked for */
+    get_m2m_config(&cfg);
+    if (session.open(static_cast<rga::Device&&>(dev), cfg, src_want > dst_want ? src_want : dst_want))
+        goto out;
+    m2m = session.device().get();
+    mem2mem_fd = m2m->fd;
+
+    if (get_dst_crop(&dst_compose)) {
+        if (plan.route == ROUTE_TILED) {
+            printf("stripes compose the whole destination, not cropping\n");
+            memset(&dst_compose, 0, sizeof(dst_compose));
+        } else if (m2m_set_selection(m2m, 1, &dst_compose)) {
+            goto out;
         }
+    }
 
-        src_buf_size[i] = buf.length;
+    num_src_bufs = src_want < m2m->num_src_bufs ? src_want : m2m->num_src_bufs;
+    num_dst_bufs = dst_want < m2m->num_dst_bufs ? dst_want : m2m->num_dst_bufs;
+    printf("Got %d src buffers\n", num_src_bufs);
+    printf("Got %d dst buffers\n", num_dst_bufs);
 
+    for (i = 0; i < num_src_bufs; ++i) {
         struct sp_bo* bo
-            = create_sp_bo(dev_sp, SRC_WIDTH, SRC_HEIGHT, 0, buf.length * 8 / (SRC_WIDTH * SRC_HEIGHT), get_drm_format(src_format), 0);
+            = create_sp_bo(dev_sp, SRC_WIDTH, SRC_HEIGHT, 0, m2m->src_size[i] * 8 / (SRC_WIDTH * SRC_HEIGHT), get_drm_format(src_format), bo_flags);
         if (!bo) {
             printf("Failed to create gem buf\n");
             exit(-1);
         }
 
-        drmPrimeHandleToFD(dev_sp->fd, bo->handle, 0, &src_buf_fd[i]);
+        src_buf_fd[i] = export_sp_bo(bo);
         src_buf_bo[i] = bo;
-        fillbuffer(src_format, src_buf_bo[i]);
+        fill_pattern_bo(pattern, pattern_color, src_format, src_buf_bo[i], 0, &src_color);
     }
 
-    for (i = 0; i < num_dst_bufs; ++i) {
-        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        buf.memory = V4L2_MEMORY_DMABUF;
-        buf.index = i;
-        ret = ioctl(mem2mem_fd, VIDIOC_QUERYBUF, &buf);
-        if (ret != 0) {
-            fprintf(stderr, "%s:%d: ", __func__, __LINE__);
-            perror("ioctl");
-            return;
-        }
+    if (input_path) {
+        reader = open_frame_reader(input_path,
+            fmt_frame_size(get_fmt_info(src_format), SRC_WIDTH, SRC_HEIGHT));
+        if (!reader)
+            exit(-1);
+    } else if (pattern_cache > 1) {
+        create_pattern_cache(m2m->src_size[0]);
+    }
 
-        dst_buf_size[i] = buf.length;
+    for (i = 0; i < num_dst_bufs; ++i) {
         struct sp_bo* bo
-            = create_sp_bo(dev_sp, DST_WIDTH, DST_HEIGHT, 0, buf.length * 8 / (DST_WIDTH * DST_HEIGHT), get_drm_format(dst_format), 0);
+            = create_sp_bo(dev_sp, DST_WIDTH, DST_HEIGHT, 0, m2m->dst_size[i] * 8 / (DST_WIDTH * DST_HEIGHT), get_drm_format(dst_format), bo_flags);
         if (!bo) {
             printf("Failed to create gem buf\n");
             exit(-1);
         }
 
-        drmPrimeHandleToFD(dev_sp->fd, bo->handle, 0, &dst_buf_fd[i]);
+        dst_buf_fd[i] = export_sp_bo(bo);
         dst_buf_bo[i] = bo;
-        fillbuffer2(dst_format, bo);
+        fill_pattern_bo(PATTERN_SOLID, 0x550000ff, dst_format, bo, 0, &dst_color);
     }
 
-    type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    ret = ioctl(mem2mem_fd, VIDIOC_STREAMON, &type);
-    if (ret != 0) {
-        fprintf(stderr, "%s:%d: ", __func__, __LINE__);
-        perror("ioctl");
-        return;
+    if (spin && num_stripes) {
+        printf("stripes are planned for one rotation, not spinning\n");
+        spin = 0;
+    }
+    if (spin && m2m->caps.num_ctrls && !find_ctrl_caps(&m2m->caps, V4L2_CID_ROTATE)) {
+        printf("%s can't rotate, not spinning\n", m2m->path);
+        spin = 0;
+    }
+    if (spin && use_uring && m2m->media_fd < 0) {
+        /* the rotation would change under the frames in flight */
+        printf("%s has no request API, not spinning queued frames\n", m2m->path);
+        spin = 0;
     }
 
-    type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
-    ret = ioctl(mem2mem_fd, VIDIOC_STREAMON, &type);
-    if (ret != 0) {
-        fprintf(stderr, "%s:%d: ", __func__, __LINE__);
-        perror("ioctl");
-        return;
+    if (verify && spin)
+        printf("spinning frames are not verified\n");
+    else if (verify)
+        start_verifier();
+
+    if (damage && (num_stripes || spin || num_results || dst_compose.w)) {
+        printf("damage needs whole frames into one buffer, transforming everything\n");
+        damage = 0;
     }
 
-    process_mem2mem_frame();
+    if (num_results)
+        create_results();
 
-    type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    ret = ioctl(mem2mem_fd, VIDIOC_STREAMOFF, &type);
-    if (ret != 0) {
-        fprintf(stderr, "%s:%d: ", __func__, __LINE__);
-        perror("ioctl");
-        return;
+    if (use_fences && display == 1 && !use_uring && !num_stripes && !results && !damage) {
+        timeline = create_sw_timeline();
+        if (!timeline)
+            printf("fenced flips need sw_sync, presenting after the transform\n");
     }
 
-    type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
-    ret = ioctl(mem2mem_fd, VIDIOC_STREAMOFF, &type);
-    if (ret != 0) {
-        fprintf(stderr, "%s:%d: ", __func__, __LINE__);
-        perror("ioctl");
-        return;
+    ret = process_mem2mem_frame();
+
+    destroy_results();
+
+    if (flip_fence >= 0) {
+        wait_fence(flip_fence, 1000);
+        close(flip_fence);
+        flip_fence = -1;
     }
+    destroy_sw_timeline(timeline);
+    timeline = NULL;
+
+out:
+    /* the buffers are freed by the caller, like after a run */
+    close_frame_reader(reader);
+    reader = NULL;
 
-    close(mem2mem_fd);
+    session.close();
+    m2m = NULL;
+    return ret;
 }
 
+
 void init_drm_context()
 {
     int ret, i;
-    dev_sp = create_sp_dev();
+
+    /* transforming alone needs buffers, not KMS */
+    dev_sp = display ? create_sp_dev() : create_headless_sp_dev(heap_name);
     if (!dev_sp) {
         printf("create_sp_dev failed\n");
         exit(-1);
@@ -585,12 +1813,174 @@ void init_drm_context()
     }
 }
 
+/* What a run leaves behind for main to free. */
+static void free_mem2mem_bufs()
+{
+    int i;
+
+    for (i = 0; i < num_src_bufs; ++i) {
+        close(src_buf_fd[i]);
+        free_sp_bo(src_buf_bo[i]);
+    }
+
+    for (i = 1; i < num_src_frames; ++i) {
+        close(src_frame_fd[i]);
+        free_sp_bo(src_frame_bo[i]);
+    }
+
+    for (i = 0; i < num_dst_bufs; ++i) {
+        close(dst_buf_fd[i]);
+        free_sp_bo(dst_buf_bo[i]);
+    }
+
+    num_src_bufs = num_dst_bufs = 0;
+    num_src_frames = 0;
+    if (display)
+        test_plane_sp->bo = NULL;
+}
+
+/* One run from setup to teardown, -1 when it failed. */
+static int run_mem2mem()
+{
+    int ret;
+
+    if (client_path)
+        ret = start_mem2mem_client();
+    else if (sched_devices || cpu_workers)
+        ret = start_mem2mem_sched();
+    else
+        ret = start_mem2mem();
+
+    free_mem2mem_bufs();
+    return ret;
+}
+
+/*
+ * Runs of --num-frames frames from setup to teardown until 'soak_secs'
+ * are up. The first round takes the options as given, the others pick a
+ * random rotation, flips, destination format and size that the node
+ * plans a route for. Returns the number of leaks and slowdowns found.
+ */
+static int run_soak()
+{
+    static const uint32_t formats[] = {
+        V4L2_PIX_FMT_NV12, V4L2_PIX_FMT_ARGB32, V4L2_PIX_FMT_RGB565, V4L2_PIX_FMT_XRGB32,
+    };
+    size_t base_width = DST_WIDTH, base_height = DST_HEIGHT;
+    int base_rotate = rotate, base_hflip = hflip, base_vflip = vflip;
+    uint32_t base_format = dst_format;
+    /* a round turns these off or falls back, the next starts over */
+    int opt_cpu_workers = cpu_workers, opt_damage = damage, opt_spin = spin, opt_warm = warm;
+    struct m2m_config cfg;
+    struct timespec t0, now;
+    struct m2m_dev* dev;
+    struct plan plan;
+    struct soak* s;
+    int round, tries, ret;
+
+    if (!soak_seed)
+        soak_seed = time(NULL);
+    printf("*[SOAK]* : %d secs, seed %u\n", soak_secs, soak_seed);
+
+    /* only the caps are needed, the rounds open their own */
+    dev = open_m2m_dev(mem2mem_dev_name);
+    if (!dev)
+        printf("*[SOAK]* : no %s to plan for, every round as given\n", mem2mem_dev_name);
+    else if (tile_width)
+        dev->caps.max_job_width = tile_width;
+
+    s = create_soak();
+    if (!s) {
+        close_m2m_dev(dev);
+        return 1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (round = 0;; round++) {
+        num_stripes = 0;
+        cpu_workers = opt_cpu_workers;
+        damage = opt_damage;
+        spin = opt_spin;
+        /* only the first round waits for the go */
+        warm = round ? 0 : opt_warm;
+
+        for (tries = 0; round && dev && tries < 16; tries++) {
+            rotate = rand_r(&soak_seed) % 4 * 90;
+            hflip = rand_r(&soak_seed) & 1;
+            vflip = rand_r(&soak_seed) & 1;
+            dst_format = formats[rand_r(&soak_seed) % (sizeof(formats) / sizeof(formats[0]))];
+            /* a crop is for one size */
+            if (!DST_CROP_W) {
+                DST_WIDTH = (base_width * (50 + rand_r(&soak_seed) % 151) / 100 + 1) & ~1;
+                DST_HEIGHT = (base_height * (50 + rand_r(&soak_seed) % 151) / 100 + 1) & ~1;
+            }
+            get_m2m_config(&cfg);
+            plan_transform(&dev->caps, &cfg, &plan);
+            if (plan.route != ROUTE_CPU)
+                break;
+        }
+        if (tries == 16) {
+            /* nothing random fit, the first round did */
+            rotate = base_rotate;
+            hflip = base_hflip;
+            vflip = base_vflip;
+            dst_format = base_format;
+            DST_WIDTH = base_width;
+            DST_HEIGHT = base_height;
+        }
+        if (round)
+            printf("*[SOAK]* : round %d, %s %zux%zu, rotate %d, hflip %d, vflip %d\n", round,
+                get_fmt_info(dst_format)->name, DST_WIDTH, DST_HEIGHT, rotate, hflip, vflip);
+
+        soak_frames = soak_us = 0;
+        ret = run_mem2mem();
+        soak_round(s, dev_sp, soak_frames * DST_WIDTH * DST_HEIGHT, soak_us,
+            ret || soak_frames < (unsigned long long)num_frames);
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (elapsed_us(&t0, &now) >= soak_secs * 1000000ULL)
+            break;
+    }
+
+    close_m2m_dev(dev);
+    return destroy_soak(s);
+}
+
+static int probe_mem2mem_dev()
+{
+    struct m2m_config cfg;
+    struct m2m_dev* dev;
+    struct plan plan;
+
+    dev = open_m2m_dev(mem2mem_dev_name);
+    if (!dev)
+        return EXIT_FAILURE;
+
+    /* refresh the cache on an explicit request */
+    probe_m2m_caps(dev->fd, &dev->caps, 1);
+    if (tile_width)
+        dev->caps.max_job_width = tile_width;
+    print_m2m_caps(&dev->caps);
+
+    get_m2m_config(&cfg);
+    plan_transform(&dev->caps, &cfg, &plan);
+    printf("route: %s", route_name(plan.route));
+    if (plan.route == ROUTE_TILED)
+        printf(", %d stripes", plan.num_tiles);
+    if (plan.route == ROUTE_TWO_PASS)
+        printf(", through %.4s %ux%u", (const char*)&plan.mid_format, plan.mid_width, plan.mid_height);
+    printf(plan.reason ? " (%s)\n" : "\n", plan.reason);
+
+    close_m2m_dev(dev);
+    return 0;
+}
+
 static void usage(FILE* fp, int argc, char** argv)
 {
     fprintf(fp,
         "Usage: %s [options]\n\n"
         "Options:\n"
-        "--device                   mem2mem device name [/dev/video0]\n"
+        "--device                   mem2mem device name [/dev/video0], fake[:job=<us>:mp=<us>:cpu=0] emulates one\n"
         "--hel                      Print this message\n"
         "--src-fmt                  Source video format, 0 = NV12, 1 = ARGB32, 2 = RGB888\n"
         "--src-width                Source video width\n"
@@ -613,6 +2003,45 @@ static void usage(FILE* fp, int argc, char** argv)
         "--vflip                    Vertical Mirror\n"
         "--num-frames               Number of frames to process [100]\n"
         "--display                  Display\n"
+        "--pattern                  Source pattern: checker, smpte, gradient, zoneplate, box, solid [checker]\n"
+        "--pattern-color            Solid and box pattern color, ARGB hex [ffffffff]\n"
+        "--pattern-cache            Number of source frames to precompute [0]\n"
+        "--verify                   Check every output against the CPU reference\n"
+        "--verify-tolerance         Max per channel difference of scaled outputs [255]\n"
+        "--verify-psnr              Min per channel PSNR of scaled outputs in dB [30]\n"
+        "--verify-dump              Directory for failing output and reference frames\n"
+        "--input                    Raw source frames to read instead of a pattern\n"
+        "--output                   File the raw destination frames are written to\n"
+        "--uring                    Batch buffer polling and file I/O through io_uring\n"
+        "--devices                  Spread frames over these m2m nodes, comma separated or all\n"
+        "--cpu-workers              Software workers that share the frames with the nodes [0]\n"
+        "--probe                    Print what the device supports and exit\n"
+        "--tile-width               Split frames into stripes no wider than this\n"
+        "--osd                      Blend an overlay at X,Y,W,H of the destination\n"
+        "--osd-color                Overlay color, ARGB hex [80ffffff]\n"
+        "--src-colorspace           Source YCbCr encoding: 601, 709, 2020 [601]\n"
+        "--src-range                Source YCbCr range: limited, full [limited]\n"
+        "--dst-colorspace           Destination YCbCr encoding: 601, 709, 2020 [601]\n"
+        "--dst-range                Destination YCbCr range: limited, full [limited]\n"
+        "--fences                   Explicit sync: fenced flips and dmabuf fence waits\n"
+        "--cached-map               Map buffers cached through the dmabuf, not write-combined\n"
+        "--huge-pages               Back host frame buffers with huge pages [1]\n"
+        "--spin                     Add this many degrees to the rotation of every frame\n"
+        "--serve                    Serve transforms on this Unix socket, with --devices and --cpu-workers\n"
+        "--client                   Run the frames through the daemon on this socket\n"
+        "--priority                 Class of the scheduled frames: realtime, interactive, bulk [realtime]\n"
+        "--deadline                 Frames are due this many msecs after submission [0 = none]\n"
+        "--late                     Frames that would miss the deadline: run, drop, degrade [run]\n"
+        "--result-cache             Keep the results of this many transforms and reuse them [0]\n"
+        "--damage                   Only transform the parts of the source that changed\n"
+        "--heap                     DMA heap the buffers come from without --display [system]\n"
+        "--config                   Take the device, formats, sizes and buffers from a saved configuration\n"
+        "--save-config              Save the configuration of these options to a file and exit\n"
+        "--warm                     Set up everything, then wait for a line on stdin before the first frame\n"
+        "--soak                     Repeat randomized runs for this many secs, fail on leaks or slowdown\n"
+        "--soak-seed                Seed of the soak parameters [0 = time]\n"
+        "--governor                 Hold the hottest thermal zone below this many degrees C by shedding depth and rate\n"
+        "--sysfs-root               Where the governor finds thermal zones and clocks [/sys]\n"
         "",
         argv[0]);
 }
@@ -641,12 +2070,53 @@ static const struct option long_options[] = {
     { "vflip", required_argument, NULL, 0 },
     { "num-frames", required_argument, NULL, 0 },
     { "display", required_argument, NULL, 0 },
+    { "pattern", required_argument, NULL, 0 },
+    { "pattern-color", required_argument, NULL, 0 },
+    { "pattern-cache", required_argument, NULL, 0 },
+    { "verify", required_argument, NULL, 0 },
+    { "verify-tolerance", required_argument, NULL, 0 },
+    { "verify-psnr", required_argument, NULL, 0 },
+    { "verify-dump", required_argument, NULL, 0 },
+    { "input", required_argument, NULL, 0 },
+    { "output", required_argument, NULL, 0 },
+    { "uring", required_argument, NULL, 0 },
+    { "devices", required_argument, NULL, 0 },
+    { "cpu-workers", required_argument, NULL, 0 },
+    { "probe", required_argument, NULL, 0 },
+    { "tile-width", required_argument, NULL, 0 },
+    { "osd", required_argument, NULL, 0 },
+    { "osd-color", required_argument, NULL, 0 },
+    { "src-colorspace", required_argument, NULL, 0 },
+    { "src-range", required_argument, NULL, 0 },
+    { "dst-colorspace", required_argument, NULL, 0 },
+    { "dst-range", required_argument, NULL, 0 },
+    { "fences", required_argument, NULL, 0 },
+    { "cached-map", required_argument, NULL, 0 },
+    { "huge-pages", required_argument, NULL, 0 },
+    { "spin", required_argument, NULL, 0 },
+    { "serve", required_argument, NULL, 0 },
+    { "client", required_argument, NULL, 0 },
+    { "priority", required_argument, NULL, 0 },
+    { "deadline", required_argument, NULL, 0 },
+    { "late", required_argument, NULL, 0 },
+    { "result-cache", required_argument, NULL, 0 },
+    { "damage", required_argument, NULL, 0 },
+    { "heap", required_argument, NULL, 0 },
+    { "config", required_argument, NULL, 0 },
+    { "save-config", required_argument, NULL, 0 },
+    { "warm", required_argument, NULL, 0 },
+    { "soak", required_argument, NULL, 0 },
+    { "soak-seed", required_argument, NULL, 0 },
+    { "governor", required_argument, NULL, 0 },
+    { "sysfs-root", required_argument, NULL, 0 },
     { 0, 0, 0, 0 }
 };
 
 int main(int argc, char** argv)
 {
-    int i;
+    const struct fmt_info* fi;
+    int i, ret, soak_failures = 0;
+    clock_gettime(CLOCK_MONOTONIC, &launch);
     mem2mem_dev_name = (char*)"/dev/video0";
 
     for (;;) {
@@ -668,34 +2138,9 @@ int main(int argc, char** argv)
             exit(EXIT_SUCCESS);
 
         case 2:
-            c = atoi(optarg);
-            if (c == 0) {
-                src_format = V4L2_PIX_FMT_NV12;
-            } else if (c == 1) {
-                src_format = V4L2_PIX_FMT_ARGB32;
-            } else if (c == 2) {
-                src_format = V4L2_PIX_FMT_RGB24;
-            } else if (c == 3) {
-                src_format = V4L2_PIX_FMT_RGB565;
-            } else if (c == 4) {
-                src_format = V4L2_PIX_FMT_YUV420;
-            } else if (c == 5) {
-                src_format = V4L2_PIX_FMT_XRGB32;
-            } else if (c == 6) {
-                src_format = V4L2_PIX_FMT_ABGR32;
-            } else if (c == 7) {
-                src_format = V4L2_PIX_FMT_XBGR32;
-            } else if (c == 8) {
-                src_format = V4L2_PIX_FMT_ARGB555;
-            } else if (c == 9) {
-                src_format = V4L2_PIX_FMT_ARGB444;
-            } else if (c == 10) {
-                src_format = V4L2_PIX_FMT_NV61;
-            } else if (c == 11) {
-                src_format = V4L2_PIX_FMT_NV16;
-            } else if (c == 12) {
-                src_format = V4L2_PIX_FMT_YUV422P;
-            }
+            fi = get_fmt_info_by_index(atoi(optarg));
+            if (fi)
+                src_format = fi->v4l2;
             break;
         case 3:
             SRC_WIDTH = atoi(optarg);
@@ -716,34 +2161,9 @@ int main(int argc, char** argv)
             SRC_CROP_H = atoi(optarg);
             break;
         case 9:
-            c = atoi(optarg);
-            if (c == 0) {
-                dst_format = V4L2_PIX_FMT_NV12;
-            } else if (c == 1) {
-                dst_format = V4L2_PIX_FMT_ARGB32;
-            } else if (c == 2) {
-                dst_format = V4L2_PIX_FMT_RGB24;
-            } else if (c == 3) {
-                dst_format = V4L2_PIX_FMT_RGB565;
-            } else if (c == 4) {
-                dst_format = V4L2_PIX_FMT_YUV420;
-            } else if (c == 5) {
-                dst_format = V4L2_PIX_FMT_XRGB32;
-            } else if (c == 6) {
-                dst_format = V4L2_PIX_FMT_ABGR32;
-            } else if (c == 7) {
-                dst_format = V4L2_PIX_FMT_XBGR32;
-            } else if (c == 8) {
-                dst_format = V4L2_PIX_FMT_ARGB555;
-            } else if (c == 9) {
-                dst_format = V4L2_PIX_FMT_ARGB444;
-            } else if (c == 10) {
-                dst_format = V4L2_PIX_FMT_NV61;
-            } else if (c == 11) {
-                dst_format = V4L2_PIX_FMT_NV16;
-            } else if (c == 12) {
-                dst_format = V4L2_PIX_FMT_YUV422P;
-            }
+            fi = get_fmt_info_by_index(atoi(optarg));
+            if (fi)
+                dst_format = fi->v4l2;
             break;
         case 10:
             DST_WIDTH = atoi(optarg);
@@ -784,29 +2204,202 @@ int main(int argc, char** argv)
         case 22:
             display = atoi(optarg);
             break;
+        case 23:
+            pattern = parse_pattern(optarg);
+            if (pattern < 0) {
+                usage(stderr, argc, argv);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 24:
+            sscanf(optarg, "%x", &pattern_color);
+            break;
+        case 25:
+            pattern_cache = atoi(optarg);
+            break;
+        case 26:
+            verify = atoi(optarg);
+            break;
+        case 27:
+            verify_tolerance = atoi(optarg);
+            break;
+        case 28:
+            verify_psnr = atof(optarg);
+            break;
+        case 29:
+            verify_dump_dir = optarg;
+            break;
+        case 30:
+            input_path = optarg;
+            break;
+        case 31:
+            output_path = optarg;
+            break;
+        case 32:
+            use_uring = atoi(optarg);
+            break;
+        case 33:
+            sched_devices = optarg;
+            break;
+        case 34:
+            cpu_workers = atoi(optarg);
+            break;
+        case 35:
+            probe = atoi(optarg);
+            break;
+        case 36:
+            tile_width = atoi(optarg);
+            break;
+        case 37:
+            if (sscanf(optarg, "%u,%u,%u,%u", &osd_rect.x, &osd_rect.y, &osd_rect.w, &osd_rect.h) != 4) {
+                usage(stderr, argc, argv);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 38:
+            sscanf(optarg, "%x", &osd_color);
+            break;
+        case 39:
+        case 41:
+            ret = parse_ycbcr_enc(optarg);
+            if (ret < 0) {
+                usage(stderr, argc, argv);
+                exit(EXIT_FAILURE);
+            }
+            (index == 39 ? &src_color : &dst_color)->ycbcr_enc = ret;
+            break;
+        case 40:
+        case 42:
+            ret = parse_quantization(optarg);
+            if (ret < 0) {
+                usage(stderr, argc, argv);
+                exit(EXIT_FAILURE);
+            }
+            (index == 40 ? &src_color : &dst_color)->quantization = ret;
+            break;
+        case 43:
+            use_fences = atoi(optarg);
+            break;
+        case 44:
+            bo_flags = atoi(optarg) ? SP_BO_FLAG_CACHED : 0;
+            break;
+        case 45:
+            frame_arena_use_huge_pages(atoi(optarg));
+            break;
+        case 46:
+            spin = atoi(optarg);
+            if (spin % 90) {
+                printf("--spin takes multiples of 90 degrees\n");
+                exit(EXIT_FAILURE);
+            }
+            spin = (spin % 360 + 360) % 360;
+            break;
+        case 47:
+            serve_path = optarg;
+            break;
+        case 48:
+            client_path = optarg;
+            break;
+        case 49:
+            job_prio = parse_sched_prio(optarg);
+            if (job_prio < 0) {
+                usage(stderr, argc, argv);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 50:
+            job_budget_us = atof(optarg) * 1000;
+            break;
+        case 51:
+            job_late = parse_sched_late(optarg);
+            if (job_late < 0) {
+                usage(stderr, argc, argv);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 52:
+            /* one slot for the result on screen, one to produce the next in */
+            num_results = atoi(optarg);
+            if (num_results == 1)
+                num_results = 2;
+            if (num_results > MAX_RESULTS)
+                num_results = MAX_RESULTS;
+            break;
+        case 53:
+            damage = atoi(optarg);
+            break;
+        case 54:
+            heap_name = optarg;
+            break;
+        case 55: {
+            struct snapshot snap;
+
+            /* options after it still apply */
+            if (load_snapshot(optarg, &snap)) {
+                printf("%s is not a saved configuration\n", optarg);
+                exit(EXIT_FAILURE);
+            }
+            set_snapshot(&snap);
+            break;
+        }
+        case 56:
+            save_config_path = optarg;
+            break;
+        case 57:
+            warm = atoi(optarg);
+            break;
+        case 58:
+            soak_secs = atoi(optarg);
+            break;
+        case 59:
+            soak_seed = strtoul(optarg, NULL, 0);
+            break;
+        case 60:
+            governor_ceiling_mc = atof(optarg) * 1000;
+            break;
+        case 61:
+            sysfs_root = optarg;
+            break;
         default:
             usage(stderr, argc, argv);
             exit(EXIT_FAILURE);
         }
     }
 
+    if (save_config_path) {
+        struct snapshot snap;
+
+        ret = get_snapshot(&snap);
+        if (!ret)
+            ret = save_snapshot(save_config_path, &snap);
+        if (ret)
+            printf("saving %s failed: %s\n", save_config_path, strerror(-ret));
+        return ret ? EXIT_FAILURE : 0;
+    }
+    if (probe)
+        return probe_mem2mem_dev();
+    if (serve_path)
+        return serve_mem2mem();
+
     init_drm_context();
 
-    start_mem2mem();
+    if (governor_ceiling_mc) {
+        struct governor_config gc;
 
-    for (i = 0; i < num_src_bufs; ++i) {
-        close(src_buf_fd[i]);
-        free_sp_bo(src_buf_bo[i]);
+        gc.sysfs_root = sysfs_root;
+        gc.ceiling_mc = governor_ceiling_mc;
+        governor = create_governor(&gc);
+        if (!governor)
+            printf("running ungoverned\n");
     }
 
-    for (i = 0; i < num_dst_bufs; ++i) {
-        close(dst_buf_fd[i]);
-        free_sp_bo(dst_buf_bo[i]);
-    }
+    if (soak_secs)
+        soak_failures = run_soak();
+    else if (run_mem2mem())
+        run_failures++;
 
-    if (display)
-        test_plane_sp->bo = NULL;
+    destroy_governor(governor);
     destroy_sp_dev(dev_sp);
 
-    return 0;
+    return verify_failures || soak_failures || run_failures ? EXIT_FAILURE : 0;
 }
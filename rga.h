@@ -0,0 +1,33 @@
+/*
+ * Copyright (C) Fuzhou Rockchip Electronics Co.Ltd
+ * Author: Jacob Chen <jacob-chen@iotwrt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#ifndef __RGA_H_INCLUDED__
+#define __RGA_H_INCLUDED__
+
+#include <linux/videodev2.h>
+
+/* operation values */
+#define V4L2_CID_BLEND			(V4L2_CID_IMAGE_PROC_CLASS_BASE + 4)
+enum v4l2_blend_mode {
+	V4L2_BLEND_SRC			= 0,
+	V4L2_BLEND_SRCATOP		= 1,
+	V4L2_BLEND_SRCIN		= 2,
+	V4L2_BLEND_SRCOUT		= 3,
+	V4L2_BLEND_SRCOVER		= 4,
+	V4L2_BLEND_DST			= 5,
+	V4L2_BLEND_DSTATOP		= 6,
+	V4L2_BLEND_DSTIN		= 7,
+	V4L2_BLEND_DSTOUT		= 8,
+	V4L2_BLEND_DSTOVER		= 9,
+	V4L2_BLEND_ADD			= 10,
+	V4L2_BLEND_CLEAR		= 11,
+};
+
+#endif /* __RGA_H_INCLUDED__ */
@@ -0,0 +1,880 @@
+/*
+ * Copyright (C) Fuzhou Rockchip Electronics Co.Ltd
+ * Author: Jacob Chen <jacob-chen@iotwrt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "format.h"
+#include "rgad.h"
+#include "scheduler.h"
+
+#define RGAD_MAGIC 0x64414752 /* "RGAd" */
+#define RGAD_VERSION 2
+#define RGAD_MAX_CONNS 16
+#define RGAD_MAX_FDS 3
+
+enum rgad_msg_type {
+    RGAD_HELLO,
+    RGAD_REGISTER,
+    RGAD_UNREGISTER,
+};
+
+/* setup messages, the same layout both ways */
+struct rgad_msg {
+    uint32_t type;
+    uint32_t magic;
+    uint32_t version;
+    int32_t id;
+    int32_t result;
+    uint64_t size;
+    struct m2m_config cfg;
+};
+
+struct rgad_sqe {
+    uint64_t tag;
+    int32_t src;
+    int32_t dst;
+    int32_t prio;
+    int32_t late;
+    uint64_t deadline_us; /* CLOCK_MONOTONIC of the daemon and the client */
+};
+
+struct rgad_cqe {
+    uint64_t tag;
+    int32_t result;
+    uint32_t pad;
+};
+
+/*
+ * Shared by a client and the daemon. Every index has one writer and sits
+ * on a cache line of its own: the client owns sq_tail and cq_head, the
+ * daemon sq_head and cq_tail. Indices count up and wrap at 2^32.
+ */
+struct rgad_ring {
+    uint32_t sq_tail __attribute__((aligned(64)));
+    uint32_t sq_head __attribute__((aligned(64)));
+    uint32_t cq_tail __attribute__((aligned(64)));
+    uint32_t cq_head __attribute__((aligned(64)));
+    struct rgad_sqe sq[RGAD_RING_ENTRIES] __attribute__((aligned(64)));
+    struct rgad_cqe cq[RGAD_RING_ENTRIES];
+};
+
+struct rgad_buf {
+    int fd; /* -1 for a free id */
+    size_t size;
+    void* addr; /* for the CPU workers */
+    int users; /* jobs in flight on it, under the connection lock */
+    int dead; /* unregistered, freed and answered by its last job */
+};
+
+struct rgad_conn;
+
+struct rgad_job {
+    struct sched_job job;
+    struct rgad_conn* conn;
+    uint64_t tag;
+    struct rgad_buf* src;
+    struct rgad_buf* dst;
+};
+
+struct rgad_conn {
+    struct rgad* d;
+    int sock;
+    int sq_efd;
+    int cq_efd;
+    struct rgad_ring* ring;
+    struct rgad_buf bufs[RGAD_MAX_BUFS];
+
+    /* a client never has more jobs out than the ring has entries */
+    struct rgad_job jobs[RGAD_RING_ENTRIES];
+    struct rgad_job* free_jobs[RGAD_RING_ENTRIES];
+    int num_free;
+    int in_flight;
+    int stalled; /* submissions left in the ring for a full scheduler */
+    pthread_mutex_t lock;
+    pthread_cond_t idle;
+};
+
+struct rgad {
+    char path[sizeof(((struct sockaddr_un*)0)->sun_path)];
+    int listen_fd;
+    int stop_efd;
+    /* rung by the first completion after a client stalled */
+    int kick_efd;
+    int stalled;
+
+    struct m2m_config cfg;
+    size_t src_size;
+    size_t dst_size;
+    struct sched* sched;
+    int map_bufs;
+
+    struct rgad_conn* conns[RGAD_MAX_CONNS];
+};
+
+struct rgad_client {
+    int sock;
+    int sq_efd;
+    int cq_efd;
+    struct rgad_ring* ring;
+    uint32_t outstanding;
+
+    int prio;
+    int late;
+    uint32_t budget_us;
+};
+
+static int send_msg(int sock, const struct rgad_msg* msg, const int* fds, int num_fds)
+{
+    char buf[CMSG_SPACE(RGAD_MAX_FDS * sizeof(int))];
+    struct iovec iov = { (void*)msg, sizeof(*msg) };
+    struct msghdr mh;
+    struct cmsghdr* cmsg;
+
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    if (num_fds) {
+        memset(buf, 0, sizeof(buf));
+        mh.msg_control = buf;
+        mh.msg_controllen = CMSG_SPACE(num_fds * sizeof(int));
+        cmsg = CMSG_FIRSTHDR(&mh);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(num_fds * sizeof(int));
+        memcpy(CMSG_DATA(cmsg), fds, num_fds * sizeof(int));
+    }
+
+    while (sendmsg(sock, &mh, MSG_NOSIGNAL) < 0) {
+        if (errno != EINTR)
+            return -errno;
+    }
+    return 0;
+}
+
+/* Returns how many fds came along, unused slots of 'fds' are -1. */
+static int recv_msg(int sock, struct rgad_msg* msg, int* fds, int max_fds)
+{
+    char buf[CMSG_SPACE(RGAD_MAX_FDS * sizeof(int))];
+    struct iovec iov = { msg, sizeof(*msg) };
+    struct msghdr mh;
+    struct cmsghdr* cmsg;
+    ssize_t len;
+    int i, n = 0;
+
+    for (i = 0; i < max_fds; i++)
+        fds[i] = -1;
+
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = buf;
+    mh.msg_controllen = sizeof(buf);
+
+    do {
+        len = recvmsg(sock, &mh, MSG_CMSG_CLOEXEC);
+    } while (len < 0 && errno == EINTR);
+    if (len < 0)
+        return -errno;
+    if (len == 0)
+        return -ECONNRESET;
+
+    for (cmsg = CMSG_FIRSTHDR(&mh); cmsg; cmsg = CMSG_NXTHDR(&mh, cmsg)) {
+        int* in = (int*)CMSG_DATA(cmsg);
+        int count;
+
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            continue;
+        count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (i = 0; i < count; i++) {
+            if (n < max_fds)
+                fds[n++] = in[i];
+            else
+                close(in[i]);
+        }
+    }
+
+    if (len != sizeof(*msg) || (mh.msg_flags & (MSG_TRUNC | MSG_CTRUNC))) {
+        for (i = 0; i < n; i++)
+            close(fds[i]);
+        return -EPROTO;
+    }
+    return n;
+}
+
+static void ring_doorbell(int efd)
+{
+    uint64_t one = 1;
+
+    if (write(efd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        perror("eventfd");
+}
+
+static void clear_doorbell(int efd)
+{
+    uint64_t count;
+
+    if (read(efd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+        perror("eventfd");
+}
+
+static void put_buf(struct rgad_buf* buf)
+{
+    if (buf->addr)
+        munmap(buf->addr, buf->size);
+    if (buf->fd >= 0)
+        close(buf->fd);
+    buf->fd = -1;
+    buf->addr = NULL;
+    buf->size = 0;
+    buf->dead = 0;
+}
+
+/*
+ * Called with the connection lock held. The last job on an unregistered
+ * buffer frees it and sends the reply the client is blocked on.
+ */
+static void release_buf(struct rgad_conn* conn, struct rgad_buf* buf)
+{
+    struct rgad_msg msg;
+
+    if (!buf || --buf->users || !buf->dead)
+        return;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.type = RGAD_UNREGISTER;
+    msg.id = buf - conn->bufs;
+    put_buf(buf);
+    send_msg(conn->sock, &msg, NULL, 0);
+}
+
+static void release_bufs(struct rgad_conn* conn, struct rgad_job* j)
+{
+    release_buf(conn, j->src);
+    release_buf(conn, j->dst);
+    j->src = j->dst = NULL;
+}
+
+/* Worker thread: post the completion to the client's ring. */
+static void job_done(struct sched_job* job, void* priv)
+{
+    struct rgad_job* j = (struct rgad_job*)priv;
+    struct rgad_conn* conn = j->conn;
+    struct rgad_ring* ring = conn->ring;
+    uint32_t tail;
+
+    pthread_mutex_lock(&conn->lock);
+    tail = ring->cq_tail;
+    if (tail - __atomic_load_n(&ring->cq_head, __ATOMIC_ACQUIRE) < RGAD_RING_ENTRIES) {
+        ring->cq[tail % RGAD_RING_ENTRIES].tag = j->tag;
+        ring->cq[tail % RGAD_RING_ENTRIES].result = job->result;
+        __atomic_store_n(&ring->cq_tail, tail + 1, __ATOMIC_RELEASE);
+    } else {
+        /* only a client that submits past its limit gets here */
+        fprintf(stderr, "rgad: completion ring full, dropped job %llu\n",
+            (unsigned long long)j->tag);
+    }
+
+    /* the job took a scheduler slot, a stalled client can go on */
+    if (__atomic_exchange_n(&conn->d->stalled, 0, __ATOMIC_ACQ_REL))
+        ring_doorbell(conn->d->kick_efd);
+    /* the connection may be closed as soon as the lock is dropped */
+    ring_doorbell(conn->cq_efd);
+    release_bufs(conn, j);
+    conn->free_jobs[conn->num_free++] = j;
+    if (!--conn->in_flight)
+        pthread_cond_broadcast(&conn->idle);
+    pthread_mutex_unlock(&conn->lock);
+}
+
+static void wait_idle(struct rgad_conn* conn)
+{
+    pthread_mutex_lock(&conn->lock);
+    while (conn->in_flight)
+        pthread_cond_wait(&conn->idle, &conn->lock);
+    pthread_mutex_unlock(&conn->lock);
+}
+
+static struct rgad_buf* get_buf(struct rgad_conn* conn, int32_t id, size_t size)
+{
+    struct rgad_buf* buf;
+
+    if (id < 0 || id >= RGAD_MAX_BUFS)
+        return NULL;
+    buf = &conn->bufs[id];
+    if (buf->fd < 0 || buf->dead || buf->size < size || (conn->d->map_bufs && !buf->addr))
+        return NULL;
+    return buf;
+}
+
+static void put_job(struct rgad_conn* conn, struct rgad_job* j)
+{
+    pthread_mutex_lock(&conn->lock);
+    release_bufs(conn, j);
+    conn->free_jobs[conn->num_free++] = j;
+    conn->in_flight--;
+    pthread_mutex_unlock(&conn->lock);
+}
+
+/*
+ * Move the client's submissions to the scheduler. When its queues are
+ * full the rest stay in the ring, the poll thread never waits on one
+ * client, and the drain goes on from the kick of the next completion.
+ */
+static int drain_sq(struct rgad_conn* conn)
+{
+    struct rgad* d = conn->d;
+    struct rgad_ring* ring = conn->ring;
+    struct rgad_buf *src, *dst;
+    struct rgad_job* j;
+    uint32_t head, tail;
+    int ret;
+
+    clear_doorbell(conn->sq_efd);
+    conn->stalled = 0;
+
+    head = ring->sq_head;
+    tail = __atomic_load_n(&ring->sq_tail, __ATOMIC_ACQUIRE);
+    if (tail - head > RGAD_RING_ENTRIES)
+        return -EPROTO;
+
+    for (; head != tail; head++) {
+        const struct rgad_sqe* sqe = &ring->sq[head % RGAD_RING_ENTRIES];
+
+        pthread_mutex_lock(&conn->lock);
+        j = conn->num_free ? conn->free_jobs[--conn->num_free] : NULL;
+        if (j)
+            conn->in_flight++;
+        pthread_mutex_unlock(&conn->lock);
+        if (!j)
+            return -EPROTO;
+
+        memset(&j->job, 0, sizeof(j->job));
+        j->tag = sqe->tag;
+        j->job.prio = sqe->prio;
+        j->job.late = sqe->late;
+        j->job.deadline_us = sqe->deadline_us;
+        j->job.complete = job_done;
+        j->job.priv = j;
+
+        src = get_buf(conn, sqe->src, d->src_size);
+        dst = get_buf(conn, sqe->dst, d->dst_size);
+        if (!src || !dst) {
+            j->job.result = -EINVAL;
+            job_done(&j->job, j);
+            continue;
+        }
+
+        pthread_mutex_lock(&conn->lock);
+        j->src = src;
+        j->dst = dst;
+        src->users++;
+        dst->users++;
+        pthread_mutex_unlock(&conn->lock);
+        j->job.src_fd = src->fd;
+        j->job.dst_fd = dst->fd;
+        j->job.src_addr = src->addr;
+        j->job.dst_addr = dst->addr;
+        ret = sched_try_submit(d->sched, &j->job);
+        if (ret == -EAGAIN) {
+            /* a completion between the two tries still kicks */
+            __atomic_store_n(&d->stalled, 1, __ATOMIC_RELEASE);
+            ret = sched_try_submit(d->sched, &j->job);
+        }
+        if (ret == -EAGAIN) {
+            put_job(conn, j);
+            conn->stalled = 1;
+            break;
+        }
+        if (ret) {
+            j->job.result = -EINVAL;
+            job_done(&j->job, j);
+        }
+    }
+
+    __atomic_store_n(&ring->sq_head, head, __ATOMIC_RELEASE);
+    return 0;
+}
+
+static int handle_msg(struct rgad_conn* conn)
+{
+    struct rgad_msg msg;
+    struct rgad_buf* buf;
+    int fd, ret, i, deferred = 0;
+    off_t end;
+
+    ret = recv_msg(conn->sock, &msg, &fd, 1);
+    if (ret < 0)
+        return ret;
+
+    switch (msg.type) {
+    case RGAD_REGISTER:
+        msg.result = -EINVAL;
+        if (fd < 0 || !msg.size)
+            break;
+        /* the mapping and the jobs rely on the size, the client's word is not enough */
+        end = lseek(fd, 0, SEEK_END);
+        if (end < 0 || (uint64_t)end < msg.size)
+            break;
+        for (i = 0; i < RGAD_MAX_BUFS && conn->bufs[i].fd >= 0; i++)
+            ;
+        if (i == RGAD_MAX_BUFS) {
+            msg.result = -ENOSPC;
+            break;
+        }
+        buf = &conn->bufs[i];
+        buf->fd = fd;
+        buf->size = msg.size;
+        fd = -1;
+        if (conn->d->map_bufs) {
+            buf->addr = mmap(NULL, buf->size, PROT_READ | PROT_WRITE, MAP_SHARED, buf->fd, 0);
+            if (buf->addr == MAP_FAILED) {
+                msg.result = -errno;
+                buf->addr = NULL;
+                put_buf(buf);
+                break;
+            }
+        }
+        msg.result = i;
+        break;
+    case RGAD_UNREGISTER:
+        msg.result = -EINVAL;
+        if (msg.id < 0 || msg.id >= RGAD_MAX_BUFS || conn->bufs[msg.id].fd < 0
+            || conn->bufs[msg.id].dead)
+            break;
+        buf = &conn->bufs[msg.id];
+        /* with jobs still on it the reply waits for the last of them */
+        pthread_mutex_lock(&conn->lock);
+        if (buf->users) {
+            buf->dead = 1;
+            deferred = 1;
+        }
+        pthread_mutex_unlock(&conn->lock);
+        if (deferred)
+            break;
+        put_buf(buf);
+        msg.result = 0;
+        break;
+    default:
+        msg.result = -EINVAL;
+        break;
+    }
+
+    if (fd >= 0)
+        close(fd);
+    if (deferred)
+        return 0;
+    return send_msg(conn->sock, &msg, NULL, 0);
+}
+
+static void close_conn(struct rgad_conn* conn)
+{
+    int i;
+
+    wait_idle(conn);
+    for (i = 0; i < RGAD_MAX_BUFS; i++)
+        put_buf(&conn->bufs[i]);
+    if (conn->ring)
+        munmap(conn->ring, sizeof(*conn->ring));
+    if (conn->sq_efd >= 0)
+        close(conn->sq_efd);
+    if (conn->cq_efd >= 0)
+        close(conn->cq_efd);
+    close(conn->sock);
+    pthread_cond_destroy(&conn->idle);
+    pthread_mutex_destroy(&conn->lock);
+    free(conn);
+}
+
+static struct rgad_conn* accept_conn(struct rgad* d, int sock)
+{
+    struct rgad_conn* conn;
+    struct rgad_msg msg;
+    int fds[3], memfd, i;
+    void* ring;
+
+    conn = (struct rgad_conn*)calloc(1, sizeof(*conn));
+    if (!conn) {
+        close(sock);
+        return NULL;
+    }
+    conn->d = d;
+    conn->sock = sock;
+    pthread_mutex_init(&conn->lock, NULL);
+    pthread_cond_init(&conn->idle, NULL);
+    for (i = 0; i < RGAD_MAX_BUFS; i++)
+        conn->bufs[i].fd = -1;
+    for (i = 0; i < RGAD_RING_ENTRIES; i++) {
+        conn->jobs[i].conn = conn;
+        conn->free_jobs[conn->num_free++] = &conn->jobs[i];
+    }
+
+    conn->sq_efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    conn->cq_efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    memfd = memfd_create("rgad-ring", MFD_CLOEXEC);
+    if (conn->sq_efd < 0 || conn->cq_efd < 0 || memfd < 0
+        || ftruncate(memfd, sizeof(*conn->ring))) {
+        perror("rgad");
+        goto err;
+    }
+
+    ring = mmap(NULL, sizeof(*conn->ring), PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    if (ring == MAP_FAILED) {
+        perror("rgad");
+        goto err;
+    }
+    conn->ring = (struct rgad_ring*)ring;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.type = RGAD_HELLO;
+    msg.magic = RGAD_MAGIC;
+    msg.version = RGAD_VERSION;
+    msg.size = sizeof(*conn->ring);
+    msg.cfg = d->cfg;
+    fds[0] = memfd;
+    fds[1] = conn->sq_efd;
+    fds[2] = conn->cq_efd;
+    if (send_msg(sock, &msg, fds, 3))
+        goto err;
+
+    close(memfd);
+    return conn;
+
+err:
+    if (memfd >= 0)
+        close(memfd);
+    close_conn(conn);
+    return NULL;
+}
+
+struct rgad* create_rgad(const char* path, const struct m2m_config* cfg,
+    struct m2m_dev** devs, int num_devs, int cpu_workers)
+{
+    struct sockaddr_un addr;
+    struct rgad* d;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        printf("socket path %s is too long\n", path);
+        return NULL;
+    }
+
+    d = (struct rgad*)calloc(1, sizeof(*d));
+    if (!d)
+        return NULL;
+
+    snprintf(d->path, sizeof(d->path), "%s", path);
+    d->cfg = *cfg;
+    d->src_size = fmt_frame_size(get_fmt_info(cfg->src_format), cfg->src_width, cfg->src_height);
+    d->dst_size = fmt_frame_size(get_fmt_info(cfg->dst_format), cfg->dst_width, cfg->dst_height);
+    d->map_bufs = cpu_workers > 0;
+    d->stop_efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    d->kick_efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+    d->listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (d->listen_fd < 0 || d->stop_efd < 0 || d->kick_efd < 0) {
+        perror("rgad");
+        goto err;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+    if (bind(d->listen_fd, (struct sockaddr*)&addr, sizeof(addr))
+        || listen(d->listen_fd, RGAD_MAX_CONNS)) {
+        printf("failed to listen on %s: %s\n", path, strerror(errno));
+        goto err;
+    }
+
+    d->sched = create_sched(cfg, devs, num_devs, cpu_workers);
+    if (!d->sched)
+        goto err;
+
+    printf("rgad: serving %d nodes and %d CPU workers on %s\n", num_devs, cpu_workers, path);
+    return d;
+
+err:
+    destroy_rgad(d);
+    return NULL;
+}
+
+static void drop_conn(struct rgad* d, int i, const char* why)
+{
+    printf("rgad: client %d %s\n", i, why);
+    close_conn(d->conns[i]);
+    d->conns[i] = NULL;
+}
+
+int run_rgad(struct rgad* d)
+{
+    struct pollfd pfd[3 + 2 * RGAD_MAX_CONNS];
+    int i, n, sock, kicked;
+
+    for (;;) {
+        pfd[0].fd = d->stop_efd;
+        pfd[0].events = POLLIN;
+        pfd[1].fd = d->listen_fd;
+        pfd[1].events = POLLIN;
+        pfd[2].fd = d->kick_efd;
+        pfd[2].events = POLLIN;
+        for (i = 0; i < RGAD_MAX_CONNS; i++) {
+            /* empty slots are skipped with a negative fd */
+            pfd[3 + 2 * i].fd = d->conns[i] ? d->conns[i]->sock : -1;
+            pfd[3 + 2 * i].events = POLLIN;
+            pfd[4 + 2 * i].fd = d->conns[i] ? d->conns[i]->sq_efd : -1;
+            pfd[4 + 2 * i].events = POLLIN;
+        }
+
+        n = poll(pfd, 3 + 2 * RGAD_MAX_CONNS, -1);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return -errno;
+
+        if (pfd[0].revents)
+            break;
+
+        kicked = pfd[2].revents & POLLIN;
+        if (kicked)
+            clear_doorbell(d->kick_efd);
+
+        for (i = 0; i < RGAD_MAX_CONNS; i++) {
+            if (!d->conns[i])
+                continue;
+            if (((pfd[4 + 2 * i].revents & POLLIN) || (kicked && d->conns[i]->stalled))
+                && drain_sq(d->conns[i])) {
+                drop_conn(d, i, "overran its ring");
+                continue;
+            }
+            if (pfd[3 + 2 * i].revents & (POLLIN | POLLHUP | POLLERR)) {
+                if (handle_msg(d->conns[i]))
+                    drop_conn(d, i, "disconnected");
+            }
+        }
+
+        if (pfd[1].revents & POLLIN) {
+            sock = accept4(d->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+            if (sock < 0)
+                continue;
+            for (i = 0; i < RGAD_MAX_CONNS && d->conns[i]; i++)
+                ;
+            if (i == RGAD_MAX_CONNS) {
+                printf("rgad: too many clients\n");
+                close(sock);
+                continue;
+            }
+            d->conns[i] = accept_conn(d, sock);
+            if (d->conns[i])
+                printf("rgad: client %d connected\n", i);
+        }
+    }
+    return 0;
+}
+
+void stop_rgad(struct rgad* d)
+{
+    ring_doorbell(d->stop_efd);
+}
+
+void destroy_rgad(struct rgad* d)
+{
+    int i;
+
+    if (!d)
+        return;
+
+    for (i = 0; i < RGAD_MAX_CONNS; i++) {
+        if (d->conns[i])
+            close_conn(d->conns[i]);
+    }
+    destroy_sched(d->sched);
+    if (d->listen_fd >= 0) {
+        close(d->listen_fd);
+        unlink(d->path);
+    }
+    if (d->stop_efd >= 0)
+        close(d->stop_efd);
+    if (d->kick_efd >= 0)
+        close(d->kick_efd);
+    free(d);
+}
+
+struct rgad_client* rgad_connect(const char* path, struct m2m_config* cfg)
+{
+    struct sockaddr_un addr;
+    struct rgad_client* c;
+    struct rgad_msg msg;
+    int fds[3], ret;
+    void* ring;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+        return NULL;
+
+    c = (struct rgad_client*)calloc(1, sizeof(*c));
+    if (!c)
+        return NULL;
+    c->sq_efd = c->cq_efd = -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    c->sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (c->sock < 0 || connect(c->sock, (struct sockaddr*)&addr, sizeof(addr))) {
+        printf("failed to connect to %s: %s\n", path, strerror(errno));
+        goto err;
+    }
+
+    ret = recv_msg(c->sock, &msg, fds, 3);
+    if (ret < 0)
+        goto err;
+    c->sq_efd = fds[1];
+    c->cq_efd = fds[2];
+    if (ret != 3 || msg.type != RGAD_HELLO || msg.magic != RGAD_MAGIC
+        || msg.version != RGAD_VERSION || msg.size != sizeof(*c->ring)) {
+        printf("%s is not a compatible rgad\n", path);
+        if (fds[0] >= 0)
+            close(fds[0]);
+        goto err;
+    }
+
+    ring = mmap(NULL, sizeof(*c->ring), PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+    close(fds[0]);
+    if (ring == MAP_FAILED)
+        goto err;
+    c->ring = (struct rgad_ring*)ring;
+
+    *cfg = msg.cfg;
+    return c;
+
+err:
+    rgad_disconnect(c);
+    return NULL;
+}
+
+void rgad_disconnect(struct rgad_client* c)
+{
+    if (!c)
+        return;
+    if (c->ring)
+        munmap(c->ring, sizeof(*c->ring));
+    if (c->sq_efd >= 0)
+        close(c->sq_efd);
+    if (c->cq_efd >= 0)
+        close(c->cq_efd);
+    if (c->sock >= 0)
+        close(c->sock);
+    free(c);
+}
+
+static int call(struct rgad_client* c, struct rgad_msg* msg, int fd)
+{
+    int ret;
+
+    ret = send_msg(c->sock, msg, &fd, fd >= 0 ? 1 : 0);
+    if (ret)
+        return ret;
+    ret = recv_msg(c->sock, msg, &fd, 1);
+    if (ret > 0)
+        close(fd);
+    return ret < 0 ? ret : msg->result;
+}
+
+int rgad_register(struct rgad_client* c, int dmabuf_fd, size_t size)
+{
+    struct rgad_msg msg;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.type = RGAD_REGISTER;
+    msg.size = size;
+    return call(c, &msg, dmabuf_fd);
+}
+
+int rgad_unregister(struct rgad_client* c, int id)
+{
+    struct rgad_msg msg;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.type = RGAD_UNREGISTER;
+    msg.id = id;
+    return call(c, &msg, -1);
+}
+
+int rgad_set_class(struct rgad_client* c, int prio, uint32_t budget_us, int late)
+{
+    if (prio < 0 || prio >= SCHED_NUM_PRIOS || late < SCHED_LATE_RUN || late > SCHED_LATE_DEGRADE)
+        return -EINVAL;
+    c->prio = prio;
+    c->budget_us = budget_us;
+    c->late = late;
+    return 0;
+}
+
+int rgad_submit(struct rgad_client* c, uint64_t tag, int src_id, int dst_id)
+{
+    struct rgad_ring* ring = c->ring;
+    uint32_t tail = ring->sq_tail;
+    struct rgad_sqe* sqe = &ring->sq[tail % RGAD_RING_ENTRIES];
+
+    if (c->outstanding == RGAD_RING_ENTRIES)
+        return -EBUSY;
+
+    sqe->tag = tag;
+    sqe->src = src_id;
+    sqe->dst = dst_id;
+    sqe->prio = c->prio;
+    sqe->late = c->late;
+    sqe->deadline_us = c->budget_us ? sched_now_us() + c->budget_us : 0;
+    __atomic_store_n(&ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    c->outstanding++;
+
+    ring_doorbell(c->sq_efd);
+    return 0;
+}
+
+int rgad_reap(struct rgad_client* c, uint64_t* tag, int* result, int timeout_ms)
+{
+    struct rgad_ring* ring = c->ring;
+    struct pollfd pfd;
+    uint32_t head;
+    int ret;
+
+    for (;;) {
+        head = ring->cq_head;
+        if (head != __atomic_load_n(&ring->cq_tail, __ATOMIC_ACQUIRE)) {
+            *tag = ring->cq[head % RGAD_RING_ENTRIES].tag;
+            *result = ring->cq[head % RGAD_RING_ENTRIES].result;
+            __atomic_store_n(&ring->cq_head, head + 1, __ATOMIC_RELEASE);
+            c->outstanding--;
+            return 0;
+        }
+        if (!c->outstanding)
+            return -ENOENT;
+
+        /* completions are posted before the doorbell rings */
+        pfd.fd = c->cq_efd;
+        pfd.events = POLLIN;
+        ret = poll(&pfd, 1, timeout_ms);
+        if (ret < 0 && errno != EINTR)
+            return -errno;
+        if (ret == 0)
+            return -ETIME;
+        clear_doorbell(c->cq_efd);
+    }
+}
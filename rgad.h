@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) Fuzhou Rockchip Electronics Co.Ltd
+ * Author: Jacob Chen <jacob-chen@iotwrt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#ifndef __RGAD_H_INCLUDED__
+#define __RGAD_H_INCLUDED__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "m2m.h"
+#include "scheduler.h"
+
+#define RGAD_RING_ENTRIES 64
+#define RGAD_MAX_BUFS 64
+
+struct rgad;
+struct rgad_client;
+
+/*
+ * Transform daemon. It owns the nodes and CPU workers of one scheduler and
+ * serves them to clients on a SOCK_SEQPACKET Unix socket. The socket only
+ * carries the setup: the ring and its two eventfds on connect, dmabufs
+ * (SCM_RIGHTS) when a client registers them. Jobs and completions go
+ * through a ring in shared memory, single producer and single consumer on
+ * each side, with an eventfd as doorbell.
+ */
+struct rgad* create_rgad(const char *path, const struct m2m_config *cfg,
+			 struct m2m_dev **devs, int num_devs, int cpu_workers);
+/* Serve until stop_rgad(). */
+int run_rgad(struct rgad *d);
+/* Async-signal-safe. */
+void stop_rgad(struct rgad *d);
+void destroy_rgad(struct rgad *d);
+
+/* The daemon's configuration is stored in 'cfg', every job uses it. */
+struct rgad_client* rgad_connect(const char *path, struct m2m_config *cfg);
+void rgad_disconnect(struct rgad_client *c);
+
+/*
+ * Returns the id jobs refer to the buffer by. The daemon keeps its own
+ * reference, the caller may close 'dmabuf_fd'. Unregistering waits for the
+ * client's jobs to finish.
+ */
+int rgad_register(struct rgad_client *c, int dmabuf_fd, size_t size);
+int rgad_unregister(struct rgad_client *c, int id);
+
+/*
+ * Jobs submitted from now on get class 'prio' (enum sched_prio) and, with
+ * a nonzero 'budget_us', are due that long after their submission; 'late'
+ * (enum sched_late) says what becomes of those that can't make it. The
+ * default is real-time without a deadline.
+ */
+int rgad_set_class(struct rgad_client *c, int prio, uint32_t budget_us, int late);
+
+/*
+ * Queue a job, -EBUSY when RGAD_RING_ENTRIES jobs have not been reaped.
+ * 'tag' comes back with the completion. Completions arrive in the order
+ * the jobs finish, which may differ from the submission order.
+ */
+int rgad_submit(struct rgad_client *c, uint64_t tag, int src_id, int dst_id);
+/* Wait for a completion, -1 waits forever. Returns -ETIME on timeout. */
+int rgad_reap(struct rgad_client *c, uint64_t *tag, int *result, int timeout_ms);
+
+#endif /* __RGAD_H_INCLUDED__ */
@@ -0,0 +1,502 @@
+/*
+ * Copyright (C) Fuzhou Rockchip Electronics Co.Ltd
+ * Author: Jacob Chen <jacob-chen@iotwrt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#include <errno.h>
+#include <float.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <linux/videodev2.h>
+
+#include "bo.h"
+#include "convert.h"
+#include "cpu_rga.h"
+#include "rga.h"
+#include "scheduler.h"
+
+#define SCHED_QUEUE_LEN 8
+
+/* queue slots each class leaves free for the classes before it */
+#define SCHED_RESERVED 2
+
+/* weight of the newest sample in the cost estimate */
+#define COST_ALPHA 0.25
+
+static const char* const prio_names[SCHED_NUM_PRIOS] = { "realtime", "interactive", "bulk" };
+static const char* const late_names[] = { "run", "drop", "degrade" };
+
+struct sched_class {
+    unsigned long jobs;
+    unsigned long missed; /* finished after the deadline */
+    unsigned long dropped;
+    unsigned long degraded;
+    unsigned long long total_us; /* submission to completion */
+    unsigned long long max_us;
+};
+
+struct sched_worker {
+    struct sched* s;
+    struct m2m_dev* dev; /* NULL for CPU workers */
+    char name[40];
+    pthread_t thread;
+
+    /* most urgent first, the owner takes the head and thieves the tail */
+    struct sched_job* queue[SCHED_QUEUE_LEN];
+    unsigned int head;
+    unsigned int count;
+    int running;
+
+    double us_per_mp; /* 0 until the first job finished */
+    unsigned long jobs;
+    unsigned long stolen;
+    unsigned long long busy_us;
+};
+
+struct sched {
+    struct m2m_config cfg;
+    struct rga_params params;
+    double job_mp;
+
+    pthread_mutex_t lock;
+    pthread_cond_t work_cond;
+    pthread_cond_t done_cond;
+    int quit;
+
+    struct sched_worker* workers;
+    int num_workers;
+    struct timespec start;
+
+    struct sched_class classes[SCHED_NUM_PRIOS];
+};
+
+uint64_t sched_now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+int parse_sched_prio(const char* arg)
+{
+    int i;
+
+    for (i = 0; i < SCHED_NUM_PRIOS; i++) {
+        if (!strcmp(arg, prio_names[i]))
+            return i;
+    }
+    return -1;
+}
+
+int parse_sched_late(const char* arg)
+{
+    unsigned int i;
+
+    for (i = 0; i < sizeof(late_names) / sizeof(late_names[0]); i++) {
+        if (!strcmp(arg, late_names[i]))
+            return i;
+    }
+    return -1;
+}
+
+/* Whether 'a' runs before 'b': earlier class, then earlier deadline. */
+static int runs_before(const struct sched_job* a, const struct sched_job* b)
+{
+    if (a->prio != b->prio)
+        return a->prio < b->prio;
+    if (a->deadline_us && b->deadline_us)
+        return a->deadline_us < b->deadline_us;
+    return a->deadline_us && !b->deadline_us;
+}
+
+/* Jobs 'w' runs before it would get to 'job'. */
+static int jobs_ahead(const struct sched_worker* w, const struct sched_job* job)
+{
+    unsigned int i;
+    int ahead = w->running;
+
+    for (i = 0; i < w->count; i++) {
+        if (!runs_before(job, w->queue[(w->head + i) % SCHED_QUEUE_LEN]))
+            ahead++;
+    }
+    return ahead;
+}
+
+/* When 'job' queued on 'w' now would be finished, in microseconds. */
+static double finish_estimate(const struct sched_worker* w, const struct sched_job* job,
+    double mp)
+{
+    int ahead = jobs_ahead(w, job);
+
+    /* an unmeasured worker gets a single job to calibrate on */
+    if (w->us_per_mp == 0)
+        return ahead ? DBL_MAX : 0;
+    return (ahead + 1) * w->us_per_mp * mp;
+}
+
+static void push_job(struct sched_worker* w, struct sched_job* job)
+{
+    unsigned int i;
+
+    /* insertion keeps the queue sorted, equal jobs stay in order */
+    for (i = w->count; i > 0; i--) {
+        struct sched_job* prev = w->queue[(w->head + i - 1) % SCHED_QUEUE_LEN];
+
+        if (!runs_before(job, prev))
+            break;
+        w->queue[(w->head + i) % SCHED_QUEUE_LEN] = prev;
+    }
+    w->queue[(w->head + i) % SCHED_QUEUE_LEN] = job;
+    w->count++;
+}
+
+static struct sched_job* pop_head(struct sched_worker* w)
+{
+    struct sched_job* job;
+
+    if (!w->count)
+        return NULL;
+    job = w->queue[w->head];
+    w->head = (w->head + 1) % SCHED_QUEUE_LEN;
+    w->count--;
+    return job;
+}
+
+static struct sched_job* pop_tail(struct sched_worker* w)
+{
+    if (!w->count)
+        return NULL;
+    w->count--;
+    return w->queue[(w->head + w->count) % SCHED_QUEUE_LEN];
+}
+
+/*
+ * Take the last job of the queue where it would wait longest, as long as
+ * running it here finishes earlier than leaving it there.
+ */
+static struct sched_job* steal_job(struct sched* s, struct sched_worker* thief)
+{
+    struct sched_worker* victim = NULL;
+    double own, gain, best = 0;
+    int i;
+
+    own = thief->us_per_mp * s->job_mp;
+    for (i = 0; i < s->num_workers; i++) {
+        struct sched_worker* w = &s->workers[i];
+
+        if (w == thief || !w->count)
+            continue;
+        gain = (w->count + w->running) * w->us_per_mp * s->job_mp - own;
+        if (gain > best || (thief->us_per_mp == 0 && !victim)) {
+            best = gain;
+            victim = w;
+        }
+    }
+
+    if (!victim)
+        return NULL;
+    thief->stolen++;
+    return pop_tail(victim);
+}
+
+/* Whether 'job' started on 'w' at 'now' would finish after its deadline. */
+static int will_miss(const struct sched* s, const struct sched_worker* w,
+    const struct sched_job* job, uint64_t now)
+{
+    return job->deadline_us && now + w->us_per_mp * s->job_mp > job->deadline_us;
+}
+
+static int run_job(struct sched* s, struct sched_worker* w, struct sched_job* job, int degrade)
+{
+    struct rga_params params = s->params;
+    struct image src, dst;
+    int ret;
+
+    if (w->dev) {
+        ret = m2m_queue(w->dev, 0, job->src_fd, job->dst_fd);
+        if (ret)
+            return ret;
+        ret = m2m_dequeue(w->dev);
+        return ret < 0 ? ret : 0;
+    }
+
+    init_image(&src, s->cfg.src_format, job->src_addr, s->cfg.src_width, s->cfg.src_height);
+    init_image(&dst, s->cfg.dst_format, job->dst_addr, s->cfg.dst_width, s->cfg.dst_height);
+    set_image_colorimetry(&src, &s->cfg.src_color);
+    set_image_colorimetry(&dst, &s->cfg.dst_color);
+
+    /* the nodes have no cheaper mode, only the CPU path degrades */
+    if (degrade) {
+        params.nearest = 1;
+        params.blend = V4L2_BLEND_SRC;
+        job->degraded = 1;
+    }
+
+    /* blending reads the destination too */
+    sync_dmabuf(job->src_fd, 1, SP_BO_READ);
+    sync_dmabuf(job->dst_fd, 1, SP_BO_READ | SP_BO_WRITE);
+    ret = cpu_rga_transform(&src, &dst, &params);
+    sync_dmabuf(job->dst_fd, 0, SP_BO_READ | SP_BO_WRITE);
+    sync_dmabuf(job->src_fd, 0, SP_BO_READ);
+    return ret;
+}
+
+/* Called locked, returns locked. */
+static void finish_job(struct sched* s, struct sched_worker* w, struct sched_job* job,
+    int ret, uint64_t now)
+{
+    struct sched_class* c = &s->classes[job->prio];
+    uint64_t latency = now - job->submit_us;
+
+    c->jobs++;
+    c->total_us += latency;
+    if (latency > c->max_us)
+        c->max_us = latency;
+    if (ret == -ETIME)
+        c->dropped++;
+    else if (job->deadline_us && now > job->deadline_us)
+        c->missed++;
+    if (job->degraded)
+        c->degraded++;
+
+    job->result = ret;
+    job->worker = w->name;
+    job->done = 1;
+    pthread_cond_broadcast(&s->done_cond);
+
+    if (job->complete) {
+        pthread_mutex_unlock(&s->lock);
+        job->complete(job, job->priv);
+        pthread_mutex_lock(&s->lock);
+    }
+}
+
+static void* sched_worker_main(void* data)
+{
+    struct sched_worker* w = (struct sched_worker*)data;
+    struct sched* s = w->s;
+    struct sched_job* job;
+    unsigned long long t0, us;
+    int ret, late;
+
+    pthread_mutex_lock(&s->lock);
+    for (;;) {
+        job = pop_head(w);
+        if (!job)
+            job = steal_job(s, w);
+        if (!job) {
+            if (s->quit)
+                break;
+            pthread_cond_wait(&s->work_cond, &s->lock);
+            continue;
+        }
+
+        t0 = sched_now_us();
+        late = job->late != SCHED_LATE_RUN && will_miss(s, w, job, t0);
+        if (late && job->late == SCHED_LATE_DROP) {
+            finish_job(s, w, job, -ETIME, t0);
+            continue;
+        }
+
+        w->running = 1;
+        /* a slot opened up for sched_submit() */
+        pthread_cond_broadcast(&s->done_cond);
+        pthread_mutex_unlock(&s->lock);
+
+        ret = run_job(s, w, job, late);
+        us = sched_now_us() - t0;
+
+        pthread_mutex_lock(&s->lock);
+        if (w->us_per_mp == 0)
+            w->us_per_mp = us / s->job_mp;
+        else
+            w->us_per_mp += COST_ALPHA * (us / s->job_mp - w->us_per_mp);
+        w->busy_us += us;
+        w->jobs++;
+        w->running = 0;
+        finish_job(s, w, job, ret, t0 + us);
+    }
+    pthread_mutex_unlock(&s->lock);
+    return NULL;
+}
+
+struct sched* create_sched(const struct m2m_config* cfg, struct m2m_dev** devs,
+    int num_devs, int cpu_workers)
+{
+    struct sched* s;
+    int i;
+
+    if (num_devs + cpu_workers <= 0)
+        return NULL;
+
+    s = (struct sched*)calloc(1, sizeof(*s));
+    if (!s)
+        return NULL;
+
+    s->workers = (struct sched_worker*)calloc(num_devs + cpu_workers, sizeof(*s->workers));
+    if (!s->workers) {
+        free(s);
+        return NULL;
+    }
+
+    s->cfg = *cfg;
+    s->params.rotate = cfg->rotate;
+    s->params.hflip = cfg->hflip;
+    s->params.vflip = cfg->vflip;
+    s->params.blend = V4L2_BLEND_SRC;
+    /* the RGA is bound by whichever side has more pixels */
+    s->job_mp = (cfg->src_width * cfg->src_height > cfg->dst_width * cfg->dst_height
+                        ? cfg->src_width * cfg->src_height
+                        : cfg->dst_width * cfg->dst_height)
+        / 1e6;
+
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->work_cond, NULL);
+    pthread_cond_init(&s->done_cond, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &s->start);
+
+    /* workers look at all queues, keep them waiting until the set is final */
+    pthread_mutex_lock(&s->lock);
+    for (i = 0; i < num_devs + cpu_workers; i++) {
+        struct sched_worker* w = &s->workers[i];
+
+        w->s = s;
+        if (i < num_devs) {
+            w->dev = devs[i];
+            snprintf(w->name, sizeof(w->name), "%s", devs[i]->path);
+        } else {
+            snprintf(w->name, sizeof(w->name), "cpu%d", i - num_devs);
+        }
+
+        if (pthread_create(&w->thread, NULL, sched_worker_main, w)) {
+            printf("failed to create worker %s\n", w->name);
+            break;
+        }
+        s->num_workers++;
+    }
+    pthread_mutex_unlock(&s->lock);
+
+    if (!s->num_workers) {
+        destroy_sched(s);
+        return NULL;
+    }
+    return s;
+}
+
+static int queue_job(struct sched* s, struct sched_job* job, int wait)
+{
+    struct sched_worker* best;
+    double cost, best_cost;
+    int i;
+
+    if (job->prio < 0 || job->prio >= SCHED_NUM_PRIOS
+        || job->late < SCHED_LATE_RUN || job->late > SCHED_LATE_DEGRADE)
+        return -EINVAL;
+    job->done = 0;
+    job->degraded = 0;
+    job->worker = NULL;
+    job->submit_us = sched_now_us();
+
+    pthread_mutex_lock(&s->lock);
+    for (;;) {
+        best = NULL;
+        best_cost = DBL_MAX;
+        for (i = 0; i < s->num_workers; i++) {
+            struct sched_worker* w = &s->workers[i];
+
+            if (w->count >= SCHED_QUEUE_LEN - job->prio * SCHED_RESERVED)
+                continue;
+            cost = finish_estimate(w, job, s->job_mp);
+            if (!best || cost < best_cost
+                || (cost == best_cost && w->count < best->count)) {
+                best = w;
+                best_cost = cost;
+            }
+        }
+        if (best)
+            break;
+        if (!wait) {
+            pthread_mutex_unlock(&s->lock);
+            return -EAGAIN;
+        }
+        pthread_cond_wait(&s->done_cond, &s->lock);
+    }
+
+    push_job(best, job);
+    pthread_cond_broadcast(&s->work_cond);
+    pthread_mutex_unlock(&s->lock);
+    return 0;
+}
+
+int sched_submit(struct sched* s, struct sched_job* job)
+{
+    return queue_job(s, job, 1);
+}
+
+int sched_try_submit(struct sched* s, struct sched_job* job)
+{
+    return queue_job(s, job, 0);
+}
+
+int sched_wait(struct sched* s, struct sched_job* job)
+{
+    pthread_mutex_lock(&s->lock);
+    while (!job->done)
+        pthread_cond_wait(&s->done_cond, &s->lock);
+    pthread_mutex_unlock(&s->lock);
+    return job->result;
+}
+
+void destroy_sched(struct sched* s)
+{
+    struct timespec end;
+    double total_us;
+    int i;
+
+    if (!s)
+        return;
+
+    pthread_mutex_lock(&s->lock);
+    s->quit = 1;
+    pthread_cond_broadcast(&s->work_cond);
+    pthread_mutex_unlock(&s->lock);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    total_us = (end.tv_sec - s->start.tv_sec) * 1e6 + (end.tv_nsec - s->start.tv_nsec) / 1e3;
+
+    for (i = 0; i < s->num_workers; i++) {
+        struct sched_worker* w = &s->workers[i];
+
+        pthread_join(w->thread, NULL);
+        printf("*[SCHED]* : %s: %lu jobs (%lu stolen), %.3f ms/MP, %.0f%% busy\n",
+            w->name, w->jobs, w->stolen, w->us_per_mp / 1000,
+            total_us > 0 ? w->busy_us * 100.0 / total_us : 0.0);
+    }
+
+    for (i = 0; i < SCHED_NUM_PRIOS; i++) {
+        struct sched_class* c = &s->classes[i];
+
+        if (!c->jobs)
+            continue;
+        printf("*[SCHED]* : %s: %lu jobs, %lu missed, %lu dropped, %lu degraded, "
+               "latency %.3f ms avg %.3f ms max\n",
+            prio_names[i], c->jobs, c->missed, c->dropped, c->degraded,
+            c->total_us / 1000.0 / c->jobs, c->max_us / 1000.0);
+    }
+
+    pthread_cond_destroy(&s->done_cond);
+    pthread_cond_destroy(&s->work_cond);
+    pthread_mutex_destroy(&s->lock);
+    free(s->workers);
+    free(s);
+}
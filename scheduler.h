@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) Fuzhou Rockchip Electronics Co.Ltd
+ * Author: Jacob Chen <jacob-chen@iotwrt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#ifndef __SCHEDULER_H_INCLUDED__
+#define __SCHEDULER_H_INCLUDED__
+
+#include <stdint.h>
+
+#include "m2m.h"
+
+struct sched;
+
+/* Classes are strict: a queued job never waits for one of a later class. */
+enum sched_prio {
+	SCHED_PRIO_REALTIME,		/* display, a late frame is worthless */
+	SCHED_PRIO_INTERACTIVE,
+	SCHED_PRIO_BULK,		/* thumbnails, analytics */
+	SCHED_NUM_PRIOS,
+};
+
+/* What happens to a job that can no longer make its deadline. */
+enum sched_late {
+	SCHED_LATE_RUN,			/* run it anyway */
+	SCHED_LATE_DROP,		/* fail it with -ETIME without running it */
+	SCHED_LATE_DEGRADE,		/* CPU workers scale nearest and skip the blend */
+};
+
+struct sched_job {
+	uint32_t frame;
+	int prio;		/* enum sched_prio */
+	uint64_t deadline_us;	/* CLOCK_MONOTONIC, 0 for none */
+	int late;		/* enum sched_late */
+	int src_fd;		/* dmabufs for the m2m nodes */
+	int dst_fd;
+	void *src_addr;		/* mappings for the CPU workers */
+	void *dst_addr;
+
+	/* called from the worker once the job is done, instead of sched_wait() */
+	void (*complete)(struct sched_job *job, void *priv);
+	void *priv;
+
+	/* filled in by the scheduler */
+	int result;
+	int done;
+	int degraded;
+	const char *worker;
+	uint64_t submit_us;
+};
+
+/*
+ * One worker thread per m2m node plus 'cpu_workers' software workers.
+ * Every node must be configured for 'cfg' and streaming with one buffer
+ * pair. Jobs go to the queue expected to finish them first, based on the
+ * measured cost per megapixel of each worker; idle workers steal from the
+ * tail of queues that would take longer to get there.
+ *
+ * Queues are ordered by class, then earliest deadline, then submission.
+ * The later classes may only fill part of a queue so that a real-time job
+ * finds a slot while bulk work is backed up.
+ */
+struct sched* create_sched(const struct m2m_config *cfg, struct m2m_dev **devs,
+			   int num_devs, int cpu_workers);
+
+/* Blocks while every queue is full for the job's class. */
+int sched_submit(struct sched *s, struct sched_job *job);
+
+/* -EAGAIN instead of blocking, room opens up as the workers take jobs. */
+int sched_try_submit(struct sched *s, struct sched_job *job);
+
+/* Wait for 'job' to finish and return its result. */
+int sched_wait(struct sched *s, struct sched_job *job);
+
+/* Microseconds on the clock deadlines are given in. */
+uint64_t sched_now_us(void);
+
+/* -1 for unknown names. */
+int parse_sched_prio(const char *arg);
+int parse_sched_late(const char *arg);
+
+/* Stop the workers and print what each of them and each class did. */
+void destroy_sched(struct sched *s);
+
+#endif /* __SCHEDULER_H_INCLUDED__ */
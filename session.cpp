@@ -0,0 +1,347 @@
+/*
+ * Copyright (C) Fuzhou Rockchip Electronics Co.Ltd
+ * Author: Jacob Chen <jacob-chen@iotwrt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "bo.h"
+#include "dev.h"
+#include "format.h"
+#include "session.h"
+
+namespace rga {
+
+Card::Card(Card&& other)
+    : dev_(other.dev_)
+{
+    other.dev_ = NULL;
+}
+
+Card& Card::operator=(Card&& other)
+{
+    if (this != &other) {
+        close();
+        dev_ = other.dev_;
+        other.dev_ = NULL;
+    }
+    return *this;
+}
+
+int Card::open()
+{
+    close();
+    dev_ = create_sp_dev();
+    return dev_ ? 0 : -ENODEV;
+}
+
+int Card::open_headless(const char* heap)
+{
+    close();
+    dev_ = create_headless_sp_dev(heap);
+    return dev_ ? 0 : -ENODEV;
+}
+
+void Card::close()
+{
+    if (dev_)
+        destroy_sp_dev(dev_);
+    dev_ = NULL;
+}
+
+Device::Device(Device&& other)
+    : dev_(other.dev_)
+{
+    other.dev_ = NULL;
+}
+
+Device& Device::operator=(Device&& other)
+{
+    if (this != &other) {
+        close();
+        dev_ = other.dev_;
+        other.dev_ = NULL;
+    }
+    return *this;
+}
+
+int Device::open(const char* path)
+{
+    close();
+    dev_ = open_m2m_dev(path);
+    return dev_ ? 0 : -ENODEV;
+}
+
+void Device::close()
+{
+    close_m2m_dev(dev_);
+    dev_ = NULL;
+}
+
+Buffer::Buffer(Buffer&& other)
+    : bo_(other.bo_)
+    , fd_(other.fd_)
+    , size_(other.size_)
+{
+    other.bo_ = NULL;
+    other.fd_ = -1;
+    other.size_ = 0;
+}
+
+Buffer& Buffer::operator=(Buffer&& other)
+{
+    if (this != &other) {
+        release();
+        bo_ = other.bo_;
+        fd_ = other.fd_;
+        size_ = other.size_;
+        other.bo_ = NULL;
+        other.fd_ = -1;
+        other.size_ = 0;
+    }
+    return *this;
+}
+
+int Buffer::alloc(Card& card, uint32_t v4l2_format, uint32_t width,
+    uint32_t height, uint32_t flags)
+{
+    const struct fmt_info* fi = get_fmt_info(v4l2_format);
+    int ret;
+
+    release();
+    if (!fi || !card)
+        return -EINVAL;
+
+    bo_ = create_sp_bo(card.get(), width, height, 0, fmt_bpp(fi), fi->drm, flags);
+    if (!bo_)
+        return -ENOMEM;
+
+    fd_ = export_sp_bo(bo_);
+    if (fd_ < 0) {
+        ret = -errno;
+        release();
+        return ret;
+    }
+    size_ = bo_->size;
+    return 0;
+}
+
+int Buffer::adopt(int dmabuf_fd, size_t size)
+{
+    release();
+    fd_ = dmabuf_fd;
+    size_ = size;
+    return 0;
+}
+
+void Buffer::release()
+{
+    if (fd_ >= 0)
+        ::close(fd_);
+    free_sp_bo(bo_);
+    bo_ = NULL;
+    fd_ = -1;
+    size_ = 0;
+}
+
+void* Buffer::begin_cpu(int access)
+{
+    if (!bo_ || begin_cpu_sp_bo(bo_, access))
+        return NULL;
+    return bo_->map_addr;
+}
+
+void Buffer::end_cpu(int access)
+{
+    if (bo_)
+        end_cpu_sp_bo(bo_, access);
+}
+
+Job::Job(const Buffer& src, const Buffer& dst)
+    : src_fd_(src.fd())
+    , dst_fd_(dst.fd())
+{
+}
+
+Job::Job(int src_fd, int dst_fd)
+    : src_fd_(src_fd)
+    , dst_fd_(dst_fd)
+{
+}
+
+/* 'other' is queued: the session has to find the job under its new address */
+void Job::take(Job& other)
+{
+    src_fd_ = other.src_fd_;
+    dst_fd_ = other.dst_fd_;
+    ctrls_ = other.ctrls_;
+    has_ctrls_ = other.has_ctrls_;
+    result_ = other.result_;
+    session_ = other.session_;
+    slot_ = other.slot_;
+    if (session_)
+        session_->jobs_[slot_] = this;
+    other.session_ = NULL;
+}
+
+Job::Job(Job&& other)
+{
+    take(other);
+}
+
+Job& Job::operator=(Job&& other)
+{
+    if (this != &other) {
+        wait();
+        take(other);
+    }
+    return *this;
+}
+
+void Job::set_ctrls(const struct m2m_ctrls& ctrls)
+{
+    ctrls_ = ctrls;
+    has_ctrls_ = true;
+}
+
+int Job::wait()
+{
+    /* earlier jobs of the session complete first */
+    while (session_) {
+        if (!session_->wait())
+            break;
+    }
+    return result_;
+}
+
+void Session::take(Session& other)
+{
+    unsigned int i;
+
+    dev_ = static_cast<Device&&>(other.dev_);
+    streaming_ = other.streaming_;
+    num_slots_ = other.num_slots_;
+    num_queued_ = other.num_queued_;
+    next_slot_ = other.next_slot_;
+    for (i = 0; i < M2M_MAX_BUFS; i++) {
+        jobs_[i] = other.jobs_[i];
+        other.jobs_[i] = NULL;
+        if (jobs_[i])
+            jobs_[i]->session_ = this;
+    }
+    other.streaming_ = false;
+    other.num_slots_ = other.num_queued_ = other.next_slot_ = 0;
+}
+
+Session::Session(Session&& other)
+{
+    take(other);
+}
+
+Session& Session::operator=(Session&& other)
+{
+    if (this != &other) {
+        close();
+        take(other);
+    }
+    return *this;
+}
+
+int Session::open(Device&& dev, const struct m2m_config& cfg, unsigned int num_slots)
+{
+    struct m2m_dev* m2m;
+    int ret;
+
+    close();
+    dev_ = static_cast<Device&&>(dev);
+    m2m = dev_.get();
+    if (!m2m)
+        return -ENODEV;
+
+    ret = m2m_set_config(m2m, &cfg);
+    if (!ret)
+        ret = m2m_request_bufs(m2m, num_slots, num_slots);
+    if (!ret)
+        ret = m2m_stream(m2m, 1);
+    if (ret) {
+        dev_.close();
+        return ret;
+    }
+
+    streaming_ = true;
+    num_slots_ = m2m->num_src_bufs < m2m->num_dst_bufs ? m2m->num_src_bufs : m2m->num_dst_bufs;
+    return num_slots_ ? 0 : -ENOMEM;
+}
+
+void Session::close()
+{
+    while (num_queued_ && wait())
+        ;
+    if (streaming_)
+        m2m_stream(dev_.get(), 0);
+    streaming_ = false;
+    num_slots_ = num_queued_ = next_slot_ = 0;
+    dev_.close();
+}
+
+int Session::submit(Job& job)
+{
+    unsigned int slot = next_slot_;
+    int ret;
+
+    if (job.session_)
+        return -EALREADY;
+    if (!streaming_ || num_queued_ == num_slots_)
+        return -EBUSY;
+
+    ret = m2m_queue_ctrls(dev_.get(), slot, job.src_fd_, job.dst_fd_,
+        job.has_ctrls_ ? &job.ctrls_ : NULL);
+    if (ret)
+        return ret;
+
+    job.result_ = 0;
+    job.session_ = this;
+    job.slot_ = slot;
+    jobs_[slot] = &job;
+    next_slot_ = (next_slot_ + 1) % num_slots_;
+    num_queued_++;
+    return 0;
+}
+
+Job* Session::wait()
+{
+    unsigned int oldest;
+    Job* job;
+    int index;
+
+    if (!num_queued_)
+        return NULL;
+
+    oldest = (next_slot_ + num_slots_ - num_queued_) % num_slots_;
+    index = m2m_dequeue(dev_.get());
+
+    /* in order: a failed or unexpected dequeue ends the oldest job */
+    job = jobs_[oldest];
+    job->result_ = index < 0 ? index : (unsigned int)index == oldest ? 0 : -EIO;
+    job->session_ = NULL;
+    jobs_[oldest] = NULL;
+    num_queued_--;
+    return job;
+}
+
+int Session::run(Job& job)
+{
+    int ret;
+
+    ret = submit(job);
+    return ret ? ret : job.wait();
+}
+
+} /* namespace rga */
@@ -0,0 +1,192 @@
+/*
+ * Copyright (C) Fuzhou Rockchip Electronics Co.Ltd
+ * Author: Jacob Chen <jacob-chen@iotwrt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#ifndef __SESSION_H_INCLUDED__
+#define __SESSION_H_INCLUDED__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "m2m.h"
+
+struct sp_bo;
+struct sp_dev;
+
+/*
+ * librga-v4l2: owning wrappers around the m2m and buffer layers for
+ * programs that transform frames in-process. All types are move-only and
+ * report errors as negative errno values; nothing allocates after
+ * Session::open(), so submit() and wait() are just the ioctls.
+ */
+namespace rga {
+
+/*
+ * The DRM device buffers are allocated on. Programs that don't display
+ * should use open_headless(), see create_headless_sp_dev().
+ */
+class Card {
+public:
+	Card() {}
+	~Card() { close(); }
+	Card(Card &&other);
+	Card& operator=(Card &&other);
+	Card(const Card &) = delete;
+	Card& operator=(const Card &) = delete;
+
+	int open();
+	int open_headless(const char *heap = NULL);
+	void close();
+	struct sp_dev* get() const { return dev_; }
+	explicit operator bool() const { return dev_ != NULL; }
+
+private:
+	struct sp_dev *dev_ = NULL;
+};
+
+/* One mem2mem node. */
+class Device {
+public:
+	Device() {}
+	~Device() { close(); }
+	Device(Device &&other);
+	Device& operator=(Device &&other);
+	Device(const Device &) = delete;
+	Device& operator=(const Device &) = delete;
+
+	int open(const char *path);
+	void close();
+	struct m2m_dev* get() const { return dev_; }
+	const struct m2m_caps& caps() const { return dev_->caps; }
+	const char* path() const { return dev_->path; }
+	explicit operator bool() const { return dev_ != NULL; }
+
+private:
+	struct m2m_dev *dev_ = NULL;
+};
+
+/* A dmabuf holding one frame, allocated on a Card or taken over. */
+class Buffer {
+public:
+	Buffer() {}
+	~Buffer() { release(); }
+	Buffer(Buffer &&other);
+	Buffer& operator=(Buffer &&other);
+	Buffer(const Buffer &) = delete;
+	Buffer& operator=(const Buffer &) = delete;
+
+	/* 'flags' are the create_sp_bo() ones. */
+	int alloc(Card &card, uint32_t v4l2_format, uint32_t width,
+		  uint32_t height, uint32_t flags = 0);
+	/* Owns 'dmabuf_fd' from now on. */
+	int adopt(int dmabuf_fd, size_t size);
+	void release();
+
+	int fd() const { return fd_; }
+	size_t size() const { return size_; }
+	explicit operator bool() const { return fd_ >= 0; }
+
+	/* CPU access to allocated buffers, 'access' is SP_BO_*. */
+	void* begin_cpu(int access);
+	void end_cpu(int access);
+
+private:
+	struct sp_bo *bo_ = NULL;
+	int fd_ = -1;
+	size_t size_ = 0;
+};
+
+class Session;
+
+/*
+ * A transform from one buffer into another, with its own controls if
+ * set_ctrls() was called. The buffers must outlive the job. Destroying a
+ * job that is still queued waits for it.
+ */
+class Job {
+public:
+	Job() {}
+	Job(const Buffer &src, const Buffer &dst);
+	/* dmabufs the caller keeps owning, for buffers that aren't Buffers */
+	Job(int src_fd, int dst_fd);
+	~Job() { wait(); }
+	Job(Job &&other);
+	Job& operator=(Job &&other);
+	Job(const Job &) = delete;
+	Job& operator=(const Job &) = delete;
+
+	void set_ctrls(const struct m2m_ctrls &ctrls);
+	void clear_ctrls() { has_ctrls_ = false; }
+
+	bool queued() const { return session_ != NULL; }
+	/* 0, or the error of the job or of waiting for it. */
+	int result() const { return result_; }
+	int wait();
+
+private:
+	friend class Session;
+	void take(Job &other);
+
+	int src_fd_ = -1;
+	int dst_fd_ = -1;
+	struct m2m_ctrls ctrls_ = {};
+	bool has_ctrls_ = false;
+	int result_ = 0;
+
+	Session *session_ = NULL;
+	unsigned int slot_ = 0;
+};
+
+/*
+ * A configured, streaming node. Jobs complete in submission order; up to
+ * slots() of them can be queued at once.
+ */
+class Session {
+public:
+	Session() {}
+	~Session() { close(); }
+	Session(Session &&other);
+	Session& operator=(Session &&other);
+	Session(const Session &) = delete;
+	Session& operator=(const Session &) = delete;
+
+	int open(Device &&dev, const struct m2m_config &cfg,
+		 unsigned int num_slots = M2M_MAX_BUFS);
+	/* Waits for the queued jobs first. */
+	void close();
+
+	/*
+	 * -EBUSY when every slot is taken, or for a job with its own controls
+	 * while others are queued on a node without the request API.
+	 */
+	int submit(Job &job);
+	/* Complete the oldest job and return it, NULL when none is queued. */
+	Job* wait();
+	/* submit() and wait() for it. */
+	int run(Job &job);
+
+	unsigned int slots() const { return num_slots_; }
+	unsigned int queued() const { return num_queued_; }
+	const Device& device() const { return dev_; }
+
+private:
+	friend class Job;
+	void take(Session &other);
+
+	Device dev_;
+	bool streaming_ = false;
+	unsigned int num_slots_ = 0;
+	unsigned int num_queued_ = 0;
+	unsigned int next_slot_ = 0;
+	Job *jobs_[M2M_MAX_BUFS] = {};
+};
+
+} /* namespace rga */
+
+#endif /* __SESSION_H_INCLUDED__ */
@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) Fuzhou Rockchip Electronics Co.Ltd
+ * Author: Jacob Chen <jacob-chen@iotwrt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#ifndef __SIMD_H_INCLUDED__
+#define __SIMD_H_INCLUDED__
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * 128-bit GCC vector types. They lower to NEON on the boards and to SSE2
+ * on x86 hosts without any per-architecture intrinsics in the kernels.
+ */
+typedef uint8_t v16u8 __attribute__((vector_size(16)));
+typedef uint16_t v8u16 __attribute__((vector_size(16)));
+typedef uint32_t v4u32 __attribute__((vector_size(16)));
+typedef int32_t v4i32 __attribute__((vector_size(16)));
+typedef uint64_t v2u64 __attribute__((vector_size(16)));
+
+/* widening target for 16 byte lanes, split into four registers */
+typedef uint32_t v16u32 __attribute__((vector_size(64)));
+
+static inline v4u32 load_v4u32(const void* p)
+{
+    v4u32 v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline void store_v4u32(void* p, v4u32 v)
+{
+    memcpy(p, &v, sizeof(v));
+}
+
+static inline v16u8 load_v16u8(const void* p)
+{
+    v16u8 v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline void store_v16u8(void* p, v16u8 v)
+{
+    memcpy(p, &v, sizeof(v));
+}
+
+static inline v4u32 splat_v4u32(uint32_t x)
+{
+    v4u32 v = { x, x, x, x };
+    return v;
+}
+
+static inline v4i32 splat_v4i32(int32_t x)
+{
+    v4i32 v = { x, x, x, x };
+    return v;
+}
+
+#endif /* __SIMD_H_INCLUDED__ */
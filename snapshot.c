@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) Fuzhou Rockchip Electronics Co.Ltd
+ * Author: Jacob Chen <jacob-chen@iotwrt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "snapshot.h"
+
+#define SNAPSHOT_MAGIC 0x53414752 /* "RGAS" */
+/* 2: device paths of up to PATH_MAX */
+#define SNAPSHOT_VERSION 2
+
+struct snapshot_file {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;
+    struct snapshot snapshot;
+};
+
+int save_snapshot(const char* path, const struct snapshot* s)
+{
+    struct snapshot_file file;
+    char tmp[320];
+    FILE* fp;
+    int ret;
+
+    memset(&file, 0, sizeof(file));
+    file.magic = SNAPSHOT_MAGIC;
+    file.version = SNAPSHOT_VERSION;
+    file.size = sizeof(file);
+    file.snapshot = *s;
+
+    snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+    fp = fopen(tmp, "wb");
+    if (!fp)
+        return -errno;
+    if (fwrite(&file, sizeof(file), 1, fp) != 1) {
+        ret = -errno;
+        fclose(fp);
+        unlink(tmp);
+        return ret;
+    }
+    if (fclose(fp) || rename(tmp, path)) {
+        ret = -errno;
+        unlink(tmp);
+        return ret;
+    }
+    return 0;
+}
+
+int load_snapshot(const char* path, struct snapshot* s)
+{
+    struct snapshot_file file;
+    FILE* fp;
+    size_t n;
+
+    fp = fopen(path, "rb");
+    if (!fp)
+        return -errno;
+    n = fread(&file, 1, sizeof(file), fp);
+    fclose(fp);
+
+    if (n != sizeof(file) || file.magic != SNAPSHOT_MAGIC || file.version != SNAPSHOT_VERSION
+        || file.size != sizeof(file))
+        return -EINVAL;
+
+    *s = file.snapshot;
+    s->device[sizeof(s->device) - 1] = '\0';
+    return 0;
+}
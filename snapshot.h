@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) Fuzhou Rockchip Electronics Co.Ltd
+ * Author: Jacob Chen <jacob-chen@iotwrt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#ifndef __SNAPSHOT_H_INCLUDED__
+#define __SNAPSHOT_H_INCLUDED__
+
+#include <limits.h>
+#include <stdint.h>
+
+#include "cpu_rga.h"
+#include "m2m.h"
+
+/*
+ * Everything a run sets up before its first frame, so a later run can
+ * start from a file instead of its options: the node, the transform and
+ * how many buffers to allocate for it.
+ */
+struct snapshot {
+	char device[PATH_MAX];
+	struct m2m_config cfg;
+	struct rga_rect src_crop;
+	struct rga_rect dst_crop;
+	uint32_t src_pool;		/* buffers asked from the node */
+	uint32_t dst_pool;
+	uint32_t pattern_cache;		/* precomputed source frames */
+	uint32_t bo_flags;
+};
+
+/* Written to a temporary file and renamed, readers never see half of it. */
+int save_snapshot(const char *path, const struct snapshot *s);
+/* Fails on files of another layout. */
+int load_snapshot(const char *path, struct snapshot *s);
+
+#endif /* __SNAPSHOT_H_INCLUDED__ */
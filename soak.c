@@ -0,0 +1,191 @@
+/*
+ * Copyright (C) Fuzhou Rockchip Electronics Co.Ltd
+ * Author: Jacob Chen <jacob-chen@iotwrt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#include <dirent.h>
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "arena.h"
+#include "dev.h"
+#include "soak.h"
+
+/* RSS growth that is allocator noise rather than a leak */
+#define RSS_SLACK_KB (16 * 1024)
+/* rounds before the random parameters average out over a quarter */
+#define MIN_TREND_ROUNDS 32
+#define MAX_DECAY 0.8
+
+struct soak_sample {
+    double mp_per_s;
+    struct proc_usage usage;
+};
+
+struct soak {
+    struct soak_sample* samples;
+    int num_samples;
+    int max_samples;
+    int failed_rounds;
+};
+
+static uint64_t get_rss_kb(void)
+{
+    char line[128];
+    uint64_t kb = 0;
+    FILE* fp;
+
+    fp = fopen("/proc/self/status", "r");
+    if (!fp)
+        return 0;
+    while (fgets(line, sizeof(line), fp)) {
+        if (sscanf(line, "VmRSS: %llu", (unsigned long long*)&kb) == 1)
+            break;
+    }
+    fclose(fp);
+    return kb;
+}
+
+int get_proc_usage(struct proc_usage* u, const struct sp_dev* dev)
+{
+    char target[128];
+    struct dirent* e;
+    DIR* dir;
+    ssize_t n;
+
+    memset(u, 0, sizeof(*u));
+    u->rss_kb = get_rss_kb();
+    /* kept on purpose and bounded, not a leak */
+    u->cached_kb = frame_arena_cached() / 1024;
+    u->rss_kb -= u->rss_kb > u->cached_kb ? u->cached_kb : u->rss_kb;
+    u->bos = dev ? dev->num_bos : 0;
+
+    dir = opendir("/proc/self/fd");
+    if (!dir)
+        return -1;
+    while ((e = readdir(dir))) {
+        if (e->d_name[0] == '.')
+            continue;
+        u->fds++;
+        n = readlinkat(dirfd(dir), e->d_name, target, sizeof(target) - 1);
+        if (n <= 0)
+            continue;
+        target[n] = '\0';
+        /* "/dmabuf:" on new kernels, "anon_inode:dmabuf" on old ones */
+        if (strstr(target, "dmabuf") || !strncmp(target, "/memfd:sp_bo", 12))
+            u->dmabufs++;
+    }
+    closedir(dir);
+
+    /* not the one opendir() held */
+    u->fds--;
+    return 0;
+}
+
+struct soak* create_soak(void)
+{
+    return (struct soak*)calloc(1, sizeof(struct soak));
+}
+
+void soak_round(struct soak* s, const struct sp_dev* dev, uint64_t pixels, uint64_t us,
+    int failed)
+{
+    struct soak_sample* sample;
+
+    if (failed) {
+        printf("*[SOAK]* : round %d failed\n", s->num_samples);
+        s->failed_rounds++;
+    }
+
+    if (s->num_samples == s->max_samples) {
+        int max = s->max_samples ? 2 * s->max_samples : 64;
+        struct soak_sample* p = (struct soak_sample*)realloc(s->samples, max * sizeof(*p));
+
+        if (!p)
+            return;
+        s->samples = p;
+        s->max_samples = max;
+    }
+
+    sample = &s->samples[s->num_samples++];
+    sample->mp_per_s = us ? pixels / (double)us : 0;
+    /* the arenas keep the peak of the largest round, RSS is to show what is live */
+    malloc_trim(0);
+    get_proc_usage(&sample->usage, dev);
+    printf("*[SOAK]* : round %d, %.1f MP/s, rss %llu kB + %llu kB cached, %d fds, %d dmabufs, %d bos\n",
+        s->num_samples - 1, sample->mp_per_s, (unsigned long long)sample->usage.rss_kb,
+        (unsigned long long)sample->usage.cached_kb,
+        sample->usage.fds, sample->usage.dmabufs, sample->usage.bos);
+}
+
+static double mean_mp_per_s(const struct soak_sample* samples, int n)
+{
+    double sum = 0;
+    int i;
+
+    for (i = 0; i < n; i++)
+        sum += samples[i].mp_per_s;
+    return n ? sum / n : 0;
+}
+
+static int check_count(const char* what, int base, int last)
+{
+    if (last <= base)
+        return 0;
+    printf("*[SOAK]* : %d %s leaked\n", last - base, what);
+    return 1;
+}
+
+int destroy_soak(struct soak* s)
+{
+    const struct proc_usage *base, *last;
+    double first_mp, last_mp;
+    int quarter, failures;
+
+    if (!s)
+        return 0;
+    /* a broken round leaks nothing and proves nothing */
+    failures = s->failed_rounds;
+    if (failures)
+        printf("*[SOAK]* : %d rounds failed\n", failures);
+    if (s->num_samples < 2) {
+        printf("*[SOAK]* : %d rounds, too short to judge\n", s->num_samples);
+        goto out;
+    }
+
+    base = &s->samples[0].usage;
+    last = &s->samples[s->num_samples - 1].usage;
+    failures += check_count("fds", base->fds, last->fds);
+    failures += check_count("dmabufs", base->dmabufs, last->dmabufs);
+    failures += check_count("bos", base->bos, last->bos);
+    if (last->rss_kb > base->rss_kb + RSS_SLACK_KB) {
+        printf("*[SOAK]* : RSS grew by %llu kB\n", (unsigned long long)(last->rss_kb - base->rss_kb));
+        failures++;
+    }
+
+    /* the baseline round warms up, the trends start after it */
+    quarter = (s->num_samples - 1) / 4;
+    if (s->num_samples - 1 >= MIN_TREND_ROUNDS) {
+        first_mp = mean_mp_per_s(s->samples + 1, quarter);
+        last_mp = mean_mp_per_s(s->samples + s->num_samples - quarter, quarter);
+        printf("*[SOAK]* : %.1f MP/s in the first quarter, %.1f MP/s in the last\n", first_mp, last_mp);
+        if (last_mp < first_mp * MAX_DECAY) {
+            printf("*[SOAK]* : throughput decayed by %.0f%%\n", 100 - last_mp * 100 / first_mp);
+            failures++;
+        }
+    }
+
+    printf("*[SOAK]* : %d rounds, %s\n", s->num_samples, failures ? "FAILED" : "passed");
+out:
+    free(s->samples);
+    free(s);
+    return failures;
+}
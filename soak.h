@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) Fuzhou Rockchip Electronics Co.Ltd
+ * Author: Jacob Chen <jacob-chen@iotwrt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#ifndef __SOAK_H_INCLUDED__
+#define __SOAK_H_INCLUDED__
+
+#include <stdint.h>
+
+struct sp_dev;
+
+/* What the process holds that a leak grows. */
+struct proc_usage {
+	uint64_t rss_kb;		/* without the blocks the frame arena keeps */
+	uint64_t cached_kb;
+	int fds;
+	int dmabufs;		/* fds of dmabufs and of memfd frames */
+	int bos;		/* live bos of 'dev', a GEM handle each on KMS */
+};
+
+int get_proc_usage(struct proc_usage *u, const struct sp_dev *dev);
+
+/*
+ * Leak and throughput tracking over the rounds of a long run. The first
+ * round fills the caches and pools and is the baseline; afterwards the
+ * fds, dmabufs and bos have to come back to it at the end of every round,
+ * RSS may only grow by some slack, and the throughput of the last quarter
+ * of the rounds must stay within 20% of the first quarter.
+ */
+struct soak;
+
+struct soak* create_soak(void);
+/*
+ * 'pixels' were transformed in 'us', the round's usage is sampled. A
+ * 'failed' round, one that errored or came up short, fails the soak.
+ */
+void soak_round(struct soak *s, const struct sp_dev *dev, uint64_t pixels, uint64_t us,
+		int failed);
+/* Prints the verdict and returns the number of failed rounds and checks. */
+int destroy_soak(struct soak *s);
+
+#endif /* __SOAK_H_INCLUDED__ */
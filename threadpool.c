@@ -0,0 +1,197 @@
+/*
+ * Copyright (C) Fuzhou Rockchip Electronics Co.Ltd
+ * Author: Jacob Chen <jacob-chen@iotwrt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "threadpool.h"
+
+struct thread_pool {
+    pthread_t* threads;
+    int num_threads;
+
+    pthread_mutex_t submit_lock; /* one parallel_for at a time */
+    pthread_mutex_t lock;
+    pthread_cond_t work_cond;
+    pthread_cond_t done_cond;
+
+    /* current job, published under 'lock' */
+    parallel_fn fn;
+    void* arg;
+    int count;
+    int grain;
+    int next;
+    int busy;
+    unsigned int generation;
+    int quit;
+};
+
+static struct thread_pool* default_pool;
+static pthread_once_t default_pool_once = PTHREAD_ONCE_INIT;
+
+static void run_chunks(struct thread_pool* pool)
+{
+    int begin, end;
+
+    for (;;) {
+        begin = __atomic_fetch_add(&pool->next, pool->grain, __ATOMIC_RELAXED);
+        if (begin >= pool->count)
+            break;
+        end = begin + pool->grain;
+        if (end > pool->count)
+            end = pool->count;
+        pool->fn(pool->arg, begin, end);
+    }
+}
+
+static void* worker_main(void* data)
+{
+    struct thread_pool* pool = (struct thread_pool*)data;
+    unsigned int seen = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (!pool->quit && pool->generation == seen)
+            pthread_cond_wait(&pool->work_cond, &pool->lock);
+        if (pool->quit)
+            break;
+        seen = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        run_chunks(pool);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->busy == 0)
+            pthread_cond_signal(&pool->done_cond);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+struct thread_pool* create_thread_pool(int num_threads)
+{
+    struct thread_pool* pool;
+    int i;
+
+    pool = (struct thread_pool*)calloc(1, sizeof(*pool));
+    if (!pool)
+        return NULL;
+
+    pthread_mutex_init(&pool->submit_lock, NULL);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_cond, NULL);
+    pthread_cond_init(&pool->done_cond, NULL);
+
+    if (num_threads > 0) {
+        pool->threads = (pthread_t*)calloc(num_threads, sizeof(pthread_t));
+        if (!pool->threads) {
+            free(pool);
+            return NULL;
+        }
+    }
+
+    for (i = 0; i < num_threads; i++) {
+        if (pthread_create(&pool->threads[i], NULL, worker_main, pool)) {
+            printf("failed to create worker thread %d\n", i);
+            break;
+        }
+    }
+    pool->num_threads = i;
+
+    return pool;
+}
+
+void destroy_thread_pool(struct thread_pool* pool)
+{
+    int i;
+
+    if (!pool)
+        return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->quit = 1;
+    pthread_cond_broadcast(&pool->work_cond);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (i = 0; i < pool->num_threads; i++)
+        pthread_join(pool->threads[i], NULL);
+
+    pthread_cond_destroy(&pool->done_cond);
+    pthread_cond_destroy(&pool->work_cond);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_mutex_destroy(&pool->submit_lock);
+    free(pool->threads);
+    free(pool);
+}
+
+static void create_default_pool(void)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    /* the submitting thread works as well */
+    default_pool = create_thread_pool(cpus > 1 ? cpus - 1 : 0);
+}
+
+struct thread_pool* get_default_thread_pool(void)
+{
+    pthread_once(&default_pool_once, create_default_pool);
+    return default_pool;
+}
+
+int thread_pool_size(struct thread_pool* pool)
+{
+    return pool ? pool->num_threads + 1 : 1;
+}
+
+void parallel_for(struct thread_pool* pool, int count, int grain,
+    parallel_fn fn, void* arg)
+{
+    int chunks;
+
+    if (count <= 0)
+        return;
+    if (grain < 1)
+        grain = 1;
+
+    /* a few chunks per thread keeps the tail short without much overhead */
+    chunks = thread_pool_size(pool) * 4;
+    if (count / chunks > grain)
+        grain = count / chunks;
+
+    if (!pool || !pool->num_threads || count <= grain) {
+        fn(arg, 0, count);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->submit_lock);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->fn = fn;
+    pool->arg = arg;
+    pool->count = count;
+    pool->grain = grain;
+    pool->next = 0;
+    pool->busy = pool->num_threads;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->work_cond);
+    pthread_mutex_unlock(&pool->lock);
+
+    run_chunks(pool);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->busy)
+        pthread_cond_wait(&pool->done_cond, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+
+    pthread_mutex_unlock(&pool->submit_lock);
+}
@@ -0,0 +1,32 @@
+/*
+ * Copyright (C) Fuzhou Rockchip Electronics Co.Ltd
+ * Author: Jacob Chen <jacob-chen@iotwrt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#ifndef __THREADPOOL_H_INCLUDED__
+#define __THREADPOOL_H_INCLUDED__
+
+struct thread_pool;
+
+typedef void (*parallel_fn)(void* arg, int begin, int end);
+
+struct thread_pool* create_thread_pool(int num_threads);
+void destroy_thread_pool(struct thread_pool* pool);
+
+/* Process-wide pool sized to the online CPUs, created on first use. */
+struct thread_pool* get_default_thread_pool(void);
+int thread_pool_size(struct thread_pool* pool);
+
+/*
+ * Split [0, count) into chunks of at least 'grain' items and run them on
+ * the pool. The caller works on chunks too and returns once all are done.
+ */
+void parallel_for(struct thread_pool* pool, int count, int grain,
+    parallel_fn fn, void* arg);
+
+#endif /* __THREADPOOL_H_INCLUDED__ */
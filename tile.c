@@ -0,0 +1,264 @@
+/*
+ * Copyright (C) Fuzhou Rockchip Electronics Co.Ltd
+ * Author: Jacob Chen <jacob-chen@iotwrt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "m2m.h"
+#include "tile.h"
+
+static uint32_t gcd(uint32_t a, uint32_t b)
+{
+    uint32_t t;
+
+    while (b) {
+        t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+/* Round 'v' to the nearest multiple of 'step'. */
+static uint32_t round_to(uint64_t v, uint32_t step)
+{
+    return (v + step / 2) / step * step;
+}
+
+/*
+ * Stripe boundaries at x where x * src_width / dst_width is a whole, even
+ * number keep the scale factor of every stripe identical to the frame's
+ * and sample the source at the same positions as one big job would.
+ * Selection rectangles can't express a sub-pixel start, so this is the
+ * only way stripes line up; taps past a boundary are only lost when
+ * upscaling, where the engine clamps at the crop edge.
+ */
+static int split(const struct m2m_config* cfg, int n, uint32_t max_width,
+    uint32_t dst_step, uint32_t* bounds)
+{
+    uint32_t src_w = cfg->src_width, dst_w = cfg->dst_width;
+    uint32_t x, sx, prev_x = 0, prev_sx = 0;
+    int i;
+
+    bounds[0] = 0;
+    for (i = 1; i <= n; i++) {
+        x = i == n ? dst_w : round_to((uint64_t)dst_w * i / n, dst_step);
+        if (x <= prev_x || x > dst_w)
+            return -1;
+        sx = i == n ? src_w : (uint64_t)x * src_w / dst_w;
+        if (x - prev_x > max_width || sx - prev_sx > max_width)
+            return -1;
+        bounds[i] = x;
+        prev_x = x;
+        prev_sx = sx;
+    }
+    return 0;
+}
+
+int plan_stripes(const struct m2m_config* cfg, int num_tiles, uint32_t max_width,
+    struct stripe* stripes, int max)
+{
+    uint32_t bounds[MAX_STRIPES + 1];
+    uint32_t g, src_step, dst_step, sx0, sx1;
+    int mirror = (cfg->rotate == 180) ^ !!cfg->hflip;
+    int i, n, exact = 1;
+
+    if (cfg->rotate == 90 || cfg->rotate == 270 || max > MAX_STRIPES)
+        return -1;
+
+    g = gcd(cfg->src_width, cfg->dst_width);
+    src_step = cfg->src_width / g;
+    dst_step = cfg->dst_width / g;
+    /* chroma pairs stay together on both sides */
+    if ((src_step | dst_step) & 1) {
+        src_step *= 2;
+        dst_step *= 2;
+    }
+
+    for (n = num_tiles; n <= max; n++) {
+        if (exact && split(cfg, n, max_width, dst_step, bounds) == 0)
+            break;
+        /* no usable exact boundaries, rounding costs a little phase */
+        if (split(cfg, n, max_width, 2, bounds) == 0) {
+            exact = 0;
+            break;
+        }
+    }
+    if (n > max)
+        return -1;
+
+    for (i = 0; i < n; i++) {
+        sx0 = (uint64_t)bounds[i] * cfg->src_width / cfg->dst_width & ~1u;
+        sx1 = i == n - 1 ? cfg->src_width
+                         : (uint64_t)bounds[i + 1] * cfg->src_width / cfg->dst_width & ~1u;
+
+        memset(&stripes[i], 0, sizeof(stripes[i]));
+        stripes[i].dst.x = bounds[i];
+        stripes[i].dst.w = bounds[i + 1] - bounds[i];
+        stripes[i].dst.h = cfg->dst_height;
+        /* a mirrored job fills the left of the destination from the right of the source */
+        stripes[i].src.x = mirror ? cfg->src_width - sx1 : sx0;
+        stripes[i].src.w = sx1 - sx0;
+        stripes[i].src.h = cfg->src_height;
+    }
+    return n;
+}
+
+/* source pixels a scaler tap reaches past the one it is centred on */
+#define DAMAGE_MARGIN 2
+
+/* One destination axis and the source axis it is scaled from. */
+struct axis {
+    uint32_t n_src;
+    uint32_t n_dst;
+    uint32_t step; /* destination positions that fall on whole, even source pixels */
+    int reverse;
+};
+
+static void init_axis(struct axis* a, uint32_t n_src, uint32_t n_dst, int reverse)
+{
+    uint32_t g = gcd(n_src, n_dst);
+
+    a->n_src = n_src;
+    a->n_dst = n_dst;
+    a->step = n_dst / g;
+    /* chroma pairs stay together on both sides */
+    if ((n_src / g | a->step) & 1)
+        a->step *= 2;
+    a->reverse = reverse;
+}
+
+/*
+ * Map the source interval [p, q) to the aligned destination interval it
+ * affects, and that back to the exact source interval the job reads.
+ */
+static void map_interval(const struct axis* a, uint32_t p, uint32_t q,
+    uint32_t* src, uint32_t* src_len, uint32_t* dst, uint32_t* dst_len)
+{
+    uint64_t t0, t1;
+
+    /*
+     * Upscaling taps reach past the crop and the engine clamps them at its
+     * edge, only a job that ends at the frame edges samples like the frame.
+     */
+    if (a->n_dst > a->n_src) {
+        p = 0;
+        q = a->n_src;
+    }
+    p = p > DAMAGE_MARGIN ? p - DAMAGE_MARGIN : 0;
+    q = q + DAMAGE_MARGIN < a->n_src ? q + DAMAGE_MARGIN : a->n_src;
+
+    t0 = (uint64_t)p * a->n_dst / a->n_src / a->step * a->step;
+    t1 = ((uint64_t)q * a->n_dst + a->n_src - 1) / a->n_src;
+    t1 = (t1 + a->step - 1) / a->step * a->step;
+    if (t1 > a->n_dst)
+        t1 = a->n_dst;
+
+    *src = t0 * a->n_src / a->n_dst;
+    *src_len = (t1 == a->n_dst ? a->n_src : t1 * a->n_src / a->n_dst) - *src;
+    /* a mirrored axis fills the end of the destination from the start of the source */
+    *dst = a->reverse ? a->n_dst - t1 : t0;
+    *dst_len = t1 - t0;
+}
+
+static int overlaps(const struct rga_rect* a, const struct rga_rect* b)
+{
+    return a->x <= b->x + b->w && b->x <= a->x + a->w
+        && a->y <= b->y + b->h && b->y <= a->y + a->h;
+}
+
+static void merge_into(struct rga_rect* a, const struct rga_rect* b)
+{
+    uint32_t x1 = a->x + a->w > b->x + b->w ? a->x + a->w : b->x + b->w;
+    uint32_t y1 = a->y + a->h > b->y + b->h ? a->y + a->h : b->y + b->h;
+
+    a->x = a->x < b->x ? a->x : b->x;
+    a->y = a->y < b->y ? a->y : b->y;
+    a->w = x1 - a->x;
+    a->h = y1 - a->y;
+}
+
+/*
+ * Union of two jobs. The bounds on both sides are aligned already, so the
+ * bounding boxes still correspond exactly.
+ */
+static void merge_job(struct stripe* a, const struct stripe* b)
+{
+    merge_into(&a->src, &b->src);
+    merge_into(&a->dst, &b->dst);
+}
+
+int plan_damage(const struct m2m_config* cfg, const struct rga_rect* damage,
+    int num_damage, struct stripe* jobs, int max)
+{
+    int swap = cfg->rotate == 90 || cfg->rotate == 270;
+    struct axis ax, ay;
+    struct stripe job;
+    uint32_t x0, x1, y0, y1;
+    int i, j, n = 0, merged;
+
+    if (max <= 0)
+        return 0;
+
+    /*
+     * Which source axis each destination axis comes from, and whether it
+     * runs backwards: the rotation is clockwise and the flips apply to
+     * the rotated picture.
+     */
+    if (!swap) {
+        init_axis(&ax, cfg->src_width, cfg->dst_width, (cfg->rotate == 180) ^ !!cfg->hflip);
+        init_axis(&ay, cfg->src_height, cfg->dst_height, (cfg->rotate == 180) ^ !!cfg->vflip);
+    } else {
+        init_axis(&ax, cfg->src_height, cfg->dst_width, (cfg->rotate == 90) ^ !!cfg->hflip);
+        init_axis(&ay, cfg->src_width, cfg->dst_height, (cfg->rotate == 270) ^ !!cfg->vflip);
+    }
+
+    for (i = 0; i < num_damage; i++) {
+        const struct rga_rect* d = &damage[i];
+
+        if (!d->w || !d->h || d->x >= cfg->src_width || d->y >= cfg->src_height)
+            continue;
+        x0 = d->x;
+        y0 = d->y;
+        x1 = d->x + d->w < cfg->src_width ? d->x + d->w : cfg->src_width;
+        y1 = d->y + d->h < cfg->src_height ? d->y + d->h : cfg->src_height;
+
+        memset(&job, 0, sizeof(job));
+        if (!swap) {
+            map_interval(&ax, x0, x1, &job.src.x, &job.src.w, &job.dst.x, &job.dst.w);
+            map_interval(&ay, y0, y1, &job.src.y, &job.src.h, &job.dst.y, &job.dst.h);
+        } else {
+            map_interval(&ax, y0, y1, &job.src.y, &job.src.h, &job.dst.x, &job.dst.w);
+            map_interval(&ay, x0, x1, &job.src.x, &job.src.w, &job.dst.y, &job.dst.h);
+        }
+
+        /* out of room: everything goes into the last job */
+        if (n == max)
+            merge_job(&jobs[n - 1], &job);
+        else
+            jobs[n++] = job;
+    }
+
+    /* merging grows jobs into others, repeat until nothing touches */
+    do {
+        merged = 0;
+        for (i = 0; i < n; i++) {
+            for (j = i + 1; j < n; j++) {
+                if (!overlaps(&jobs[i].dst, &jobs[j].dst))
+                    continue;
+                merge_job(&jobs[i], &jobs[j]);
+                jobs[j--] = jobs[--n];
+                merged = 1;
+            }
+        }
+    } while (merged);
+
+    return n;
+}
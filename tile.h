@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) Fuzhou Rockchip Electronics Co.Ltd
+ * Author: Jacob Chen <jacob-chen@iotwrt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#ifndef __TILE_H_INCLUDED__
+#define __TILE_H_INCLUDED__
+
+#include <stdint.h>
+
+#include "cpu_rga.h"
+
+#define MAX_STRIPES 32
+
+struct m2m_config;
+
+/* One job of a striped transform. */
+struct stripe {
+	struct rga_rect src;	/* OUTPUT crop */
+	struct rga_rect dst;	/* CAPTURE compose, inside the full frame */
+};
+
+/*
+ * Split the transform into at least 'num_tiles' vertical stripes no wider
+ * than 'max_width' on either side. Returns the number of stripes or -1.
+ */
+int plan_stripes(const struct m2m_config *cfg, int num_tiles, uint32_t max_width,
+		 struct stripe *stripes, int max);
+
+/*
+ * The jobs that bring the previous destination up to date after the
+ * source rectangles 'damage' changed. Every job samples the source at the
+ * same positions as the full frame does, so the merged result matches a
+ * full transform. Jobs that touch are merged; the rectangles work as
+ * selections on a node and as rga_params for cpu_rga_transform().
+ * Returns the number of jobs, at most 'max'.
+ */
+int plan_damage(const struct m2m_config *cfg, const struct rga_rect *damage,
+		int num_damage, struct stripe *jobs, int max);
+
+#endif /* __TILE_H_INCLUDED__ */
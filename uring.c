@@ -0,0 +1,240 @@
+/*
+ * Copyright (C) Fuzhou Rockchip Electronics Co.Ltd
+ * Author: Jacob Chen <jacob-chen@iotwrt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <linux/io_uring.h>
+
+#include "uring.h"
+
+struct uring {
+    int fd;
+
+    void* sq_map;
+    size_t sq_map_len;
+    void* cq_map;
+    size_t cq_map_len;
+    struct io_uring_sqe* sqes;
+    size_t sqes_len;
+
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    unsigned sq_entries;
+
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_cqe* cqes;
+
+    /* prepared but not yet handed to the kernel */
+    unsigned pending;
+    unsigned long enters;
+};
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params* p)
+{
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+struct uring* create_uring(unsigned int entries)
+{
+    struct io_uring_params p;
+    struct uring* u;
+    uint8_t* sq;
+    uint8_t* cq;
+
+    u = (struct uring*)calloc(1, sizeof(*u));
+    if (!u)
+        return NULL;
+
+    memset(&p, 0, sizeof(p));
+    u->fd = sys_io_uring_setup(entries, &p);
+    if (u->fd < 0) {
+        printf("io_uring_setup failed: %s\n", strerror(errno));
+        free(u);
+        return NULL;
+    }
+
+    u->sq_map_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    u->cq_map_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (u->cq_map_len > u->sq_map_len)
+            u->sq_map_len = u->cq_map_len;
+        u->cq_map_len = 0;
+    }
+
+    u->sq_map = mmap(NULL, u->sq_map_len, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+    if (u->sq_map == MAP_FAILED)
+        goto err_close;
+
+    if (u->cq_map_len) {
+        u->cq_map = mmap(NULL, u->cq_map_len, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+        if (u->cq_map == MAP_FAILED)
+            goto err_sq;
+    } else {
+        u->cq_map = u->sq_map;
+    }
+
+    u->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = (struct io_uring_sqe*)mmap(NULL, u->sqes_len, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+    if (u->sqes == MAP_FAILED)
+        goto err_cq;
+
+    sq = (uint8_t*)u->sq_map;
+    u->sq_head = (unsigned*)(sq + p.sq_off.head);
+    u->sq_tail = (unsigned*)(sq + p.sq_off.tail);
+    u->sq_mask = (unsigned*)(sq + p.sq_off.ring_mask);
+    u->sq_array = (unsigned*)(sq + p.sq_off.array);
+    u->sq_entries = p.sq_entries;
+
+    cq = (uint8_t*)u->cq_map;
+    u->cq_head = (unsigned*)(cq + p.cq_off.head);
+    u->cq_tail = (unsigned*)(cq + p.cq_off.tail);
+    u->cq_mask = (unsigned*)(cq + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+    return u;
+
+err_cq:
+    if (u->cq_map != u->sq_map)
+        munmap(u->cq_map, u->cq_map_len);
+err_sq:
+    munmap(u->sq_map, u->sq_map_len);
+err_close:
+    printf("failed to map io_uring: %s\n", strerror(errno));
+    close(u->fd);
+    free(u);
+    return NULL;
+}
+
+void destroy_uring(struct uring* u)
+{
+    if (!u)
+        return;
+    munmap(u->sqes, u->sqes_len);
+    if (u->cq_map != u->sq_map)
+        munmap(u->cq_map, u->cq_map_len);
+    munmap(u->sq_map, u->sq_map_len);
+    close(u->fd);
+    free(u);
+}
+
+static struct io_uring_sqe* get_sqe(struct uring* u)
+{
+    unsigned head = __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+    unsigned tail = *u->sq_tail + u->pending;
+    struct io_uring_sqe* sqe;
+
+    if (tail - head >= u->sq_entries)
+        return NULL;
+
+    sqe = &u->sqes[tail & *u->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    u->sq_array[tail & *u->sq_mask] = tail & *u->sq_mask;
+    u->pending++;
+    return sqe;
+}
+
+int uring_poll_add(struct uring* u, int fd, short events, uint64_t user_data)
+{
+    struct io_uring_sqe* sqe = get_sqe(u);
+
+    if (!sqe)
+        return -EBUSY;
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll_events = events;
+    sqe->user_data = user_data;
+    return 0;
+}
+
+static int prep_rw(struct uring* u, int op, int fd, const void* buf, uint32_t len,
+    uint64_t off, uint64_t user_data)
+{
+    struct io_uring_sqe* sqe = get_sqe(u);
+
+    if (!sqe)
+        return -EBUSY;
+    sqe->opcode = op;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)buf;
+    sqe->len = len;
+    sqe->off = off;
+    sqe->user_data = user_data;
+    return 0;
+}
+
+int uring_read(struct uring* u, int fd, void* buf, uint32_t len, uint64_t off,
+    uint64_t user_data)
+{
+    return prep_rw(u, IORING_OP_READ, fd, buf, len, off, user_data);
+}
+
+int uring_write(struct uring* u, int fd, const void* buf, uint32_t len,
+    uint64_t off, uint64_t user_data)
+{
+    return prep_rw(u, IORING_OP_WRITE, fd, buf, len, off, user_data);
+}
+
+int uring_submit(struct uring* u, unsigned int wait_nr)
+{
+    unsigned submit = u->pending;
+    int ret;
+
+    /* publish the new tail only after the entries are written */
+    __atomic_store_n(u->sq_tail, *u->sq_tail + submit, __ATOMIC_RELEASE);
+    u->pending = 0;
+
+    if (!submit && !wait_nr)
+        return 0;
+
+    do {
+        u->enters++;
+        ret = sys_io_uring_enter(u->fd, submit, wait_nr,
+            wait_nr ? IORING_ENTER_GETEVENTS : 0);
+    } while (ret < 0 && errno == EINTR);
+
+    return ret < 0 ? -errno : ret;
+}
+
+int uring_reap(struct uring* u, uint64_t* user_data, int32_t* res)
+{
+    unsigned head = *u->cq_head;
+    struct io_uring_cqe* cqe;
+
+    if (head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE))
+        return 0;
+
+    cqe = &u->cqes[head & *u->cq_mask];
+    *user_data = cqe->user_data;
+    *res = cqe->res;
+    __atomic_store_n(u->cq_head, head + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+unsigned long uring_enter_count(struct uring* u)
+{
+    return u->enters;
+}
@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) Fuzhou Rockchip Electronics Co.Ltd
+ * Author: Jacob Chen <jacob-chen@iotwrt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#ifndef __URING_H_INCLUDED__
+#define __URING_H_INCLUDED__
+
+#include <stdint.h>
+
+struct uring;
+
+/*
+ * Minimal io_uring wrapper on the raw syscalls. Requests are only prepared
+ * by the uring_* helpers; uring_submit() hands the whole batch to the
+ * kernel and waits for completions in the same system call.
+ */
+struct uring* create_uring(unsigned int entries);
+void destroy_uring(struct uring *u);
+
+/* Return -EBUSY when the submission queue is full. */
+int uring_poll_add(struct uring *u, int fd, short events, uint64_t user_data);
+int uring_read(struct uring *u, int fd, void *buf, uint32_t len, uint64_t off,
+	       uint64_t user_data);
+int uring_write(struct uring *u, int fd, const void *buf, uint32_t len,
+		uint64_t off, uint64_t user_data);
+
+/* Submit the prepared requests and wait for 'wait_nr' completions. */
+int uring_submit(struct uring *u, unsigned int wait_nr);
+
+/* Pop one completion. Returns 0 when the completion queue is empty. */
+int uring_reap(struct uring *u, uint64_t *user_data, int32_t *res);
+
+/* Number of io_uring_enter calls so far. */
+unsigned long uring_enter_count(struct uring *u);
+
+#endif /* __URING_H_INCLUDED__ */
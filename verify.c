@@ -0,0 +1,450 @@
+/*
+ * Copyright (C) Fuzhou Rockchip Electronics Co.Ltd
+ * Author: Jacob Chen <jacob-chen@iotwrt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "arena.h"
+#include "convert.h"
+#include "cpu_rga.h"
+#include "format.h"
+#include "hash.h"
+#include "pattern.h"
+#include "simd.h"
+#include "verify.h"
+#include "wcmem.h"
+
+#define VERIFY_QUEUE_DEPTH 4
+#define REF_CACHE_SIZE 4
+#define VERIFY_MAX_DUMPS 16
+
+struct ref_entry {
+    int valid;
+    uint32_t src_id;
+    uint32_t hash;
+    uint64_t last_use;
+    uint8_t* data;
+};
+
+struct verify_slot {
+    uint32_t frame;
+    uint32_t src_id;
+    uint8_t* data;
+};
+
+struct lane_stats {
+    uint8_t max[16];
+    uint64_t sse[16];
+    uint64_t count[16];
+};
+
+struct diff_result {
+    int channels;
+    const char* names[4];
+    uint32_t max[4];
+    double psnr[4];
+};
+
+struct verifier {
+    struct verify_config cfg;
+    verify_src_fn render_src;
+    void* priv;
+    int exact;
+    size_t src_size;
+    size_t dst_size;
+
+    /* owned by the worker */
+    uint8_t* src_scratch;
+    struct ref_entry refs[REF_CACHE_SIZE];
+    uint64_t clock;
+    int dumps;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct verify_slot slots[VERIFY_QUEUE_DEPTH];
+    int head;
+    int count;
+    int quit;
+
+    unsigned int passed;
+    unsigned int failed;
+    unsigned int skipped;
+};
+
+static void diff_bytes(const uint8_t* a, const uint8_t* b, size_t n, struct lane_stats* st)
+{
+    v16u8 vmax = load_v16u8(st->max), x, y, gt, d, m;
+    v16u32 acc = { 0 }, d32;
+    size_t i = 0;
+    uint32_t iter = 0, k;
+
+    for (; i + 16 <= n; i += 16) {
+        x = load_v16u8(a + i);
+        y = load_v16u8(b + i);
+        gt = (v16u8)(x > y);
+        d = ((x - y) & gt) | ((y - x) & ~gt);
+        m = (v16u8)(d > vmax);
+        vmax = (d & m) | (vmax & ~m);
+
+        d32 = __builtin_convertvector(d, v16u32);
+        acc += d32 * d32;
+        /* 65535 * 255^2 still fits the 32 bit lanes */
+        if (++iter == 65535) {
+            for (k = 0; k < 16; k++)
+                st->sse[k] += acc[k];
+            acc = (v16u32) { 0 };
+            iter = 0;
+        }
+    }
+
+    store_v16u8(st->max, vmax);
+    for (k = 0; k < 16; k++) {
+        st->sse[k] += acc[k];
+        st->count[k] += i / 16;
+    }
+
+    for (k = 0; i < n; i++, k++) {
+        uint32_t dd = a[i] > b[i] ? a[i] - b[i] : b[i] - a[i];
+
+        if (dd > st->max[k])
+            st->max[k] = dd;
+        st->sse[k] += dd * dd;
+        st->count[k]++;
+    }
+}
+
+/* fold the 16 byte lanes into channel 'first' + lane % 'mod' */
+static void fold_lanes(const struct lane_stats* st, int mod, int first,
+    uint32_t max[4], uint64_t sse[4], uint64_t count[4])
+{
+    int k, c;
+
+    for (k = 0; k < 16; k++) {
+        c = first + k % mod;
+        if (st->max[k] > max[c])
+            max[c] = st->max[k];
+        sse[c] += st->sse[k];
+        count[c] += st->count[k];
+    }
+}
+
+static void diff_images(const struct image* a, const struct image* b, struct diff_result* r)
+{
+    const struct fmt_info* fi = a->fi;
+    uint64_t sse[4] = { 0 }, count[4] = { 0 };
+    struct lane_stats st;
+    uint32_t *ra, *rb, y;
+    double mse;
+    int c, i;
+
+    memset(r, 0, sizeof(*r));
+
+    if (fi->is_yuv) {
+        r->channels = 3;
+        r->names[0] = "Y";
+        r->names[1] = fi->uv_swap ? "V" : "U";
+        r->names[2] = fi->uv_swap ? "U" : "V";
+
+        for (i = 0; i < fi->num_planes; i++) {
+            size_t n = (size_t)a->pitches[i] * (i ? (a->height + fi->ysub - 1) / fi->ysub : a->height);
+
+            memset(&st, 0, sizeof(st));
+            diff_bytes(a->planes[i], b->planes[i], n, &st);
+            fold_lanes(&st, fi->num_planes == 2 && i ? 2 : 1, i, r->max, sse, count);
+        }
+    } else {
+        /* compare unpacked 0xAARRGGBB so every format has 8 bit channels */
+        r->channels = 4;
+        r->names[0] = "B";
+        r->names[1] = "G";
+        r->names[2] = "R";
+        r->names[3] = "A";
+
+        ra = (uint32_t*)malloc(a->width * sizeof(uint32_t));
+        rb = (uint32_t*)malloc(a->width * sizeof(uint32_t));
+        memset(&st, 0, sizeof(st));
+        for (y = 0; ra && rb && y < a->height; y++) {
+            unpack_row(a, y, ra);
+            unpack_row(b, y, rb);
+            diff_bytes((uint8_t*)ra, (uint8_t*)rb, a->width * 4, &st);
+        }
+        fold_lanes(&st, 4, 0, r->max, sse, count);
+        free(ra);
+        free(rb);
+    }
+
+    for (c = 0; c < r->channels; c++) {
+        mse = count[c] ? (double)sse[c] / count[c] : 0;
+        r->psnr[c] = mse > 0 ? 10.0 * log10(255.0 * 255.0 / mse) : INFINITY;
+    }
+}
+
+static void print_diff(const struct diff_result* r)
+{
+    int c;
+
+    for (c = 0; c < r->channels; c++)
+        printf(" %s: max %u psnr %.2f", r->names[c], r->max[c], r->psnr[c]);
+    printf("\n");
+}
+
+static void dump_file(struct verifier* v, uint32_t frame, const char* what, const void* data)
+{
+    const struct fmt_info* fi = get_fmt_info(v->cfg.dst_format);
+    char path[512];
+    ssize_t ret;
+    int fd;
+
+    snprintf(path, sizeof(path), "%s/frame-%05u-%s-%s-%ux%u.raw", v->cfg.dump_dir, frame,
+        what, fi ? fi->name : "unknown", v->cfg.dst_width, v->cfg.dst_height);
+
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        printf("verify: failed to create %s: %s\n", path, strerror(errno));
+        return;
+    }
+    ret = write(fd, data, v->dst_size);
+    if (ret != (ssize_t)v->dst_size)
+        printf("verify: short write to %s\n", path);
+    close(fd);
+}
+
+static struct ref_entry* get_reference(struct verifier* v, uint32_t src_id)
+{
+    struct ref_entry* e = &v->refs[0];
+    struct image src, dst;
+    int i;
+
+    for (i = 0; i < REF_CACHE_SIZE; i++) {
+        if (v->refs[i].valid && v->refs[i].src_id == src_id) {
+            v->refs[i].last_use = ++v->clock;
+            return &v->refs[i];
+        }
+        if (!v->refs[i].valid || v->refs[i].last_use < e->last_use)
+            e = &v->refs[i];
+    }
+
+    if (v->render_src(v->priv, src_id, v->src_scratch))
+        return NULL;
+
+    init_image(&src, v->cfg.src_format, v->src_scratch, v->cfg.src_width, v->cfg.src_height);
+    init_image(&dst, v->cfg.dst_format, e->data, v->cfg.dst_width, v->cfg.dst_height);
+    set_image_colorimetry(&src, &v->cfg.src_color);
+    set_image_colorimetry(&dst, &v->cfg.dst_color);
+    fill_pattern(PATTERN_SOLID, v->cfg.dst_background, v->cfg.dst_format, e->data,
+        v->cfg.dst_width, v->cfg.dst_height, 0, &v->cfg.dst_color);
+    if (cpu_rga_transform(&src, &dst, &v->cfg.params))
+        return NULL;
+
+    e->valid = 1;
+    e->src_id = src_id;
+    e->hash = xxh32(e->data, v->dst_size, 0);
+    e->last_use = ++v->clock;
+    return e;
+}
+
+static int check_frame(struct verifier* v, const struct verify_slot* slot)
+{
+    struct image out, ref;
+    struct diff_result diff;
+    struct ref_entry* e;
+    int c, ok = 1;
+
+    e = get_reference(v, slot->src_id);
+    if (!e) {
+        printf("verify: frame %u: no reference\n", slot->frame);
+        return 0;
+    }
+
+    if (v->exact && xxh32(slot->data, v->dst_size, 0) == e->hash)
+        return 1;
+
+    init_image(&out, v->cfg.dst_format, slot->data, v->cfg.dst_width, v->cfg.dst_height);
+    init_image(&ref, v->cfg.dst_format, e->data, v->cfg.dst_width, v->cfg.dst_height);
+    diff_images(&out, &ref, &diff);
+
+    if (v->exact) {
+        ok = 0;
+    } else {
+        for (c = 0; c < diff.channels; c++) {
+            if ((int)diff.max[c] > v->cfg.max_diff || diff.psnr[c] < v->cfg.min_psnr)
+                ok = 0;
+        }
+    }
+    if (ok)
+        return 1;
+
+    printf("verify: frame %u FAILED (%s):", slot->frame, v->exact ? "checksum" : "tolerance");
+    print_diff(&diff);
+
+    if (v->cfg.dump_dir && v->dumps < VERIFY_MAX_DUMPS) {
+        dump_file(v, slot->frame, "out", slot->data);
+        dump_file(v, slot->frame, "ref", e->data);
+        v->dumps++;
+    }
+    return 0;
+}
+
+static void* verify_main(void* data)
+{
+    struct verifier* v = (struct verifier*)data;
+    struct verify_slot* slot;
+    int ok;
+
+    pthread_mutex_lock(&v->lock);
+    for (;;) {
+        while (!v->count && !v->quit)
+            pthread_cond_wait(&v->cond, &v->lock);
+        if (!v->count)
+            break;
+        slot = &v->slots[v->head];
+        pthread_mutex_unlock(&v->lock);
+
+        ok = check_frame(v, slot);
+
+        pthread_mutex_lock(&v->lock);
+        if (ok)
+            v->passed++;
+        else
+            v->failed++;
+        v->head = (v->head + 1) % VERIFY_QUEUE_DEPTH;
+        v->count--;
+    }
+    pthread_mutex_unlock(&v->lock);
+    return NULL;
+}
+
+struct verifier* create_verifier(const struct verify_config* cfg,
+    verify_src_fn render_src, void* priv)
+{
+    const struct fmt_info* sfi = get_fmt_info(cfg->src_format);
+    const struct fmt_info* dfi = get_fmt_info(cfg->dst_format);
+    struct image src, dst;
+    struct verifier* v;
+    int i;
+
+    if (!sfi || !dfi) {
+        printf("verify: unsupported format\n");
+        return NULL;
+    }
+
+    v = (struct verifier*)calloc(1, sizeof(*v));
+    if (!v)
+        return NULL;
+
+    v->cfg = *cfg;
+    v->render_src = render_src;
+    v->priv = priv;
+    v->src_size = fmt_frame_size(sfi, cfg->src_width, cfg->src_height);
+    v->dst_size = fmt_frame_size(dfi, cfg->dst_width, cfg->dst_height);
+
+    init_image(&src, cfg->src_format, NULL, cfg->src_width, cfg->src_height);
+    init_image(&dst, cfg->dst_format, NULL, cfg->dst_width, cfg->dst_height);
+    set_image_colorimetry(&src, &cfg->src_color);
+    set_image_colorimetry(&dst, &cfg->dst_color);
+    v->exact = cpu_rga_is_exact(&src, &dst, &cfg->params);
+
+    v->src_scratch = (uint8_t*)frame_alloc(v->src_size);
+    if (!v->src_scratch)
+        goto err;
+    for (i = 0; i < REF_CACHE_SIZE; i++) {
+        v->refs[i].data = (uint8_t*)frame_alloc(v->dst_size);
+        if (!v->refs[i].data)
+            goto err;
+    }
+    for (i = 0; i < VERIFY_QUEUE_DEPTH; i++) {
+        v->slots[i].data = (uint8_t*)frame_alloc(v->dst_size);
+        if (!v->slots[i].data)
+            goto err;
+    }
+
+    pthread_mutex_init(&v->lock, NULL);
+    pthread_cond_init(&v->cond, NULL);
+    if (pthread_create(&v->thread, NULL, verify_main, v)) {
+        printf("verify: failed to create thread\n");
+        pthread_cond_destroy(&v->cond);
+        pthread_mutex_destroy(&v->lock);
+        goto err;
+    }
+
+    printf("verify: %s compare of %s %ux%u output\n", v->exact ? "checksum" : "tolerance",
+        dfi->name, cfg->dst_width, cfg->dst_height);
+    return v;
+
+err:
+    printf("verify: out of memory\n");
+    for (i = 0; i < REF_CACHE_SIZE; i++)
+        frame_free(v->refs[i].data);
+    for (i = 0; i < VERIFY_QUEUE_DEPTH; i++)
+        frame_free(v->slots[i].data);
+    frame_free(v->src_scratch);
+    free(v);
+    return NULL;
+}
+
+int verify_frame(struct verifier* v, uint32_t frame, uint32_t src_id, const void* addr)
+{
+    struct verify_slot* slot;
+
+    pthread_mutex_lock(&v->lock);
+    if (v->count == VERIFY_QUEUE_DEPTH) {
+        v->skipped++;
+        pthread_mutex_unlock(&v->lock);
+        return -1;
+    }
+    slot = &v->slots[(v->head + v->count) % VERIFY_QUEUE_DEPTH];
+    pthread_mutex_unlock(&v->lock);
+
+    /* the slot is ours until it is counted */
+    slot->frame = frame;
+    slot->src_id = src_id;
+    /* the CAPTURE buffer is likely write-combined */
+    wc_copy(slot->data, addr, v->dst_size);
+
+    pthread_mutex_lock(&v->lock);
+    v->count++;
+    pthread_cond_signal(&v->cond);
+    pthread_mutex_unlock(&v->lock);
+    return 0;
+}
+
+int destroy_verifier(struct verifier* v)
+{
+    int i, failed;
+
+    if (!v)
+        return 0;
+
+    pthread_mutex_lock(&v->lock);
+    v->quit = 1;
+    pthread_cond_signal(&v->cond);
+    pthread_mutex_unlock(&v->lock);
+    pthread_join(v->thread, NULL);
+
+    printf("*[VERIFY]* : %u passed, %u failed, %u skipped\n", v->passed, v->failed, v->skipped);
+    failed = v->failed;
+
+    pthread_cond_destroy(&v->cond);
+    pthread_mutex_destroy(&v->lock);
+    for (i = 0; i < REF_CACHE_SIZE; i++)
+        frame_free(v->refs[i].data);
+    for (i = 0; i < VERIFY_QUEUE_DEPTH; i++)
+        frame_free(v->slots[i].data);
+    frame_free(v->src_scratch);
+    free(v);
+    return failed;
+}
@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) Fuzhou Rockchip Electronics Co.Ltd
+ * Author: Jacob Chen <jacob-chen@iotwrt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#ifndef __VERIFY_H_INCLUDED__
+#define __VERIFY_H_INCLUDED__
+
+#include <stdint.h>
+
+#include "cpu_rga.h"
+#include "format.h"
+
+struct verifier;
+
+struct verify_config {
+	uint32_t src_format;
+	uint32_t src_width;
+	uint32_t src_height;
+	uint32_t dst_format;
+	uint32_t dst_width;
+	uint32_t dst_height;
+	struct colorimetry src_color;
+	struct colorimetry dst_color;
+	struct rga_params params;
+	uint32_t dst_background;	/* ARGB the CAPTURE buffers start with */
+
+	int max_diff;		/* per channel, inexact operations only */
+	double min_psnr;	/* dB, inexact operations only */
+	const char *dump_dir;	/* failing frames are written here */
+};
+
+/*
+ * Renders source frame 'src_id' into 'addr' (tight layout of format.h).
+ * Called from the verifier thread.
+ */
+typedef int (*verify_src_fn)(void *priv, uint32_t src_id, void *addr);
+
+struct verifier* create_verifier(const struct verify_config *cfg,
+				 verify_src_fn render_src, void *priv);
+
+/*
+ * Queue a CAPTURE buffer for checking. The buffer is copied, the check
+ * itself runs on the verifier thread. Frames are skipped rather than
+ * waited for when the verifier falls behind; returns -1 in that case.
+ */
+int verify_frame(struct verifier *v, uint32_t frame, uint32_t src_id,
+		 const void *addr);
+
+/* Drain the queue, print a summary and return the number of failures. */
+int destroy_verifier(struct verifier *v);
+
+#endif /* __VERIFY_H_INCLUDED__ */
@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) Fuzhou Rockchip Electronics Co.Ltd
+ * Author: Jacob Chen <jacob-chen@iotwrt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "simd.h"
+#include "wcmem.h"
+
+#define LINE 64
+
+/* the only per-architecture part: one line of non-temporal stores */
+static inline void store_line(uint8_t* d, v16u8 a, v16u8 b, v16u8 c, v16u8 e)
+{
+#if defined(__aarch64__)
+    __asm__ volatile("stnp %q1, %q2, [%0]\n\t"
+                     "stnp %q3, %q4, [%0, #32]"
+                     :
+                     : "r"(d), "w"(a), "w"(b), "w"(c), "w"(e)
+                     : "memory");
+#elif defined(__SSE2__)
+    _mm_stream_si128((__m128i*)d, (__m128i)a);
+    _mm_stream_si128((__m128i*)(d + 16), (__m128i)b);
+    _mm_stream_si128((__m128i*)(d + 32), (__m128i)c);
+    _mm_stream_si128((__m128i*)(d + 48), (__m128i)e);
+#else
+    store_v16u8(d, a);
+    store_v16u8(d + 16, b);
+    store_v16u8(d + 32, c);
+    store_v16u8(d + 48, e);
+#endif
+}
+
+static inline void store_fence(void)
+{
+#if defined(__SSE2__)
+    _mm_sfence();
+#elif defined(__aarch64__)
+    __asm__ volatile("dmb ishst" ::: "memory");
+#endif
+}
+
+void wc_copy(void* dst, const void* src, size_t size)
+{
+    uint8_t* d = (uint8_t*)dst;
+    const uint8_t* s = (const uint8_t*)src;
+    size_t head;
+
+    if (size < 2 * LINE) {
+        memcpy(d, s, size);
+        return;
+    }
+
+    head = -(uintptr_t)d & (LINE - 1);
+    memcpy(d, s, head);
+    d += head;
+    s += head;
+    size -= head;
+
+    for (; size >= LINE; size -= LINE, d += LINE, s += LINE)
+        store_line(d, load_v16u8(s), load_v16u8(s + 16), load_v16u8(s + 32), load_v16u8(s + 48));
+
+    memcpy(d, s, size);
+    store_fence();
+}
+
+void wc_fill32(void* dst, uint32_t value, size_t size)
+{
+    uint8_t* d = (uint8_t*)dst;
+    v16u8 v = (v16u8)splat_v4u32(value);
+    size_t i;
+
+    /* whole pixels up to the first line, unaligned buffers never get there */
+    for (; ((uintptr_t)d & (LINE - 1)) && size >= 4; d += 4, size -= 4)
+        memcpy(d, &value, 4);
+
+    if (!((uintptr_t)d & 3)) {
+        for (; size >= LINE; size -= LINE, d += LINE)
+            store_line(d, v, v, v, v);
+        store_fence();
+    }
+
+    for (i = 0; i + 4 <= size; i += 4)
+        memcpy(d + i, &value, 4);
+    memcpy(d + i, &value, size - i);
+}
@@ -0,0 +1,27 @@
+/*
+ * Copyright (C) Fuzhou Rockchip Electronics Co.Ltd
+ * Author: Jacob Chen <jacob-chen@iotwrt.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version
+ */
+
+#ifndef __WCMEM_H_INCLUDED__
+#define __WCMEM_H_INCLUDED__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Copies and fills for write-combined buffer mappings. They move whole
+ * 64 byte lines: reads as wide loads, which uncached memory serves one
+ * burst each instead of one per byte, writes as non-temporal stores that
+ * fill a combining buffer at once and keep cached source data in cache.
+ * Either side may be ordinary memory.
+ */
+void wc_copy(void *dst, const void *src, size_t size);
+void wc_fill32(void *dst, uint32_t value, size_t size);
+
+#endif /* __WCMEM_H_INCLUDED__ */